@@ -0,0 +1,192 @@
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "arrow_ingest.hpp"
+#include "benchmark.hpp"
+#include "benchmark/benchmark.h"
+#include "cs/cs_final.hpp"
+#include "data.hpp"
+#include "kll/kll_final.hpp"
+#include "ss/ss_final.hpp"
+#include "types.hpp"
+
+/// Arrays of the benchmark own their buffers, so their release does nothing.
+void ReleaseNothing(ArrowArray*) {}
+
+/// A column of the benchmark data as an Arrow array, with the buffers it
+/// points to. Not movable, since the array points into it.
+struct Column {
+  Column() = default;
+  Column(const Column&) = delete;
+  Column& operator=(const Column&) = delete;
+
+  std::vector<uint8_t> validity;
+  /// Offsets and data of strings, indices of dictionary-encoded strings.
+  std::vector<int32_t> offsets;
+  std::string data;
+  std::array<const void*, 3> buffers{};
+  ArrowSchema schema{};
+  ArrowArray array{};
+  /// The dictionary of dictionary-encoded strings.
+  std::vector<int32_t> dictionary_offsets;
+  std::string dictionary_data;
+  std::array<const void*, 3> dictionary_buffers{};
+  ArrowSchema dictionary_schema{};
+  ArrowArray dictionary_array{};
+};
+
+/// Fills the validity bitmap of a column of n rows with about `null_percent`
+/// percent of nulls at random rows.
+/// @return the number of nulls.
+int64_t MakeValidity(Column& column, size_t n, int64_t null_percent) {
+  if (null_percent == 0) return 0;
+  std::mt19937 gen(42);
+  std::uniform_int_distribution<int64_t> dist(0, 99);
+  column.validity.assign((n + 7) / 8, 0);
+  int64_t null_count = 0;
+  for (size_t i = 0; i < n; ++i) {
+    if (dist(gen) < null_percent) {
+      ++null_count;
+    } else {
+      column.validity[i / 8] |= 1 << (i % 8);
+    }
+  }
+  column.buffers[0] = column.validity.data();
+  return null_count;
+}
+
+void InitArray(ArrowArray& array, int64_t length, int64_t null_count,
+               int64_t num_buffers, const void** buffers) {
+  array.length = length;
+  array.null_count = null_count;
+  array.n_buffers = num_buffers;
+  array.buffers = buffers;
+  array.release = ReleaseNothing;
+}
+
+/// Points a column at the benchmark data of type T in place.
+template <typename T>
+void MakePrimitiveColumn(Column& column, int64_t null_percent) {
+  const auto& data = GetData<T>();
+  const int64_t null_count = MakeValidity(column, data.size(), null_percent);
+  column.buffers[1] = data.data();
+  column.schema.format = columnar::detail::PrimitiveFormat<T>();
+  InitArray(column.array, data.size(), null_count, 2, column.buffers.data());
+}
+
+/// Fills a column with Zipf distributed strings of the benchmark data, drawn
+/// from its first `num_distinct` values, as utf8 or dictionary-encoded
+/// strings.
+void MakeStringColumn(Column& column, size_t num_distinct,
+                      int64_t null_percent, bool dictionary) {
+  const auto& data = GetData<std::string>();
+  std::mt19937 gen(42);
+  const auto ranks = detail::ZipfRanks(num_distinct, 1.2, gen);
+  const int64_t null_count = MakeValidity(column, ranks.size(), null_percent);
+  column.schema.format = dictionary ? "i" : "u";
+  if (dictionary) {
+    column.offsets.assign(ranks.begin(), ranks.end());
+    column.buffers[1] = column.offsets.data();
+    InitArray(column.array, ranks.size(), null_count, 2,
+              column.buffers.data());
+
+    column.dictionary_offsets.push_back(0);
+    for (size_t i = 0; i < num_distinct; ++i) {
+      column.dictionary_data += data[i];
+      column.dictionary_offsets.push_back(column.dictionary_data.size());
+    }
+    column.dictionary_buffers[1] = column.dictionary_offsets.data();
+    column.dictionary_buffers[2] = column.dictionary_data.data();
+    column.dictionary_schema.format = "u";
+    InitArray(column.dictionary_array, num_distinct, 0, 3,
+              column.dictionary_buffers.data());
+    column.schema.dictionary = &column.dictionary_schema;
+    column.array.dictionary = &column.dictionary_array;
+  } else {
+    column.offsets.push_back(0);
+    for (const uint32_t rank : ranks) {
+      column.data += data[rank];
+      column.offsets.push_back(column.data.size());
+    }
+    column.buffers[1] = column.offsets.data();
+    column.buffers[2] = column.data.data();
+    InitArray(column.array, ranks.size(), null_count, 3,
+              column.buffers.data());
+  }
+}
+
+/// Benchmarks inserting a column of the benchmark data of type T with
+/// `state.range(0)` percent of nulls into a sketch through
+/// `columnar::InsertArrow`, to compare with the `BM_InsertBatch` rows of
+/// `bm_insert`.
+template <typename Sketch, typename T>
+void BM_InsertArrow(benchmark::State& state) {
+  Column column;
+  MakePrimitiveColumn<T>(column, state.range(0));
+  for (auto _ : state) {
+    Sketch sketch;
+    columnar::InsertArrow<T>(sketch, column.schema, column.array);
+    ::benchmark::DoNotOptimize(sketch);
+    ::benchmark::ClobberMemory();
+  }
+
+  int64_t num_items = state.iterations() * column.array.length;
+  state.SetItemsProcessed(num_items);
+  state.SetBytesProcessed(num_items * sizeof(T));
+  state.counters["item_size"] = sizeof(T);
+  state.counters["null_percent"] = state.range(0);
+}
+
+/// Benchmarks inserting a column of Zipf distributed strings over
+/// `state.range(0)` distinct values with `state.range(1)` percent of nulls,
+/// as utf8 strings or, with kDictionary, as dictionary-encoded strings whose
+/// dictionary is decoded and hashed once per insert.
+template <typename Sketch, bool kDictionary>
+void BM_InsertArrowStrings(benchmark::State& state) {
+  Column column;
+  MakeStringColumn(column, state.range(0), state.range(1), kDictionary);
+  for (auto _ : state) {
+    Sketch sketch;
+    columnar::InsertArrow<std::string>(sketch, column.schema, column.array);
+    ::benchmark::DoNotOptimize(sketch);
+    ::benchmark::ClobberMemory();
+  }
+
+  state.SetItemsProcessed(state.iterations() * column.array.length);
+  state.counters["num_distinct"] = state.range(0);
+  state.counters["null_percent"] = state.range(1);
+}
+
+#define BENCHMARK_INSERT_ARROW_TYPE(sketch, type)          \
+  BENCHMARK_TEMPLATE(BM_InsertArrow, sketch<type>, type) \
+      ->ArgName("null_percent")                          \
+      ->Arg(0)                                           \
+      ->Arg(10)
+
+#define BENCHMARK_INSERT_ARROW_ALL_TYPES(sketch) \
+  BENCHMARK_INSERT_ARROW_TYPE(sketch, int64_t);  \
+  BENCHMARK_INSERT_ARROW_TYPE(sketch, double)
+
+BENCHMARK_INSERT_ARROW_ALL_TYPES(final::CountSketch);
+BENCHMARK_INSERT_ARROW_ALL_TYPES(final::SpaceSaving);
+BENCHMARK_INSERT_ARROW_ALL_TYPES(final::KarninLangLiberty);
+
+#define BENCHMARK_INSERT_ARROW_STRINGS(sketch, dictionary)                  \
+  BENCHMARK_TEMPLATE(BM_InsertArrowStrings, sketch<std::string>, dictionary) \
+      ->ArgNames({"num_distinct", "null_percent"})                          \
+      ->Args({1 << 10, 0})                                                  \
+      ->Args({1 << 10, 10})
+
+#define BENCHMARK_INSERT_ARROW_ALL_STRINGS(sketch) \
+  BENCHMARK_INSERT_ARROW_STRINGS(sketch, false);   \
+  BENCHMARK_INSERT_ARROW_STRINGS(sketch, true)
+
+BENCHMARK_INSERT_ARROW_ALL_STRINGS(final::CountSketch);
+BENCHMARK_INSERT_ARROW_ALL_STRINGS(final::SpaceSaving);
+BENCHMARK_INSERT_ARROW_ALL_STRINGS(final::KarninLangLiberty);
+
+CUSTOM_BENCHMARK_MAIN(true, false);
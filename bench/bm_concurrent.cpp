@@ -0,0 +1,200 @@
+#include <cstddef>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "benchmark/benchmark.h"
+#include "compiler.hpp"
+#include "cs/cs_concurrent.hpp"
+#include "cs/cs_final.hpp"
+#include "ss/ss_concurrent.hpp"
+#include "ss/ss_final.hpp"
+#include "data.hpp"
+#include "span.hpp"
+#include "types.hpp"
+
+/// Number of values each thread inserts per iteration.
+constexpr size_t kBlockSize = 1024;
+
+/// Number of iterations after which the per-thread sketches are merged into
+/// the shared sketch, so that queries see the inserts with a delay of at most
+/// 64K values per thread.
+constexpr size_t kMergeInterval = 64;
+
+// The shared sketches of a run are created by thread 0 before the loop and
+// replaced by the next run, not destroyed after the loop, because the other
+// threads may still use them after thread 0 left the loop.
+
+/// @return the block of values a thread inserts in an iteration. The threads
+/// start at different offsets so that they do not insert the same values in
+/// lockstep.
+template <typename T>
+std::span<const T> GetBlock(const benchmark::State& state, size_t iteration) {
+  const auto& data = GetData<T>();
+  const size_t num_blocks = data.size() / kBlockSize;
+  const size_t block =
+      (iteration + static_cast<size_t>(state.thread_index()) * 7919) %
+      num_blocks;
+  return std::span<const T>(data).subspan(block * kBlockSize, kBlockSize);
+}
+
+/// Measures all threads inserting into one sketch with atomic counters.
+template <typename T>
+void BM_ConcurrentInsert(benchmark::State& state) {
+  static std::unique_ptr<concurrent::CountSketch<T>> sketch;
+  if (state.thread_index() == 0) {
+    sketch = std::make_unique<concurrent::CountSketch<T>>();
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    sketch->InsertBatch(GetBlock<T>(state, i++));
+  }
+
+  state.SetItemsProcessed(state.iterations() * kBlockSize);
+}
+
+/// Measures every thread inserting into its own shard of one sketch.
+template <typename T>
+void BM_ShardedInsert(benchmark::State& state) {
+  static std::unique_ptr<concurrent::ShardedCountSketch<T>> sketch;
+  if (state.thread_index() == 0) {
+    sketch = std::make_unique<concurrent::ShardedCountSketch<T>>();
+  }
+
+  // The setup by thread 0 is only ordered before the loop of the other
+  // threads, so they acquire their writers in the first iteration.
+  std::optional<typename concurrent::ShardedCountSketch<T>::Writer> writer;
+  size_t i = 0;
+  for (auto _ : state) {
+    if (UNLIKELY(!writer)) writer.emplace(sketch->GetWriter());
+    writer->InsertBatch(GetBlock<T>(state, i++));
+  }
+
+  state.SetItemsProcessed(state.iterations() * kBlockSize);
+}
+
+/// Measures the per-thread-then-merge approach: every thread inserts into a
+/// private sketch and periodically merges it into a shared sketch under a
+/// lock.
+template <typename T>
+void BM_PerThreadMerge(benchmark::State& state) {
+  using Sketch = final::CountSketch<T>;
+  static std::mutex mutex;
+  static std::unique_ptr<Sketch> shared;
+  if (state.thread_index() == 0) {
+    shared = std::make_unique<Sketch>();
+  }
+
+  auto local = std::make_unique<Sketch>();
+  size_t i = 0;
+  for (auto _ : state) {
+    local->InsertBatch(GetBlock<T>(state, i++));
+    if (i % kMergeInterval == 0) {
+      std::lock_guard<std::mutex> lock(mutex);
+      shared->Merge(*local);
+      *local = Sketch();
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * kBlockSize);
+}
+
+/// Measures a query of the sharded sketch, which sums the counters of all
+/// shards, as a function of the number of shards.
+template <typename T>
+void BM_ShardedEstimate(benchmark::State& state) {
+  const auto num_shards = static_cast<size_t>(state.range(0));
+  const auto& data = GetData<T>();
+  concurrent::ShardedCountSketch<T> sketch;
+  {
+    std::vector<typename concurrent::ShardedCountSketch<T>::Writer> writers;
+    for (size_t s = 0; s < num_shards; ++s) {
+      writers.push_back(sketch.GetWriter());
+      writers.back().InsertBatch(
+          std::span<const T>(data).subspan(s * kBlockSize, kBlockSize));
+    }
+  }
+  size_t i = 0;
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(sketch.Estimate(data[i++ % data.size()]));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["num_shards"] = num_shards;
+}
+
+/// Measures all threads inserting into a SpaceSaving sketch guarded by a
+/// lock, the baseline of the sharded sketch.
+template <typename T>
+void BM_LockedSpaceSavingInsert(benchmark::State& state) {
+  static std::mutex mutex;
+  static std::unique_ptr<final::SpaceSaving<T>> sketch;
+  if (state.thread_index() == 0) {
+    sketch = std::make_unique<final::SpaceSaving<T>>();
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    const auto block = GetBlock<T>(state, i++);
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const auto& value : block) {
+      sketch->Insert(value);
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * kBlockSize);
+}
+
+/// Measures all threads inserting into the sharded SpaceSaving sketch. The
+/// ring buffers hold only a few blocks, so the producers are throttled to the
+/// rate of the consumers.
+template <typename T>
+void BM_ShardedSpaceSavingInsert(benchmark::State& state) {
+  static std::unique_ptr<concurrent::ShardedSpaceSaving<T>> sketch;
+  if (state.thread_index() == 0) {
+    sketch = std::make_unique<concurrent::ShardedSpaceSaving<T>>();
+  }
+
+  size_t i = 0;
+  for (auto _ : state) {
+    sketch->InsertBatch(GetBlock<T>(state, i++));
+  }
+
+  state.SetItemsProcessed(state.iterations() * kBlockSize);
+}
+
+#define BENCHMARK_CONCURRENT_TYPE(type)                 \
+  BENCHMARK_TEMPLATE(BM_ConcurrentInsert, type)         \
+      ->ThreadRange(1, 64)                              \
+      ->UseRealTime();                                  \
+  BENCHMARK_TEMPLATE(BM_ShardedInsert, type)            \
+      ->ThreadRange(1, 64)                              \
+      ->UseRealTime();                                  \
+  BENCHMARK_TEMPLATE(BM_PerThreadMerge, type)           \
+      ->ThreadRange(1, 64)                              \
+      ->UseRealTime();                                  \
+  BENCHMARK_TEMPLATE(BM_ShardedEstimate, type)          \
+      ->RangeMultiplier(4)                              \
+      ->Range(1, 64);                                   \
+  BENCHMARK_TEMPLATE(BM_LockedSpaceSavingInsert, type)  \
+      ->ThreadRange(1, 64)                              \
+      ->UseRealTime();                                  \
+  BENCHMARK_TEMPLATE(BM_ShardedSpaceSavingInsert, type) \
+      ->ThreadRange(1, 64)                              \
+      ->UseRealTime()
+
+#define BENCHMARK_CONCURRENT_ALL_TYPES() \
+  BENCHMARK_CONCURRENT_TYPE(int16_t);    \
+  BENCHMARK_CONCURRENT_TYPE(int32_t);    \
+  BENCHMARK_CONCURRENT_TYPE(int64_t);    \
+  BENCHMARK_CONCURRENT_TYPE(__int128_t); \
+  BENCHMARK_CONCURRENT_TYPE(float);      \
+  BENCHMARK_CONCURRENT_TYPE(double);     \
+  BENCHMARK_CONCURRENT_TYPE(std::string)
+
+BENCHMARK_CONCURRENT_ALL_TYPES();
+
+CUSTOM_BENCHMARK_MAIN(true, false);
@@ -0,0 +1,94 @@
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "benchmark/benchmark.h"
+#include "cs/cs_cuda.cuh"
+#include "cs/cs_final.hpp"
+#include "data.hpp"
+#include "span.hpp"
+
+/// @return the batch of the first n values of the benchmark data, repeated
+/// where n exceeds the data.
+template <typename T>
+std::vector<T> MakeBatch(size_t n) {
+  const auto& data = GetData<T>();
+  std::vector<T> batch(n);
+  for (size_t i = 0; i < n; ++i) batch[i] = data[i % data.size()];
+  return batch;
+}
+
+template <typename Sketch>
+std::vector<std::byte> SerializeSketch(const Sketch& sketch) {
+  std::vector<std::byte> bytes(sketch.SerializedSize());
+  sketch.Serialize(bytes);
+  return bytes;
+}
+
+/// Benchmarks building a Count Sketch from a batch of `state.range(0)` values
+/// on the CUDA device, including the copies of the values to the device and
+/// of the counters back, to compare with the `BM_CpuInsert` rows for the
+/// batch size from which the device pays off.
+template <typename Sketch, typename T>
+void BM_CudaInsert(benchmark::State& state) {
+  const auto batch = MakeBatch<T>(state.range(0));
+  const std::span<const T> values(batch.data(), batch.size());
+  cuda::CountSketchBuilder<Sketch> builder;
+
+  Sketch cpu;
+  cpu.InsertBatch(values);
+  Sketch gpu;
+  builder.InsertBatch(gpu, values);
+  if (SerializeSketch(cpu) != SerializeSketch(gpu)) {
+    state.SkipWithError("counters of the device differ from the CPU");
+    return;
+  }
+
+  for (auto _ : state) {
+    Sketch sketch;
+    builder.InsertBatch(sketch, values);
+    ::benchmark::DoNotOptimize(sketch);
+    ::benchmark::ClobberMemory();
+  }
+
+  int64_t num_items = state.iterations() * batch.size();
+  state.SetItemsProcessed(num_items);
+  state.SetBytesProcessed(num_items * sizeof(T));
+  state.counters["item_size"] = sizeof(T);
+}
+
+/// Benchmarks `InsertBatch` of the CPU on the batches of `BM_CudaInsert`. The
+/// host code is compiled with the ARCH_FLAGS of the other benchmarks, see
+/// `bench/local.cmake`, so this uses the vectorized hash kernels.
+template <typename Sketch, typename T>
+void BM_CpuInsert(benchmark::State& state) {
+  const auto batch = MakeBatch<T>(state.range(0));
+  const std::span<const T> values(batch.data(), batch.size());
+  for (auto _ : state) {
+    Sketch sketch;
+    sketch.InsertBatch(values);
+    ::benchmark::DoNotOptimize(sketch);
+    ::benchmark::ClobberMemory();
+  }
+
+  int64_t num_items = state.iterations() * batch.size();
+  state.SetItemsProcessed(num_items);
+  state.SetBytesProcessed(num_items * sizeof(T));
+  state.counters["item_size"] = sizeof(T);
+}
+
+#define BENCHMARK_CUDA_INSERT_TYPE(bm, type)             \
+  BENCHMARK_TEMPLATE(bm, final::CountSketch<type>, type) \
+      ->ArgName("batch_size")                            \
+      ->RangeMultiplier(8)                               \
+      ->Range(1 << 10, 1 << 22)
+
+#define BENCHMARK_CUDA_INSERT_ALL_TYPES(bm) \
+  BENCHMARK_CUDA_INSERT_TYPE(bm, int64_t);  \
+  BENCHMARK_CUDA_INSERT_TYPE(bm, double)
+
+BENCHMARK_CUDA_INSERT_ALL_TYPES(BM_CudaInsert);
+BENCHMARK_CUDA_INSERT_ALL_TYPES(BM_CpuInsert);
+
+CUSTOM_BENCHMARK_MAIN(true, false);
@@ -0,0 +1,161 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <random>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "benchmark/benchmark.h"
+#include "cs/cs_final.hpp"
+#include "data.hpp"
+#include "ss/ss_final.hpp"
+#include "span.hpp"
+#include "types.hpp"
+
+/// @return a sketch summarizing the benchmark data.
+template <typename Sketch, typename T>
+Sketch BuildSketch() {
+  Sketch sketch;
+  for (const auto& value : GetData<T>()) {
+    sketch.Insert(value);
+  }
+  return sketch;
+}
+
+/// Sets the same counters as the insert benchmarks, so that the query and
+/// insert throughput can be compared directly.
+template <typename T>
+void SetCounters(benchmark::State& state, const std::vector<T>& data) {
+  int64_t num_items = state.iterations() * data.size();
+  state.SetItemsProcessed(num_items);
+  int64_t item_size = sizeof(T);
+  if constexpr (detail::is_string_v<T>) {
+    item_size = data[0].size() * sizeof(char);
+  }
+  state.SetBytesProcessed(num_items * item_size);
+  state.counters["item_size"] = item_size;
+}
+
+template <typename Sketch, typename T>
+void BM_Estimate(benchmark::State& state) {
+  const auto& data = GetData<T>();
+  const auto sketch = BuildSketch<Sketch, T>();
+  for (auto _ : state) {
+    for (const auto& value : data) {
+      ::benchmark::DoNotOptimize(sketch.Estimate(value));
+    }
+  }
+
+  SetCounters(state, data);
+}
+
+template <typename Sketch, typename T>
+void BM_EstimateBatch(benchmark::State& state) {
+  const auto& data = GetData<T>();
+  const auto batch_size = static_cast<size_t>(state.range(0));
+  const auto sketch = BuildSketch<Sketch, T>();
+  std::vector<int64_t> estimates(batch_size);
+  for (auto _ : state) {
+    for (size_t i = 0; i < data.size(); i += batch_size) {
+      const size_t n = std::min(batch_size, data.size() - i);
+      sketch.EstimateBatch(std::span<const T>(data.data() + i, n),
+                           estimates.data());
+      ::benchmark::DoNotOptimize(estimates.data());
+      ::benchmark::ClobberMemory();
+    }
+  }
+
+  SetCounters(state, data);
+  state.counters["batch_size"] = batch_size;
+}
+
+/// Measures repeated top-k queries of a sketch summarizing the benchmark data.
+template <typename Sketch, typename T>
+void BM_TopK(benchmark::State& state) {
+  const auto k = static_cast<size_t>(state.range(0));
+  const auto sketch = BuildSketch<Sketch, T>();
+  std::vector<final::WeightedValue<T>> top(k);
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(sketch.TopK(top));
+    ::benchmark::ClobberMemory();
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["k"] = k;
+}
+
+/// @return a random schedule of one operation per benchmark value, where
+/// `true` marks a query, for the given percentage of queries.
+inline std::vector<bool> QuerySchedule(size_t size, int64_t query_percent) {
+  std::mt19937_64 rng(size);
+  std::bernoulli_distribution is_query(query_percent / 100.0);
+  std::vector<bool> schedule(size);
+  for (size_t i = 0; i < size; ++i) {
+    schedule[i] = is_query(rng);
+  }
+  return schedule;
+}
+
+/// Interleaves queries with inserts on a live sketch, like a cache admission
+/// policy that looks up every key it inserts some of the time. The operations
+/// are drawn at random so that the branch selecting them cannot be predicted.
+template <typename Sketch, typename T>
+void BM_EstimateInsertMix(benchmark::State& state) {
+  const auto& data = GetData<T>();
+  const auto query_percent = state.range(0);
+  const auto schedule = QuerySchedule(data.size(), query_percent);
+  for (auto _ : state) {
+    Sketch sketch;
+    for (size_t i = 0; i < data.size(); ++i) {
+      if (schedule[i]) {
+        ::benchmark::DoNotOptimize(sketch.Estimate(data[i]));
+      } else {
+        sketch.Insert(data[i]);
+      }
+    }
+    ::benchmark::DoNotOptimize(sketch);
+    ::benchmark::ClobberMemory();
+  }
+
+  SetCounters(state, data);
+  state.counters["query_percent"] = query_percent;
+}
+
+#define BENCHMARK_ESTIMATE_TYPE(sketch, type)                  \
+  BENCHMARK_TEMPLATE(BM_Estimate, sketch<type>, type);         \
+  BENCHMARK_TEMPLATE(BM_EstimateBatch, sketch<type>, type)     \
+      ->RangeMultiplier(4)                                     \
+      ->Range(1, 1 << 14);                                     \
+  BENCHMARK_TEMPLATE(BM_EstimateInsertMix, sketch<type>, type) \
+      ->DenseRange(0, 100, 25)
+
+#define BENCHMARK_ESTIMATE_ALL_TYPES(sketch)   \
+  BENCHMARK_ESTIMATE_TYPE(sketch, int16_t);    \
+  BENCHMARK_ESTIMATE_TYPE(sketch, int32_t);    \
+  BENCHMARK_ESTIMATE_TYPE(sketch, int64_t);    \
+  BENCHMARK_ESTIMATE_TYPE(sketch, __int128_t); \
+  BENCHMARK_ESTIMATE_TYPE(sketch, float);      \
+  BENCHMARK_ESTIMATE_TYPE(sketch, double);     \
+  BENCHMARK_ESTIMATE_TYPE(sketch, std::string)
+
+BENCHMARK_ESTIMATE_ALL_TYPES(final::CountSketch);
+
+#define BENCHMARK_SS_QUERY_TYPE(sketch, type)                  \
+  BENCHMARK_TEMPLATE(BM_Estimate, sketch<type>, type);         \
+  BENCHMARK_TEMPLATE(BM_TopK, sketch<type>, type)->Arg(10);    \
+  BENCHMARK_TEMPLATE(BM_EstimateInsertMix, sketch<type>, type) \
+      ->DenseRange(0, 100, 25)
+
+#define BENCHMARK_SS_QUERY_ALL_TYPES(sketch)   \
+  BENCHMARK_SS_QUERY_TYPE(sketch, int16_t);    \
+  BENCHMARK_SS_QUERY_TYPE(sketch, int32_t);    \
+  BENCHMARK_SS_QUERY_TYPE(sketch, int64_t);    \
+  BENCHMARK_SS_QUERY_TYPE(sketch, __int128_t); \
+  BENCHMARK_SS_QUERY_TYPE(sketch, float);      \
+  BENCHMARK_SS_QUERY_TYPE(sketch, double);     \
+  BENCHMARK_SS_QUERY_TYPE(sketch, std::string)
+
+BENCHMARK_SS_QUERY_ALL_TYPES(final::SpaceSaving);
+
+CUSTOM_BENCHMARK_MAIN(true, false);
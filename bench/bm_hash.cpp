@@ -1,19 +1,46 @@
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <type_traits>
+
 #include "benchmark.hpp"
 #include "benchmark/benchmark.h"
 #include "data.hpp"
 #include "hash.hpp"
+#include "perf_counters.hpp"
+#include "span.hpp"
 #include "types.hpp"
 
+/// Hash functors that hash a block of values at once declare a kBatchSize.
+template <typename HashFn, typename = void>
+struct is_batch_hash_fn : std::false_type {};
+
+template <typename HashFn>
+struct is_batch_hash_fn<HashFn, std::void_t<decltype(HashFn::kBatchSize)>>
+    : std::true_type {};
+
 template <typename HashFn, typename T>
 void BM_Hash(benchmark::State& state) {
   const auto& data = GetData<T>();
   HashFn hash_fn;
+  PerfCounters perf;
+  perf.Start();
   for (auto _ : state) {
-    for (const auto& value : data) {
-      ::benchmark::DoNotOptimize(hash_fn(value));
+    if constexpr (is_batch_hash_fn<HashFn>::value) {
+      std::array<__uint128_t, HashFn::kBatchSize> hashes;
+      for (size_t i = 0; i < data.size(); i += HashFn::kBatchSize) {
+        const size_t n = std::min(HashFn::kBatchSize, data.size() - i);
+        hash_fn(std::span<const T>(data.data() + i, n), hashes.data());
+        ::benchmark::DoNotOptimize(hashes.data());
+      }
+    } else {
+      for (const auto& value : data) {
+        ::benchmark::DoNotOptimize(hash_fn(value));
+      }
     }
     ::benchmark::ClobberMemory();
   }
+  perf.Stop();
 
   int64_t num_items = state.iterations() * data.size();
   state.SetItemsProcessed(num_items);
@@ -23,6 +50,7 @@ void BM_Hash(benchmark::State& state) {
   }
   state.SetBytesProcessed(num_items * item_size);
   state.counters["item_size"] = item_size;
+  perf.Report(state, num_items);
 }
 
 #define BENCHMARK_HASH_ALL_TYPES(hashfn)           \
@@ -49,4 +77,25 @@ struct HashNoUnrollFn {
 };
 BENCHMARK_HASH_ALL_TYPES(HashNoUnrollFn);
 
+struct HashBatchFn {
+  static constexpr size_t kBatchSize = 64;
+  template <typename T>
+  void operator()(std::span<const T> values, __uint128_t* out) const {
+    detail::HashBatch(values, out);
+  }
+};
+BENCHMARK_HASH_ALL_TYPES(HashBatchFn);
+
+/// Hashes with a hash policy, see `hash.hpp`.
+template <typename Hasher>
+struct HasherFn {
+  template <typename T>
+  auto operator()(const T& v) const {
+    return Hasher::Hash(v);
+  }
+};
+BENCHMARK_HASH_ALL_TYPES(HasherFn<detail::Xxh3Hasher>);
+BENCHMARK_HASH_ALL_TYPES(HasherFn<detail::WyHasher>);
+BENCHMARK_HASH_ALL_TYPES(HasherFn<detail::Crc32cHasher>);
+
 CUSTOM_BENCHMARK_MAIN(true, false);
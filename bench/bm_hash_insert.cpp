@@ -1,8 +1,13 @@
+#include <algorithm>
 #include <cstddef>
 
 #include "benchmark.hpp"
 #include "benchmark/benchmark.h"
 #include "cs/cs_final.hpp"
+#include "kll/kll_final.hpp"
+#include "perf_counters.hpp"
+#include "sketch_group.hpp"
+#include "span.hpp"
 #include "ss/ss_final.hpp"
 #include "types.hpp"
 
@@ -10,6 +15,8 @@ template <typename Sketch, typename T>
 void BM_HashInsert(benchmark::State& state) {
   const auto& data = GetData<T>();
   const auto& hashes = GetHashes<T>();
+  PerfCounters perf;
+  perf.Start();
   for (auto _ : state) {
     Sketch sketch;
     for (size_t i = 0; i < data.size(); ++i) {
@@ -18,6 +25,7 @@ void BM_HashInsert(benchmark::State& state) {
     ::benchmark::DoNotOptimize(sketch);
     ::benchmark::ClobberMemory();
   }
+  perf.Stop();
 
   int64_t num_items = state.iterations() * data.size();
   state.SetItemsProcessed(num_items);
@@ -27,6 +35,58 @@ void BM_HashInsert(benchmark::State& state) {
   }
   state.SetBytesProcessed(num_items * item_size);
   state.counters["item_size"] = item_size;
+  perf.Report(state, num_items);
+}
+
+/// The sketches every event feeds in production.
+template <typename T>
+using Group = final::SketchGroup<T, final::CountSketch<T>,
+                                 final::SpaceSaving<T>,
+                                 final::KarninLangLiberty<T>>;
+
+/// Benchmarks inserting every value into all sketches of a `Group`
+/// independently, each hashing the value on its own.
+template <typename T>
+void BM_InsertIndependent(benchmark::State& state) {
+  const auto& data = GetData<T>();
+  for (auto _ : state) {
+    final::CountSketch<T> cs;
+    final::SpaceSaving<T> ss;
+    final::KarninLangLiberty<T> kll;
+    for (const auto& value : data) {
+      cs.Insert(value);
+      ss.Insert(value);
+      kll.Insert(value);
+    }
+    ::benchmark::DoNotOptimize(cs);
+    ::benchmark::DoNotOptimize(ss);
+    ::benchmark::DoNotOptimize(kll);
+    ::benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * data.size());
+}
+
+/// Benchmarks a `Group` that hashes every value once, inserted one by one, or
+/// in batches of `state.range(0)` values if it is not 0.
+template <typename T>
+void BM_InsertGroup(benchmark::State& state) {
+  const auto& data = GetData<T>();
+  const auto batch_size = static_cast<size_t>(state.range(0));
+  for (auto _ : state) {
+    Group<T> group;
+    if (batch_size == 0) {
+      for (const auto& value : data) group.Insert(value);
+    } else {
+      for (size_t i = 0; i < data.size(); i += batch_size) {
+        const size_t n = std::min(batch_size, data.size() - i);
+        group.InsertBatch(std::span<const T>(data.data() + i, n));
+      }
+    }
+    ::benchmark::DoNotOptimize(group);
+    ::benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * data.size());
+  state.counters["batch_size"] = batch_size;
 }
 
 #define BENCHMARK_HASH_INSERT_TYPE(sketch, type) \
@@ -49,4 +109,20 @@ BENCHMARK_HASH_INSERT_LARGE_TYPES(final::SpaceSaving);
 
 BENCHMARK_HASH_INSERT_ALL_TYPES(final::CountSketch);
 
+#define BENCHMARK_INSERT_GROUP_TYPE(type)           \
+  BENCHMARK_TEMPLATE(BM_InsertIndependent, type);   \
+  BENCHMARK_TEMPLATE(BM_InsertGroup, type)->Arg(0); \
+  BENCHMARK_TEMPLATE(BM_InsertGroup, type)->Arg(1 << 10)
+
+#define BENCHMARK_INSERT_GROUP_ALL_TYPES() \
+  BENCHMARK_INSERT_GROUP_TYPE(int16_t);    \
+  BENCHMARK_INSERT_GROUP_TYPE(int32_t);    \
+  BENCHMARK_INSERT_GROUP_TYPE(int64_t);    \
+  BENCHMARK_INSERT_GROUP_TYPE(__int128_t); \
+  BENCHMARK_INSERT_GROUP_TYPE(float);      \
+  BENCHMARK_INSERT_GROUP_TYPE(double);     \
+  BENCHMARK_INSERT_GROUP_TYPE(std::string)
+
+BENCHMARK_INSERT_GROUP_ALL_TYPES();
+
 CUSTOM_BENCHMARK_MAIN(true, true);
@@ -1,3 +1,13 @@
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "any_sketch.hpp"
+#include "arena.hpp"
 #include "benchmark.hpp"
 #include "benchmark/benchmark.h"
 #include "cs/cs_datasketches.hpp"
@@ -7,6 +17,8 @@
 #include "cs/cs_fixed_size.hpp"
 #include "cs/cs_naive.hpp"
 #include "data.hpp"
+#include "hash.hpp"
+#include "kll/kll_buffered_random.hpp"
 #include "kll/kll_cached_level_capacities.hpp"
 #include "kll/kll_datasketches.hpp"
 #include "kll/kll_final.hpp"
@@ -14,16 +26,23 @@
 #include "kll/kll_no_min_max.hpp"
 #include "kll/kll_no_self_move_protection.hpp"
 #include "kll/kll_pcg_random.hpp"
+#include "perf_counters.hpp"
 #include "ss/ss_datasketches.hpp"
 #include "ss/ss_final.hpp"
 #include "ss/ss_heap.hpp"
+#include "ss/ss_indirect.hpp"
 #include "ss/ss_map.hpp"
 #include "ss/ss_naive.hpp"
+#include "ss/ss_swiss.hpp"
+#include "simd.hpp"
+#include "span.hpp"
 #include "types.hpp"
 
 template <typename Sketch, typename T>
 void BM_Insert(benchmark::State& state) {
   const auto& data = GetData<T>();
+  PerfCounters perf;
+  perf.Start();
   for (auto _ : state) {
     Sketch sketch;
     for (const auto& value : data) {
@@ -32,6 +51,63 @@ void BM_Insert(benchmark::State& state) {
     ::benchmark::DoNotOptimize(sketch);
     ::benchmark::ClobberMemory();
   }
+  perf.Stop();
+
+  int64_t num_items = state.iterations() * data.size();
+  state.SetItemsProcessed(num_items);
+  int64_t item_size = sizeof(T);
+  if constexpr (detail::is_string_v<T>) {
+    item_size = data[0].size() * sizeof(char);
+  }
+  state.SetBytesProcessed(num_items * item_size);
+  state.counters["item_size"] = item_size;
+  perf.Report(state, num_items);
+}
+
+template <typename Sketch, typename T>
+void BM_InsertBatch(benchmark::State& state) {
+  const auto& data = GetData<T>();
+  const auto batch_size = static_cast<size_t>(state.range(0));
+  PerfCounters perf;
+  perf.Start();
+  for (auto _ : state) {
+    Sketch sketch;
+    for (size_t i = 0; i < data.size(); i += batch_size) {
+      const size_t n = std::min(batch_size, data.size() - i);
+      sketch.InsertBatch(std::span<const T>(data.data() + i, n));
+    }
+    ::benchmark::DoNotOptimize(sketch);
+    ::benchmark::ClobberMemory();
+  }
+  perf.Stop();
+
+  int64_t num_items = state.iterations() * data.size();
+  state.SetItemsProcessed(num_items);
+  int64_t item_size = sizeof(T);
+  if constexpr (detail::is_string_v<T>) {
+    item_size = data[0].size() * sizeof(char);
+  }
+  state.SetBytesProcessed(num_items * item_size);
+  state.counters["item_size"] = item_size;
+  state.counters["batch_size"] = batch_size;
+  perf.Report(state, num_items);
+}
+
+/// Benchmarks `BM_InsertBatch` through a `final::AnySketch`, whose virtual
+/// call per batch should vanish in the rows with large batches.
+template <typename Sketch, typename T>
+void BM_InsertAny(benchmark::State& state) {
+  const auto& data = GetData<T>();
+  const auto batch_size = static_cast<size_t>(state.range(0));
+  for (auto _ : state) {
+    final::AnySketch<T> sketch(std::in_place_type<Sketch>);
+    for (size_t i = 0; i < data.size(); i += batch_size) {
+      const size_t n = std::min(batch_size, data.size() - i);
+      sketch.InsertBatch(std::span<const T>(data.data() + i, n));
+    }
+    ::benchmark::DoNotOptimize(sketch);
+    ::benchmark::ClobberMemory();
+  }
 
   int64_t num_items = state.iterations() * data.size();
   state.SetItemsProcessed(num_items);
@@ -41,6 +117,194 @@ void BM_Insert(benchmark::State& state) {
   }
   state.SetBytesProcessed(num_items * item_size);
   state.counters["item_size"] = item_size;
+  state.counters["batch_size"] = batch_size;
+}
+
+/// Benchmarks weighted inserts of a pre-aggregated stream, in which each
+/// distinct value occurs `state.range(0)` times. Counts the logical values, so
+/// the throughput is comparable to inserting the stream value by value.
+template <typename Sketch, typename T>
+void BM_InsertWeighted(benchmark::State& state) {
+  const auto& data = GetData<T>();
+  const auto weight = static_cast<uint64_t>(state.range(0));
+  const size_t num_distinct = data.size() / weight;
+  for (auto _ : state) {
+    Sketch sketch;
+    for (size_t i = 0; i < num_distinct; ++i) {
+      sketch.Insert(data[i], weight);
+    }
+    ::benchmark::DoNotOptimize(sketch);
+    ::benchmark::ClobberMemory();
+  }
+
+  int64_t num_items = state.iterations() * num_distinct * weight;
+  state.SetItemsProcessed(num_items);
+  state.counters["weight"] = weight;
+}
+
+/// Benchmarks inserts of data drawn from the distribution `state.range(0)`
+/// with parameter `state.range(1)`, see `DistributionArgs`.
+template <typename Sketch, typename T>
+void BM_InsertDistribution(benchmark::State& state) {
+  const auto distribution = static_cast<Distribution>(state.range(0));
+  const auto param = state.range(1);
+  const std::vector<T>* data;
+  try {
+    data = &GetData<T>(distribution, param);
+  } catch (const std::runtime_error& e) {
+    state.SkipWithError(e.what());
+    return;
+  }
+  for (auto _ : state) {
+    Sketch sketch;
+    for (const auto& value : *data) {
+      sketch.Insert(value);
+    }
+    ::benchmark::DoNotOptimize(sketch);
+    ::benchmark::ClobberMemory();
+  }
+
+  state.SetItemsProcessed(state.iterations() * data->size());
+  state.SetLabel(DistributionName(distribution, param));
+}
+
+/// Benchmarks the insert of a sketch with the given SIMD backend, see
+/// `simd.hpp`. Backends the host CPU does not support are skipped.
+template <template <typename, size_t, typename, size_t, typename, typename>
+          class Sketch,
+          typename Backend, typename T>
+void BM_InsertSimdBackend(benchmark::State& state) {
+  if (!Backend::IsSupported()) {
+    state.SkipWithError("SIMD backend not supported by this CPU");
+    return;
+  }
+  BM_Insert<Sketch<T, 96, Backend, 0, detail::Murmur3Hasher, void>, T>(state);
+}
+
+/// `final::CountSketch` and `final::SpaceSaving` in their default shape with
+/// the hash policy as the first template parameter, for `BM_InsertHasher`.
+template <typename Hasher, typename T>
+using HashedCountSketch = final::CountSketch<T, 2048, 5, int64_t, Hasher>;
+
+template <typename Hasher, typename T>
+using HashedSpaceSaving =
+    final::SpaceSaving<T, 96, detail::simd::DefaultBackend, 0, Hasher>;
+
+/// Benchmarks the insert of a sketch with the given hash policy, see
+/// `hash.hpp`. Compare against `BM_Hash` of the policy in `bm_hash`.
+template <template <typename, typename> class Sketch, typename Hasher,
+          typename T>
+void BM_InsertHasher(benchmark::State& state) {
+  BM_Insert<Sketch<Hasher, T>, T>(state);
+}
+
+/// Benchmarks the insert of a SpaceSaving sketch with a front cache of the
+/// given size on the distributions of `DistributionArgs`. Compare against
+/// `BM_InsertDistribution` of the sketch without a cache.
+template <size_t kCacheSize, typename T>
+void BM_InsertFrontCache(benchmark::State& state) {
+  BM_InsertDistribution<
+      final::SpaceSaving<T, 96, detail::simd::DefaultBackend, kCacheSize>, T>(
+      state);
+  state.counters["cache_size"] = kCacheSize;
+}
+
+/// `final::SpaceSaving` and `swiss::SpaceSaving` with the capacity as the
+/// second template parameter, and `map::SpaceSaving`, which takes it at
+/// runtime, for `BM_InsertCapacity`.
+template <typename T, size_t K>
+using FinalSpaceSaving = final::SpaceSaving<T, K>;
+
+template <typename T, size_t K>
+using SwissSpaceSaving = swiss::SpaceSaving<T, K>;
+
+template <typename T, size_t K>
+class MapSpaceSaving : public map::SpaceSaving<T> {
+ public:
+  MapSpaceSaving() : map::SpaceSaving<T>(K) {}
+};
+
+/// Benchmarks the insert of a SpaceSaving sketch that stores K values, to
+/// show how the find and the eviction of the sketch scale with K.
+template <template <typename, size_t> class Sketch, size_t K, typename T>
+void BM_InsertCapacity(benchmark::State& state) {
+  BM_Insert<Sketch<T, K>, T>(state);
+  state.counters["K"] = K;
+}
+
+/// Benchmarks the insert of a CountSketch of width t with the given counter
+/// type, to show the effect of the table size on the cache misses.
+template <template <typename, size_t, size_t, typename> class Sketch, size_t t,
+          typename Counter, typename T>
+void BM_InsertCounterWidth(benchmark::State& state) {
+  BM_Insert<Sketch<T, t, 5, Counter>, T>(state);
+  state.counters["table_size"] = t * 5 * sizeof(Counter);
+}
+
+/// Benchmarks the insert of a CountSketch of width t with the given counter
+/// type and layout, to compare the cache misses of the rows and the blocked
+/// layout, e.g. with SKETCHES_PERF_COUNTERS=1, see `PerfCounters`.
+template <size_t t, typename Counter, final::CountSketchLayout kLayout,
+          typename T>
+void BM_InsertLayout(benchmark::State& state) {
+  using Sketch =
+      final::CountSketch<T, t, 5, Counter, detail::Murmur3Hasher, kLayout>;
+  BM_Insert<Sketch, T>(state);
+  state.counters["table_size"] = t * 5 * sizeof(Counter);
+  state.counters["block_width"] = Sketch::kBlockWidth;
+}
+
+/// Benchmarks a fleet of `state.range(0)` KLL sketches, e.g. one per tenant
+/// and metric, over which the values are spread round robin. With kReset, the
+/// fleet is built once and reset for every iteration, like at the start of a
+/// time window, otherwise it is built for every iteration. With kArena, the
+/// sketches allocate from one arena instead of the heap.
+template <typename T, bool kArena, bool kReset>
+void BM_InsertFleet(benchmark::State& state) {
+  using Allocator = std::conditional_t<kArena, detail::ArenaAllocator<T>,
+                                       std::allocator<T>>;
+  using Sketch = final::KarninLangLiberty<T, std::less<T>, Allocator>;
+  const auto& data = GetData<T>();
+  const auto num_sketches = static_cast<size_t>(state.range(0));
+  const auto build = [num_sketches](detail::Arena& arena) {
+    std::vector<Sketch> fleet;
+    fleet.reserve(num_sketches);
+    for (size_t i = 0; i < num_sketches; ++i) {
+      if constexpr (kArena) {
+        fleet.emplace_back(200, std::less<T>(), Allocator(arena));
+      } else {
+        fleet.emplace_back();
+      }
+    }
+    return fleet;
+  };
+  const auto fill = [&data, num_sketches](std::vector<Sketch>& fleet) {
+    size_t sketch = 0;
+    for (const auto& value : data) {
+      fleet[sketch].Insert(value);
+      if (++sketch == num_sketches) sketch = 0;
+    }
+  };
+
+  detail::Arena arena;
+  auto fleet = build(arena);
+  for (auto _ : state) {
+    if constexpr (kReset) {
+      for (auto& sketch : fleet) sketch.Reset();
+      fill(fleet);
+    } else {
+      detail::Arena window_arena;
+      fleet = build(window_arena);
+      fill(fleet);
+      // destroys the fleet before its arena
+      fleet.clear();
+    }
+    ::benchmark::DoNotOptimize(fleet);
+    ::benchmark::ClobberMemory();
+  }
+
+  state.SetItemsProcessed(state.iterations() * data.size());
+  state.counters["num_sketches"] = num_sketches;
 }
 
 #define BENCHMARK_INSERT_TYPE(sketch, type) \
@@ -60,6 +324,54 @@ BENCHMARK_INSERT_ALL_TYPES(naive::SpaceSaving);
 BENCHMARK_INSERT_ALL_TYPES(map::SpaceSaving);
 BENCHMARK_INSERT_ALL_TYPES(heap::SpaceSaving);
 BENCHMARK_INSERT_ALL_TYPES(final::SpaceSaving);
+BENCHMARK_INSERT_ALL_TYPES(indirect::SpaceSaving);
+BENCHMARK_INSERT_ALL_TYPES(swiss::SpaceSaving);
+
+#define BENCHMARK_INSERT_CAPACITY_TYPE(sketch, type)         \
+  BENCHMARK_TEMPLATE(BM_InsertCapacity, sketch, 96, type);   \
+  BENCHMARK_TEMPLATE(BM_InsertCapacity, sketch, 256, type);  \
+  BENCHMARK_TEMPLATE(BM_InsertCapacity, sketch, 1024, type); \
+  BENCHMARK_TEMPLATE(BM_InsertCapacity, sketch, 4096, type)
+
+#define BENCHMARK_INSERT_CAPACITY_ALL_TYPES(sketch)   \
+  BENCHMARK_INSERT_CAPACITY_TYPE(sketch, int16_t);    \
+  BENCHMARK_INSERT_CAPACITY_TYPE(sketch, int32_t);    \
+  BENCHMARK_INSERT_CAPACITY_TYPE(sketch, int64_t);    \
+  BENCHMARK_INSERT_CAPACITY_TYPE(sketch, __int128_t); \
+  BENCHMARK_INSERT_CAPACITY_TYPE(sketch, float);      \
+  BENCHMARK_INSERT_CAPACITY_TYPE(sketch, double);     \
+  BENCHMARK_INSERT_CAPACITY_TYPE(sketch, std::string)
+
+BENCHMARK_INSERT_CAPACITY_ALL_TYPES(MapSpaceSaving);
+BENCHMARK_INSERT_CAPACITY_ALL_TYPES(FinalSpaceSaving);
+BENCHMARK_INSERT_CAPACITY_ALL_TYPES(SwissSpaceSaving);
+
+#define BENCHMARK_INSERT_SIMD_BACKEND_TYPE(sketch, backend, type) \
+  BENCHMARK_TEMPLATE(BM_InsertSimdBackend, sketch, backend, type)
+
+#define BENCHMARK_INSERT_SIMD_BACKEND_ALL_TYPES(sketch, backend)   \
+  BENCHMARK_INSERT_SIMD_BACKEND_TYPE(sketch, backend, int16_t);    \
+  BENCHMARK_INSERT_SIMD_BACKEND_TYPE(sketch, backend, int32_t);    \
+  BENCHMARK_INSERT_SIMD_BACKEND_TYPE(sketch, backend, int64_t);    \
+  BENCHMARK_INSERT_SIMD_BACKEND_TYPE(sketch, backend, __int128_t); \
+  BENCHMARK_INSERT_SIMD_BACKEND_TYPE(sketch, backend, float);      \
+  BENCHMARK_INSERT_SIMD_BACKEND_TYPE(sketch, backend, double);     \
+  BENCHMARK_INSERT_SIMD_BACKEND_TYPE(sketch, backend, std::string)
+
+BENCHMARK_INSERT_SIMD_BACKEND_ALL_TYPES(final::SpaceSaving,
+                                        detail::simd::Scalar);
+#if defined(SIMD_X86)
+BENCHMARK_INSERT_SIMD_BACKEND_ALL_TYPES(final::SpaceSaving,
+                                        detail::simd::Sse42);
+BENCHMARK_INSERT_SIMD_BACKEND_ALL_TYPES(final::SpaceSaving, detail::simd::Avx2);
+BENCHMARK_INSERT_SIMD_BACKEND_ALL_TYPES(final::SpaceSaving,
+                                        detail::simd::Avx512);
+#endif
+#if defined(SIMD_NEON)
+BENCHMARK_INSERT_SIMD_BACKEND_ALL_TYPES(final::SpaceSaving, detail::simd::Neon);
+#endif
+BENCHMARK_INSERT_SIMD_BACKEND_ALL_TYPES(final::SpaceSaving,
+                                        detail::simd::Dispatch);
 
 BENCHMARK_INSERT_ALL_TYPES(datasketches::CountMinSketch);
 BENCHMARK_INSERT_ALL_TYPES(naive::CountSketch);
@@ -68,12 +380,176 @@ BENCHMARK_INSERT_ALL_TYPES(fixed_size::CountSketch);
 BENCHMARK_INSERT_ALL_TYPES(final_no_murmur_unroll::CountSketch);
 BENCHMARK_INSERT_ALL_TYPES(final::CountSketch);
 
+#define BENCHMARK_INSERT_COUNTER_WIDTH_TYPE(sketch, t, counter, type) \
+  BENCHMARK_TEMPLATE(BM_InsertCounterWidth, sketch, t, counter, type)
+
+#define BENCHMARK_INSERT_COUNTER_WIDTH_ALL_TYPES(sketch, t, counter)   \
+  BENCHMARK_INSERT_COUNTER_WIDTH_TYPE(sketch, t, counter, int16_t);    \
+  BENCHMARK_INSERT_COUNTER_WIDTH_TYPE(sketch, t, counter, int32_t);    \
+  BENCHMARK_INSERT_COUNTER_WIDTH_TYPE(sketch, t, counter, int64_t);    \
+  BENCHMARK_INSERT_COUNTER_WIDTH_TYPE(sketch, t, counter, __int128_t); \
+  BENCHMARK_INSERT_COUNTER_WIDTH_TYPE(sketch, t, counter, float);      \
+  BENCHMARK_INSERT_COUNTER_WIDTH_TYPE(sketch, t, counter, double);     \
+  BENCHMARK_INSERT_COUNTER_WIDTH_TYPE(sketch, t, counter, std::string)
+
+BENCHMARK_INSERT_COUNTER_WIDTH_ALL_TYPES(final::CountSketch, 2048, int16_t);
+BENCHMARK_INSERT_COUNTER_WIDTH_ALL_TYPES(final::CountSketch, 2048, int32_t);
+BENCHMARK_INSERT_COUNTER_WIDTH_ALL_TYPES(final::CountSketch, 2048, int64_t);
+BENCHMARK_INSERT_COUNTER_WIDTH_ALL_TYPES(final::CountSketch, 16384, int16_t);
+BENCHMARK_INSERT_COUNTER_WIDTH_ALL_TYPES(final::CountSketch, 16384, int32_t);
+BENCHMARK_INSERT_COUNTER_WIDTH_ALL_TYPES(final::CountSketch, 16384, int64_t);
+
+#define BENCHMARK_INSERT_HASHER_TYPE(sketch, hasher, type) \
+  BENCHMARK_TEMPLATE(BM_InsertHasher, sketch, hasher, type)
+
+#define BENCHMARK_INSERT_HASHER_ALL_TYPES(sketch, hasher)   \
+  BENCHMARK_INSERT_HASHER_TYPE(sketch, hasher, int16_t);    \
+  BENCHMARK_INSERT_HASHER_TYPE(sketch, hasher, int32_t);    \
+  BENCHMARK_INSERT_HASHER_TYPE(sketch, hasher, int64_t);    \
+  BENCHMARK_INSERT_HASHER_TYPE(sketch, hasher, __int128_t); \
+  BENCHMARK_INSERT_HASHER_TYPE(sketch, hasher, float);      \
+  BENCHMARK_INSERT_HASHER_TYPE(sketch, hasher, double);     \
+  BENCHMARK_INSERT_HASHER_TYPE(sketch, hasher, std::string)
+
+// SpaceSaving hashes only the types it does not store as they are
+#define BENCHMARK_INSERT_HASHER_HASHED_TYPES(sketch, hasher) \
+  BENCHMARK_INSERT_HASHER_TYPE(sketch, hasher, __int128_t);  \
+  BENCHMARK_INSERT_HASHER_TYPE(sketch, hasher, std::string)
+
+BENCHMARK_INSERT_HASHER_ALL_TYPES(HashedCountSketch, detail::Murmur3Hasher);
+BENCHMARK_INSERT_HASHER_ALL_TYPES(HashedCountSketch, detail::Xxh3Hasher);
+BENCHMARK_INSERT_HASHER_ALL_TYPES(HashedCountSketch, detail::WyHasher);
+BENCHMARK_INSERT_HASHER_ALL_TYPES(HashedCountSketch, detail::Crc32cHasher);
+BENCHMARK_INSERT_HASHER_HASHED_TYPES(HashedSpaceSaving, detail::Murmur3Hasher);
+BENCHMARK_INSERT_HASHER_HASHED_TYPES(HashedSpaceSaving, detail::Xxh3Hasher);
+BENCHMARK_INSERT_HASHER_HASHED_TYPES(HashedSpaceSaving, detail::WyHasher);
+BENCHMARK_INSERT_HASHER_HASHED_TYPES(HashedSpaceSaving, detail::Crc32cHasher);
+
+#define BENCHMARK_INSERT_LAYOUT_TYPE(t, counter, layout, type) \
+  BENCHMARK_TEMPLATE(BM_InsertLayout, t, counter, layout, type)
+
+#define BENCHMARK_INSERT_LAYOUT_ALL_TYPES(t, counter, layout)   \
+  BENCHMARK_INSERT_LAYOUT_TYPE(t, counter, layout, int16_t);    \
+  BENCHMARK_INSERT_LAYOUT_TYPE(t, counter, layout, int32_t);    \
+  BENCHMARK_INSERT_LAYOUT_TYPE(t, counter, layout, int64_t);    \
+  BENCHMARK_INSERT_LAYOUT_TYPE(t, counter, layout, __int128_t); \
+  BENCHMARK_INSERT_LAYOUT_TYPE(t, counter, layout, float);      \
+  BENCHMARK_INSERT_LAYOUT_TYPE(t, counter, layout, double);     \
+  BENCHMARK_INSERT_LAYOUT_TYPE(t, counter, layout, std::string)
+
+// short names for the benchmark names
+constexpr auto kRowsLayout = final::CountSketchLayout::kRows;
+constexpr auto kBlockedLayout = final::CountSketchLayout::kBlocked;
+
+#define BENCHMARK_INSERT_LAYOUTS(t, counter)                  \
+  BENCHMARK_INSERT_LAYOUT_ALL_TYPES(t, counter, kRowsLayout); \
+  BENCHMARK_INSERT_LAYOUT_ALL_TYPES(t, counter, kBlockedLayout)
+
+BENCHMARK_INSERT_LAYOUTS(2048, int64_t);
+BENCHMARK_INSERT_LAYOUTS(2048, int16_t);
+BENCHMARK_INSERT_LAYOUTS(65536, int64_t);
+BENCHMARK_INSERT_LAYOUTS(65536, int16_t);
+
+#define BENCHMARK_INSERT_BATCH_TYPE(sketch, type)          \
+  BENCHMARK_TEMPLATE(BM_InsertBatch, sketch<type>, type) \
+      ->RangeMultiplier(4)                               \
+      ->Range(1, 1 << 14)
+
+#define BENCHMARK_INSERT_BATCH_ALL_TYPES(sketch)   \
+  BENCHMARK_INSERT_BATCH_TYPE(sketch, int16_t);    \
+  BENCHMARK_INSERT_BATCH_TYPE(sketch, int32_t);    \
+  BENCHMARK_INSERT_BATCH_TYPE(sketch, int64_t);    \
+  BENCHMARK_INSERT_BATCH_TYPE(sketch, __int128_t); \
+  BENCHMARK_INSERT_BATCH_TYPE(sketch, float);      \
+  BENCHMARK_INSERT_BATCH_TYPE(sketch, double);     \
+  BENCHMARK_INSERT_BATCH_TYPE(sketch, std::string)
+
+BENCHMARK_INSERT_BATCH_ALL_TYPES(final::CountSketch);
+BENCHMARK_INSERT_BATCH_ALL_TYPES(final::KarninLangLiberty);
+
+#define BENCHMARK_INSERT_ANY_TYPE(sketch, type)          \
+  BENCHMARK_TEMPLATE(BM_InsertAny, sketch<type>, type) \
+      ->RangeMultiplier(16)                            \
+      ->Range(1, 1 << 12)
+
+#define BENCHMARK_INSERT_ANY_ALL_TYPES(sketch)  \
+  BENCHMARK_INSERT_ANY_TYPE(sketch, int64_t); \
+  BENCHMARK_INSERT_ANY_TYPE(sketch, std::string)
+
+BENCHMARK_INSERT_ANY_ALL_TYPES(final::CountSketch);
+BENCHMARK_INSERT_ANY_ALL_TYPES(final::SpaceSaving);
+BENCHMARK_INSERT_ANY_ALL_TYPES(final::KarninLangLiberty);
+
+#define BENCHMARK_INSERT_FLEET_TYPE(type)                               \
+  BENCHMARK_TEMPLATE(BM_InsertFleet, type, false, false)->Arg(1 << 10); \
+  BENCHMARK_TEMPLATE(BM_InsertFleet, type, true, false)->Arg(1 << 10);  \
+  BENCHMARK_TEMPLATE(BM_InsertFleet, type, false, true)->Arg(1 << 10);  \
+  BENCHMARK_TEMPLATE(BM_InsertFleet, type, true, true)->Arg(1 << 10)
+
+BENCHMARK_INSERT_FLEET_TYPE(int64_t);
+BENCHMARK_INSERT_FLEET_TYPE(double);
+BENCHMARK_INSERT_FLEET_TYPE(std::string);
+
+#define BENCHMARK_INSERT_WEIGHTED_TYPE(sketch, type)          \
+  BENCHMARK_TEMPLATE(BM_InsertWeighted, sketch<type>, type) \
+      ->RangeMultiplier(16)                                 \
+      ->Range(1, 1 << 12)
+
+#define BENCHMARK_INSERT_WEIGHTED_ALL_TYPES(sketch)   \
+  BENCHMARK_INSERT_WEIGHTED_TYPE(sketch, int16_t);    \
+  BENCHMARK_INSERT_WEIGHTED_TYPE(sketch, int32_t);    \
+  BENCHMARK_INSERT_WEIGHTED_TYPE(sketch, int64_t);    \
+  BENCHMARK_INSERT_WEIGHTED_TYPE(sketch, __int128_t); \
+  BENCHMARK_INSERT_WEIGHTED_TYPE(sketch, float);      \
+  BENCHMARK_INSERT_WEIGHTED_TYPE(sketch, double);     \
+  BENCHMARK_INSERT_WEIGHTED_TYPE(sketch, std::string)
+
+BENCHMARK_INSERT_WEIGHTED_ALL_TYPES(final::SpaceSaving);
+BENCHMARK_INSERT_WEIGHTED_ALL_TYPES(swiss::SpaceSaving);
+BENCHMARK_INSERT_WEIGHTED_ALL_TYPES(final::CountSketch);
+BENCHMARK_INSERT_WEIGHTED_ALL_TYPES(final::KarninLangLiberty);
+
+#define BENCHMARK_INSERT_DISTRIBUTION_TYPE(sketch, type)          \
+  BENCHMARK_TEMPLATE(BM_InsertDistribution, sketch<type>, type) \
+      ->Apply(DistributionArgs)
+
+#define BENCHMARK_INSERT_DISTRIBUTION_ALL_TYPES(sketch)   \
+  BENCHMARK_INSERT_DISTRIBUTION_TYPE(sketch, int16_t);    \
+  BENCHMARK_INSERT_DISTRIBUTION_TYPE(sketch, int32_t);    \
+  BENCHMARK_INSERT_DISTRIBUTION_TYPE(sketch, int64_t);    \
+  BENCHMARK_INSERT_DISTRIBUTION_TYPE(sketch, __int128_t); \
+  BENCHMARK_INSERT_DISTRIBUTION_TYPE(sketch, float);      \
+  BENCHMARK_INSERT_DISTRIBUTION_TYPE(sketch, double);     \
+  BENCHMARK_INSERT_DISTRIBUTION_TYPE(sketch, std::string)
+
+BENCHMARK_INSERT_DISTRIBUTION_ALL_TYPES(final::SpaceSaving);
+BENCHMARK_INSERT_DISTRIBUTION_ALL_TYPES(indirect::SpaceSaving);
+BENCHMARK_INSERT_DISTRIBUTION_ALL_TYPES(final::CountSketch);
+BENCHMARK_INSERT_DISTRIBUTION_ALL_TYPES(final::KarninLangLiberty);
+
+#define BENCHMARK_INSERT_FRONT_CACHE_TYPE(size, type)          \
+  BENCHMARK_TEMPLATE(BM_InsertFrontCache, size, type)->Apply( \
+      DistributionArgs)
+
+#define BENCHMARK_INSERT_FRONT_CACHE_ALL_TYPES(size)   \
+  BENCHMARK_INSERT_FRONT_CACHE_TYPE(size, int16_t);    \
+  BENCHMARK_INSERT_FRONT_CACHE_TYPE(size, int32_t);    \
+  BENCHMARK_INSERT_FRONT_CACHE_TYPE(size, int64_t);    \
+  BENCHMARK_INSERT_FRONT_CACHE_TYPE(size, __int128_t); \
+  BENCHMARK_INSERT_FRONT_CACHE_TYPE(size, float);      \
+  BENCHMARK_INSERT_FRONT_CACHE_TYPE(size, double);     \
+  BENCHMARK_INSERT_FRONT_CACHE_TYPE(size, std::string)
+
+BENCHMARK_INSERT_FRONT_CACHE_ALL_TYPES(64);
+BENCHMARK_INSERT_FRONT_CACHE_ALL_TYPES(256);
+
 BENCHMARK_INSERT_ALL_TYPES(naive::KarninLangLiberty);
 BENCHMARK_INSERT_ALL_TYPES(datasketches::KarninLangLiberty);
 BENCHMARK_INSERT_ALL_TYPES(no_min_max::KarninLangLiberty);
 BENCHMARK_INSERT_ALL_TYPES(no_self_move_protection::KarninLangLiberty);
 BENCHMARK_INSERT_ALL_TYPES(cached_level_capacities::KarninLangLiberty);
 BENCHMARK_INSERT_ALL_TYPES(pcg_random::KarninLangLiberty);
+BENCHMARK_INSERT_ALL_TYPES(buffered_random::KarninLangLiberty);
 BENCHMARK_INSERT_ALL_TYPES(final::KarninLangLiberty);
 
 CUSTOM_BENCHMARK_MAIN(true, false);
@@ -0,0 +1,196 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#include "benchmark.hpp"
+#include "benchmark/benchmark.h"
+#include "compiler.hpp"
+#include "cs/cs_datasketches.hpp"
+#include "cs/cs_final.hpp"
+#include "cs/cs_windowed.hpp"
+#include "data.hpp"
+#include "kll/kll_datasketches.hpp"
+#include "kll/kll_final.hpp"
+#include "span.hpp"
+#include "ss/ss_datasketches.hpp"
+#include "ss/ss_decayed.hpp"
+#include "ss/ss_final.hpp"
+#include "ss/ss_heap.hpp"
+#include "ss/ss_indirect.hpp"
+#include "types.hpp"
+
+/// The reported percentiles of the batch latencies and their counter names.
+constexpr std::array<std::pair<double, const char*>, 6> kPercentiles = {{
+    {0.5, "p50_ns"},
+    {0.9, "p90_ns"},
+    {0.99, "p99_ns"},
+    {0.999, "p999_ns"},
+    {0.9999, "p9999_ns"},
+    {1.0, "max_ns"},
+}};
+
+/// @return the time stamp counter once all earlier instructions completed,
+/// before any later instruction starts. Nanoseconds on other targets.
+ALWAYS_INLINE uint64_t ReadClockBegin() {
+#if defined(__x86_64__) || defined(__i386__)
+  _mm_lfence();
+  const uint64_t tsc = __rdtsc();
+  _mm_lfence();
+  return tsc;
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+#endif
+}
+
+/// @return the time stamp counter once all earlier instructions completed.
+ALWAYS_INLINE uint64_t ReadClockEnd() {
+#if defined(__x86_64__) || defined(__i386__)
+  unsigned int aux;
+  const uint64_t tsc = __rdtscp(&aux);
+  _mm_lfence();
+  return tsc;
+#else
+  return ReadClockBegin();
+#endif
+}
+
+/// @return the smallest number of ticks between ReadClockBegin and
+/// ReadClockEnd without any work in between.
+inline uint64_t ClockOverhead() {
+  uint64_t overhead = std::numeric_limits<uint64_t>::max();
+  for (int i = 0; i < 1000; ++i) {
+    const uint64_t begin = ReadClockBegin();
+    overhead = std::min(overhead, ReadClockEnd() - begin);
+  }
+  return overhead;
+}
+
+/// Ends the epoch of a windowed sketch.
+template <typename T, size_t t, size_t d, size_t kWindows, typename Hasher>
+void NextEpoch(windowed::CountSketch<T, t, d, kWindows, Hasher>& sketch) {
+  sketch.Rotate();
+}
+
+/// Ends the epoch of a decayed sketch, halving the weights of the epochs so
+/// far.
+template <typename T, size_t K, typename Backend, typename Hasher>
+void NextEpoch(decayed::SpaceSaving<T, K, Backend, Hasher>& sketch) {
+  sketch.Decay(0.5);
+}
+
+/// Benchmarks the latency of inserting batches of `state.range(0)` values,
+/// where `BM_Insert` only reports their mean. Every batch is inserted value by
+/// value and timed with the time stamp counter, so the rare slow batches that
+/// contain e.g. a KLL compaction or a long SpaceSaving sift down show up in
+/// the tail. The ticks of the batches of an iteration are buffered and fed to
+/// a KLL sketch with the largest k outside the timing, whose rank error of
+/// about 1e-4 still resolves the 99.99th percentile. The percentiles are
+/// reported in nanoseconds per batch, net of the overhead of reading the
+/// counter, by the ticks per nanosecond of the whole run.
+///
+/// With kEpochs, the sketch is moved to the next epoch with `NextEpoch` every
+/// `state.range(1)` values, in the timing of the batch that starts the epoch.
+template <typename Sketch, typename T, bool kEpochs = false>
+void BM_InsertLatency(benchmark::State& state) {
+  const auto& data = GetData<T>();
+  const auto batch_size = static_cast<size_t>(state.range(0));
+  const auto epoch_size = kEpochs ? static_cast<size_t>(state.range(1)) : 0;
+  const uint64_t overhead = ClockOverhead();
+  final::KarninLangLiberty<uint64_t> latencies(final::kll_constants::MAX_K);
+  std::vector<uint64_t> ticks;
+  ticks.reserve(data.size() / batch_size + 1);
+
+  const auto start_time = std::chrono::steady_clock::now();
+  const uint64_t start_ticks = ReadClockBegin();
+  for (auto _ : state) {
+    Sketch sketch;
+    for (size_t i = 0; i < data.size(); i += batch_size) {
+      const size_t end = std::min(data.size(), i + batch_size);
+      const uint64_t begin = ReadClockBegin();
+      if constexpr (kEpochs) {
+        if (i > 0 && i % epoch_size < batch_size) NextEpoch(sketch);
+      }
+      for (size_t j = i; j < end; ++j) {
+        sketch.Insert(data[j]);
+      }
+      const uint64_t elapsed = ReadClockEnd() - begin;
+      ticks.push_back(elapsed > overhead ? elapsed - overhead : 0);
+    }
+    ::benchmark::DoNotOptimize(sketch);
+    ::benchmark::ClobberMemory();
+
+    state.PauseTiming();
+    latencies.InsertBatch(std::span<const uint64_t>(ticks));
+    ticks.clear();
+    state.ResumeTiming();
+  }
+  const uint64_t end_ticks = ReadClockEnd();
+  const std::chrono::duration<double, std::nano> run_time =
+      std::chrono::steady_clock::now() - start_time;
+
+  int64_t num_items = state.iterations() * data.size();
+  state.SetItemsProcessed(num_items);
+  int64_t item_size = sizeof(T);
+  if constexpr (detail::is_string_v<T>) {
+    item_size = data[0].size() * sizeof(char);
+  }
+  state.SetBytesProcessed(num_items * item_size);
+  state.counters["item_size"] = item_size;
+  state.counters["batch_size"] = batch_size;
+  if constexpr (kEpochs) state.counters["epoch_size"] = epoch_size;
+  if (latencies.GetN() == 0 || run_time.count() <= 0) return;
+
+  const double ns_per_tick = run_time.count() / (end_ticks - start_ticks);
+  for (const auto& [rank, name] : kPercentiles) {
+    state.counters[name] = latencies.GetQuantile(rank) * ns_per_tick;
+  }
+}
+
+#define BENCHMARK_INSERT_LATENCY_TYPE(sketch, type)        \
+  BENCHMARK_TEMPLATE(BM_InsertLatency, sketch<type>, type) \
+      ->ArgName("batch_size")                              \
+      ->Arg(64)
+
+#define BENCHMARK_INSERT_LATENCY_ALL_TYPES(sketch)   \
+  BENCHMARK_INSERT_LATENCY_TYPE(sketch, int64_t);    \
+  BENCHMARK_INSERT_LATENCY_TYPE(sketch, std::string)
+
+BENCHMARK_INSERT_LATENCY_ALL_TYPES(datasketches::SpaceSaving);
+BENCHMARK_INSERT_LATENCY_ALL_TYPES(heap::SpaceSaving);
+BENCHMARK_INSERT_LATENCY_ALL_TYPES(indirect::SpaceSaving);
+BENCHMARK_INSERT_LATENCY_ALL_TYPES(final::SpaceSaving);
+
+BENCHMARK_INSERT_LATENCY_ALL_TYPES(datasketches::CountMinSketch);
+BENCHMARK_INSERT_LATENCY_ALL_TYPES(final::CountSketch);
+
+BENCHMARK_INSERT_LATENCY_ALL_TYPES(datasketches::KarninLangLiberty);
+BENCHMARK_INSERT_LATENCY_ALL_TYPES(final::KarninLangLiberty);
+
+BENCHMARK_INSERT_LATENCY_ALL_TYPES(windowed::CountSketch);
+BENCHMARK_INSERT_LATENCY_ALL_TYPES(decayed::SpaceSaving);
+
+/// Windows of 5 epochs of 64Ki values each, so that an iteration ends 15.
+#define BENCHMARK_INSERT_EPOCH_LATENCY_TYPE(sketch, type)        \
+  BENCHMARK_TEMPLATE(BM_InsertLatency, sketch<type>, type, true) \
+      ->ArgNames({"batch_size", "epoch_size"})                   \
+      ->Args({64, 1 << 16})
+
+#define BENCHMARK_INSERT_EPOCH_LATENCY_ALL_TYPES(sketch)   \
+  BENCHMARK_INSERT_EPOCH_LATENCY_TYPE(sketch, int64_t);    \
+  BENCHMARK_INSERT_EPOCH_LATENCY_TYPE(sketch, std::string)
+
+BENCHMARK_INSERT_EPOCH_LATENCY_ALL_TYPES(windowed::CountSketch);
+BENCHMARK_INSERT_EPOCH_LATENCY_ALL_TYPES(decayed::SpaceSaving);
+
+CUSTOM_BENCHMARK_MAIN(true, false);
@@ -0,0 +1,126 @@
+#include <cstddef>
+#include <vector>
+
+#include "benchmark.hpp"
+#include "benchmark/benchmark.h"
+#include "cs/cs_final.hpp"
+#include "data.hpp"
+#include "kll/kll_final.hpp"
+#include "parallel_merge.hpp"
+#include "span.hpp"
+#include "ss/ss_final.hpp"
+#include "thread_pool.hpp"
+#include "types.hpp"
+
+/// Number of values inserted into each of the merged sketches.
+constexpr size_t kValuesPerSketch = 10'000;
+
+/// Makes the i-th empty sketch of a merge.
+template <typename Sketch>
+struct SketchFactory {
+  static Sketch Make(size_t) { return Sketch(); }
+};
+
+/// KLL sketches that are merged with each other need distinct seeds, see
+/// `concurrent::ParallelMerge`.
+template <typename T, typename C, typename A>
+struct SketchFactory<final::KarninLangLiberty<T, C, A>> {
+  using Sketch = final::KarninLangLiberty<T, C, A>;
+  static Sketch Make(size_t i) {
+    return Sketch(final::kll_constants::DEFAULT_K, Sketch::kDefaultSeed + i);
+  }
+};
+
+/// @return `num_sketches` sketches, each summarizing a different slice of the
+/// benchmark data.
+template <typename Sketch, typename T>
+std::vector<Sketch> BuildSketches(size_t num_sketches) {
+  const auto& data = GetData<T>();
+  std::vector<Sketch> sketches;
+  sketches.reserve(num_sketches);
+  for (size_t i = 0; i < num_sketches; ++i) {
+    Sketch& sketch = sketches.emplace_back(SketchFactory<Sketch>::Make(i));
+    for (size_t j = 0; j < kValuesPerSketch; ++j) {
+      sketch.Insert(data[(i * kValuesPerSketch + j) % data.size()]);
+    }
+  }
+  return sketches;
+}
+
+template <typename Sketch, typename T>
+void BM_Merge(benchmark::State& state) {
+  const auto num_sketches = static_cast<size_t>(state.range(0));
+  const auto sketches = BuildSketches<Sketch, T>(num_sketches);
+  for (auto _ : state) {
+    Sketch merged = SketchFactory<Sketch>::Make(num_sketches);
+    for (const auto& sketch : sketches) {
+      merged.Merge(sketch);
+    }
+    ::benchmark::DoNotOptimize(merged);
+    ::benchmark::ClobberMemory();
+  }
+
+  int64_t num_items = state.iterations() * num_sketches;
+  state.SetItemsProcessed(num_items);
+  state.counters["num_sketches"] = num_sketches;
+  state.counters["retained_per_sketch"] = sketches[0].GetNumRetained();
+}
+
+/// Measures the tree reduction of `range(0)` sketches on a pool of `range(1)`
+/// threads.
+template <typename Sketch, typename T>
+void BM_ParallelMerge(benchmark::State& state) {
+  const auto num_sketches = static_cast<size_t>(state.range(0));
+  const auto num_threads = static_cast<size_t>(state.range(1));
+  const auto sketches = BuildSketches<Sketch, T>(num_sketches);
+  std::vector<const Sketch*> pointers;
+  for (const auto& sketch : sketches) {
+    pointers.push_back(&sketch);
+  }
+  detail::ThreadPool pool(num_threads);
+  for (auto _ : state) {
+    // the partials are seeded apart from the merged sketches
+    auto merged = concurrent::ParallelMerge<Sketch>(
+        pointers, pool, [num_sketches](size_t p) {
+          return SketchFactory<Sketch>::Make(num_sketches + p);
+        });
+    ::benchmark::DoNotOptimize(merged);
+    ::benchmark::ClobberMemory();
+  }
+
+  int64_t num_items = state.iterations() * num_sketches;
+  state.SetItemsProcessed(num_items);
+  state.counters["num_sketches"] = num_sketches;
+  state.counters["num_threads"] = num_threads;
+}
+
+#define BENCHMARK_MERGE_TYPE(sketch, type)          \
+  BENCHMARK_TEMPLATE(BM_Merge, sketch<type>, type) \
+      ->RangeMultiplier(8)                         \
+      ->Range(2, 1 << 10)
+
+#define BENCHMARK_MERGE_ALL_TYPES(sketch)   \
+  BENCHMARK_MERGE_TYPE(sketch, int16_t);    \
+  BENCHMARK_MERGE_TYPE(sketch, int32_t);    \
+  BENCHMARK_MERGE_TYPE(sketch, int64_t);    \
+  BENCHMARK_MERGE_TYPE(sketch, __int128_t); \
+  BENCHMARK_MERGE_TYPE(sketch, float);      \
+  BENCHMARK_MERGE_TYPE(sketch, double);     \
+  BENCHMARK_MERGE_TYPE(sketch, std::string)
+
+BENCHMARK_MERGE_ALL_TYPES(final::KarninLangLiberty);
+
+#define BENCHMARK_PARALLEL_MERGE_TYPE(sketch, type, max_sketches)   \
+  BENCHMARK_TEMPLATE(BM_ParallelMerge, sketch<type>, type)         \
+      ->ArgsProduct({benchmark::CreateRange(16, max_sketches, 16), \
+                     benchmark::CreateRange(1, 16, 2)})            \
+      ->UseRealTime()
+
+BENCHMARK_PARALLEL_MERGE_TYPE(final::CountSketch, int64_t, 1 << 10);
+BENCHMARK_PARALLEL_MERGE_TYPE(final::CountSketch, std::string, 1 << 10);
+BENCHMARK_PARALLEL_MERGE_TYPE(final::SpaceSaving, int64_t, 1 << 12);
+BENCHMARK_PARALLEL_MERGE_TYPE(final::SpaceSaving, std::string, 1 << 12);
+BENCHMARK_PARALLEL_MERGE_TYPE(final::KarninLangLiberty, int64_t, 1 << 12);
+BENCHMARK_PARALLEL_MERGE_TYPE(final::KarninLangLiberty, std::string, 1 << 12);
+
+CUSTOM_BENCHMARK_MAIN(true, false);
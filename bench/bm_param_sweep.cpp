@@ -0,0 +1,130 @@
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "benchmark.hpp"
+#include "benchmark/benchmark.h"
+#include "cs/cs_final.hpp"
+#include "data.hpp"
+#include "kll/kll_final.hpp"
+#include "ss/ss_final.hpp"
+#include "types.hpp"
+
+// Sweeps the shape of the final sketches across the cache sizes, to find the
+// sizes at which the insert falls off a cliff. Every row reports the size of
+// the sketch in bytes as sketch_size, to be compared with the cache sizes in
+// the context of the output.
+
+/// Widths t of the CountSketch grid, from 6 KiB to 3.5 MiB of counters.
+using SweepWidths = std::index_sequence<256, 1024, 4096, 16384, 65536>;
+/// Heights d of the CountSketch grid.
+using SweepHeights = std::index_sequence<3, 5, 7>;
+/// Capacities K of the SpaceSaving grid.
+using SweepCapacities = std::index_sequence<32, 64, 128, 256, 512, 1024>;
+/// Parameters k of the KLL grid, which is a constructor argument.
+constexpr int64_t kSweepKllK[] = {50, 100, 200, 400, 800, 1600};
+
+/// @return the bytes of the sketch, including the retained values of a KLL
+/// sketch, which live outside of it.
+template <typename Sketch, typename T>
+size_t SketchSize(const Sketch& sketch) {
+  if constexpr (std::is_same_v<Sketch, final::KarninLangLiberty<T>>) {
+    return sizeof(sketch) + sketch.GetNumRetained() * sizeof(T);
+  } else {
+    return sizeof(sketch);
+  }
+}
+
+/// Benchmarks the insert of the benchmark data into a sketch constructed from
+/// `args`. The sketch is allocated on the heap, since the largest tables of
+/// the grid exceed the stack.
+template <typename Sketch, typename T, typename... Args>
+void BM_InsertSweep(benchmark::State& state, Args... args) {
+  const auto& data = GetData<T>();
+  size_t sketch_size = 0;
+  for (auto _ : state) {
+    auto sketch = std::make_unique<Sketch>(args...);
+    for (const auto& value : data) {
+      sketch->Insert(value);
+    }
+    ::benchmark::DoNotOptimize(*sketch);
+    ::benchmark::ClobberMemory();
+    sketch_size = SketchSize<Sketch, T>(*sketch);
+  }
+
+  int64_t num_items = state.iterations() * data.size();
+  state.SetItemsProcessed(num_items);
+  int64_t item_size = sizeof(T);
+  if constexpr (detail::is_string_v<T>) {
+    item_size = data[0].size() * sizeof(char);
+  }
+  state.SetBytesProcessed(num_items * item_size);
+  state.counters["item_size"] = item_size;
+  state.counters["sketch_size"] = sketch_size;
+}
+
+/// Registers `BM_InsertSweep` of `final::CountSketch<T, t, d>` for every t of
+/// the grid, named like the rows of `BENCHMARK_TEMPLATE`.
+template <typename T, size_t d, size_t... ts>
+void RegisterCountSketchWidths(const std::string& type,
+                               std::index_sequence<ts...>) {
+  (::benchmark::RegisterBenchmark(
+       ("BM_InsertSweep<final::CountSketch<" + type + ", " +
+        std::to_string(ts) + ", " + std::to_string(d) + ">, " + type + ">")
+           .c_str(),
+       BM_InsertSweep<final::CountSketch<T, ts, d>, T>),
+   ...);
+}
+
+/// Registers the CountSketch grid, every height with every width.
+template <typename T, size_t... ds>
+void RegisterCountSketchSweep(const std::string& type,
+                              std::index_sequence<ds...>) {
+  (RegisterCountSketchWidths<T, ds>(type, SweepWidths{}), ...);
+}
+
+/// Registers `BM_InsertSweep` of `final::SpaceSaving<T, K>` for every K of the
+/// grid.
+template <typename T, size_t... Ks>
+void RegisterSpaceSavingSweep(const std::string& type,
+                              std::index_sequence<Ks...>) {
+  (::benchmark::RegisterBenchmark(
+       ("BM_InsertSweep<final::SpaceSaving<" + type + ", " +
+        std::to_string(Ks) + ">, " + type + ">")
+           .c_str(),
+       BM_InsertSweep<final::SpaceSaving<T, Ks>, T>),
+   ...);
+}
+
+/// Registers `BM_InsertSweep` of `final::KarninLangLiberty<T>` for every k of
+/// the grid, with k as the argument of the row.
+template <typename T>
+void RegisterKllSweep(const std::string& type) {
+  for (const int64_t k : kSweepKllK) {
+    ::benchmark::RegisterBenchmark(
+        ("BM_InsertSweep<final::KarninLangLiberty<" + type + ">, " + type +
+         ">/k:" + std::to_string(k))
+            .c_str(),
+        BM_InsertSweep<final::KarninLangLiberty<T>, T, uint16_t>,
+        static_cast<uint16_t>(k));
+  }
+}
+
+/// Registers the grid of all sketches for a data type.
+template <typename T>
+void RegisterSweep(const std::string& type) {
+  RegisterCountSketchSweep<T>(type, SweepHeights{});
+  RegisterSpaceSavingSweep<T>(type, SweepCapacities{});
+  RegisterKllSweep<T>(type);
+}
+
+[[maybe_unused]] static const bool kSweepRegistered = [] {
+  RegisterSweep<int64_t>("int64_t");
+  RegisterSweep<std::string>("std::string");
+  return true;
+}();
+
+CUSTOM_BENCHMARK_MAIN(true, false);
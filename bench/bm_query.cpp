@@ -0,0 +1,85 @@
+#include <array>
+#include <cstddef>
+
+#include "benchmark.hpp"
+#include "benchmark/benchmark.h"
+#include "data.hpp"
+#include "kll/kll_final.hpp"
+#include "types.hpp"
+
+/// The ranks a latency dashboard polls, p50, p99 and p999.
+constexpr std::array<double, 3> kRanks = {0.5, 0.99, 0.999};
+
+/// @return a sketch summarizing the benchmark data.
+template <typename Sketch, typename T>
+Sketch BuildSketch() {
+  Sketch sketch;
+  for (const auto& value : GetData<T>()) {
+    sketch.Insert(value);
+  }
+  return sketch;
+}
+
+/// Measures the first query after an insert, which has to rebuild the sorted
+/// view. The cost of the single insert is negligible in comparison.
+template <typename Sketch, typename T>
+void BM_QueryFirst(benchmark::State& state) {
+  const auto& data = GetData<T>();
+  auto sketch = BuildSketch<Sketch, T>();
+  size_t i = 0;
+  for (auto _ : state) {
+    sketch.Insert(data[i++ % data.size()]);
+    ::benchmark::DoNotOptimize(sketch.GetQuantile(kRanks[0]));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["num_retained"] = sketch.GetNumRetained();
+}
+
+/// Measures repeated quantile queries answered from the cached sorted view.
+template <typename Sketch, typename T>
+void BM_QueryQuantile(benchmark::State& state) {
+  const auto sketch = BuildSketch<Sketch, T>();
+  ::benchmark::DoNotOptimize(sketch.GetQuantile(kRanks[0]));
+  for (auto _ : state) {
+    for (const double rank : kRanks) {
+      ::benchmark::DoNotOptimize(sketch.GetQuantile(rank));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * kRanks.size());
+  state.counters["num_retained"] = sketch.GetNumRetained();
+}
+
+/// Measures repeated rank queries answered from the cached sorted view.
+template <typename Sketch, typename T>
+void BM_QueryRank(benchmark::State& state) {
+  const auto& data = GetData<T>();
+  const auto sketch = BuildSketch<Sketch, T>();
+  ::benchmark::DoNotOptimize(sketch.GetRank(data[0]));
+  size_t i = 0;
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(sketch.GetRank(data[i++ % data.size()]));
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["num_retained"] = sketch.GetNumRetained();
+}
+
+#define BENCHMARK_QUERY_TYPE(sketch, type)                    \
+  BENCHMARK_TEMPLATE(BM_QueryFirst, sketch<type>, type);    \
+  BENCHMARK_TEMPLATE(BM_QueryQuantile, sketch<type>, type); \
+  BENCHMARK_TEMPLATE(BM_QueryRank, sketch<type>, type)
+
+#define BENCHMARK_QUERY_ALL_TYPES(sketch)   \
+  BENCHMARK_QUERY_TYPE(sketch, int16_t);    \
+  BENCHMARK_QUERY_TYPE(sketch, int32_t);    \
+  BENCHMARK_QUERY_TYPE(sketch, int64_t);    \
+  BENCHMARK_QUERY_TYPE(sketch, __int128_t); \
+  BENCHMARK_QUERY_TYPE(sketch, float);      \
+  BENCHMARK_QUERY_TYPE(sketch, double);     \
+  BENCHMARK_QUERY_TYPE(sketch, std::string)
+
+BENCHMARK_QUERY_ALL_TYPES(final::KarninLangLiberty);
+
+CUSTOM_BENCHMARK_MAIN(true, false);
@@ -0,0 +1,257 @@
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <string>
+#include <utility>
+
+#include "benchmark.hpp"
+#include "benchmark/benchmark.h"
+#include "cs/cs_final.hpp"
+#include "data.hpp"
+#include "kll/kll_final.hpp"
+#include "serialization.hpp"
+#include "span.hpp"
+#include "ss/ss_final.hpp"
+
+/// Wire buffer aligned like a memory-mapped file or a network receive buffer.
+class AlignedBuffer {
+ public:
+  explicit AlignedBuffer(size_t size)
+      : data_(static_cast<std::byte*>(::operator new(
+            size, std::align_val_t{detail::kWireAlignment}))),
+        size_(size) {}
+
+  ~AlignedBuffer() {
+    ::operator delete(data_, std::align_val_t{detail::kWireAlignment});
+  }
+
+  AlignedBuffer(const AlignedBuffer&) = delete;
+  AlignedBuffer& operator=(const AlignedBuffer&) = delete;
+
+  std::span<std::byte> span() { return {data_, size_}; }
+  std::span<const std::byte> span() const { return {data_, size_}; }
+
+ private:
+  std::byte* data_;
+  size_t size_;
+};
+
+/// @return a heap-allocated sketch summarizing the benchmark data.
+template <typename Sketch, typename T>
+std::unique_ptr<Sketch> BuildSketch() {
+  auto sketch = std::make_unique<Sketch>();
+  for (const auto& value : GetData<T>()) {
+    sketch->Insert(value);
+  }
+  return sketch;
+}
+
+/// Sets the throughput in bytes of the in-memory counters, so that the rows of
+/// all encodings are comparable, and the size of the wire format.
+template <typename Sketch>
+void SetCounters(benchmark::State& state, size_t wire_size) {
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() *
+                          Sketch().SerializedSize(
+                              final::CountSketchEncoding::kInt64));
+  state.counters["wire_size"] = wire_size;
+  state.counters["encoding"] = state.range(0);
+}
+
+template <typename Sketch, typename T>
+void BM_Serialize(benchmark::State& state) {
+  const auto encoding = static_cast<final::CountSketchEncoding>(state.range(0));
+  const auto sketch = BuildSketch<Sketch, T>();
+  AlignedBuffer buffer(sketch->SerializedSize(encoding));
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(sketch->Serialize(buffer.span(), encoding));
+    ::benchmark::ClobberMemory();
+  }
+
+  SetCounters<Sketch>(state, buffer.span().size());
+}
+
+template <typename Sketch, typename T>
+void BM_Deserialize(benchmark::State& state) {
+  const auto encoding = static_cast<final::CountSketchEncoding>(state.range(0));
+  const auto sketch = BuildSketch<Sketch, T>();
+  AlignedBuffer buffer(sketch->SerializedSize(encoding));
+  sketch->Serialize(buffer.span(), encoding);
+  auto deserialized = std::make_unique<Sketch>();
+  for (auto _ : state) {
+    deserialized->Deserialize(std::as_const(buffer).span());
+    ::benchmark::DoNotOptimize(*deserialized);
+    ::benchmark::ClobberMemory();
+  }
+
+  SetCounters<Sketch>(state, buffer.span().size());
+}
+
+template <typename Sketch, typename T>
+void BM_MergeFromBuffer(benchmark::State& state) {
+  const auto encoding = static_cast<final::CountSketchEncoding>(state.range(0));
+  const auto sketch = BuildSketch<Sketch, T>();
+  AlignedBuffer buffer(sketch->SerializedSize(encoding));
+  sketch->Serialize(buffer.span(), encoding);
+  auto merged = BuildSketch<Sketch, T>();
+  for (auto _ : state) {
+    merged->Merge(std::as_const(buffer).span());
+    ::benchmark::DoNotOptimize(*merged);
+    ::benchmark::ClobberMemory();
+  }
+
+  SetCounters<Sketch>(state, buffer.span().size());
+}
+
+/// Measures queries answered in place from a serialized sketch, for reference
+/// next to BM_Estimate in bm_estimate.
+template <typename Sketch, typename T>
+void BM_ViewEstimate(benchmark::State& state) {
+  const auto encoding = static_cast<final::CountSketchEncoding>(state.range(0));
+  const auto& data = GetData<T>();
+  const auto sketch = BuildSketch<Sketch, T>();
+  AlignedBuffer buffer(sketch->SerializedSize(encoding));
+  sketch->Serialize(buffer.span(), encoding);
+  const typename Sketch::View view(std::as_const(buffer).span());
+  for (auto _ : state) {
+    for (const auto& value : data) {
+      ::benchmark::DoNotOptimize(view.Estimate(value));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * data.size());
+  state.counters["wire_size"] = buffer.span().size();
+  state.counters["encoding"] = state.range(0);
+}
+
+/// Measures the compact formats of the KLL and SpaceSaving sketches, which
+/// have a single encoding.
+template <typename Sketch, typename T>
+void BM_SerializeCompact(benchmark::State& state) {
+  const auto sketch = BuildSketch<Sketch, T>();
+  AlignedBuffer buffer(sketch->SerializedSize());
+  for (auto _ : state) {
+    ::benchmark::DoNotOptimize(sketch->Serialize(buffer.span()));
+    ::benchmark::ClobberMemory();
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["wire_size"] = buffer.span().size();
+}
+
+template <typename Sketch, typename T>
+void BM_DeserializeCompact(benchmark::State& state) {
+  const auto sketch = BuildSketch<Sketch, T>();
+  AlignedBuffer buffer(sketch->SerializedSize());
+  sketch->Serialize(buffer.span());
+  auto deserialized = std::make_unique<Sketch>();
+  for (auto _ : state) {
+    deserialized->Deserialize(std::as_const(buffer).span());
+    ::benchmark::DoNotOptimize(*deserialized);
+    ::benchmark::ClobberMemory();
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["wire_size"] = buffer.span().size();
+}
+
+/// Measures a snapshot of a KLL sketch that a background thread would
+/// serialize, taken between batches of inserts. The values are shared until
+/// the next compaction, so the fewer compactions a batch triggers, the fewer
+/// snapshots cost a copy of the retained values.
+template <typename Sketch, typename T>
+void BM_TakeSnapshot(benchmark::State& state) {
+  const auto& data = GetData<T>();
+  const auto batch_size = static_cast<size_t>(state.range(0));
+  auto sketch = BuildSketch<Sketch, T>();
+  size_t next = 0;
+  for (auto _ : state) {
+    const auto snapshot = sketch->TakeSnapshot();
+    ::benchmark::DoNotOptimize(snapshot.GetN());
+    for (size_t i = 0; i < batch_size; ++i) {
+      sketch->Insert(data[next]);
+      next = next + 1 == data.size() ? 0 : next + 1;
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations());
+  state.counters["batch_size"] = batch_size;
+}
+
+/// Measures queries answered in place from a serialized KLL sketch, for
+/// reference next to BM_QueryQuantile in bm_query.
+template <typename Sketch, typename T>
+void BM_CompactViewQuantile(benchmark::State& state) {
+  constexpr size_t kNumRanks = 1000;
+  const auto sketch = BuildSketch<Sketch, T>();
+  AlignedBuffer buffer(sketch->SerializedSize());
+  sketch->Serialize(buffer.span());
+  const typename Sketch::View view(std::as_const(buffer).span());
+  for (auto _ : state) {
+    for (size_t i = 0; i <= kNumRanks; ++i) {
+      ::benchmark::DoNotOptimize(
+          view.GetQuantile(static_cast<double>(i) / kNumRanks));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * (kNumRanks + 1));
+  state.counters["wire_size"] = buffer.span().size();
+}
+
+/// Measures estimates answered in place from a serialized SpaceSaving sketch.
+template <typename Sketch, typename T>
+void BM_CompactViewEstimate(benchmark::State& state) {
+  const auto& data = GetData<T>();
+  const auto sketch = BuildSketch<Sketch, T>();
+  AlignedBuffer buffer(sketch->SerializedSize());
+  sketch->Serialize(buffer.span());
+  const typename Sketch::View view(std::as_const(buffer).span());
+  for (auto _ : state) {
+    for (const auto& value : data) {
+      ::benchmark::DoNotOptimize(view.Estimate(value));
+    }
+  }
+
+  state.SetItemsProcessed(state.iterations() * data.size());
+  state.counters["wire_size"] = buffer.span().size();
+}
+
+#define BENCHMARK_SERIALIZE_TYPE(sketch, type)                   \
+  BENCHMARK_TEMPLATE(BM_Serialize, sketch<type>, type)         \
+      ->DenseRange(0, 2);                                      \
+  BENCHMARK_TEMPLATE(BM_Deserialize, sketch<type>, type)       \
+      ->DenseRange(0, 2);                                      \
+  BENCHMARK_TEMPLATE(BM_MergeFromBuffer, sketch<type>, type)   \
+      ->DenseRange(0, 2);                                      \
+  BENCHMARK_TEMPLATE(BM_ViewEstimate, sketch<type>, type)      \
+      ->DenseRange(0, 1)
+
+// The wire format does not depend on the data type, so one type suffices. The
+// argument is the counter encoding, 0 = int64, 1 = int32 and 2 = varint.
+BENCHMARK_SERIALIZE_TYPE(final::CountSketch, int64_t);
+
+#define BENCHMARK_SERIALIZE_COMPACT_TYPE(sketch, type)         \
+  BENCHMARK_TEMPLATE(BM_SerializeCompact, sketch<type>, type); \
+  BENCHMARK_TEMPLATE(BM_DeserializeCompact, sketch<type>, type)
+
+#define BENCHMARK_SERIALIZE_COMPACT_ALL_TYPES(sketch) \
+  BENCHMARK_SERIALIZE_COMPACT_TYPE(sketch, int64_t);  \
+  BENCHMARK_SERIALIZE_COMPACT_TYPE(sketch, std::string)
+
+// The compact formats store the values, so their size depends on the type.
+BENCHMARK_SERIALIZE_COMPACT_ALL_TYPES(final::KarninLangLiberty);
+BENCHMARK_SERIALIZE_COMPACT_ALL_TYPES(final::SpaceSaving);
+
+BENCHMARK_TEMPLATE(BM_TakeSnapshot, final::KarninLangLiberty<int64_t>, int64_t)
+    ->ArgName("batch_size")
+    ->RangeMultiplier(8)
+    ->Range(8, 4096);
+BENCHMARK_TEMPLATE(BM_CompactViewQuantile, final::KarninLangLiberty<int64_t>,
+                   int64_t);
+BENCHMARK_TEMPLATE(BM_CompactViewEstimate, final::SpaceSaving<int64_t>,
+                   int64_t);
+BENCHMARK_TEMPLATE(BM_CompactViewEstimate, final::SpaceSaving<std::string>,
+                   std::string);
+
+CUSTOM_BENCHMARK_MAIN(true, false);
@@ -6,4 +6,26 @@ foreach(benchfile ${BENCHMARK_CPP})
     target_link_libraries(${benchname} benchmark)
     target_compile_options(${benchname} PUBLIC -Wall -Wextra -Werror)
     message(${benchfile})
-endforeach(benchfile ${BENCHMARK_CPP})
\ No newline at end of file
+endforeach(benchfile ${BENCHMARK_CPP})
+
+if (SKETCHES_CUDA)
+    enable_language(CUDA)
+    file(GLOB BENCHMARK_CU "${CMAKE_CURRENT_LIST_DIR}/bm_*.cu")
+    foreach(benchfile ${BENCHMARK_CU})
+        get_filename_component(benchname ${benchfile} NAME_WE)
+        add_executable(${benchname} ${benchfile} )
+        target_link_libraries(${benchname} benchmark)
+        set_target_properties(${benchname} PROPERTIES CUDA_STANDARD 17)
+        # The kernels call the constexpr MurmurHash3 and index helpers.
+        target_compile_options(${benchname} PUBLIC
+            $<$<COMPILE_LANGUAGE:CUDA>:--expt-relaxed-constexpr>)
+        # The host code is compiled by nvcc, which does not see the
+        # CMAKE_CXX_FLAGS. Without ARCH_FLAGS the CPU baseline would miss the
+        # vectorized hash kernels.
+        if (ARCH_FLAGS)
+            target_compile_options(${benchname} PUBLIC
+                $<$<COMPILE_LANGUAGE:CUDA>:-Xcompiler=${ARCH_FLAGS}>)
+        endif()
+        message(${benchfile})
+    endforeach(benchfile ${BENCHMARK_CU})
+endif()
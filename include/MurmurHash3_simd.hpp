@@ -0,0 +1,319 @@
+// Vectorized MurmurHash3_x64_128 for fixed-width keys.
+//
+// Hashes 4 (AVX2) or 8 (AVX-512) keys of 16, 32, 64 or 128 bits per
+// iteration. The output is bit identical to the unrolled scalar overloads in
+// MurmurHash3.h, i.e. every key is hashed as if it was passed on its own.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+#include "MurmurHash3.h"
+#include "compiler.hpp"
+
+// GCC 12 reports the _mm512_undefined_epi32() pass-through operand of the
+// AVX-512 intrinsics as maybe uninitialized once they are inlined.
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+
+namespace detail {
+namespace murmur3_simd {
+
+/// Whether keys of type T can be hashed by the vectorized kernels.
+template <typename T>
+inline constexpr bool kSupported =
+    std::is_same_v<T, int16_t> || std::is_same_v<T, uint16_t> ||
+    std::is_same_v<T, int32_t> || std::is_same_v<T, uint32_t> ||
+    std::is_same_v<T, int64_t> || std::is_same_v<T, uint64_t> ||
+    std::is_same_v<T, __int128_t> || std::is_same_v<T, __uint128_t> ||
+    std::is_same_v<T, float> || std::is_same_v<T, double>;
+
+#if defined(__AVX2__)
+
+/// Multiplies each 64 bit lane with a 64 bit constant, keeping the lower 64
+/// bits. AVX2 has no 64 bit multiply, so we combine three 32 bit multiplies.
+ALWAYS_INLINE static __m256i mullo_epi64(__m256i a, uint64_t b) {
+  const __m256i b_lo = _mm256_set1_epi64x(static_cast<uint32_t>(b));
+  const __m256i b_hi = _mm256_set1_epi64x(b >> 32);
+  const __m256i lo = _mm256_mul_epu32(a, b_lo);
+  const __m256i cross = _mm256_add_epi64(
+      _mm256_mul_epu32(_mm256_srli_epi64(a, 32), b_lo),
+      _mm256_mul_epu32(a, b_hi));
+  return _mm256_add_epi64(lo, _mm256_slli_epi64(cross, 32));
+}
+
+template <int r>
+ALWAYS_INLINE static __m256i rotl_epi64(__m256i x) {
+  return _mm256_or_si256(_mm256_slli_epi64(x, r), _mm256_srli_epi64(x, 64 - r));
+}
+
+ALWAYS_INLINE static __m256i fmix64(__m256i k) {
+  k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+  k = mullo_epi64(k, 0xff51afd7ed558ccdULL);
+  k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+  k = mullo_epi64(k, 0xc4ceb9fe1a85ec53ULL);
+  k = _mm256_xor_si256(k, _mm256_srli_epi64(k, 33));
+  return k;
+}
+
+/// Hashes 4 keys of `len` <= 8 bytes, zero extended to 64 bit lanes.
+/// The hashes are written in key order as h1 | h2 << 64.
+ALWAYS_INLINE static void Hash4x64(__m256i k1, uint64_t len, uint64_t seed,
+                                   __uint128_t* out) {
+  k1 = mullo_epi64(k1, c1);
+  k1 = rotl_epi64<31>(k1);
+  k1 = mullo_epi64(k1, c2);
+
+  __m256i h2 = _mm256_set1_epi64x(seed ^ len);
+  __m256i h1 = _mm256_xor_si256(h2, k1);
+
+  h1 = _mm256_add_epi64(h1, h2);
+  h2 = _mm256_add_epi64(h2, h1);
+
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+
+  h1 = _mm256_add_epi64(h1, h2);
+  h2 = _mm256_add_epi64(h2, h1);
+
+  // Lanes are in key order, interleave h1 and h2 per key.
+  const __m256i lo = _mm256_unpacklo_epi64(h1, h2);  // keys 0, 2
+  const __m256i hi = _mm256_unpackhi_epi64(h1, h2);  // keys 1, 3
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out),
+                      _mm256_permute2x128_si256(lo, hi, 0x20));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2),
+                      _mm256_permute2x128_si256(lo, hi, 0x31));
+}
+
+/// Hashes 4 consecutive 128 bit keys.
+ALWAYS_INLINE static void Hash4x128(const __uint128_t* keys, uint64_t seed,
+                                    __uint128_t* out) {
+  const __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys));
+  const __m256i b =
+      _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys + 2));
+  // The lanes hold keys 0, 2, 1, 3. The interleave at the end undoes this.
+  __m256i k1 = _mm256_unpacklo_epi64(a, b);
+  __m256i k2 = _mm256_unpackhi_epi64(a, b);
+
+  const __m256i s = _mm256_set1_epi64x(seed);
+
+  k1 = mullo_epi64(k1, c1);
+  k1 = rotl_epi64<31>(k1);
+  k1 = mullo_epi64(k1, c2);
+  __m256i h1 = _mm256_xor_si256(s, k1);
+  h1 = rotl_epi64<27>(h1);
+  h1 = _mm256_add_epi64(h1, s);
+  h1 = _mm256_add_epi64(_mm256_add_epi64(_mm256_slli_epi64(h1, 2), h1),
+                        _mm256_set1_epi64x(0x52dce729));
+
+  k2 = mullo_epi64(k2, c2);
+  k2 = rotl_epi64<33>(k2);
+  k2 = mullo_epi64(k2, c1);
+  __m256i h2 = _mm256_xor_si256(s, k2);
+  h2 = rotl_epi64<31>(h2);
+  h2 = _mm256_add_epi64(h2, h1);
+  h2 = _mm256_add_epi64(_mm256_add_epi64(_mm256_slli_epi64(h2, 2), h2),
+                        _mm256_set1_epi64x(0x38495ab5));
+
+  const __m256i len = _mm256_set1_epi64x(sizeof(__uint128_t));
+  h1 = _mm256_xor_si256(h1, len);
+  h2 = _mm256_xor_si256(h2, len);
+
+  h1 = _mm256_add_epi64(h1, h2);
+  h2 = _mm256_add_epi64(h2, h1);
+
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+
+  h1 = _mm256_add_epi64(h1, h2);
+  h2 = _mm256_add_epi64(h2, h1);
+
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out),
+                      _mm256_unpacklo_epi64(h1, h2));  // keys 0, 1
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2),
+                      _mm256_unpackhi_epi64(h1, h2));  // keys 2, 3
+}
+
+/// Loads 4 keys of type T, zero extended to 64 bit lanes. Floating point keys
+/// are normalized like fp_hash_bits in hash.hpp, mapping -0.0 to +0.0.
+template <typename T>
+ALWAYS_INLINE static __m256i Load4x64(const T* keys) {
+  if constexpr (sizeof(T) == 2) {
+    return _mm256_cvtepu16_epi64(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(keys)));
+  } else if constexpr (sizeof(T) == 4) {
+    __m128i x = _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys));
+    if constexpr (std::is_floating_point_v<T>) {
+      const __m128i abs = _mm_and_si128(x, _mm_set1_epi32(0x7fffffff));
+      x = _mm_andnot_si128(_mm_cmpeq_epi32(abs, _mm_setzero_si128()), x);
+    }
+    return _mm256_cvtepu32_epi64(x);
+  } else {
+    __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys));
+    if constexpr (std::is_floating_point_v<T>) {
+      const __m256i abs =
+          _mm256_and_si256(x, _mm256_set1_epi64x(0x7fffffffffffffff));
+      x = _mm256_andnot_si256(_mm256_cmpeq_epi64(abs, _mm256_setzero_si256()),
+                              x);
+    }
+    return x;
+  }
+}
+
+#endif  // __AVX2__
+
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+
+ALWAYS_INLINE static __m512i fmix64(__m512i k) {
+  k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+  k = _mm512_mullo_epi64(k, _mm512_set1_epi64(0xff51afd7ed558ccdULL));
+  k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+  k = _mm512_mullo_epi64(k, _mm512_set1_epi64(0xc4ceb9fe1a85ec53ULL));
+  k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+  return k;
+}
+
+/// Hashes 8 keys of `len` <= 8 bytes, zero extended to 64 bit lanes.
+/// The hashes are written in key order as h1 | h2 << 64.
+ALWAYS_INLINE static void Hash8x64(__m512i k1, uint64_t len, uint64_t seed,
+                                   __uint128_t* out) {
+  k1 = _mm512_mullo_epi64(k1, _mm512_set1_epi64(c1));
+  k1 = _mm512_rol_epi64(k1, 31);
+  k1 = _mm512_mullo_epi64(k1, _mm512_set1_epi64(c2));
+
+  __m512i h2 = _mm512_set1_epi64(seed ^ len);
+  __m512i h1 = _mm512_xor_si512(h2, k1);
+
+  h1 = _mm512_add_epi64(h1, h2);
+  h2 = _mm512_add_epi64(h2, h1);
+
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+
+  h1 = _mm512_add_epi64(h1, h2);
+  h2 = _mm512_add_epi64(h2, h1);
+
+  // Lanes are in key order, interleave h1 and h2 per key.
+  const __m512i lo = _mm512_unpacklo_epi64(h1, h2);  // keys 0, 2, 4, 6
+  const __m512i hi = _mm512_unpackhi_epi64(h1, h2);  // keys 1, 3, 5, 7
+  const __m512i idx0 = _mm512_setr_epi64(0, 1, 8, 9, 2, 3, 10, 11);
+  const __m512i idx1 = _mm512_setr_epi64(4, 5, 12, 13, 6, 7, 14, 15);
+  _mm512_storeu_si512(out, _mm512_permutex2var_epi64(lo, idx0, hi));
+  _mm512_storeu_si512(out + 4, _mm512_permutex2var_epi64(lo, idx1, hi));
+}
+
+/// Hashes 8 consecutive 128 bit keys.
+ALWAYS_INLINE static void Hash8x128(const __uint128_t* keys, uint64_t seed,
+                                    __uint128_t* out) {
+  const __m512i a = _mm512_loadu_si512(keys);
+  const __m512i b = _mm512_loadu_si512(keys + 4);
+  // The lanes hold keys 0, 4, 1, 5, 2, 6, 3, 7. The interleave at the end
+  // undoes this.
+  __m512i k1 = _mm512_unpacklo_epi64(a, b);
+  __m512i k2 = _mm512_unpackhi_epi64(a, b);
+
+  const __m512i s = _mm512_set1_epi64(seed);
+
+  k1 = _mm512_mullo_epi64(k1, _mm512_set1_epi64(c1));
+  k1 = _mm512_rol_epi64(k1, 31);
+  k1 = _mm512_mullo_epi64(k1, _mm512_set1_epi64(c2));
+  __m512i h1 = _mm512_xor_si512(s, k1);
+  h1 = _mm512_rol_epi64(h1, 27);
+  h1 = _mm512_add_epi64(h1, s);
+  h1 = _mm512_add_epi64(_mm512_add_epi64(_mm512_slli_epi64(h1, 2), h1),
+                        _mm512_set1_epi64(0x52dce729));
+
+  k2 = _mm512_mullo_epi64(k2, _mm512_set1_epi64(c2));
+  k2 = _mm512_rol_epi64(k2, 33);
+  k2 = _mm512_mullo_epi64(k2, _mm512_set1_epi64(c1));
+  __m512i h2 = _mm512_xor_si512(s, k2);
+  h2 = _mm512_rol_epi64(h2, 31);
+  h2 = _mm512_add_epi64(h2, h1);
+  h2 = _mm512_add_epi64(_mm512_add_epi64(_mm512_slli_epi64(h2, 2), h2),
+                        _mm512_set1_epi64(0x38495ab5));
+
+  const __m512i len = _mm512_set1_epi64(sizeof(__uint128_t));
+  h1 = _mm512_xor_si512(h1, len);
+  h2 = _mm512_xor_si512(h2, len);
+
+  h1 = _mm512_add_epi64(h1, h2);
+  h2 = _mm512_add_epi64(h2, h1);
+
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+
+  h1 = _mm512_add_epi64(h1, h2);
+  h2 = _mm512_add_epi64(h2, h1);
+
+  _mm512_storeu_si512(out, _mm512_unpacklo_epi64(h1, h2));  // keys 0..3
+  _mm512_storeu_si512(out + 4, _mm512_unpackhi_epi64(h1, h2));  // keys 4..7
+}
+
+/// Loads 8 keys of type T, zero extended to 64 bit lanes. Floating point keys
+/// are normalized like fp_hash_bits in hash.hpp, mapping -0.0 to +0.0.
+template <typename T>
+ALWAYS_INLINE static __m512i Load8x64(const T* keys) {
+  if constexpr (sizeof(T) == 2) {
+    return _mm512_cvtepu16_epi64(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(keys)));
+  } else if constexpr (sizeof(T) == 4) {
+    __m512i x = _mm512_cvtepu32_epi64(
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(keys)));
+    if constexpr (std::is_floating_point_v<T>) {
+      x = _mm512_maskz_mov_epi64(
+          _mm512_test_epi64_mask(x, _mm512_set1_epi64(0x7fffffff)), x);
+    }
+    return x;
+  } else {
+    __m512i x = _mm512_loadu_si512(keys);
+    if constexpr (std::is_floating_point_v<T>) {
+      x = _mm512_maskz_mov_epi64(
+          _mm512_test_epi64_mask(x, _mm512_set1_epi64(0x7fffffffffffffff)), x);
+    }
+    return x;
+  }
+}
+
+#endif  // __AVX512F__ && __AVX512DQ__
+
+/// Hashes as many keys as the widest available vector unit allows, i.e. a
+/// multiple of 8 (AVX-512) or 4 (AVX2) keys.
+/// @return the number of keys hashed, the caller hashes the rest.
+template <typename T>
+OPT_INLINE size_t MurmurHash3_x64_128(const T* keys, size_t n, uint64_t seed,
+                                      __uint128_t* out) {
+  static_assert(kSupported<T>, "Unsupported key type");
+  size_t i = 0;
+  if constexpr (sizeof(T) == 16) {
+    [[maybe_unused]] const auto* k = reinterpret_cast<const __uint128_t*>(keys);
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+    for (; i + 8 <= n; i += 8) Hash8x128(k + i, seed, out + i);
+#endif
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4) Hash4x128(k + i, seed, out + i);
+#endif
+  } else {
+#if defined(__AVX512F__) && defined(__AVX512DQ__)
+    for (; i + 8 <= n; i += 8) {
+      Hash8x64(Load8x64(keys + i), sizeof(T), seed, out + i);
+    }
+#endif
+#if defined(__AVX2__)
+    for (; i + 4 <= n; i += 4) {
+      Hash4x64(Load4x64(keys + i), sizeof(T), seed, out + i);
+    }
+#endif
+  }
+  return i;
+}
+
+}  // namespace murmur3_simd
+}  // namespace detail
+
+#pragma GCC diagnostic pop
@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace detail {
+
+/// Slab allocator that packs the storage of many small objects, e.g. a fleet
+/// of sketches, into large contiguous pages.
+///
+/// Blocks are cut from the current page with a bump pointer. Freed blocks are
+/// kept on a free list per size and handed out again to the next allocation of
+/// the same size, so sketches of the same parameters that are destroyed or
+/// reset and rebuilt recycle each other's storage without calling malloc.
+/// Pages are only returned when the arena is destroyed, which must happen
+/// after all objects using it. Not thread-safe.
+class Arena {
+ public:
+  /// Alignment of every block, enough for all fundamental types.
+  static constexpr size_t kAlignment = alignof(std::max_align_t);
+
+  /// @param page_size size of the pages in bytes. Larger blocks get a page of
+  /// their own.
+  explicit Arena(size_t page_size = size_t{1} << 20)
+      : page_size_(RoundUp(page_size)) {}
+
+  Arena(const Arena&) = delete;
+  Arena& operator=(const Arena&) = delete;
+
+  /// @return a block of at least `bytes` bytes aligned to `kAlignment`.
+  /// @throws std::bad_alloc if a new page cannot be allocated.
+  void* Allocate(size_t bytes) {
+    bytes = RoundUp(bytes);
+    // creates the free list now, so that Deallocate cannot throw
+    FreeBlock*& free_list = free_lists_[bytes];
+    if (free_list != nullptr) {
+      return std::exchange(free_list, free_list->next);
+    }
+    if (bytes > page_size_) return NewPage(bytes);
+    if (static_cast<size_t>(end_ - next_) < bytes) {
+      next_ = NewPage(page_size_);
+      end_ = next_ + page_size_;
+    }
+    return std::exchange(next_, next_ + bytes);
+  }
+
+  /// Returns a block of `bytes` bytes from `Allocate` to its free list.
+  void Deallocate(void* block, size_t bytes) noexcept {
+    FreeBlock*& free_list = free_lists_.find(RoundUp(bytes))->second;
+    free_list = new (block) FreeBlock{free_list};
+  }
+
+  /// @return the number of bytes of all pages.
+  size_t Capacity() const noexcept { return capacity_; }
+
+ private:
+  struct FreeBlock {
+    FreeBlock* next;
+  };
+
+  static constexpr size_t RoundUp(size_t bytes) {
+    return (std::max(bytes, sizeof(FreeBlock)) + kAlignment - 1) &
+           ~(kAlignment - 1);
+  }
+
+  std::byte* NewPage(size_t bytes) {
+    pages_.push_back(std::make_unique<std::byte[]>(bytes));
+    capacity_ += bytes;
+    return pages_.back().get();
+  }
+
+  size_t page_size_;
+  std::vector<std::unique_ptr<std::byte[]>> pages_;
+  std::byte* next_ = nullptr;
+  std::byte* end_ = nullptr;
+  size_t capacity_ = 0;
+  std::unordered_map<size_t, FreeBlock*> free_lists_;
+};
+
+/// Standard allocator that allocates from an `Arena`, e.g. as the allocator of
+/// `final::KarninLangLiberty`. Copies allocate from the same arena.
+template <typename T>
+class ArenaAllocator {
+ public:
+  static_assert(alignof(T) <= Arena::kAlignment);
+
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  explicit ArenaAllocator(Arena& arena) noexcept : arena_(&arena) {}
+
+  template <typename U>
+  ArenaAllocator(  // NOLINT(runtime/explicit)
+      const ArenaAllocator<U>& other) noexcept
+      : arena_(other.arena_) {}
+
+  T* allocate(size_t n) {
+    return static_cast<T*>(arena_->Allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) noexcept {
+    arena_->Deallocate(p, n * sizeof(T));
+  }
+
+  template <typename U>
+  bool operator==(const ArenaAllocator<U>& other) const noexcept {
+    return arena_ == other.arena_;
+  }
+
+  template <typename U>
+  bool operator!=(const ArenaAllocator<U>& other) const noexcept {
+    return arena_ != other.arena_;
+  }
+
+ private:
+  template <typename U>
+  friend class ArenaAllocator;
+
+  Arena* arena_;
+};
+
+}  // namespace detail
@@ -1,12 +1,30 @@
 #pragma once
 
 #include <cstdint>
+#include <cstdlib>
 #include <string>
 #include <vector>
 
 #include "benchmark/benchmark.h"
 #include "data.hpp"
 
+/// Adds the arguments {distribution, parameter} of the benchmark data
+/// distributions, see `Distribution`. The file distribution is only added if
+/// its environment variable is set.
+inline void DistributionArgs(::benchmark::internal::Benchmark* benchmark) {
+  benchmark->ArgNames({"distribution", "param"});
+  benchmark->Args({static_cast<int64_t>(Distribution::kUniform), 0});
+  for (const int64_t exponent : {80, 100, 120, 150}) {
+    benchmark->Args({static_cast<int64_t>(Distribution::kZipf), exponent});
+  }
+  benchmark->Args({static_cast<int64_t>(Distribution::kHeavyTailed), 120});
+  benchmark->Args({static_cast<int64_t>(Distribution::kSorted), 0});
+  benchmark->Args({static_cast<int64_t>(Distribution::kNearlySorted), 1});
+  if (std::getenv(kDataFileVariable) != nullptr) {
+    benchmark->Args({static_cast<int64_t>(Distribution::kFile), 0});
+  }
+}
+
 inline auto AmendArgs(int argc, char* argv[]) {
   std::vector<char*> new_argv(argv, argv + argc);
   new_argv.push_back(const_cast<char*>("--benchmark_counters_tabular=true"));
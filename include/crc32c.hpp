@@ -0,0 +1,60 @@
+// CRC-32C (Castagnoli) of 64 bit words.
+//
+// Uses the crc32 instruction of SSE 4.2 or the ARMv8 CRC extension when the
+// target has one, and a byte-wise table otherwise. The variants agree bit for
+// bit. Like the instruction, the CRC is neither pre- nor post-inverted.
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#elif defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
+
+#include "compiler.hpp"
+
+namespace detail {
+namespace crc32c {
+
+/// Whether `Extend` compiles to a single instruction.
+#if defined(__SSE4_2__) || defined(__ARM_FEATURE_CRC32)
+inline constexpr bool kHardware = true;
+#else
+inline constexpr bool kHardware = false;
+#endif
+
+inline constexpr uint32_t kPolynomial = 0x82F63B78;  // reflected 0x1EDC6F41
+
+inline constexpr std::array<uint32_t, 256> kTable = [] {
+  std::array<uint32_t, 256> table{};
+  for (uint32_t i = 0; i < 256; ++i) {
+    uint32_t crc = i;
+    for (int bit = 0; bit < 8; ++bit) {
+      crc = (crc >> 1) ^ (kPolynomial & (0 - (crc & 1)));
+    }
+    table[i] = crc;
+  }
+  return table;
+}();
+
+/// @return the CRC of the 8 little-endian bytes of `word`, continuing `crc`.
+ALWAYS_INLINE static uint32_t Extend(uint32_t crc, uint64_t word) {
+#if defined(__SSE4_2__)
+  return static_cast<uint32_t>(_mm_crc32_u64(crc, word));
+#elif defined(__ARM_FEATURE_CRC32)
+  return __crc32cd(crc, word);
+#else
+  for (int i = 0; i < 8; ++i) {
+    crc = kTable[(crc ^ word) & 0xFF] ^ (crc >> 8);
+    word >>= 8;
+  }
+  return crc;
+#endif
+}
+
+}  // namespace crc32c
+}  // namespace detail
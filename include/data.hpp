@@ -1,9 +1,20 @@
 #pragma once
 
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
 #include <iomanip>
+#include <iterator>
 #include <limits>
+#include <map>
 #include <random>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "hash.hpp"
@@ -51,6 +62,9 @@ std::string to_string(const T& value) {
   return std::move(ss).str();
 }
 
+/// Number of values of the generated benchmark data.
+inline constexpr size_t kNumDataValues = 1'000'000;
+
 template <typename T>
 const std::vector<T>& GetData() {
   static std::vector<T> data;
@@ -68,9 +82,8 @@ const std::vector<T>& GetData() {
     // pcg32_fast gen(kSeed);
     distribution dist(std::numeric_limits<TT>::min(),
                       std::numeric_limits<TT>::max());
-    constexpr size_t kNumValues = 1'000'000;
-    data.reserve(kNumValues);
-    for (size_t i = 0; i < kNumValues; ++i) {
+    data.reserve(kNumDataValues);
+    for (size_t i = 0; i < kNumDataValues; ++i) {
       if constexpr (detail::is_string_v<T>) {
         data.emplace_back(to_string(dist(gen)));
       } else if constexpr (std::is_same_v<T, __int128_t> ||
@@ -97,3 +110,201 @@ const std::vector<__uint128_t>& GetHashes() {
   }
   return hashes;
 }
+
+/// Distributions of the benchmark data, passed to the benchmarks as the first
+/// argument, with the parameter of the distribution as the second argument.
+enum class Distribution : int64_t {
+  /// The values of GetData(), drawn uniformly from the domain of the type.
+  kUniform = 0,
+  /// Zipf distribution over the kNumDataValues values of GetData(), whose
+  /// exponent is the parameter divided by 100.
+  kZipf = 1,
+  /// Pareto distribution with scale 1, whose shape is the parameter divided
+  /// by 100. The values themselves are heavy-tailed, not their frequencies.
+  kHeavyTailed = 2,
+  /// The values of GetData(), sorted in increasing order.
+  kSorted = 3,
+  /// The sorted values of GetData() after swapping parameter percent of them
+  /// with random positions.
+  kNearlySorted = 4,
+  /// Values replayed from the file named by the environment variable
+  /// SKETCHES_DATA_FILE, newline delimited for strings and a binary column of
+  /// little-endian values for all other types.
+  kFile = 5,
+};
+
+/// Environment variable naming the file of Distribution::kFile.
+inline constexpr const char* kDataFileVariable = "SKETCHES_DATA_FILE";
+
+/// @return a short name of a distribution and its parameter, e.g. zipf(1.20).
+inline std::string DistributionName(Distribution distribution,
+                                    int64_t param) {
+  std::stringstream ss;
+  ss << std::fixed << std::setprecision(2);
+  switch (distribution) {
+    case Distribution::kUniform:
+      return "uniform";
+    case Distribution::kZipf:
+      ss << "zipf(" << param / 100.0 << ")";
+      return ss.str();
+    case Distribution::kHeavyTailed:
+      ss << "pareto(" << param / 100.0 << ")";
+      return ss.str();
+    case Distribution::kSorted:
+      return "sorted";
+    case Distribution::kNearlySorted:
+      return "nearly_sorted(" + std::to_string(param) + "%)";
+    case Distribution::kFile:
+      return "file";
+  }
+  return "unknown";
+}
+
+namespace detail {
+
+/// @return kNumDataValues Zipf distributed ranks in [0, n).
+inline std::vector<uint32_t> ZipfRanks(size_t n, double exponent,
+                                       std::mt19937& gen) {
+  std::vector<double> cdf(n);
+  double sum = 0;
+  for (size_t i = 0; i < n; ++i) {
+    sum += 1.0 / std::pow(static_cast<double>(i + 1), exponent);
+    cdf[i] = sum;
+  }
+  std::uniform_real_distribution<double> dist(0, sum);
+  std::vector<uint32_t> ranks(kNumDataValues);
+  for (auto& rank : ranks) {
+    const auto it = std::upper_bound(cdf.begin(), cdf.end(), dist(gen));
+    rank = static_cast<uint32_t>(
+        std::min<size_t>(std::distance(cdf.begin(), it), n - 1));
+  }
+  return ranks;
+}
+
+/// @return a value of type T for a non-negative heavy-tailed sample,
+/// converted like the uniform values of GetData().
+template <typename T>
+T FromSample(double sample) {
+  if constexpr (is_string_v<T>) {
+    return to_string(sample);
+  } else if constexpr (std::is_floating_point_v<T>) {
+    return static_cast<T>(sample);
+  } else {
+    // 128 bit samples are limited to 64 bits, like their uniform values.
+    using Limit =
+        std::conditional_t<std::is_same_v<T, __int128_t>, int64_t,
+                           std::conditional_t<std::is_same_v<T, __uint128_t>,
+                                              uint64_t, T>>;
+    constexpr Limit kMax = std::numeric_limits<Limit>::max();
+    return static_cast<T>(sample < static_cast<double>(kMax)
+                              ? static_cast<Limit>(sample)
+                              : kMax);
+  }
+}
+
+/// @return the values of the file named by kDataFileVariable.
+/// @throws std::runtime_error if the variable is not set or the file cannot
+/// be read.
+template <typename T>
+std::vector<T> ReadDataFile() {
+  const char* path = std::getenv(kDataFileVariable);
+  if (path == nullptr) {
+    throw std::runtime_error(std::string(kDataFileVariable) + " is not set");
+  }
+  std::ifstream file(path, std::ios::binary);
+  if (!file) {
+    throw std::runtime_error(std::string("cannot open ") + path);
+  }
+  std::vector<T> data;
+  if constexpr (is_string_v<T>) {
+    for (std::string line; std::getline(file, line);) {
+      data.push_back(std::move(line));
+    }
+  } else {
+    const std::string bytes((std::istreambuf_iterator<char>(file)),
+                            std::istreambuf_iterator<char>());
+    if (bytes.size() % sizeof(T) != 0) {
+      throw std::runtime_error(std::string(path) + " is not a column of " +
+                               std::to_string(sizeof(T)) + " byte values");
+    }
+    data.resize(bytes.size() / sizeof(T));
+    std::memcpy(data.data(), bytes.data(), bytes.size());
+  }
+  if (data.empty()) {
+    throw std::runtime_error(std::string(path) + " is empty");
+  }
+  return data;
+}
+
+}  // namespace detail
+
+/// @return the benchmark data drawn from the given distribution, generated on
+/// the first call and cached like GetData().
+/// @throws std::runtime_error if the data of Distribution::kFile cannot be
+/// read.
+template <typename T>
+const std::vector<T>& GetData(Distribution distribution, int64_t param) {
+  static std::map<std::pair<Distribution, int64_t>, std::vector<T>> cache;
+  auto& data = cache[{distribution, param}];
+  if (!data.empty()) return data;
+
+  const auto& uniform = GetData<T>();
+  std::mt19937 gen(42 + static_cast<int>(distribution));
+  switch (distribution) {
+    case Distribution::kUniform:
+      data = uniform;
+      break;
+    case Distribution::kZipf:
+      data.reserve(kNumDataValues);
+      for (const uint32_t rank :
+           detail::ZipfRanks(uniform.size(), param / 100.0, gen)) {
+        data.push_back(uniform[rank]);
+      }
+      break;
+    case Distribution::kHeavyTailed: {
+      const double shape = param / 100.0;
+      std::uniform_real_distribution<double> dist(0, 1);
+      data.reserve(kNumDataValues);
+      for (size_t i = 0; i < kNumDataValues; ++i) {
+        // Inverse transform sampling of the Pareto distribution.
+        data.push_back(
+            detail::FromSample<T>(std::pow(1.0 - dist(gen), -1.0 / shape)));
+      }
+      break;
+    }
+    case Distribution::kSorted:
+    case Distribution::kNearlySorted:
+      data = uniform;
+      std::sort(data.begin(), data.end());
+      if (distribution == Distribution::kNearlySorted) {
+        std::uniform_int_distribution<size_t> dist(0, data.size() - 1);
+        const size_t num_swaps = data.size() * param / 100;
+        for (size_t i = 0; i < num_swaps; ++i) {
+          std::swap(data[dist(gen)], data[dist(gen)]);
+        }
+      }
+      break;
+    case Distribution::kFile:
+      data = detail::ReadDataFile<T>();
+      break;
+  }
+  return data;
+}
+
+/// @return the hashes of GetData(distribution, param), cached like
+/// GetHashes().
+template <typename T>
+const std::vector<__uint128_t>& GetHashes(Distribution distribution,
+                                          int64_t param) {
+  static std::map<std::pair<Distribution, int64_t>, std::vector<__uint128_t>>
+      cache;
+  auto& hashes = cache[{distribution, param}];
+  if (hashes.empty()) {
+    const auto& data = GetData<T>(distribution, param);
+    hashes.reserve(data.size());
+    for (const auto& value : data) {
+      hashes.push_back(detail::Hash(value));
+    }
+  }
+  return hashes;
+}
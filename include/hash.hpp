@@ -1,11 +1,20 @@
 #pragma once
 
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <limits>
+#include <string_view>
 #include <type_traits>
 
 #include "MurmurHash3.h"
+#include "MurmurHash3_simd.hpp"
 #include "compiler.hpp"
+#include "crc32c.hpp"
+#include "span.hpp"
 #include "types.hpp"
+#include "wyhash.hpp"
+#include "xxh3.hpp"
 
 static constexpr uint64_t kSeed = 9001;
 
@@ -23,6 +32,20 @@ ALWAYS_INLINE static uint64_t fp_hash_bits(const double& f) {
   return (i & kMask) ? i : 0;
 }
 
+/// Returns a normalized representation of the given value, for the sketches
+/// that compare values by their bits or their hashes.
+///
+/// For floating point types, +0.0 == -0.0, but they have different binary
+/// representations. Hence we return +0.0 for both.
+template <typename T>
+OPT_INLINE const T& Normalized(const T& value) {
+  if constexpr (std::is_floating_point_v<T>) {
+    static constexpr T kZero = 0.0;
+    return (value == kZero) ? kZero : value;
+  }
+  return value;
+}
+
 template <typename T>
 OPT_INLINE constexpr __uint128_t Hash(const T& key, uint64_t seed) {
   if constexpr (std::is_same_v<T, int16_t>) {
@@ -47,6 +70,22 @@ OPT_INLINE constexpr __uint128_t Hash(const T& key) {
   return Hash(key, kSeed);
 }
 
+/// Hashes a batch of keys, writing `Hash(keys[i])` to `out[i]`.
+///
+/// Fixed-width keys are hashed several at a time with the vectorized
+/// MurmurHash3 kernels, all other keys one at a time.
+template <typename T>
+OPT_INLINE void HashBatch(std::span<const T> keys, __uint128_t* out) {
+  size_t i = 0;
+  if constexpr (murmur3_simd::kSupported<T>) {
+    i = murmur3_simd::MurmurHash3_x64_128(keys.data(), keys.size(), kSeed,
+                                          out);
+  }
+  for (; i < keys.size(); ++i) {
+    out[i] = Hash(keys[i]);
+  }
+}
+
 template <typename T>
 OPT_INLINE constexpr __uint128_t HashNoUnroll(const T& key) {
   if constexpr (is_string_v<T> || std::is_same_v<T, std::string_view>) {
@@ -61,4 +100,147 @@ OPT_INLINE constexpr uint64_t roll_down(const __uint128_t& hash) {
   return hash ^ (hash >> 64);
 }
 
+/// The bits a fixed-width key is hashed as, which are the same for -0.0 and
+/// 0.0.
+template <typename T>
+ALWAYS_INLINE constexpr auto HashBits(const T& key) {
+  if constexpr (std::is_same_v<T, float> || std::is_same_v<T, double>) {
+    return fp_hash_bits(key);
+  } else {
+    return key;
+  }
+}
+
+/// Hash function families of the hash policies, recorded in serialized
+/// sketches.
+enum class HashFamily : uint8_t {
+  kMurmur3 = 0,
+  kXxh3 = 1,
+  kWyhash = 2,
+  kCrc32c = 3,
+};
+
+// Hash policies select the hash function of a sketch, e.g.
+// `final::CountSketch<T, 2048, 5, int64_t, detail::Xxh3Hasher>`. A policy
+// provides
+//  * `kBits`, the number of good bits in the lower bits of its hashes,
+//  * `kFamily`, the `HashFamily` of the hash function,
+//  * `Hash(key)`, the `__uint128_t` hash of a key, and
+//  * `HashBatch(keys, out)`, which writes `Hash(keys[i])` to `out[i]`.
+// Sketches check with a static_assert that `kBits` covers the bits they
+// extract from a hash, and expose their policy as `hasher`.
+
+/// Hashes batches one key at a time, for policies without batch kernels.
+template <typename Hasher>
+struct ScalarHashBatch {
+  template <typename T>
+  OPT_INLINE static void HashBatch(std::span<const T> keys, __uint128_t* out) {
+    for (size_t i = 0; i < keys.size(); ++i) {
+      out[i] = Hasher::Hash(keys[i]);
+    }
+  }
+};
+
+/// MurmurHash3_x64_128, the default policy. The only one with 128 bits, and
+/// the only one whose batches of fixed-width keys are hashed by vectorized
+/// kernels.
+struct Murmur3Hasher {
+  static constexpr size_t kBits = 128;
+  static constexpr HashFamily kFamily = HashFamily::kMurmur3;
+
+  template <typename T>
+  OPT_INLINE static __uint128_t Hash(const T& key) {
+    return detail::Hash(key);
+  }
+
+  template <typename T>
+  OPT_INLINE static void HashBatch(std::span<const T> keys, __uint128_t* out) {
+    detail::HashBatch(keys, out);
+  }
+};
+
+/// XXH3 64 bit, see `xxh3.hpp`. Cheaper than MurmurHash3 for keys of up to 16
+/// bytes, and much cheaper for long strings.
+struct Xxh3Hasher : ScalarHashBatch<Xxh3Hasher> {
+  static constexpr size_t kBits = 64;
+  static constexpr HashFamily kFamily = HashFamily::kXxh3;
+
+  template <typename T>
+  OPT_INLINE static __uint128_t Hash(const T& key) {
+    if constexpr (is_string_v<T> || std::is_same_v<T, std::string_view>) {
+      return xxh3::Hash64(key.data(), key.size(), kSeed);
+    } else {
+      const auto bits = HashBits(key);
+      return xxh3::Hash64(&bits, sizeof(bits), kSeed);
+    }
+  }
+};
+
+/// wyhash, see `wyhash.hpp`. Two 64x64 bit multiplies for keys of up to 16
+/// bytes.
+struct WyHasher : ScalarHashBatch<WyHasher> {
+  static constexpr size_t kBits = 64;
+  static constexpr HashFamily kFamily = HashFamily::kWyhash;
+
+  template <typename T>
+  OPT_INLINE static __uint128_t Hash(const T& key) {
+    if constexpr (is_string_v<T> || std::is_same_v<T, std::string_view>) {
+      return wyhash::Hash64(key.data(), key.size(), kSeed);
+    } else {
+      const auto bits = HashBits(key);
+      return wyhash::Hash64(&bits, sizeof(bits), kSeed);
+    }
+  }
+};
+
+/// Two lanes of CRC-32C over the 64 bit words of a key, see `crc32c.hpp`,
+/// the second over the words rotated by 32 bits. The cheapest policy on
+/// targets with a crc32 instruction.
+///
+/// A CRC is linear in the key, so keys that differ in a few bits get hashes
+/// that differ in a fixed pattern. The lanes are therefore mixed by one
+/// multiply, which spreads every bit of the key over the upper bits, but the
+/// hash is still further from random than the other policies, e.g. for
+/// adversarial keys.
+struct Crc32cHasher : ScalarHashBatch<Crc32cHasher> {
+  static constexpr size_t kBits = 64;
+  static constexpr HashFamily kFamily = HashFamily::kCrc32c;
+
+  template <typename T>
+  OPT_INLINE static __uint128_t Hash(const T& key) {
+    uint32_t lo = static_cast<uint32_t>(kSeed);
+    uint32_t hi = static_cast<uint32_t>(kSeed);
+    const auto extend = [&](uint64_t word) {
+      lo = crc32c::Extend(lo, word);
+      hi = crc32c::Extend(hi, (word >> 32) | (word << 32));
+    };
+    if constexpr (is_string_v<T> || std::is_same_v<T, std::string_view>) {
+      const char* p = key.data();
+      size_t n = key.size();
+      uint64_t word;
+      for (; n >= sizeof(word); n -= sizeof(word), p += sizeof(word)) {
+        std::memcpy(&word, p, sizeof(word));
+        extend(word);
+      }
+      // the zero padded tail, with the length in the upper byte so that
+      // trailing zeros change the hash
+      word = 0;
+      std::memcpy(&word, p, n);
+      extend(word ^ (static_cast<uint64_t>(key.size()) << 56));
+    } else {
+      const auto bits = HashBits(key);
+      if constexpr (sizeof(bits) == sizeof(__uint128_t)) {
+        extend(static_cast<uint64_t>(bits));
+        extend(static_cast<uint64_t>(static_cast<__uint128_t>(bits) >> 64));
+      } else {
+        static_assert(sizeof(bits) <= sizeof(uint64_t));
+        extend(static_cast<uint64_t>(bits));
+      }
+    }
+    const uint64_t h =
+        ((static_cast<uint64_t>(hi) << 32) | lo) * 0x9E3779B97F4A7C15ULL;
+    return h ^ (h >> 32);
+  }
+};
+
 }  // namespace detail
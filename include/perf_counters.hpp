@@ -0,0 +1,157 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include "benchmark/benchmark.h"
+
+/// Environment variable that turns on the hardware counters of
+/// `PerfCounters`, e.g. SKETCHES_PERF_COUNTERS=1.
+inline constexpr const char* kPerfCountersVariable = "SKETCHES_PERF_COUNTERS";
+
+/// Hardware performance counters of the calling thread, read with
+/// perf_event_open(2) on Linux.
+///
+/// Every event is opened on its own, so that an event the CPU or the kernel
+/// does not offer (e.g. in a VM, or with /proc/sys/kernel/perf_event_paranoid
+/// above 2) drops only its counter. The kernel multiplexes events when there
+/// are more than hardware counters; the counts are scaled by the time each
+/// event was enabled. Only user space is counted.
+///
+/// Does nothing unless `kPerfCountersVariable` is set, and on other systems.
+class PerfCounters {
+ public:
+  /// The counted events, in the order of `kNames`.
+  enum Event : size_t {
+    kCycles,
+    kInstructions,
+    kL1dMisses,
+    kLlcMisses,
+    kBranchMisses,
+    kNumEvents
+  };
+
+  /// Names of the benchmark counters per item of every event.
+  static constexpr std::array<const char*, kNumEvents> kNames = {
+      "cycles_per_item", "instructions_per_item", "l1d_misses_per_item",
+      "llc_misses_per_item", "branch_misses_per_item"};
+
+  PerfCounters() {
+    fds_.fill(-1);
+    if (std::getenv(kPerfCountersVariable) == nullptr) return;
+#if defined(__linux__)
+    for (size_t i = 0; i < kNumEvents; ++i) {
+      fds_[i] = Open(static_cast<Event>(i));
+    }
+#endif
+  }
+
+  ~PerfCounters() {
+#if defined(__linux__)
+    for (const int fd : fds_) {
+      if (fd >= 0) close(fd);
+    }
+#endif
+  }
+
+  PerfCounters(const PerfCounters&) = delete;
+  PerfCounters& operator=(const PerfCounters&) = delete;
+
+  /// Reset and start all counters.
+  void Start() noexcept {
+#if defined(__linux__)
+    for (const int fd : fds_) {
+      if (fd < 0) continue;
+      ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+      ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+  }
+
+  /// Stop all counters and read their counts since `Start`.
+  void Stop() noexcept {
+#if defined(__linux__)
+    for (const int fd : fds_) {
+      if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+    for (size_t i = 0; i < kNumEvents; ++i) {
+      counts_[i] = fds_[i] < 0 ? -1.0 : Read(fds_[i]);
+    }
+#endif
+  }
+
+  /// Adds the counts of the events read by `Stop` divided by `num_items`, and
+  /// the instructions per cycle, to the counters of the benchmark.
+  void Report(::benchmark::State& state, int64_t num_items) const {
+    if (num_items <= 0) return;
+    for (size_t i = 0; i < kNumEvents; ++i) {
+      if (counts_[i] >= 0) state.counters[kNames[i]] = counts_[i] / num_items;
+    }
+    if (counts_[kCycles] > 0 && counts_[kInstructions] >= 0) {
+      state.counters["ipc"] = counts_[kInstructions] / counts_[kCycles];
+    }
+  }
+
+ private:
+#if defined(__linux__)
+  static int Open(Event event) noexcept {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format =
+        PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    constexpr uint64_t kReadMiss = PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                   PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+    switch (event) {
+      case kCycles:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+        break;
+      case kInstructions:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+        break;
+      case kL1dMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_L1D | kReadMiss;
+        break;
+      case kLlcMisses:
+        attr.type = PERF_TYPE_HW_CACHE;
+        attr.config = PERF_COUNT_HW_CACHE_LL | kReadMiss;
+        break;
+      case kBranchMisses:
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+        break;
+      default:
+        return -1;
+    }
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+
+  /// @return the count of the event, scaled up if it was multiplexed, or -1
+  /// if it could not be read or never ran.
+  static double Read(int fd) noexcept {
+    uint64_t values[3];  // value, time enabled, time running
+    if (read(fd, values, sizeof(values)) != sizeof(values) || values[2] == 0) {
+      return -1.0;
+    }
+    return static_cast<double>(values[0]) * values[1] / values[2];
+  }
+#endif
+
+  std::array<int, kNumEvents> fds_;
+  std::array<double, kNumEvents> counts_{-1.0, -1.0, -1.0, -1.0, -1.0};
+};
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+
+#include "compiler.hpp"
+#include "pcg_random.hpp"
+
+namespace detail {
+
+/// Source of random bits that draws 64 bits from the engine at once and hands
+/// them out one at a time, where `std::independent_bits_engine<E, 1, ...>`
+/// calls the engine for every bit and drops the rest of its output.
+///
+/// @tparam Engine a generator of 64 bit values, e.g. pcg64_fast.
+template <typename Engine = pcg64_fast>
+class RandomBits {
+ public:
+  using result_type = uint32_t;
+
+  /// Seeds the engine with its default seed.
+  RandomBits() = default;
+
+  explicit RandomBits(uint64_t seed) : engine_(seed) {}
+
+  static constexpr result_type min() { return 0; }
+  static constexpr result_type max() { return 1; }
+
+  /// @return the next random bit, 0 or 1.
+  OPT_INLINE result_type operator()() {
+    if (UNLIKELY(remaining_ == 0)) {
+      bits_ = static_cast<uint64_t>(engine_());
+      remaining_ = 64;
+    }
+    const auto bit = static_cast<result_type>(bits_ & 1);
+    bits_ >>= 1;
+    --remaining_;
+    return bit;
+  }
+
+ private:
+  Engine engine_;
+  /// The bits of the last draw that were not handed out yet, from the bottom.
+  uint64_t bits_ = 0;
+  uint32_t remaining_ = 0;
+};
+
+}  // namespace detail
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+
+#include "compiler.hpp"
+
+namespace detail {
+
+/// Size of a cache line, to keep the producer and consumer state of the ring
+/// buffers on separate lines.
+inline constexpr size_t kCacheLineSize = 64;
+
+/// Bounded lock-free ring buffer for many producers and a single consumer.
+///
+/// Follows Dmitry Vyukov's bounded MPMC queue: every cell carries a sequence
+/// number that tells producers whether it is free and the consumer whether it
+/// is full, so producers only contend on the fetch of the enqueue position and
+/// the consumer needs no atomic read-modify-write at all.
+///
+/// @tparam T the type of the elements, must be default constructible and
+/// move assignable.
+/// @tparam kCapacity number of cells, must be a power of 2.
+template <typename T, size_t kCapacity>
+class MpscRing {
+  static_assert((kCapacity & (kCapacity - 1)) == 0 && kCapacity >= 2,
+                "capacity must be a power of 2");
+
+ public:
+  MpscRing() : cells_(std::make_unique<Cell[]>(kCapacity)) {
+    for (size_t i = 0; i < kCapacity; ++i) {
+      cells_[i].sequence.store(i, std::memory_order_relaxed);
+    }
+  }
+
+  MpscRing(const MpscRing&) = delete;
+  MpscRing& operator=(const MpscRing&) = delete;
+
+  /// Appends an element, callable from any thread.
+  /// @return false if the ring is full, in which case value is unchanged.
+  bool TryPush(T& value) noexcept {
+    size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    Cell* cell;
+    while (true) {
+      cell = &cells_[pos & kMask];
+      const size_t sequence = cell->sequence.load(std::memory_order_acquire);
+      const auto diff = static_cast<std::ptrdiff_t>(sequence - pos);
+      if (diff == 0) {
+        if (enqueue_pos_.compare_exchange_weak(pos, pos + 1,
+                                               std::memory_order_relaxed)) {
+          break;
+        }
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = enqueue_pos_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->value = std::move(value);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+
+  /// Removes the oldest element, only callable from the consumer thread.
+  /// @return false if the ring is empty.
+  bool TryPop(T& value) noexcept {
+    Cell& cell = cells_[dequeue_pos_ & kMask];
+    if (cell.sequence.load(std::memory_order_acquire) != dequeue_pos_ + 1) {
+      return false;
+    }
+    value = std::move(cell.value);
+    cell.sequence.store(dequeue_pos_ + kCapacity, std::memory_order_release);
+    ++dequeue_pos_;
+    return true;
+  }
+
+  /// @return the number of pushes that started so far. Once the consumer
+  /// popped this many elements, all of them have been consumed.
+  size_t NumPushed() const noexcept {
+    return enqueue_pos_.load(std::memory_order_acquire);
+  }
+
+ private:
+  static constexpr size_t kMask = kCapacity - 1;
+
+  struct Cell {
+    std::atomic<size_t> sequence;
+    T value;
+  };
+
+  std::unique_ptr<Cell[]> cells_;
+  alignas(kCacheLineSize) std::atomic<size_t> enqueue_pos_{0};
+  alignas(kCacheLineSize) size_t dequeue_pos_ = 0;
+};
+
+}  // namespace detail
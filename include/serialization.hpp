@@ -0,0 +1,120 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include "compiler.hpp"
+#include "span.hpp"
+#include "types.hpp"
+
+namespace detail {
+
+// The wire formats store all integers in little-endian byte order. All
+// platforms this repo targets, x86-64 and AArch64, are little-endian, so the
+// buffers can be read and written without byte swapping.
+static_assert(__BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__,
+              "the serialization requires a little-endian platform");
+
+/// Alignment of the serialized sketches and of every section within, so that
+/// a buffer that is cache-line aligned, e.g. an mmap'ed file, can be read in
+/// place.
+inline constexpr size_t kWireAlignment = 64;
+
+/// @return n rounded up to the next multiple of the wire alignment.
+constexpr size_t WireAlign(size_t n) {
+  return (n + kWireAlignment - 1) & ~(kWireAlignment - 1);
+}
+
+/// @return the tag identifying the data type T in serialized sketches, or 0
+/// for types without a tag.
+template <typename T>
+constexpr uint8_t TypeTag() {
+  if constexpr (std::is_same_v<T, int16_t>) {
+    return 1;
+  } else if constexpr (std::is_same_v<T, int32_t>) {
+    return 2;
+  } else if constexpr (std::is_same_v<T, int64_t>) {
+    return 3;
+  } else if constexpr (std::is_same_v<T, __int128_t>) {
+    return 4;
+  } else if constexpr (std::is_same_v<T, float>) {
+    return 5;
+  } else if constexpr (std::is_same_v<T, double>) {
+    return 6;
+  } else if constexpr (is_string_v<T>) {
+    return 7;
+  } else {
+    return 0;
+  }
+}
+
+/// Reads a trivially copyable value from a possibly unaligned address.
+template <typename T>
+OPT_INLINE T LoadUnaligned(const std::byte* data) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  T value;
+  std::memcpy(&value, data, sizeof(T));
+  return value;
+}
+
+/// Writes a trivially copyable value to a possibly unaligned address.
+template <typename T>
+OPT_INLINE void StoreUnaligned(std::byte* data, const T& value) {
+  static_assert(std::is_trivially_copyable_v<T>);
+  std::memcpy(data, &value, sizeof(T));
+}
+
+/// Maps signed integers to unsigned integers so that values of small
+/// magnitude have small encodings: 0 -> 0, -1 -> 1, 1 -> 2, -2 -> 3, ...
+constexpr uint64_t ZigZagEncode(int64_t value) {
+  return (static_cast<uint64_t>(value) << 1) ^
+         static_cast<uint64_t>(value >> 63);
+}
+
+/// Inverse of ZigZagEncode.
+constexpr int64_t ZigZagDecode(uint64_t value) {
+  return static_cast<int64_t>((value >> 1) ^ (~(value & 1) + 1));
+}
+
+/// Maximum number of bytes of a LEB128 varint encoding of 64 bits.
+inline constexpr size_t kMaxVarintSize = 10;
+
+/// Writes the LEB128 varint encoding of value to out.
+/// @return the number of bytes written, at most kMaxVarintSize.
+OPT_INLINE size_t PutVarint(uint64_t value, std::byte* out) {
+  size_t i = 0;
+  while (value >= 0x80) {
+    out[i++] = static_cast<std::byte>(value | 0x80);
+    value >>= 7;
+  }
+  out[i++] = static_cast<std::byte>(value);
+  return i;
+}
+
+/// @return the number of bytes of the LEB128 varint encoding of value.
+constexpr size_t VarintSize(uint64_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    ++size;
+  }
+  return size;
+}
+
+/// Reads a LEB128 varint from [pos, end) and advances pos past it.
+/// @throws std::invalid_argument if the varint is truncated or too long.
+OPT_INLINE uint64_t GetVarint(const std::byte*& pos, const std::byte* end) {
+  uint64_t value = 0;
+  for (unsigned shift = 0; shift < 64 && pos != end; shift += 7) {
+    const auto byte = static_cast<uint8_t>(*pos++);
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) return value;
+  }
+  throw std::invalid_argument("truncated or malformed varint");
+}
+
+}  // namespace detail
@@ -1,158 +1,681 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
 #include <immintrin.h>
+#elif defined(__ARM_NEON)
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#endif
 
 #include "compiler.hpp"
 
-namespace detail {
+/// Compiles a kernel for the given instruction sets, independent of the
+/// -march flags of the translation unit.
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+
+namespace detail::simd {
+
+// Every backend implements the same set of compare kernels. A kernel compares
+// a key with 32 or 64 consecutive keys of the sketch, and returns a bitmask
+// with bit i set iff `keys[i] == key`. The kernels carry the target attribute
+// of their instruction sets, so a binary built for a baseline CPU can contain
+// all backends and select one at runtime, see `Dispatch`. `IsSupported()`
+// tells whether the host CPU can run a backend.
+
+/// Portable fallback that compares the keys one at a time.
+struct Scalar {
+  static constexpr const char* kName = "scalar";
+
+  static bool IsSupported() { return true; }
+
+  inline static uint64_t Compare64Keys16Bit(uint16_t key,
+                                            const uint16_t* keys) {
+    return CompareKeys<64>(key, keys);
+  }
+  inline static uint64_t Compare32Keys16Bit(uint16_t key,
+                                            const uint16_t* keys) {
+    return CompareKeys<32>(key, keys);
+  }
+  inline static uint64_t Compare64Keys32Bit(uint32_t key,
+                                            const uint32_t* keys) {
+    return CompareKeys<64>(key, keys);
+  }
+  inline static uint64_t Compare32Keys32Bit(uint32_t key,
+                                            const uint32_t* keys) {
+    return CompareKeys<32>(key, keys);
+  }
+  inline static uint64_t Compare32Keys64Bit(uint64_t key,
+                                            const uint64_t* keys) {
+    return CompareKeys<32>(key, keys);
+  }
+  inline static uint64_t Compare64Keys64Bit(uint64_t key,
+                                            const uint64_t* keys) {
+    return CompareKeys<64>(key, keys);
+  }
+
+ private:
+  template <size_t N, typename Key>
+  inline static uint64_t CompareKeys(Key key, const Key* keys) {
+    uint64_t m = 0;
+    for (size_t i = 0; i < N; ++i) {
+      m |= static_cast<uint64_t>(keys[i] == key) << i;
+    }
+    return m;
+  }
+};
+
+#if defined(SIMD_X86)
+
+/// SSE4.2 backend, comparing 128 bits of keys per instruction.
+struct Sse42 {
+  static constexpr const char* kName = "sse4.2";
+
+  static bool IsSupported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("sse4.2");
+  }
+
+  SIMD_TARGET("sse4.2")
+  inline static uint64_t Compare64Keys16Bit(uint16_t key,
+                                            const uint16_t* keys) {
+    const __m128i v = _mm_set1_epi16(key);
+    uint64_t m = 0;
+    for (size_t i = 0; i < 4; ++i) {
+      m |= Compare16Keys16Bit(v, keys + 16 * i) << (16 * i);
+    }
+    return m;
+  }
+
+  SIMD_TARGET("sse4.2")
+  inline static uint64_t Compare32Keys16Bit(uint16_t key,
+                                            const uint16_t* keys) {
+    const __m128i v = _mm_set1_epi16(key);
+    uint64_t m = Compare16Keys16Bit(v, keys);
+    m |= Compare16Keys16Bit(v, keys + 16) << 16;
+    return m;
+  }
+
+  SIMD_TARGET("sse4.2")
+  inline static uint64_t Compare64Keys32Bit(uint32_t key,
+                                            const uint32_t* keys) {
+    const __m128i v = _mm_set1_epi32(key);
+    uint64_t m = 0;
+    for (size_t i = 0; i < 4; ++i) {
+      m |= Compare16Keys32Bit(v, keys + 16 * i) << (16 * i);
+    }
+    return m;
+  }
+
+  SIMD_TARGET("sse4.2")
+  inline static uint64_t Compare32Keys32Bit(uint32_t key,
+                                            const uint32_t* keys) {
+    const __m128i v = _mm_set1_epi32(key);
+    uint64_t m = Compare16Keys32Bit(v, keys);
+    m |= Compare16Keys32Bit(v, keys + 16) << 16;
+    return m;
+  }
+
+  SIMD_TARGET("sse4.2")
+  inline static uint64_t Compare32Keys64Bit(uint64_t key,
+                                            const uint64_t* keys) {
+    const __m128i v = _mm_set1_epi64x(key);
+    uint64_t m = 0;
+    for (size_t i = 0; i < 16; ++i) {
+      const __m128i x = _mm_cmpeq_epi64(Load(keys + 2 * i), v);
+      m |= static_cast<uint64_t>(_mm_movemask_pd(_mm_castsi128_pd(x)))
+           << (2 * i);
+    }
+    return m;
+  }
+
+  SIMD_TARGET("sse4.2")
+  inline static uint64_t Compare64Keys64Bit(uint64_t key,
+                                            const uint64_t* keys) {
+    uint64_t m = Compare32Keys64Bit(key, keys);
+    m |= Compare32Keys64Bit(key, keys + 32) << 32;
+    return m;
+  }
+
+ private:
+  SIMD_TARGET("sse4.2")
+  inline static __m128i Load(const void* p) {
+    return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+  }
+
+  /// Compares 16 keys, narrowing the 16 bit lanes to bytes for the movemask.
+  SIMD_TARGET("sse4.2")
+  inline static uint64_t Compare16Keys16Bit(const __m128i& v,
+                                            const uint16_t* keys) {
+    const __m128i x1 = _mm_cmpeq_epi16(Load(keys), v);
+    const __m128i x2 = _mm_cmpeq_epi16(Load(keys + 8), v);
+    return _mm_movemask_epi8(_mm_packs_epi16(x1, x2));
+  }
+
+  /// Compares 16 keys, narrowing the 32 bit lanes to bytes for the movemask.
+  SIMD_TARGET("sse4.2")
+  inline static uint64_t Compare16Keys32Bit(const __m128i& v,
+                                            const uint32_t* keys) {
+    const __m128i x1 = _mm_cmpeq_epi32(Load(keys), v);
+    const __m128i x2 = _mm_cmpeq_epi32(Load(keys + 4), v);
+    const __m128i x3 = _mm_cmpeq_epi32(Load(keys + 8), v);
+    const __m128i x4 = _mm_cmpeq_epi32(Load(keys + 12), v);
+    const __m128i x12 = _mm_packs_epi32(x1, x2);
+    const __m128i x34 = _mm_packs_epi32(x3, x4);
+    return _mm_movemask_epi8(_mm_packs_epi16(x12, x34));
+  }
+};
 
 #define _mm256_loadu_si256(x) \
   _mm256_loadu_si256(reinterpret_cast<const __m256i*>(x))
 
-/// Broadcast 16-bit integer to all lanes of an AVX2 vector.
-ALWAYS_INLINE static __m256i broadcast_epi16(uint16_t x) {
-  return _mm256_broadcastw_epi16(_mm_cvtsi64_si128(x));
-}
+/// AVX2 backend, comparing 256 bits of keys per instruction.
+struct Avx2 {
+  static constexpr const char* kName = "avx2";
 
-/// Broadcast 32-bit integer to all lanes of an AVX2 vector.
-ALWAYS_INLINE static __m256i broadcast_epi32(uint32_t x) {
-  return _mm256_broadcastd_epi32(_mm_cvtsi64_si128(x));
-}
+  static bool IsSupported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx2");
+  }
 
-/// Broadcast 64-bit integer to all lanes of an AVX2 vector.
-ALWAYS_INLINE static __m256i broadcast_epi64(uint64_t x) {
-  return _mm256_broadcastq_epi64(_mm_cvtsi64_si128(x));
-}
+  /// Compares a 16 bit item with 64 keys of the sketch using AVX2 instructions.
+  /// @return a bitmask of the matching keys.
+  SIMD_TARGET("avx2")
+  inline static uint64_t Compare64Keys16Bit(uint16_t key,
+                                            const uint16_t* keys) {
+    const __m256i v = broadcast_epi16(key);
+    __m256i x1 = _mm256_loadu_si256(keys);
+    __m256i x2 = _mm256_loadu_si256(keys + 16);
+    __m256i x3 = _mm256_loadu_si256(keys + 32);
+    __m256i x4 = _mm256_loadu_si256(keys + 48);
+    x1 = _mm256_cmpeq_epi16(x1, v);
+    x2 = _mm256_cmpeq_epi16(x2, v);
+    x3 = _mm256_cmpeq_epi16(x3, v);
+    x4 = _mm256_cmpeq_epi16(x4, v);
+    __m256i x12 = _mm256_packs_epi16(x1, x2);
+    __m256i x34 = _mm256_packs_epi16(x3, x4);
+    x12 = _mm256_permute4x64_epi64(x12, _MM_SHUFFLE(3, 1, 2, 0));
+    x34 = _mm256_permute4x64_epi64(x34, _MM_SHUFFLE(3, 1, 2, 0));
+    uint64_t m = movemask_epi8(x12);
+    m |= movemask_epi8(x34) << 32;
+    return m;
+  }
 
-/// A utility function to return a mask from the msb from each 8 bit lane.
-ALWAYS_INLINE static uint64_t movemask_epi8(__m256i x) {
-  return _mm256_movemask_epi8(x);
-}
+  /// Compares a 16 bit item with 32 keys of the sketch using AVX2 instructions.
+  /// @return a bitmask of the matching keys.
+  SIMD_TARGET("avx2")
+  inline static uint64_t Compare32Keys16Bit(uint16_t key,
+                                            const uint16_t* keys) {
+    const __m256i v = broadcast_epi16(key);
+    __m256i x1 = _mm256_loadu_si256(keys);
+    __m256i x2 = _mm256_loadu_si256(keys + 16);
+    x1 = _mm256_cmpeq_epi16(x1, v);
+    x2 = _mm256_cmpeq_epi16(x2, v);
+    __m256i x12 = _mm256_packs_epi16(x1, x2);
+    x12 = _mm256_permute4x64_epi64(x12, _MM_SHUFFLE(3, 1, 2, 0));
+    uint64_t m = movemask_epi8(x12);
+    return m;
+  }
 
-/// A utility function to return a mask from the msb from each 32 bit lane.
-ALWAYS_INLINE static uint64_t movemask_epi32(__m256i x) {
-  return _mm256_movemask_ps(_mm256_castsi256_ps(x));
-}
+  /// Compares a 32 bit item with 64 keys of the sketch using AVX2 instructions.
+  /// @return a bitmask of the matching keys.
+  SIMD_TARGET("avx2")
+  inline static uint64_t Compare64Keys32Bit(uint32_t key,
+                                            const uint32_t* keys) {
+    const __m256i v = broadcast_epi32(key);
+    __m256i x1 = _mm256_loadu_si256(keys);
+    __m256i x2 = _mm256_loadu_si256(keys + 8);
+    __m256i x3 = _mm256_loadu_si256(keys + 16);
+    __m256i x4 = _mm256_loadu_si256(keys + 24);
+    __m256i x5 = _mm256_loadu_si256(keys + 32);
+    __m256i x6 = _mm256_loadu_si256(keys + 40);
+    __m256i x7 = _mm256_loadu_si256(keys + 48);
+    __m256i x8 = _mm256_loadu_si256(keys + 56);
+    x1 = _mm256_cmpeq_epi32(x1, v);
+    x2 = _mm256_cmpeq_epi32(x2, v);
+    x3 = _mm256_cmpeq_epi32(x3, v);
+    x4 = _mm256_cmpeq_epi32(x4, v);
+    x5 = _mm256_cmpeq_epi32(x5, v);
+    x6 = _mm256_cmpeq_epi32(x6, v);
+    x7 = _mm256_cmpeq_epi32(x7, v);
+    x8 = _mm256_cmpeq_epi32(x8, v);
+    uint64_t m = movemask_epi32(x1);
+    m |= movemask_epi32(x2) << 8;
+    m |= movemask_epi32(x3) << 16;
+    m |= movemask_epi32(x4) << 24;
+    m |= movemask_epi32(x5) << 32;
+    m |= movemask_epi32(x6) << 40;
+    m |= movemask_epi32(x7) << 48;
+    m |= movemask_epi32(x8) << 56;
+    return m;
+  }
 
-/// A utility function to return a mask from the msb from each 64 bit lane.
-ALWAYS_INLINE static uint64_t movemask_epi64(__m256i x) {
-  return _mm256_movemask_pd(_mm256_castsi256_pd(x));
-}
+  /// Compares a 32 bit item with 32 keys of the sketch using AVX2 instructions.
+  /// @return a bitmask of the matching keys.
+  SIMD_TARGET("avx2")
+  inline static uint64_t Compare32Keys32Bit(uint32_t key,
+                                            const uint32_t* keys) {
+    const __m256i v = broadcast_epi32(key);
+    __m256i x1 = _mm256_loadu_si256(keys);
+    __m256i x2 = _mm256_loadu_si256(keys + 8);
+    __m256i x3 = _mm256_loadu_si256(keys + 16);
+    __m256i x4 = _mm256_loadu_si256(keys + 24);
+    x1 = _mm256_cmpeq_epi32(x1, v);
+    x2 = _mm256_cmpeq_epi32(x2, v);
+    x3 = _mm256_cmpeq_epi32(x3, v);
+    x4 = _mm256_cmpeq_epi32(x4, v);
+    uint64_t m = movemask_epi32(x1);
+    m |= movemask_epi32(x2) << 8;
+    m |= movemask_epi32(x3) << 16;
+    m |= movemask_epi32(x4) << 24;
+    return m;
+  }
 
-/// Compares a 16 bit item with 64 keys of the sketch using AVX2 instructions.
-/// @return a bitmask of the matching keys.
-OPT_INLINE static uint64_t Compare64Keys16Bit(const __m256i& v,
-                                              const uint16_t* keys) {
-  __m256i x1 = _mm256_loadu_si256(keys);
-  __m256i x2 = _mm256_loadu_si256(keys + 16);
-  __m256i x3 = _mm256_loadu_si256(keys + 32);
-  __m256i x4 = _mm256_loadu_si256(keys + 48);
-  x1 = _mm256_cmpeq_epi16(x1, v);
-  x2 = _mm256_cmpeq_epi16(x2, v);
-  x3 = _mm256_cmpeq_epi16(x3, v);
-  x4 = _mm256_cmpeq_epi16(x4, v);
-  __m256i x12 = _mm256_packs_epi16(x1, x2);
-  __m256i x34 = _mm256_packs_epi16(x3, x4);
-  x12 = _mm256_permute4x64_epi64(x12, _MM_SHUFFLE(3, 1, 2, 0));
-  x34 = _mm256_permute4x64_epi64(x34, _MM_SHUFFLE(3, 1, 2, 0));
-  uint64_t m = movemask_epi8(x12);
-  m |= movemask_epi8(x34) << 32;
-  return m;
-}
+  /// Compares a 64 bit item with 32 keys of the sketch using AVX2 instructions.
+  /// @return a bitmask of the matching keys.
+  SIMD_TARGET("avx2")
+  inline static uint64_t Compare32Keys64Bit(uint64_t key,
+                                            const uint64_t* keys) {
+    const __m256i v = broadcast_epi64(key);
+    __m256i x1 = _mm256_loadu_si256(keys);
+    __m256i x2 = _mm256_loadu_si256(keys + 4);
+    __m256i x3 = _mm256_loadu_si256(keys + 8);
+    __m256i x4 = _mm256_loadu_si256(keys + 12);
+    __m256i x5 = _mm256_loadu_si256(keys + 16);
+    __m256i x6 = _mm256_loadu_si256(keys + 20);
+    __m256i x7 = _mm256_loadu_si256(keys + 24);
+    __m256i x8 = _mm256_loadu_si256(keys + 28);
+    x1 = _mm256_cmpeq_epi64(x1, v);
+    x2 = _mm256_cmpeq_epi64(x2, v);
+    x3 = _mm256_cmpeq_epi64(x3, v);
+    x4 = _mm256_cmpeq_epi64(x4, v);
+    x5 = _mm256_cmpeq_epi64(x5, v);
+    x6 = _mm256_cmpeq_epi64(x6, v);
+    x7 = _mm256_cmpeq_epi64(x7, v);
+    x8 = _mm256_cmpeq_epi64(x8, v);
+    uint64_t m = movemask_epi64(x1);
+    m |= movemask_epi64(x2) << 4;
+    m |= movemask_epi64(x3) << 8;
+    m |= movemask_epi64(x4) << 12;
+    m |= movemask_epi64(x5) << 16;
+    m |= movemask_epi64(x6) << 20;
+    m |= movemask_epi64(x7) << 24;
+    m |= movemask_epi64(x8) << 28;
+    return m;
+  }
+
+  /// Compares a 64 bit item with 64 keys of the sketch using AVX2 instructions.
+  /// @return a bitmask of the matching keys.
+  SIMD_TARGET("avx2")
+  inline static uint64_t Compare64Keys64Bit(uint64_t key,
+                                            const uint64_t* keys) {
+    uint64_t m = Compare32Keys64Bit(key, keys);
+    m |= Compare32Keys64Bit(key, keys + 32) << 32;
+    return m;
+  }
+
+ private:
+  /// Broadcast 16-bit integer to all lanes of an AVX2 vector.
+  SIMD_TARGET("avx2") inline static __m256i broadcast_epi16(uint16_t x) {
+    return _mm256_broadcastw_epi16(_mm_cvtsi64_si128(x));
+  }
+
+  /// Broadcast 32-bit integer to all lanes of an AVX2 vector.
+  SIMD_TARGET("avx2") inline static __m256i broadcast_epi32(uint32_t x) {
+    return _mm256_broadcastd_epi32(_mm_cvtsi64_si128(x));
+  }
+
+  /// Broadcast 64-bit integer to all lanes of an AVX2 vector.
+  SIMD_TARGET("avx2") inline static __m256i broadcast_epi64(uint64_t x) {
+    return _mm256_broadcastq_epi64(_mm_cvtsi64_si128(x));
+  }
+
+  /// A utility function to return a mask from the msb from each 8 bit lane.
+  SIMD_TARGET("avx2") inline static uint64_t movemask_epi8(__m256i x) {
+    return static_cast<uint32_t>(_mm256_movemask_epi8(x));
+  }
+
+  /// A utility function to return a mask from the msb from each 32 bit lane.
+  SIMD_TARGET("avx2") inline static uint64_t movemask_epi32(__m256i x) {
+    return _mm256_movemask_ps(_mm256_castsi256_ps(x));
+  }
+
+  /// A utility function to return a mask from the msb from each 64 bit lane.
+  SIMD_TARGET("avx2") inline static uint64_t movemask_epi64(__m256i x) {
+    return _mm256_movemask_pd(_mm256_castsi256_pd(x));
+  }
+};
+
+/// AVX-512 backend. The compares write straight into mask registers, which
+/// are concatenated with kunpck, so no movemask, pack or shift sequence is
+/// needed to merge the results. A 64 key scan takes 2 (16 bit), 4 (32 bit) or
+/// 8 (64 bit) loads instead of 4, 8 and 16 with AVX2.
+struct Avx512 {
+  static constexpr const char* kName = "avx512";
 
-/// Compares a 16 bit item with 32 keys of the sketch using AVX2 instructions.
-/// @return a bitmask of the matching keys.
-OPT_INLINE static uint64_t Compare32Keys16Bit(const __m256i& v,
+  static bool IsSupported() {
+    __builtin_cpu_init();
+    return __builtin_cpu_supports("avx512f") &&
+           __builtin_cpu_supports("avx512bw");
+  }
+
+  SIMD_TARGET("avx512f,avx512bw")
+  inline static uint64_t Compare64Keys16Bit(uint16_t key,
+                                            const uint16_t* keys) {
+    const __m512i v = _mm512_set1_epi16(key);
+    const __mmask32 m1 = _mm512_cmpeq_epi16_mask(Load(keys), v);
+    const __mmask32 m2 = _mm512_cmpeq_epi16_mask(Load(keys + 32), v);
+    return _mm512_kunpackd(m2, m1);
+  }
+
+  SIMD_TARGET("avx512f,avx512bw")
+  inline static uint64_t Compare32Keys16Bit(uint16_t key,
+                                            const uint16_t* keys) {
+    const __m512i v = _mm512_set1_epi16(key);
+    return _mm512_cmpeq_epi16_mask(Load(keys), v);
+  }
+
+  SIMD_TARGET("avx512f,avx512bw")
+  inline static uint64_t Compare64Keys32Bit(uint32_t key,
+                                            const uint32_t* keys) {
+    const __m512i v = _mm512_set1_epi32(key);
+    const __mmask16 m1 = _mm512_cmpeq_epi32_mask(Load(keys), v);
+    const __mmask16 m2 = _mm512_cmpeq_epi32_mask(Load(keys + 16), v);
+    const __mmask16 m3 = _mm512_cmpeq_epi32_mask(Load(keys + 32), v);
+    const __mmask16 m4 = _mm512_cmpeq_epi32_mask(Load(keys + 48), v);
+    return _mm512_kunpackd(_mm512_kunpackw(m4, m3), _mm512_kunpackw(m2, m1));
+  }
+
+  SIMD_TARGET("avx512f,avx512bw")
+  inline static uint64_t Compare32Keys32Bit(uint32_t key,
+                                            const uint32_t* keys) {
+    const __m512i v = _mm512_set1_epi32(key);
+    const __mmask16 m1 = _mm512_cmpeq_epi32_mask(Load(keys), v);
+    const __mmask16 m2 = _mm512_cmpeq_epi32_mask(Load(keys + 16), v);
+    return _mm512_kunpackw(m2, m1);
+  }
+
+  SIMD_TARGET("avx512f,avx512bw")
+  inline static uint64_t Compare32Keys64Bit(uint64_t key,
+                                            const uint64_t* keys) {
+    const __m512i v = _mm512_set1_epi64(key);
+    return Compare32Keys64Bit(v, keys);
+  }
+
+  SIMD_TARGET("avx512f,avx512bw")
+  inline static uint64_t Compare64Keys64Bit(uint64_t key,
+                                            const uint64_t* keys) {
+    const __m512i v = _mm512_set1_epi64(key);
+    const __mmask32 m1 = Compare32Keys64Bit(v, keys);
+    const __mmask32 m2 = Compare32Keys64Bit(v, keys + 32);
+    return _mm512_kunpackd(m2, m1);
+  }
+
+ private:
+  SIMD_TARGET("avx512f,avx512bw")
+  inline static __m512i Load(const void* p) { return _mm512_loadu_si512(p); }
+
+  /// Compares 32 keys, concatenating the 8 bit masks of the compares.
+  SIMD_TARGET("avx512f,avx512bw")
+  inline static __mmask32 Compare32Keys64Bit(const __m512i& v,
+                                             const uint64_t* keys) {
+    const __mmask8 m1 = _mm512_cmpeq_epi64_mask(Load(keys), v);
+    const __mmask8 m2 = _mm512_cmpeq_epi64_mask(Load(keys + 8), v);
+    const __mmask8 m3 = _mm512_cmpeq_epi64_mask(Load(keys + 16), v);
+    const __mmask8 m4 = _mm512_cmpeq_epi64_mask(Load(keys + 24), v);
+    return _mm512_kunpackw(_mm512_kunpackb(m4, m3), _mm512_kunpackb(m2, m1));
+  }
+};
+
+#endif  // SIMD_X86
+
+#if defined(SIMD_NEON)
+
+/// NEON backend for AArch64, where NEON is part of the base instruction set.
+///
+/// NEON has no movemask, so the compare results are narrowed to bytes and
+/// each byte is reduced to its bit with pairwise additions.
+struct Neon {
+  static constexpr const char* kName = "neon";
+
+  static bool IsSupported() { return true; }
+
+  inline static uint64_t Compare64Keys16Bit(uint16_t key,
+                                            const uint16_t* keys) {
+    const uint16x8_t v = vdupq_n_u16(key);
+    return Movemask(Compare16Keys16Bit(v, keys),
+                    Compare16Keys16Bit(v, keys + 16),
+                    Compare16Keys16Bit(v, keys + 32),
+                    Compare16Keys16Bit(v, keys + 48));
+  }
+
+  inline static uint64_t Compare32Keys16Bit(uint16_t key,
+                                            const uint16_t* keys) {
+    const uint16x8_t v = vdupq_n_u16(key);
+    return Movemask(Compare16Keys16Bit(v, keys),
+                    Compare16Keys16Bit(v, keys + 16));
+  }
+
+  inline static uint64_t Compare64Keys32Bit(uint32_t key,
+                                            const uint32_t* keys) {
+    const uint32x4_t v = vdupq_n_u32(key);
+    return Movemask(Compare16Keys32Bit(v, keys),
+                    Compare16Keys32Bit(v, keys + 16),
+                    Compare16Keys32Bit(v, keys + 32),
+                    Compare16Keys32Bit(v, keys + 48));
+  }
+
+  inline static uint64_t Compare32Keys32Bit(uint32_t key,
+                                            const uint32_t* keys) {
+    const uint32x4_t v = vdupq_n_u32(key);
+    return Movemask(Compare16Keys32Bit(v, keys),
+                    Compare16Keys32Bit(v, keys + 16));
+  }
+
+  inline static uint64_t Compare32Keys64Bit(uint64_t key,
+                                            const uint64_t* keys) {
+    const uint64x2_t v = vdupq_n_u64(key);
+    return Movemask(Compare16Keys64Bit(v, keys),
+                    Compare16Keys64Bit(v, keys + 16));
+  }
+
+  inline static uint64_t Compare64Keys64Bit(uint64_t key,
+                                            const uint64_t* keys) {
+    const uint64x2_t v = vdupq_n_u64(key);
+    return Movemask(Compare16Keys64Bit(v, keys),
+                    Compare16Keys64Bit(v, keys + 16),
+                    Compare16Keys64Bit(v, keys + 32),
+                    Compare16Keys64Bit(v, keys + 48));
+  }
+
+ private:
+  /// Compares 16 keys, narrowing the 16 bit results to bytes.
+  inline static uint8x16_t Compare16Keys16Bit(uint16x8_t v,
                                               const uint16_t* keys) {
-  __m256i x1 = _mm256_loadu_si256(keys);
-  __m256i x2 = _mm256_loadu_si256(keys + 16);
-  x1 = _mm256_cmpeq_epi16(x1, v);
-  x2 = _mm256_cmpeq_epi16(x2, v);
-  __m256i x12 = _mm256_packs_epi16(x1, x2);
-  x12 = _mm256_permute4x64_epi64(x12, _MM_SHUFFLE(3, 1, 2, 0));
-  uint64_t m = movemask_epi8(x12);
-  return m;
-}
+    const uint16x8_t x1 = vceqq_u16(vld1q_u16(keys), v);
+    const uint16x8_t x2 = vceqq_u16(vld1q_u16(keys + 8), v);
+    return vcombine_u8(vmovn_u16(x1), vmovn_u16(x2));
+  }
 
-/// Compares a 32 bit item with 64 keys of the sketch using AVX2 instructions.
-/// @return a bitmask of the matching keys.
-OPT_INLINE static uint64_t Compare64Keys32Bit(const __m256i& v,
+  /// Compares 16 keys, narrowing the 32 bit results to bytes.
+  inline static uint8x16_t Compare16Keys32Bit(uint32x4_t v,
                                               const uint32_t* keys) {
-  __m256i x1 = _mm256_loadu_si256(keys);
-  __m256i x2 = _mm256_loadu_si256(keys + 8);
-  __m256i x3 = _mm256_loadu_si256(keys + 16);
-  __m256i x4 = _mm256_loadu_si256(keys + 24);
-  __m256i x5 = _mm256_loadu_si256(keys + 32);
-  __m256i x6 = _mm256_loadu_si256(keys + 40);
-  __m256i x7 = _mm256_loadu_si256(keys + 48);
-  __m256i x8 = _mm256_loadu_si256(keys + 56);
-  x1 = _mm256_cmpeq_epi32(x1, v);
-  x2 = _mm256_cmpeq_epi32(x2, v);
-  x3 = _mm256_cmpeq_epi32(x3, v);
-  x4 = _mm256_cmpeq_epi32(x4, v);
-  x5 = _mm256_cmpeq_epi32(x5, v);
-  x6 = _mm256_cmpeq_epi32(x6, v);
-  x7 = _mm256_cmpeq_epi32(x7, v);
-  x8 = _mm256_cmpeq_epi32(x8, v);
-  uint64_t m = movemask_epi32(x1);
-  m |= movemask_epi32(x2) << 8;
-  m |= movemask_epi32(x3) << 16;
-  m |= movemask_epi32(x4) << 24;
-  m |= movemask_epi32(x5) << 32;
-  m |= movemask_epi32(x6) << 40;
-  m |= movemask_epi32(x7) << 48;
-  m |= movemask_epi32(x8) << 56;
-  return m;
+    const uint32x4_t x1 = vceqq_u32(vld1q_u32(keys), v);
+    const uint32x4_t x2 = vceqq_u32(vld1q_u32(keys + 4), v);
+    const uint32x4_t x3 = vceqq_u32(vld1q_u32(keys + 8), v);
+    const uint32x4_t x4 = vceqq_u32(vld1q_u32(keys + 12), v);
+    const uint16x8_t x12 = vcombine_u16(vmovn_u32(x1), vmovn_u32(x2));
+    const uint16x8_t x34 = vcombine_u16(vmovn_u32(x3), vmovn_u32(x4));
+    return vcombine_u8(vmovn_u16(x12), vmovn_u16(x34));
+  }
+
+  /// Compares 16 keys, narrowing the 64 bit results to bytes.
+  inline static uint8x16_t Compare16Keys64Bit(uint64x2_t v,
+                                              const uint64_t* keys) {
+    uint32x4_t x[4];
+    for (size_t i = 0; i < 4; ++i) {
+      const uint64x2_t lo = vceqq_u64(vld1q_u64(keys + 4 * i), v);
+      const uint64x2_t hi = vceqq_u64(vld1q_u64(keys + 4 * i + 2), v);
+      x[i] = vcombine_u32(vmovn_u64(lo), vmovn_u64(hi));
+    }
+    const uint16x8_t x01 = vcombine_u16(vmovn_u32(x[0]), vmovn_u32(x[1]));
+    const uint16x8_t x23 = vcombine_u16(vmovn_u32(x[2]), vmovn_u32(x[3]));
+    return vcombine_u8(vmovn_u16(x01), vmovn_u16(x23));
+  }
+
+  /// Returns a mask from the msb of each byte of up to 4 vectors.
+  inline static uint64_t Movemask(uint8x16_t x1, uint8x16_t x2,
+                                  uint8x16_t x3 = vdupq_n_u8(0),
+                                  uint8x16_t x4 = vdupq_n_u8(0)) {
+    static constexpr uint8_t kBits[16] = {1, 2, 4, 8, 16, 32, 64, 128,
+                                          1, 2, 4, 8, 16, 32, 64, 128};
+    const uint8x16_t bits = vld1q_u8(kBits);
+    const uint8x16_t x12 = vpaddq_u8(vandq_u8(x1, bits), vandq_u8(x2, bits));
+    const uint8x16_t x34 = vpaddq_u8(vandq_u8(x3, bits), vandq_u8(x4, bits));
+    uint8x16_t x = vpaddq_u8(x12, x34);
+    x = vpaddq_u8(x, x);
+    return vgetq_lane_u64(vreinterpretq_u64_u8(x), 0);
+  }
+};
+
+#endif  // SIMD_NEON
+
+/// Pointers to the `FindKey` instantiations of one backend.
+struct KernelTable {
+  size_t (*find16)(const uint16_t*, size_t, uint16_t);
+  size_t (*find32)(const uint32_t*, size_t, uint32_t);
+  size_t (*find64)(const uint64_t*, size_t, uint64_t);
+  const char* name;
+};
+
+/// Backend that selects the best backend supported by the host CPU at
+/// startup, and calls its find function through a function pointer.
+struct Dispatch {
+  static constexpr const char* kName = "dispatch";
+
+  static bool IsSupported() { return true; }
+
+  /// @return the kernels of the backend selected for this host.
+  static const KernelTable& Kernels();
+};
+
+/// Finds the first occurrence of a key in an array of keys.
+///
+/// The full blocks of 64 and 32 keys are scanned with the compare kernels of
+/// the given backend, any tail one key at a time.
+/// @return the index of the key, or `n` if not found.
+template <typename Backend, typename Key>
+inline size_t FindKey(const Key* keys, size_t n, Key key) {
+  static_assert(std::is_same_v<Key, uint16_t> ||
+                std::is_same_v<Key, uint32_t> ||
+                std::is_same_v<Key, uint64_t>);
+  size_t i = 0;
+  if constexpr (std::is_same_v<Backend, Dispatch>) {
+    if constexpr (sizeof(Key) == 2) {
+      return Dispatch::Kernels().find16(keys, n, key);
+    } else if constexpr (sizeof(Key) == 4) {
+      return Dispatch::Kernels().find32(keys, n, key);
+    } else {
+      return Dispatch::Kernels().find64(keys, n, key);
+    }
+  } else if constexpr (sizeof(Key) == 2) {
+    for (; i + 64 <= n; i += 64) {
+      const uint64_t mask = Backend::Compare64Keys16Bit(key, keys + i);
+      if (mask != 0) return i + __builtin_ctzll(mask);
+    }
+    for (; i + 32 <= n; i += 32) {
+      const uint64_t mask = Backend::Compare32Keys16Bit(key, keys + i);
+      if (mask != 0) return i + __builtin_ctzll(mask);
+    }
+  } else if constexpr (sizeof(Key) == 4) {
+    for (; i + 64 <= n; i += 64) {
+      const uint64_t mask = Backend::Compare64Keys32Bit(key, keys + i);
+      if (mask != 0) return i + __builtin_ctzll(mask);
+    }
+    for (; i + 32 <= n; i += 32) {
+      const uint64_t mask = Backend::Compare32Keys32Bit(key, keys + i);
+      if (mask != 0) return i + __builtin_ctzll(mask);
+    }
+  } else {
+    for (; i + 64 <= n; i += 64) {
+      const uint64_t mask = Backend::Compare64Keys64Bit(key, keys + i);
+      if (mask != 0) return i + __builtin_ctzll(mask);
+    }
+    for (; i + 32 <= n; i += 32) {
+      const uint64_t mask = Backend::Compare32Keys64Bit(key, keys + i);
+      if (mask != 0) return i + __builtin_ctzll(mask);
+    }
+  }
+  for (; i < n; ++i) {
+    if (keys[i] == key) return i;
+  }
+  return n;
 }
 
-/// Compares a 32 bit item with 32 keys of the sketch using AVX2 instructions.
-/// @return a bitmask of the matching keys.
-OPT_INLINE static uint64_t Compare32Keys32Bit(const __m256i& v,
-                                              const uint32_t* keys) {
-  __m256i x1 = _mm256_loadu_si256(keys);
-  __m256i x2 = _mm256_loadu_si256(keys + 8);
-  __m256i x3 = _mm256_loadu_si256(keys + 16);
-  __m256i x4 = _mm256_loadu_si256(keys + 24);
-  x1 = _mm256_cmpeq_epi32(x1, v);
-  x2 = _mm256_cmpeq_epi32(x2, v);
-  x3 = _mm256_cmpeq_epi32(x3, v);
-  x4 = _mm256_cmpeq_epi32(x4, v);
-  uint64_t m = movemask_epi32(x1);
-  m |= movemask_epi32(x2) << 8;
-  m |= movemask_epi32(x3) << 16;
-  m |= movemask_epi32(x4) << 24;
-  return m;
+/// Defines `k<Backend>Kernels`, the kernel table of a backend. The find
+/// functions are compiled with the backend's target attribute and flattened,
+/// so that the kernels are inlined even if the translation unit is compiled
+/// for a baseline CPU.
+#define SIMD_DEFINE_KERNEL_TABLE(Backend, target)                   \
+  template <typename Key>                                           \
+  target __attribute__((flatten)) size_t Backend##FindKey(          \
+      const Key* keys, size_t n, Key key) {                         \
+    return FindKey<Backend>(keys, n, key);                          \
+  }                                                                 \
+  inline constexpr KernelTable k##Backend##Kernels = {              \
+      &Backend##FindKey<uint16_t>, &Backend##FindKey<uint32_t>,     \
+      &Backend##FindKey<uint64_t>, Backend::kName};
+
+SIMD_DEFINE_KERNEL_TABLE(Scalar, )
+#if defined(SIMD_X86)
+SIMD_DEFINE_KERNEL_TABLE(Sse42, SIMD_TARGET("sse4.2"))
+SIMD_DEFINE_KERNEL_TABLE(Avx2, SIMD_TARGET("avx2"))
+SIMD_DEFINE_KERNEL_TABLE(Avx512, SIMD_TARGET("avx512f,avx512bw"))
+#endif
+#if defined(SIMD_NEON)
+SIMD_DEFINE_KERNEL_TABLE(Neon, )
+#endif
+
+#undef SIMD_DEFINE_KERNEL_TABLE
+
+/// @return the kernel table of the best backend the host CPU supports.
+inline const KernelTable& SelectKernels() {
+#if defined(SIMD_X86)
+  if (Avx512::IsSupported()) return kAvx512Kernels;
+  if (Avx2::IsSupported()) return kAvx2Kernels;
+  if (Sse42::IsSupported()) return kSse42Kernels;
+#elif defined(SIMD_NEON)
+  return kNeonKernels;
+#endif
+  return kScalarKernels;
 }
 
-/// Compares a 64 bit item with 32 keys of the sketch using AVX2 instructions.
-/// @return a bitmask of the matching keys.
-OPT_INLINE static uint64_t Compare32Keys64Bit(const __m256i& v,
-                                              const uint64_t* keys) {
-  __m256i x1 = _mm256_loadu_si256(keys);
-  __m256i x2 = _mm256_loadu_si256(keys + 4);
-  __m256i x3 = _mm256_loadu_si256(keys + 8);
-  __m256i x4 = _mm256_loadu_si256(keys + 12);
-  __m256i x5 = _mm256_loadu_si256(keys + 16);
-  __m256i x6 = _mm256_loadu_si256(keys + 20);
-  __m256i x7 = _mm256_loadu_si256(keys + 24);
-  __m256i x8 = _mm256_loadu_si256(keys + 28);
-  x1 = _mm256_cmpeq_epi64(x1, v);
-  x2 = _mm256_cmpeq_epi64(x2, v);
-  x3 = _mm256_cmpeq_epi64(x3, v);
-  x4 = _mm256_cmpeq_epi64(x4, v);
-  x5 = _mm256_cmpeq_epi64(x5, v);
-  x6 = _mm256_cmpeq_epi64(x6, v);
-  x7 = _mm256_cmpeq_epi64(x7, v);
-  x8 = _mm256_cmpeq_epi64(x8, v);
-  uint64_t m = movemask_epi64(x1);
-  m |= movemask_epi64(x2) << 4;
-  m |= movemask_epi64(x3) << 8;
-  m |= movemask_epi64(x4) << 12;
-  m |= movemask_epi64(x5) << 16;
-  m |= movemask_epi64(x6) << 20;
-  m |= movemask_epi64(x7) << 24;
-  m |= movemask_epi64(x8) << 28;
-  return m;
+inline const KernelTable& Dispatch::Kernels() {
+  static const KernelTable kernels = SelectKernels();
+  return kernels;
 }
 
-}  // namespace detail
+/// The backend used by the sketches.
+///
+/// Builds configured with SKETCHES_RUNTIME_DISPATCH select the backend at
+/// runtime, all other builds use the best backend enabled by the compiler
+/// flags, e.g. for -march=native.
+#if defined(SKETCHES_RUNTIME_DISPATCH)
+using DefaultBackend = Dispatch;
+#elif defined(__AVX512F__) && defined(__AVX512BW__)
+using DefaultBackend = Avx512;
+#elif defined(__AVX2__)
+using DefaultBackend = Avx2;
+#elif defined(__SSE4_2__)
+using DefaultBackend = Sse42;
+#elif defined(SIMD_NEON)
+using DefaultBackend = Neon;
+#else
+using DefaultBackend = Scalar;
+#endif
+
+}  // namespace detail::simd
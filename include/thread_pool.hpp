@@ -0,0 +1,104 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace detail {
+
+/// Fixed-size pool of threads that runs parallel loops.
+///
+/// The caller of `ParallelFor` takes part in the loop, so a pool of n threads
+/// spawns n - 1 workers, and a pool of one thread runs the loop inline. The
+/// iterations are handed out one at a time from a shared counter, so threads
+/// that finish early take over the remaining iterations of slower ones.
+class ThreadPool {
+ public:
+  /// @param num_threads number of threads running a loop, including the
+  /// caller, at least 1.
+  explicit ThreadPool(size_t num_threads) {
+    for (size_t i = 1; i < num_threads; ++i) {
+      workers_.emplace_back([this] { Work(); });
+    }
+  }
+
+  ~ThreadPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    start_.notify_all();
+    for (auto& worker : workers_) {
+      worker.join();
+    }
+  }
+
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  /// @return the number of threads running a loop, including the caller.
+  size_t NumThreads() const noexcept { return workers_.size() + 1; }
+
+  /// Calls `body(i)` for all i in [0, n) on the threads of the pool and waits
+  /// for all calls to return. The body must not throw, and must not call
+  /// `ParallelFor` on the same pool.
+  void ParallelFor(size_t n, const std::function<void(size_t)>& body) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      body_ = &body;
+      num_iterations_ = n;
+      next_iteration_.store(0, std::memory_order_relaxed);
+      num_busy_ = workers_.size();
+      ++generation_;
+    }
+    start_.notify_all();
+    RunIterations();
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_.wait(lock, [this] { return num_busy_ == 0; });
+    body_ = nullptr;
+  }
+
+ private:
+  void RunIterations() {
+    size_t i;
+    while ((i = next_iteration_.fetch_add(1, std::memory_order_relaxed)) <
+           num_iterations_) {
+      (*body_)(i);
+    }
+  }
+
+  void Work() {
+    size_t generation = 0;
+    while (true) {
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        start_.wait(lock, [&] { return stop_ || generation_ != generation; });
+        if (stop_) return;
+        generation = generation_;
+      }
+      RunIterations();
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (--num_busy_ == 0) done_.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers_;
+  /// Guards the fields below, except for the iteration counter.
+  std::mutex mutex_;
+  std::condition_variable start_;
+  std::condition_variable done_;
+  const std::function<void(size_t)>* body_ = nullptr;
+  size_t num_iterations_ = 0;
+  std::atomic<size_t> next_iteration_{0};
+  /// Number of workers that did not finish the current loop yet.
+  size_t num_busy_ = 0;
+  /// Incremented for every loop, to wake up the workers.
+  size_t generation_ = 0;
+  bool stop_ = false;
+};
+
+}  // namespace detail
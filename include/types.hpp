@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <type_traits>
 
@@ -18,4 +19,41 @@ struct is_string<std::basic_string<char, std::char_traits<char>, Alloc>>
 template <typename T>
 inline constexpr bool is_string_v = is_string<T>::value;
 
+/// Whether W is an integer type that the weighted inserts take as weight.
+///
+/// Sketches that also take pre-hashed values have an
+/// `Insert(const T&, const __uint128_t&)`, to which an integer weight converts
+/// as well as to a `uint64_t` weight. Their weighted inserts therefore take the
+/// weight as a template parameter constrained by this, which is an exact match
+/// for every integer type.
+template <typename W>
+inline constexpr bool is_weight_v = std::is_integral_v<W> &&
+                                    !std::is_same_v<W, bool> &&
+                                    sizeof(W) <= sizeof(uint64_t);
+
+/// @return an integer weight as the weight of a sketch that can only add,
+/// with negative weights clamped to 0, which these sketches ignore.
+template <typename W>
+constexpr uint64_t ClampWeight(W weight) noexcept {
+  static_assert(is_weight_v<W>);
+  if constexpr (std::is_signed_v<W>) {
+    return weight < 0 ? 0 : static_cast<uint64_t>(weight);
+  } else {
+    return weight;
+  }
+}
+
+/// @return an integer weight as the signed count of a sketch that can also
+/// subtract, with unsigned weights above INT64_MAX saturated to INT64_MAX.
+template <typename W>
+constexpr int64_t SignedWeight(W weight) noexcept {
+  static_assert(is_weight_v<W>);
+  if constexpr (std::is_unsigned_v<W> && sizeof(W) == sizeof(int64_t)) {
+    return weight > uint64_t{INT64_MAX} ? INT64_MAX
+                                        : static_cast<int64_t>(weight);
+  } else {
+    return weight;
+  }
+}
+
 }  // namespace detail
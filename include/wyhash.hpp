@@ -0,0 +1,101 @@
+// wyhash final version 4.2, modified from Wang Yi's code:
+//  * Only the hash function with the default secret, no random numbers
+//  * Only the default protection (WYHASH_CONDOM 1) on 64 bit platforms
+//  * Made entire hash function defined inline
+//  * Change casts to C++ style
+//-----------------------------------------------------------------------------
+// wyhash was written by Wang Yi and is released into the public domain under
+// The Unlicense, https://github.com/wangyi-fudan/wyhash.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "compiler.hpp"
+
+namespace detail {
+namespace wyhash {
+
+/// The default secret of wyhash.
+inline constexpr uint64_t kSecret[4] = {
+    0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL,
+    0x4d5a2da51de1aa47ULL};
+
+ALWAYS_INLINE static void Mum(uint64_t* a, uint64_t* b) {
+  const __uint128_t r = static_cast<__uint128_t>(*a) * *b;
+  *a = static_cast<uint64_t>(r);
+  *b = static_cast<uint64_t>(r >> 64);
+}
+
+ALWAYS_INLINE static uint64_t Mix(uint64_t a, uint64_t b) {
+  Mum(&a, &b);
+  return a ^ b;
+}
+
+ALWAYS_INLINE static uint64_t Read8(const uint8_t* p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+ALWAYS_INLINE static uint64_t Read4(const uint8_t* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+ALWAYS_INLINE static uint64_t Read3(const uint8_t* p, size_t k) {
+  return (static_cast<uint64_t>(p[0]) << 16) |
+         (static_cast<uint64_t>(p[k >> 1]) << 8) | p[k - 1];
+}
+
+/// wyhash of `len` bytes at `key` with the given seed. Inputs of a constant
+/// length up to 16 bytes compile to two 64x64 bit multiplies.
+ALWAYS_INLINE static uint64_t Hash64(const void* key, size_t len,
+                                     uint64_t seed) {
+  const auto* p = static_cast<const uint8_t*>(key);
+  seed ^= Mix(seed ^ kSecret[0], kSecret[1]);
+  uint64_t a;
+  uint64_t b;
+  if (LIKELY(len <= 16)) {
+    if (LIKELY(len >= 4)) {
+      a = (Read4(p) << 32) | Read4(p + ((len >> 3) << 2));
+      b = (Read4(p + len - 4) << 32) | Read4(p + len - 4 - ((len >> 3) << 2));
+    } else if (LIKELY(len > 0)) {
+      a = Read3(p, len);
+      b = 0;
+    } else {
+      a = b = 0;
+    }
+  } else {
+    size_t i = len;
+    if (UNLIKELY(i > 48)) {
+      uint64_t see1 = seed;
+      uint64_t see2 = seed;
+      do {
+        seed = Mix(Read8(p) ^ kSecret[1], Read8(p + 8) ^ seed);
+        see1 = Mix(Read8(p + 16) ^ kSecret[2], Read8(p + 24) ^ see1);
+        see2 = Mix(Read8(p + 32) ^ kSecret[3], Read8(p + 40) ^ see2);
+        p += 48;
+        i -= 48;
+      } while (LIKELY(i > 48));
+      seed ^= see1 ^ see2;
+    }
+    while (UNLIKELY(i > 16)) {
+      seed = Mix(Read8(p) ^ kSecret[1], Read8(p + 8) ^ seed);
+      i -= 16;
+      p += 16;
+    }
+    a = Read8(p + i - 16);
+    b = Read8(p + i - 8);
+  }
+  a ^= kSecret[1];
+  b ^= seed;
+  Mum(&a, &b);
+  return Mix(a ^ kSecret[0] ^ len, b ^ kSecret[1]);
+}
+
+}  // namespace wyhash
+}  // namespace detail
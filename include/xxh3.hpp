@@ -0,0 +1,257 @@
+// XXH3_64bits_withSeed of xxHash 0.8, written from the specification:
+//  * Only the 64 bit variant with a seed and the default secret
+//  * Scalar accumulation loop for long inputs, no SIMD variants
+//  * Made entire hash function defined inline
+//
+// The output is bit identical to XXH3_64bits_withSeed of the reference
+// implementation.
+//-----------------------------------------------------------------------------
+// xxHash was written by Yann Collet and is released under the BSD 2-Clause
+// license, https://github.com/Cyan4973/xxHash.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "compiler.hpp"
+
+namespace detail {
+namespace xxh3 {
+
+inline constexpr uint64_t kPrime32_1 = 0x9E3779B1U;
+inline constexpr uint64_t kPrime32_2 = 0x85EBCA77U;
+inline constexpr uint64_t kPrime32_3 = 0xC2B2AE3DU;
+inline constexpr uint64_t kPrime64_1 = 0x9E3779B185EBCA87ULL;
+inline constexpr uint64_t kPrime64_2 = 0xC2B2AE3D27D4EB4FULL;
+inline constexpr uint64_t kPrime64_3 = 0x165667B19E3779F9ULL;
+inline constexpr uint64_t kPrime64_4 = 0x85EBCA77C2B2AE63ULL;
+inline constexpr uint64_t kPrime64_5 = 0x27D4EB2F165667C5ULL;
+inline constexpr uint64_t kPrimeMx1 = 0x165667919E3779F9ULL;
+inline constexpr uint64_t kPrimeMx2 = 0x9FB21C651E98DF25ULL;
+
+inline constexpr size_t kSecretSize = 192;
+inline constexpr size_t kStripeLen = 64;
+inline constexpr size_t kSecretConsumeRate = 8;
+inline constexpr size_t kMidSizeMax = 240;
+
+/// The default secret of XXH3.
+alignas(64) inline constexpr uint8_t kSecret[kSecretSize] = {
+    0xb8, 0xfe, 0x6c, 0x39, 0x23, 0xa4, 0x4b, 0xbe, 0x7c, 0x01, 0x81, 0x2c,
+    0xf7, 0x21, 0xad, 0x1c, 0xde, 0xd4, 0x6d, 0xe9, 0x83, 0x90, 0x97, 0xdb,
+    0x72, 0x40, 0xa4, 0xa4, 0xb7, 0xb3, 0x67, 0x1f, 0xcb, 0x79, 0xe6, 0x4e,
+    0xcc, 0xc0, 0xe5, 0x78, 0x82, 0x5a, 0xd0, 0x7d, 0xcc, 0xff, 0x72, 0x21,
+    0xb8, 0x08, 0x46, 0x74, 0xf7, 0x43, 0x24, 0x8e, 0xe0, 0x35, 0x90, 0xe6,
+    0x81, 0x3a, 0x26, 0x4c, 0x3c, 0x28, 0x52, 0xbb, 0x91, 0xc3, 0x00, 0xcb,
+    0x88, 0xd0, 0x65, 0x8b, 0x1b, 0x53, 0x2e, 0xa3, 0x71, 0x64, 0x48, 0x97,
+    0xa2, 0x0d, 0xf9, 0x4e, 0x38, 0x19, 0xef, 0x46, 0xa9, 0xde, 0xac, 0xd8,
+    0xa8, 0xfa, 0x76, 0x3f, 0xe3, 0x9c, 0x34, 0x3f, 0xf9, 0xdc, 0xbb, 0xc7,
+    0xc7, 0x0b, 0x4f, 0x1d, 0x8a, 0x51, 0xe0, 0x4b, 0xcd, 0xb4, 0x59, 0x31,
+    0xc8, 0x9f, 0x7e, 0xc9, 0xd9, 0x78, 0x73, 0x64, 0xea, 0xc5, 0xac, 0x83,
+    0x34, 0xd3, 0xeb, 0xc3, 0xc5, 0x81, 0xa0, 0xff, 0xfa, 0x13, 0x63, 0xeb,
+    0x17, 0x0d, 0xdd, 0x51, 0xb7, 0xf0, 0xda, 0x49, 0xd3, 0x16, 0x55, 0x26,
+    0x29, 0xd4, 0x68, 0x9e, 0x2b, 0x16, 0xbe, 0x58, 0x7d, 0x47, 0xa1, 0xfc,
+    0x8f, 0xf8, 0xb8, 0xd1, 0x7a, 0xd0, 0x31, 0xce, 0x45, 0xcb, 0x3a, 0x8f,
+    0x95, 0x16, 0x04, 0x28, 0xaf, 0xd7, 0xfb, 0xca, 0xbb, 0x4b, 0x40, 0x7e,
+};
+
+ALWAYS_INLINE static uint64_t Read64(const void* p) {
+  uint64_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+ALWAYS_INLINE static uint32_t Read32(const void* p) {
+  uint32_t v;
+  std::memcpy(&v, p, sizeof(v));
+  return v;
+}
+
+ALWAYS_INLINE static constexpr uint64_t Rotl64(uint64_t x, int r) {
+  return (x << r) | (x >> (64 - r));
+}
+
+ALWAYS_INLINE static constexpr uint64_t Mul128Fold64(uint64_t a, uint64_t b) {
+  const __uint128_t product = static_cast<__uint128_t>(a) * b;
+  return static_cast<uint64_t>(product) ^ static_cast<uint64_t>(product >> 64);
+}
+
+ALWAYS_INLINE static constexpr uint64_t XXH64Avalanche(uint64_t h) {
+  h ^= h >> 33;
+  h *= kPrime64_2;
+  h ^= h >> 29;
+  h *= kPrime64_3;
+  h ^= h >> 32;
+  return h;
+}
+
+ALWAYS_INLINE static constexpr uint64_t Avalanche(uint64_t h) {
+  h ^= h >> 37;
+  h *= kPrimeMx1;
+  h ^= h >> 32;
+  return h;
+}
+
+ALWAYS_INLINE static constexpr uint64_t Rrmxmx(uint64_t h, uint64_t len) {
+  h ^= Rotl64(h, 49) ^ Rotl64(h, 24);
+  h *= kPrimeMx2;
+  h ^= (h >> 35) + len;
+  h *= kPrimeMx2;
+  return h ^ (h >> 28);
+}
+
+ALWAYS_INLINE static uint64_t Mix16(const uint8_t* p, const uint8_t* secret,
+                                    uint64_t seed) {
+  return Mul128Fold64(Read64(p) ^ (Read64(secret) + seed),
+                      Read64(p + 8) ^ (Read64(secret + 8) - seed));
+}
+
+ALWAYS_INLINE static uint64_t Len1To3(const uint8_t* p, size_t len,
+                                      uint64_t seed) {
+  const uint32_t combined = (static_cast<uint32_t>(p[0]) << 16) |
+                            (static_cast<uint32_t>(p[len >> 1]) << 24) |
+                            static_cast<uint32_t>(p[len - 1]) |
+                            (static_cast<uint32_t>(len) << 8);
+  const uint64_t bitflip = (Read32(kSecret) ^ Read32(kSecret + 4)) + seed;
+  return XXH64Avalanche(combined ^ bitflip);
+}
+
+ALWAYS_INLINE static uint64_t Len4To8(const uint8_t* p, size_t len,
+                                      uint64_t seed) {
+  seed ^= static_cast<uint64_t>(
+              __builtin_bswap32(static_cast<uint32_t>(seed)))
+          << 32;
+  const uint64_t bitflip = (Read64(kSecret + 8) ^ Read64(kSecret + 16)) - seed;
+  const uint64_t input =
+      Read32(p + len - 4) + (static_cast<uint64_t>(Read32(p)) << 32);
+  return Rrmxmx(input ^ bitflip, len);
+}
+
+ALWAYS_INLINE static uint64_t Len9To16(const uint8_t* p, size_t len,
+                                       uint64_t seed) {
+  const uint64_t bitflip1 =
+      (Read64(kSecret + 24) ^ Read64(kSecret + 32)) + seed;
+  const uint64_t bitflip2 =
+      (Read64(kSecret + 40) ^ Read64(kSecret + 48)) - seed;
+  const uint64_t lo = Read64(p) ^ bitflip1;
+  const uint64_t hi = Read64(p + len - 8) ^ bitflip2;
+  return Avalanche(len + __builtin_bswap64(lo) + hi + Mul128Fold64(lo, hi));
+}
+
+ALWAYS_INLINE static uint64_t Len17To128(const uint8_t* p, size_t len,
+                                         uint64_t seed) {
+  uint64_t acc = len * kPrime64_1;
+  if (len > 32) {
+    if (len > 64) {
+      if (len > 96) {
+        acc += Mix16(p + 48, kSecret + 96, seed);
+        acc += Mix16(p + len - 64, kSecret + 112, seed);
+      }
+      acc += Mix16(p + 32, kSecret + 64, seed);
+      acc += Mix16(p + len - 48, kSecret + 80, seed);
+    }
+    acc += Mix16(p + 16, kSecret + 32, seed);
+    acc += Mix16(p + len - 32, kSecret + 48, seed);
+  }
+  acc += Mix16(p, kSecret, seed);
+  acc += Mix16(p + len - 16, kSecret + 16, seed);
+  return Avalanche(acc);
+}
+
+inline uint64_t Len129To240(const uint8_t* p, size_t len, uint64_t seed) {
+  constexpr size_t kStartOffset = 3;
+  constexpr size_t kLastOffset = 17;
+  uint64_t acc = len * kPrime64_1;
+  for (size_t i = 0; i < 8; ++i) {
+    acc += Mix16(p + 16 * i, kSecret + 16 * i, seed);
+  }
+  acc = Avalanche(acc);
+  const size_t rounds = len / 16;
+  for (size_t i = 8; i < rounds; ++i) {
+    acc += Mix16(p + 16 * i, kSecret + 16 * (i - 8) + kStartOffset, seed);
+  }
+  acc += Mix16(p + len - 16, kSecret + 136 - kLastOffset, seed);
+  return Avalanche(acc);
+}
+
+ALWAYS_INLINE static void Accumulate512(uint64_t* acc, const uint8_t* p,
+                                        const uint8_t* secret) {
+  for (size_t i = 0; i < 8; ++i) {
+    const uint64_t value = Read64(p + 8 * i);
+    const uint64_t key = value ^ Read64(secret + 8 * i);
+    acc[i ^ 1] += value;
+    acc[i] += (key & 0xFFFFFFFF) * (key >> 32);
+  }
+}
+
+ALWAYS_INLINE static void ScrambleAcc(uint64_t* acc, const uint8_t* secret) {
+  for (size_t i = 0; i < 8; ++i) {
+    uint64_t a = acc[i];
+    a ^= a >> 47;
+    a ^= Read64(secret + 8 * i);
+    acc[i] = a * kPrime32_1;
+  }
+}
+
+inline uint64_t HashLong(const uint8_t* p, size_t len, uint64_t seed) {
+  // the secret of a seeded hash is the default secret shifted by the seed
+  alignas(64) uint8_t secret[kSecretSize];
+  for (size_t i = 0; i < kSecretSize; i += 16) {
+    const uint64_t lo = Read64(kSecret + i) + seed;
+    const uint64_t hi = Read64(kSecret + i + 8) - seed;
+    std::memcpy(secret + i, &lo, sizeof(lo));
+    std::memcpy(secret + i + 8, &hi, sizeof(hi));
+  }
+
+  uint64_t acc[8] = {kPrime32_3, kPrime64_1, kPrime64_2, kPrime64_3,
+                     kPrime64_4, kPrime32_2, kPrime64_5, kPrime32_1};
+  constexpr size_t kStripesPerBlock =
+      (kSecretSize - kStripeLen) / kSecretConsumeRate;
+  constexpr size_t kBlockLen = kStripeLen * kStripesPerBlock;
+  const size_t blocks = (len - 1) / kBlockLen;
+  for (size_t n = 0; n < blocks; ++n) {
+    for (size_t s = 0; s < kStripesPerBlock; ++s) {
+      Accumulate512(acc, p + n * kBlockLen + s * kStripeLen,
+                    secret + s * kSecretConsumeRate);
+    }
+    ScrambleAcc(acc, secret + kSecretSize - kStripeLen);
+  }
+  const size_t stripes = ((len - 1) - kBlockLen * blocks) / kStripeLen;
+  for (size_t s = 0; s < stripes; ++s) {
+    Accumulate512(acc, p + blocks * kBlockLen + s * kStripeLen,
+                  secret + s * kSecretConsumeRate);
+  }
+  // the last stripe always ends at the end of the input
+  constexpr size_t kLastAccStart = 7;
+  Accumulate512(acc, p + len - kStripeLen,
+                secret + kSecretSize - kStripeLen - kLastAccStart);
+
+  constexpr size_t kMergeAccsStart = 11;
+  uint64_t result = len * kPrime64_1;
+  for (size_t i = 0; i < 4; ++i) {
+    const uint8_t* s = secret + kMergeAccsStart + 16 * i;
+    result +=
+        Mul128Fold64(acc[2 * i] ^ Read64(s), acc[2 * i + 1] ^ Read64(s + 8));
+  }
+  return Avalanche(result);
+}
+
+/// XXH3 64 bit hash of `len` bytes at `key` with the given seed. Inputs of a
+/// constant length up to 16 bytes compile to a handful of instructions.
+ALWAYS_INLINE static uint64_t Hash64(const void* key, size_t len,
+                                     uint64_t seed) {
+  const auto* p = static_cast<const uint8_t*>(key);
+  if (len <= 16) {
+    if (len > 8) return Len9To16(p, len, seed);
+    if (len >= 4) return Len4To8(p, len, seed);
+    if (len > 0) return Len1To3(p, len, seed);
+    return XXH64Avalanche(seed ^ Read64(kSecret + 56) ^ Read64(kSecret + 64));
+  }
+  if (len <= 128) return Len17To128(p, len, seed);
+  if (len <= kMidSizeMax) return Len129To240(p, len, seed);
+  return HashLong(p, len, seed);
+}
+
+}  // namespace xxh3
+}  // namespace detail
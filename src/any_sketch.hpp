@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "cs/cs_final.hpp"
+#include "hash.hpp"
+#include "kll/kll_final.hpp"
+#include "sketch_traits.hpp"
+#include "span.hpp"
+#include "ss/ss_final.hpp"
+
+namespace final {
+
+/// A sketch of any type that summarizes values of type T, picked at runtime,
+/// e.g. from a config by `SketchRegistry`.
+///
+/// The sketch lives on the heap behind one virtual call per operation, so a
+/// batch of values costs one dispatch, after which the batch is inserted by
+/// the code of the concrete sketch: its `InsertBatch` if it has one, its
+/// pre-hashed `Insert` on blocks hashed by the vectorized kernels, or its
+/// `Insert` inlined into the loop over the batch. Inserting value by value
+/// costs a virtual call per value instead, so feed batches where possible.
+///
+/// Queries that the concrete sketch does not support throw, see the traits in
+/// `sketch_traits.hpp`; `Get` returns the concrete sketch for everything else.
+///
+/// @tparam T the data type the sketch summarizes.
+template <typename T>
+class AnySketch {
+ public:
+  /// Constructs a `Sketch` from `args`.
+  template <typename Sketch, typename... Args>
+  explicit AnySketch(std::in_place_type_t<Sketch>, Args&&... args)
+      : sketch_(std::make_unique<Model<Sketch>>(std::forward<Args>(args)...)) {}
+
+  /// Insert a value, with a virtual call.
+  void Insert(const T& value) { sketch_->Insert(value); }
+
+  /// Insert a batch of values, with one virtual call for the whole batch.
+  void InsertBatch(std::span<const T> values) { sketch_->InsertBatch(values); }
+
+  /// Merges another sketch of the same concrete type into this one.
+  /// @throws std::invalid_argument if the types differ or the sketch is not
+  /// mergeable.
+  void Merge(const AnySketch& other) { sketch_->Merge(*other.sketch_); }
+
+  /// @return the estimated frequency of a value.
+  /// @throws std::invalid_argument if the sketch does not estimate
+  /// frequencies.
+  double Estimate(const T& value) const { return sketch_->Estimate(value); }
+
+  /// @return the value at the given normalized rank.
+  /// @throws std::invalid_argument if the sketch has no quantiles.
+  T GetQuantile(double rank) const { return sketch_->GetQuantile(rank); }
+
+  /// @return the normalized rank of a value.
+  /// @throws std::invalid_argument if the sketch has no quantiles.
+  double GetRank(const T& value) const { return sketch_->GetRank(value); }
+
+  /// @return the concrete sketch, or nullptr if it is not a `Sketch`.
+  template <typename Sketch>
+  Sketch* Get() noexcept {
+    auto* model = dynamic_cast<Model<Sketch>*>(sketch_.get());
+    return model != nullptr ? &model->sketch : nullptr;
+  }
+
+  /// @return the concrete sketch, or nullptr if it is not a `Sketch`.
+  template <typename Sketch>
+  const Sketch* Get() const noexcept {
+    const auto* model = dynamic_cast<const Model<Sketch>*>(sketch_.get());
+    return model != nullptr ? &model->sketch : nullptr;
+  }
+
+ private:
+  struct Concept {
+    virtual ~Concept() = default;
+    virtual void Insert(const T& value) = 0;
+    virtual void InsertBatch(std::span<const T> values) = 0;
+    virtual void Merge(const Concept& other) = 0;
+    virtual double Estimate(const T& value) const = 0;
+    virtual T GetQuantile(double rank) const = 0;
+    virtual double GetRank(const T& value) const = 0;
+  };
+
+  template <typename Sketch>
+  struct Model final : Concept {
+    template <typename... Args>
+    explicit Model(Args&&... args) : sketch(std::forward<Args>(args)...) {}
+
+    void Insert(const T& value) override { sketch.Insert(value); }
+
+    void InsertBatch(std::span<const T> values) override {
+      if constexpr (detail::supports_batch_v<Sketch, T>) {
+        sketch.InsertBatch(values);
+      } else if constexpr (detail::accepts_hash_v<Sketch, T>) {
+        std::array<__uint128_t, kHashBlockSize> hashes;
+        for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+          const size_t n = std::min(kHashBlockSize, values.size() - i);
+          detail::HashBatch(values.subspan(i, n), hashes.data());
+          for (size_t k = 0; k < n; ++k) {
+            sketch.Insert(values[i + k], hashes[k]);
+          }
+        }
+      } else {
+        for (const auto& value : values) sketch.Insert(value);
+      }
+    }
+
+    void Merge(const Concept& other) override {
+      if constexpr (detail::is_mergeable_v<Sketch>) {
+        const auto* model = dynamic_cast<const Model*>(&other);
+        if (model == nullptr) {
+          throw std::invalid_argument(
+              "cannot merge sketches of different types");
+        }
+        sketch.Merge(model->sketch);
+      } else {
+        throw std::invalid_argument("sketch is not mergeable");
+      }
+    }
+
+    double Estimate(const T& value) const override {
+      if constexpr (detail::supports_estimate_v<Sketch, T>) {
+        return static_cast<double>(sketch.Estimate(value));
+      } else {
+        throw std::invalid_argument("sketch does not estimate frequencies");
+      }
+    }
+
+    T GetQuantile(double rank) const override {
+      if constexpr (detail::supports_quantiles_v<Sketch, T>) {
+        return sketch.GetQuantile(rank);
+      } else {
+        throw std::invalid_argument("sketch has no quantiles");
+      }
+    }
+
+    double GetRank(const T& value) const override {
+      if constexpr (detail::supports_quantiles_v<Sketch, T>) {
+        return sketch.GetRank(value);
+      } else {
+        throw std::invalid_argument("sketch has no quantiles");
+      }
+    }
+
+    Sketch sketch;
+  };
+
+  /// Number of values hashed at once by the batch insert.
+  static constexpr size_t kHashBlockSize = 64;
+
+  std::unique_ptr<Concept> sketch_;
+};
+
+/// The sketch a `SketchRegistry` constructs, e.g. parsed from a config.
+struct SketchConfig {
+  /// Name the sketch type is registered under, e.g. "kll".
+  std::string name;
+  /// Parameter k of the sketches constructed from it, e.g. the KLL sketches.
+  /// The shape of the other sketches is part of their type.
+  uint16_t k = kll_constants::DEFAULT_K;
+  /// Seed of the sketches constructed from k and a seed, their default seed
+  /// if unset.
+  std::optional<uint64_t> seed;
+};
+
+/// Sketch types by name, to construct the sketch a config asks for.
+///
+/// Template parameters such as the width of a Count Sketch cannot be picked
+/// at runtime, so every shape a service may use is registered as a type of
+/// its own, e.g. `Register<CountSketch<T, 4096, 5>>("cs_4096x5")`.
+///
+/// @tparam T the data type the sketches summarize.
+template <typename T>
+class SketchRegistry {
+ public:
+  using Factory = std::function<AnySketch<T>(const SketchConfig&)>;
+
+  /// @return a registry of the final sketches in their default shapes as "cs",
+  /// "ss" and "kll".
+  static SketchRegistry Default() {
+    SketchRegistry registry;
+    registry.Register<CountSketch<T>>("cs");
+    registry.Register<SpaceSaving<T>>("ss");
+    registry.Register<KarninLangLiberty<T>>("kll");
+    return registry;
+  }
+
+  /// Registers a `Sketch` under `name`, replacing the previous sketch of that
+  /// name. It is constructed from k and the seed of the config if it has such
+  /// a constructor, from k if it has one and default constructed otherwise.
+  template <typename Sketch>
+  void Register(const std::string& name) {
+    Register(name, [](const SketchConfig& config) {
+      constexpr auto kInPlace = std::in_place_type<Sketch>;
+      if constexpr (std::is_constructible_v<Sketch, uint16_t, uint64_t>) {
+        if (config.seed.has_value()) {
+          return AnySketch<T>(kInPlace, config.k, *config.seed);
+        }
+      }
+      if constexpr (std::is_constructible_v<Sketch, uint16_t>) {
+        return AnySketch<T>(kInPlace, config.k);
+      } else {
+        return AnySketch<T>(kInPlace);
+      }
+    });
+  }
+
+  /// Registers a factory under `name`, replacing the previous sketch of that
+  /// name.
+  void Register(const std::string& name, Factory factory) {
+    factories_[name] = std::move(factory);
+  }
+
+  /// @return a new sketch of the type registered under `config.name`.
+  /// @throws std::invalid_argument if no sketch is registered under the name,
+  /// or the sketch rejects the parameters of the config.
+  AnySketch<T> Make(const SketchConfig& config) const {
+    const auto it = factories_.find(config.name);
+    if (it == factories_.end()) {
+      throw std::invalid_argument("unknown sketch: " + config.name);
+    }
+    return it->second(config);
+  }
+
+ private:
+  std::map<std::string, Factory> factories_;
+};
+
+}  // namespace final
@@ -0,0 +1,465 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+
+#include "compiler.hpp"
+#include "hash.hpp"
+#include "sketch_traits.hpp"
+#include "span.hpp"
+#include "types.hpp"
+
+// The structs of the Arrow C data interface, which
+// https://arrow.apache.org/docs/format/CDataInterface.html asks consumers to
+// copy, so that arrays can be exchanged without depending on libarrow. The
+// guard is the one of arrow/c/abi.h, whose definitions are the same.
+#ifndef ARROW_C_DATA_INTERFACE
+#define ARROW_C_DATA_INTERFACE
+
+#define ARROW_FLAG_DICTIONARY_ORDERED 1
+#define ARROW_FLAG_NULLABLE 2
+#define ARROW_FLAG_MAP_KEYS_SORTED 4
+
+extern "C" {
+
+struct ArrowSchema {
+  const char* format;
+  const char* name;
+  const char* metadata;
+  int64_t flags;
+  int64_t n_children;
+  struct ArrowSchema** children;
+  struct ArrowSchema* dictionary;
+  void (*release)(struct ArrowSchema*);
+  void* private_data;
+};
+
+struct ArrowArray {
+  int64_t length;
+  int64_t null_count;
+  int64_t offset;
+  int64_t n_buffers;
+  int64_t n_children;
+  const void** buffers;
+  struct ArrowArray** children;
+  struct ArrowArray* dictionary;
+  void (*release)(struct ArrowArray*);
+  void* private_data;
+};
+
+}  // extern "C"
+
+#endif  // ARROW_C_DATA_INTERFACE
+
+namespace columnar {
+
+/// The values of the dictionary of a dictionary-encoded Arrow array, decoded
+/// and hashed by `detail::Hash` once, so that every row only looks up its
+/// entry. Arrow streams usually keep the dictionary of a column across record
+/// batches, in which case one `ArrowDictionary` serves all of them.
+///
+/// @tparam T the type of the entries, a fixed-width arithmetic type or
+///   std::string.
+template <typename T>
+class ArrowDictionary {
+ public:
+  /// Decodes the dictionary of a dictionary-encoded array.
+  /// @throws std::invalid_argument if the dictionary is not an array of T or
+  /// has nulls.
+  ArrowDictionary(const ArrowSchema& schema, const ArrowArray& array);
+
+  size_t size() const noexcept { return values_.size(); }
+  const T& value(size_t i) const noexcept { return values_[i]; }
+  const __uint128_t& hash(size_t i) const noexcept { return hashes_[i]; }
+
+ private:
+  std::vector<T> values_;
+  std::vector<__uint128_t> hashes_;
+};
+
+/// Inserts the valid values of an Arrow array of T into a sketch, skipping
+/// the nulls.
+///
+/// Fixed-width values are inserted in place from the values buffer, one batch
+/// insert per run of valid values, so a column without nulls is a single
+/// `InsertBatch`. Runs are found 64 rows at a time from the words of the
+/// validity bitmap: words of all valid or all null rows extend or skip a run
+/// as a whole, and only the words that mix both look for the edges of the
+/// runs, with a count of trailing zeros per edge.
+///
+/// Strings are read as views into the data buffer. Sketches that take batches
+/// of hashes, e.g. a `final::CountSketch`, get the hashes of the views in
+/// blocks; all others get every value as a string.
+///
+/// Dictionary-encoded arrays are decoded by an `ArrowDictionary`, and every
+/// row inserts the value and hash of its entry through the pre-hashed insert
+/// of the sketch if it has one. Pass the dictionary to reuse it across
+/// batches.
+///
+/// @tparam T the data type the sketch summarizes, int8_t to int64_t, the
+///   unsigned integer types, float, double or std::string.
+/// @throws std::invalid_argument if the array is released, its type is not T
+/// or a dictionary of T, or a row refers to an entry past the dictionary.
+template <typename T, typename Sketch>
+void InsertArrow(Sketch& sketch, const ArrowSchema& schema,
+                 const ArrowArray& array);
+
+/// Inserts the valid rows of a dictionary-encoded Arrow array, whose
+/// dictionary was decoded into `dictionary` before, see above.
+template <typename T, typename Sketch>
+void InsertArrow(Sketch& sketch, const ArrowSchema& schema,
+                 const ArrowArray& array,
+                 const ArrowDictionary<T>& dictionary);
+
+namespace detail {
+
+using ::detail::accepts_hash_batch_v;
+using ::detail::accepts_hash_v;
+using ::detail::supports_batch_v;
+
+/// Number of strings hashed at once for sketches that take batches of hashes.
+inline constexpr size_t kHashBlockSize = 64;
+
+/// @return the Arrow format string of T, or nullptr if T is not a primitive
+/// Arrow type.
+template <typename T>
+constexpr const char* PrimitiveFormat() {
+  if constexpr (std::is_same_v<T, int8_t>) return "c";
+  if constexpr (std::is_same_v<T, uint8_t>) return "C";
+  if constexpr (std::is_same_v<T, int16_t>) return "s";
+  if constexpr (std::is_same_v<T, uint16_t>) return "S";
+  if constexpr (std::is_same_v<T, int32_t>) return "i";
+  if constexpr (std::is_same_v<T, uint32_t>) return "I";
+  if constexpr (std::is_same_v<T, int64_t>) return "l";
+  if constexpr (std::is_same_v<T, uint64_t>) return "L";
+  if constexpr (std::is_same_v<T, float>) return "f";
+  if constexpr (std::is_same_v<T, double>) return "g";
+  return nullptr;
+}
+
+inline bool IsFormat(const ArrowSchema& schema, const char* format) {
+  return schema.format != nullptr && std::strcmp(schema.format, format) == 0;
+}
+
+/// @return whether the schema is of utf8 or binary values with 32 bit
+/// offsets, and sets `large` for 64 bit offsets.
+inline bool IsStringFormat(const ArrowSchema& schema, bool& large) {
+  large = IsFormat(schema, "U") || IsFormat(schema, "Z");
+  return large || IsFormat(schema, "u") || IsFormat(schema, "z");
+}
+
+inline void CheckArray(const ArrowArray& array, int64_t num_buffers) {
+  if (array.release == nullptr) {
+    throw std::invalid_argument("the Arrow array is released");
+  }
+  if (array.length < 0 || array.offset < 0 || array.n_buffers != num_buffers) {
+    throw std::invalid_argument(
+        "malformed Arrow array: length " + std::to_string(array.length) +
+        ", offset " + std::to_string(array.offset) + ", " +
+        std::to_string(array.n_buffers) + " buffers");
+  }
+}
+
+[[noreturn]] inline void ThrowFormat(const ArrowSchema& schema,
+                                     const char* expected) {
+  throw std::invalid_argument(
+      std::string("Arrow format ") +
+      (schema.format != nullptr ? schema.format : "(null)") +
+      " does not match the sketch, expected " + expected);
+}
+
+/// @return the validity bitmap of the array, or nullptr if all rows are
+/// valid.
+inline const uint8_t* ValidityOf(const ArrowArray& array) {
+  if (array.null_count == 0) return nullptr;
+  return static_cast<const uint8_t*>(array.buffers[0]);
+}
+
+/// @return the n <= 64 bits of the bitmap from bit `begin` on, in the low n
+/// bits of the result.
+OPT_INLINE uint64_t LoadBits(const uint8_t* bitmap, int64_t begin, int n) {
+  const uint8_t* bytes = bitmap + begin / 8;
+  const int shift = static_cast<int>(begin % 8);
+  // The bits span up to 9 bytes, and the bitmap may end after the last one.
+  const int num_bytes = (shift + n + 7) / 8;
+  uint64_t word = 0;
+  if (num_bytes >= 8) {
+    std::memcpy(&word, bytes, sizeof(word));
+    word >>= shift;
+    if (num_bytes > 8) word |= static_cast<uint64_t>(bytes[8]) << (64 - shift);
+  } else {
+    for (int i = 0; i < num_bytes; ++i) {
+      word |= static_cast<uint64_t>(bytes[i]) << (8 * i);
+    }
+    word >>= shift;
+  }
+  return n == 64 ? word : word & ((uint64_t{1} << n) - 1);
+}
+
+/// Calls `f(begin, end)` for every maximal run [begin, end) of valid rows in
+/// [0, length) of a bitmap whose row 0 is bit `offset`, in increasing order.
+template <typename F>
+void ForEachValidRun(const uint8_t* validity, int64_t offset, int64_t length,
+                     F&& f) {
+  if (validity == nullptr) {
+    if (length > 0) f(int64_t{0}, length);
+    return;
+  }
+  int64_t run_begin = -1;
+  for (int64_t i = 0; i < length; i += 64) {
+    const int n = static_cast<int>(std::min<int64_t>(64, length - i));
+    const uint64_t word = LoadBits(validity, offset + i, n);
+    const uint64_t all = n == 64 ? ~uint64_t{0} : (uint64_t{1} << n) - 1;
+    if (word == all) {
+      if (run_begin < 0) run_begin = i;
+      continue;
+    }
+    if (word == 0) {
+      if (run_begin >= 0) f(run_begin, i);
+      run_begin = -1;
+      continue;
+    }
+    int bit = 0;
+    while (bit < n) {
+      if (run_begin >= 0) {
+        // the run ends at the next null row, if there is one in the word
+        const uint64_t nulls = ~word >> bit;
+        if (nulls == 0) break;
+        bit += __builtin_ctzll(nulls);
+        if (bit >= n) break;
+        f(run_begin, i + bit);
+        run_begin = -1;
+      } else {
+        const uint64_t valid = word >> bit;
+        if (valid == 0) break;
+        bit += __builtin_ctzll(valid);
+        run_begin = i + bit;
+      }
+    }
+  }
+  if (run_begin >= 0) f(run_begin, length);
+}
+
+/// Inserts a run of fixed-width values through the batch insert of the
+/// sketch if it has one.
+template <typename T, typename Sketch>
+OPT_INLINE void InsertRun(Sketch& sketch, std::span<const T> values) {
+  if constexpr (supports_batch_v<Sketch, T>) {
+    sketch.InsertBatch(values);
+  } else {
+    for (const auto& value : values) sketch.Insert(value);
+  }
+}
+
+template <typename T, typename Sketch>
+void InsertPrimitive(Sketch& sketch, const ArrowArray& array) {
+  CheckArray(array, 2);
+  const T* values = static_cast<const T*>(array.buffers[1]) + array.offset;
+  ForEachValidRun(ValidityOf(array), array.offset, array.length,
+                  [&](int64_t begin, int64_t end) {
+                    InsertRun<T>(sketch, std::span<const T>(values + begin,
+                                                            end - begin));
+                  });
+}
+
+template <typename Offset, typename Sketch>
+void InsertStrings(Sketch& sketch, const ArrowArray& array) {
+  using T = std::string;
+  CheckArray(array, 3);
+  const Offset* offsets =
+      static_cast<const Offset*>(array.buffers[1]) + array.offset;
+  const char* data = static_cast<const char*>(array.buffers[2]);
+  const auto view = [&](int64_t i) {
+    return std::string_view(data + offsets[i],
+                            static_cast<size_t>(offsets[i + 1] - offsets[i]));
+  };
+  if constexpr (accepts_hash_batch_v<Sketch, T>) {
+    std::array<std::string_view, kHashBlockSize> views;
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    size_t n = 0;
+    const auto flush = [&] {
+      ::detail::HashBatch(std::span<const std::string_view>(views.data(), n),
+                          hashes.data());
+      sketch.InsertBatch(std::span<const __uint128_t>(hashes.data(), n));
+      n = 0;
+    };
+    ForEachValidRun(ValidityOf(array), array.offset, array.length,
+                    [&](int64_t begin, int64_t end) {
+                      for (int64_t i = begin; i < end; ++i) {
+                        views[n++] = view(i);
+                        if (n == kHashBlockSize) flush();
+                      }
+                    });
+    if (n > 0) flush();
+  } else {
+    // reused, so that short strings and the strings of a column of similar
+    // lengths do not allocate
+    std::string value;
+    ForEachValidRun(ValidityOf(array), array.offset, array.length,
+                    [&](int64_t begin, int64_t end) {
+                      for (int64_t i = begin; i < end; ++i) {
+                        value.assign(view(i));
+                        sketch.Insert(value);
+                      }
+                    });
+  }
+}
+
+template <typename T, typename Index, typename Sketch>
+void InsertDictionary(Sketch& sketch, const ArrowArray& array,
+                      const ArrowDictionary<T>& dictionary) {
+  CheckArray(array, 2);
+  const Index* indices =
+      static_cast<const Index*>(array.buffers[1]) + array.offset;
+  const auto entry = [&](int64_t i) {
+    const auto index = static_cast<uint64_t>(indices[i]);
+    if (UNLIKELY(index >= dictionary.size())) {
+      throw std::invalid_argument(
+          "dictionary index " + std::to_string(indices[i]) + " of row " +
+          std::to_string(i) + " is past the dictionary of " +
+          std::to_string(dictionary.size()) + " entries");
+    }
+    return static_cast<size_t>(index);
+  };
+  if constexpr (accepts_hash_batch_v<Sketch, T>) {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    size_t n = 0;
+    ForEachValidRun(ValidityOf(array), array.offset, array.length,
+                    [&](int64_t begin, int64_t end) {
+                      for (int64_t i = begin; i < end; ++i) {
+                        hashes[n++] = dictionary.hash(entry(i));
+                        if (n < kHashBlockSize) continue;
+                        sketch.InsertBatch(
+                            std::span<const __uint128_t>(hashes.data(), n));
+                        n = 0;
+                      }
+                    });
+    if (n > 0) {
+      sketch.InsertBatch(std::span<const __uint128_t>(hashes.data(), n));
+    }
+  } else {
+    ForEachValidRun(ValidityOf(array), array.offset, array.length,
+                    [&](int64_t begin, int64_t end) {
+                      for (int64_t i = begin; i < end; ++i) {
+                        const size_t j = entry(i);
+                        if constexpr (accepts_hash_v<Sketch, T>) {
+                          sketch.Insert(dictionary.value(j),
+                                        dictionary.hash(j));
+                        } else {
+                          sketch.Insert(dictionary.value(j));
+                        }
+                      }
+                    });
+  }
+}
+
+/// Calls `f(Index{})` with the index type of a dictionary-encoded array.
+template <typename F>
+void WithIndexType(const ArrowSchema& schema, F&& f) {
+  if (IsFormat(schema, "c")) return f(int8_t{});
+  if (IsFormat(schema, "C")) return f(uint8_t{});
+  if (IsFormat(schema, "s")) return f(int16_t{});
+  if (IsFormat(schema, "S")) return f(uint16_t{});
+  if (IsFormat(schema, "i")) return f(int32_t{});
+  if (IsFormat(schema, "I")) return f(uint32_t{});
+  if (IsFormat(schema, "l")) return f(int64_t{});
+  if (IsFormat(schema, "L")) return f(uint64_t{});
+  ThrowFormat(schema, "an integer dictionary index");
+}
+
+}  // namespace detail
+
+template <typename T>
+ArrowDictionary<T>::ArrowDictionary(const ArrowSchema& schema,
+                                    const ArrowArray& array) {
+  const bool has_nulls =
+      array.null_count != 0 && array.n_buffers > 0 && array.buffers[0];
+  if constexpr (::detail::is_string_v<T>) {
+    bool large;
+    if (!detail::IsStringFormat(schema, large)) {
+      detail::ThrowFormat(schema, "u, U, z or Z");
+    }
+    detail::CheckArray(array, 3);
+    if (has_nulls) {
+      throw std::invalid_argument("dictionaries with nulls are not supported");
+    }
+    values_.reserve(array.length);
+    const char* data = static_cast<const char*>(array.buffers[2]);
+    for (int64_t i = 0; i < array.length; ++i) {
+      const int64_t row = array.offset + i;
+      int64_t begin, end;
+      if (large) {
+        const auto* offsets = static_cast<const int64_t*>(array.buffers[1]);
+        begin = offsets[row];
+        end = offsets[row + 1];
+      } else {
+        const auto* offsets = static_cast<const int32_t*>(array.buffers[1]);
+        begin = offsets[row];
+        end = offsets[row + 1];
+      }
+      values_.emplace_back(data + begin, static_cast<size_t>(end - begin));
+    }
+  } else {
+    static_assert(detail::PrimitiveFormat<T>() != nullptr,
+                  "T is not a primitive Arrow type");
+    if (!detail::IsFormat(schema, detail::PrimitiveFormat<T>())) {
+      detail::ThrowFormat(schema, detail::PrimitiveFormat<T>());
+    }
+    detail::CheckArray(array, 2);
+    if (has_nulls) {
+      throw std::invalid_argument("dictionaries with nulls are not supported");
+    }
+    const T* values = static_cast<const T*>(array.buffers[1]) + array.offset;
+    values_.assign(values, values + array.length);
+  }
+  hashes_.resize(values_.size());
+  ::detail::HashBatch(std::span<const T>(values_), hashes_.data());
+}
+
+template <typename T, typename Sketch>
+void InsertArrow(Sketch& sketch, const ArrowSchema& schema,
+                 const ArrowArray& array) {
+  if (schema.dictionary != nullptr) {
+    if (array.dictionary == nullptr) {
+      throw std::invalid_argument("the Arrow array has no dictionary");
+    }
+    const ArrowDictionary<T> dictionary(*schema.dictionary, *array.dictionary);
+    InsertArrow<T>(sketch, schema, array, dictionary);
+  } else if constexpr (::detail::is_string_v<T>) {
+    bool large;
+    if (!detail::IsStringFormat(schema, large)) {
+      detail::ThrowFormat(schema, "u, U, z or Z");
+    }
+    if (large) {
+      detail::InsertStrings<int64_t>(sketch, array);
+    } else {
+      detail::InsertStrings<int32_t>(sketch, array);
+    }
+  } else {
+    static_assert(detail::PrimitiveFormat<T>() != nullptr,
+                  "T is not a primitive Arrow type");
+    if (!detail::IsFormat(schema, detail::PrimitiveFormat<T>())) {
+      detail::ThrowFormat(schema, detail::PrimitiveFormat<T>());
+    }
+    detail::InsertPrimitive<T>(sketch, array);
+  }
+}
+
+template <typename T, typename Sketch>
+void InsertArrow(Sketch& sketch, const ArrowSchema& schema,
+                 const ArrowArray& array,
+                 const ArrowDictionary<T>& dictionary) {
+  detail::WithIndexType(schema, [&](auto index) {
+    detail::InsertDictionary<T, decltype(index)>(sketch, array, dictionary);
+  });
+}
+
+}  // namespace columnar
@@ -0,0 +1,318 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+#include "compiler.hpp"
+#include "cs/cs_final.hpp"
+#include "hash.hpp"
+#include "span.hpp"
+
+namespace concurrent {
+
+/// Count Sketch that many threads can insert into at once.
+///
+/// The sketch has the counter layout of `final::CountSketch`, but its counters
+/// are atomics that inserts update with relaxed `fetch_add`. Inserts are
+/// lock-free and never lost.
+///
+/// A query that runs concurrently with inserts reads every counter atomically,
+/// but an insert may be visible in some of the d counters of a value and not
+/// yet in others. This changes an estimate by at most the weight of the inserts
+/// in flight, which is consistent enough for frequency estimation. Once all
+/// inserts completed, the queries are exact like those of `final::CountSketch`.
+///
+/// Threads that insert the same heavy hitters contend on the cache lines of
+/// their counters. See `ShardedCountSketch` for a sketch without contention.
+///
+/// @tparam T the data type the sketch summarizes.
+/// @tparam t width of the sketch, must be a power of 2.
+/// @tparam d height of the sketch, must be odd.
+/// @tparam Hasher the hash policy, see `final::CountSketch`.
+/// @tparam kLayout the order of the counters, see `final::CountSketch`.
+template <typename T, size_t t = 2048, size_t d = 5,
+          typename Hasher = detail::Murmur3Hasher,
+          final::CountSketchLayout kLayout = final::CountSketchLayout::kRows>
+class CountSketch {
+  using Layout = final::CountSketch<T, t, d, int64_t, Hasher, kLayout>;
+  using Slots = typename Layout::slots;
+
+ public:
+  CountSketch() noexcept {
+    for (auto& counter : C) {
+      counter.store(0, std::memory_order_relaxed);
+    }
+  }
+
+  CountSketch(const CountSketch&) = delete;
+  CountSketch& operator=(const CountSketch&) = delete;
+
+  /// Insert a value into the sketch.
+  void Insert(const T& value) noexcept { Insert(Hasher::Hash(value)); }
+
+  /// Insert a hashed value into the sketch.
+  void Insert(const __uint128_t& hash) noexcept { Add(hash, 1); }
+
+  /// Insert a value with the given weight into the sketch. Weights above
+  /// INT64_MAX count as INT64_MAX.
+  void Insert(const T& value, uint64_t weight) noexcept {
+    Add(Hasher::Hash(value), detail::SignedWeight(weight));
+  }
+
+  /// Insert a batch of values into the sketch, hashing them in blocks like
+  /// `final::CountSketch::InsertBatch`.
+  void InsertBatch(std::span<const T> values) noexcept {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      Hasher::HashBatch(values.subspan(i, n), hashes.data());
+      for (size_t k = 0; k < n; ++k) {
+        Add(hashes[k], 1);
+      }
+    }
+  }
+
+  /// @return the estimated frequency of a value.
+  int64_t Estimate(const T& value) const noexcept {
+    return Estimate(Hasher::Hash(value));
+  }
+
+  /// @return the estimated frequency of a hashed value, the median of its d
+  /// signed counters.
+  int64_t Estimate(const __uint128_t& hash) const noexcept {
+    std::array<int64_t, d> estimates;
+    for (size_t j = 0; j < d; j++) {
+      const auto [h, sign] = Slots::HashExtract(hash, j);
+      const auto& counter = C[Slots::CounterIndex(j, h)];
+      estimates[j] = sign * counter.load(std::memory_order_relaxed);
+    }
+    return Slots::Median(estimates);
+  }
+
+  /// Copies the counters into `out`, e.g. to serialize them. The snapshot is
+  /// consistent like the queries, see the class comment.
+  void Snapshot(Layout& out) const noexcept {
+    out.Clear();
+    for (size_t i = 0; i < t * d; i++) {
+      out.AddToCounter(i, C[i].load(std::memory_order_relaxed));
+    }
+  }
+
+  /// Adds the counters of another sketch to this sketch, concurrently with
+  /// inserts.
+  void Merge(const Layout& other) noexcept {
+    for (size_t i = 0; i < t * d; i++) {
+      const int64_t count = other.GetCounter(i);
+      if (count != 0) C[i].fetch_add(count, std::memory_order_relaxed);
+    }
+  }
+
+ private:
+  /// Number of values hashed up front by the batch insert.
+  static constexpr size_t kHashBlockSize = 64;
+
+  OPT_INLINE void Add(const __uint128_t& hash, int64_t weight) {
+    for (size_t j = 0; j < d; j++) {
+      const auto [h, sign] = Slots::HashExtract(hash, j);
+      C[Slots::CounterIndex(j, h)].fetch_add(sign * weight,
+                                             std::memory_order_relaxed);
+    }
+  }
+
+  /// Counters of the sketch, aligned to cache lines like the shards of
+  /// ShardedCountSketch.
+  alignas(64) std::array<std::atomic<int64_t>, t * d> C;
+};
+
+/// Count Sketch that many threads can insert into at once, with one shard of
+/// counters per inserting thread.
+///
+/// Each inserting thread acquires a `Writer`, which owns one shard. Only the
+/// owner writes the counters of a shard, with plain relaxed loads and stores
+/// instead of atomic read-modify-writes, so inserts run at the speed of
+/// `final::CountSketch` and never contend. Count Sketches are linear, so
+/// queries merge the shards lazily by summing their counters, which costs
+/// O(shards) per counter. They are consistent like the queries of
+/// `concurrent::CountSketch`.
+///
+/// @tparam T the data type the sketch summarizes.
+/// @tparam t width of the sketch, must be a power of 2.
+/// @tparam d height of the sketch, must be odd.
+/// @tparam kMaxShards maximum number of concurrent writers.
+/// @tparam Hasher the hash policy, see `final::CountSketch`.
+/// @tparam kLayout the order of the counters, see `final::CountSketch`.
+template <typename T, size_t t = 2048, size_t d = 5, size_t kMaxShards = 64,
+          typename Hasher = detail::Murmur3Hasher,
+          final::CountSketchLayout kLayout = final::CountSketchLayout::kRows>
+class ShardedCountSketch {
+  using Layout = final::CountSketch<T, t, d, int64_t, Hasher, kLayout>;
+  using Slots = typename Layout::slots;
+
+  /// Counters of one writer.
+  struct Shard {
+    Shard() noexcept {
+      for (auto& counter : C) {
+        counter.store(0, std::memory_order_relaxed);
+      }
+    }
+
+    /// Adds to a counter. Only the owner of the shard writes to the counters,
+    /// so a load and a store are enough.
+    OPT_INLINE void Add(size_t i, int64_t delta) {
+      C[i].store(C[i].load(std::memory_order_relaxed) + delta,
+                 std::memory_order_relaxed);
+    }
+
+    alignas(64) std::array<std::atomic<int64_t>, t * d> C;
+    /// Whether a writer owns the shard.
+    bool in_use = false;
+  };
+
+ public:
+  ShardedCountSketch() = default;
+  ShardedCountSketch(const ShardedCountSketch&) = delete;
+  ShardedCountSketch& operator=(const ShardedCountSketch&) = delete;
+
+  /// Inserts into one shard of the sketch. A writer must only be used by one
+  /// thread at a time and must not outlive the sketch. The inserts stay in the
+  /// sketch after the writer is destroyed, and the shard is reused by the next
+  /// writer.
+  class Writer {
+   public:
+    Writer(Writer&& other) noexcept
+        : sketch_(std::exchange(other.sketch_, nullptr)),
+          shard_(std::exchange(other.shard_, nullptr)) {}
+
+    Writer& operator=(Writer&& other) noexcept {
+      std::swap(sketch_, other.sketch_);
+      std::swap(shard_, other.shard_);
+      return *this;
+    }
+
+    ~Writer() {
+      if (sketch_ != nullptr) sketch_->Release(shard_);
+    }
+
+    /// Insert a value into the sketch.
+    void Insert(const T& value) noexcept { Insert(Hasher::Hash(value)); }
+
+    /// Insert a hashed value into the sketch.
+    void Insert(const __uint128_t& hash) noexcept { Add(hash, 1); }
+
+    /// Insert a value with the given weight into the sketch. Weights above
+    /// INT64_MAX count as INT64_MAX.
+    void Insert(const T& value, uint64_t weight) noexcept {
+      Add(Hasher::Hash(value), detail::SignedWeight(weight));
+    }
+
+    /// Insert a batch of values into the sketch, hashing them in blocks like
+    /// `final::CountSketch::InsertBatch`.
+    void InsertBatch(std::span<const T> values) noexcept {
+      std::array<__uint128_t, kHashBlockSize> hashes;
+      for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+        const size_t n = std::min(kHashBlockSize, values.size() - i);
+        Hasher::HashBatch(values.subspan(i, n), hashes.data());
+        for (size_t k = 0; k < n; ++k) {
+          Add(hashes[k], 1);
+        }
+      }
+    }
+
+   private:
+    friend class ShardedCountSketch;
+
+    Writer(ShardedCountSketch* sketch, Shard* shard) noexcept
+        : sketch_(sketch), shard_(shard) {}
+
+    OPT_INLINE void Add(const __uint128_t& hash, int64_t weight) {
+      for (size_t j = 0; j < d; j++) {
+        const auto [h, sign] = Slots::HashExtract(hash, j);
+        shard_->Add(Slots::CounterIndex(j, h), sign * weight);
+      }
+    }
+
+    ShardedCountSketch* sketch_;
+    Shard* shard_;
+  };
+
+  /// @return a writer owning a free shard, allocating the shard if needed.
+  /// @throws std::runtime_error if kMaxShards writers already exist.
+  Writer GetWriter() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const size_t num_shards = num_shards_.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < num_shards; ++i) {
+      if (!shards_[i]->in_use) {
+        shards_[i]->in_use = true;
+        return Writer(this, shards_[i].get());
+      }
+    }
+    if (num_shards == kMaxShards) {
+      throw std::runtime_error("all " + std::to_string(kMaxShards) +
+                               " shards are in use");
+    }
+    shards_[num_shards] = std::make_unique<Shard>();
+    shards_[num_shards]->in_use = true;
+    // Publishes the shard to the queries.
+    num_shards_.store(num_shards + 1, std::memory_order_release);
+    return Writer(this, shards_[num_shards].get());
+  }
+
+  /// @return the estimated frequency of a value.
+  int64_t Estimate(const T& value) const noexcept {
+    return Estimate(Hasher::Hash(value));
+  }
+
+  /// @return the estimated frequency of a hashed value, the median of its d
+  /// signed counters summed over all shards.
+  int64_t Estimate(const __uint128_t& hash) const noexcept {
+    const size_t num_shards = num_shards_.load(std::memory_order_acquire);
+    std::array<int64_t, d> estimates{};
+    for (size_t s = 0; s < num_shards; ++s) {
+      const Shard& shard = *shards_[s];
+      for (size_t j = 0; j < d; j++) {
+        const auto [h, sign] = Slots::HashExtract(hash, j);
+        const auto& counter = shard.C[Slots::CounterIndex(j, h)];
+        estimates[j] += sign * counter.load(std::memory_order_relaxed);
+      }
+    }
+    return Slots::Median(estimates);
+  }
+
+  /// Sums the counters of all shards into `out`, e.g. to serialize them.
+  void Snapshot(Layout& out) const noexcept {
+    const size_t num_shards = num_shards_.load(std::memory_order_acquire);
+    out.Clear();
+    for (size_t s = 0; s < num_shards; ++s) {
+      const Shard& shard = *shards_[s];
+      for (size_t i = 0; i < t * d; i++) {
+        out.AddToCounter(i, shard.C[i].load(std::memory_order_relaxed));
+      }
+    }
+  }
+
+ private:
+  /// Number of values hashed up front by the batch insert.
+  static constexpr size_t kHashBlockSize = 64;
+
+  void Release(Shard* shard) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    shard->in_use = false;
+  }
+
+  /// Guards the allocation and ownership of the shards.
+  std::mutex mutex_;
+  /// Shards [0, num_shards_) are allocated. They are only written before
+  /// num_shards_ is incremented, so queries can read them without the lock.
+  std::array<std::unique_ptr<Shard>, kMaxShards> shards_{};
+  std::atomic<size_t> num_shards_{0};
+};
+
+}  // namespace concurrent
@@ -0,0 +1,261 @@
+#pragma once
+
+// Bulk build of a final::CountSketch on a CUDA device, for backfills over
+// billions of values in which the CPU insert is bound by hashing.
+//
+// Only built with -DSKETCHES_CUDA=ON, and compiled by nvcc with
+// --expt-relaxed-constexpr: the kernels call the constexpr MurmurHash3 of
+// MurmurHash3.h and the constexpr HashExtract and CounterIndex of
+// detail::CountSketchSlots, so the device hashes and indexes with the very
+// code of the CPU insert.
+
+#include <cuda_runtime.h>
+
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "MurmurHash3.h"
+#include "cs/cs_final.hpp"
+#include "hash.hpp"
+#include "span.hpp"
+
+namespace cuda {
+
+namespace detail {
+
+/// @throws std::runtime_error if a CUDA call failed.
+inline void Check(cudaError_t error, const char* what) {
+  if (error != cudaSuccess) {
+    throw std::runtime_error(std::string(what) + ": " +
+                             cudaGetErrorString(error));
+  }
+}
+
+/// Frees device memory, for `std::unique_ptr`.
+struct FreeDevice {
+  void operator()(void* p) const noexcept { cudaFree(p); }
+};
+
+/// Destroys a stream, for `std::unique_ptr`.
+struct DestroyStream {
+  void operator()(cudaStream_t stream) const noexcept {
+    cudaStreamDestroy(stream);
+  }
+};
+
+template <typename T>
+using DevicePtr = std::unique_ptr<T, FreeDevice>;
+using StreamPtr = std::unique_ptr<std::remove_pointer_t<cudaStream_t>,
+                                  DestroyStream>;
+
+/// @return `detail::Hash(value)` of hash.hpp, on the device. Floating point
+/// values are hashed by their bits with -0.0 mapped to 0.0, like
+/// `detail::fp_hash_bits`, which is not constexpr.
+template <typename T>
+__host__ __device__ __forceinline__ __uint128_t Hash(const T& value) {
+  if constexpr (std::is_same_v<T, float>) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return MurmurHash3_x64_128(bits & 0x7fffffffu ? bits : 0u, kSeed);
+  } else if constexpr (std::is_same_v<T, double>) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return MurmurHash3_x64_128(
+        bits & 0x7fffffffffffffffull ? bits : uint64_t{0}, kSeed);
+  } else if constexpr (std::is_same_v<T, __int128_t>) {
+    return MurmurHash3_x64_128(static_cast<__uint128_t>(value), kSeed);
+  } else {
+    return MurmurHash3_x64_128(static_cast<std::make_unsigned_t<T>>(value),
+                               kSeed);
+  }
+}
+
+/// Adds the d signed unit counts of every value of `values` to `counters`.
+///
+/// With kShared, every block counts its share of the values into a table of
+/// 32 bit counters in shared memory, and adds its nonzero counters to the
+/// global table at the end, so that the atomics of the values stay on the
+/// chip. Tables that do not fit into shared memory are counted with global
+/// atomics. All counts are integers, so the order of the atomics does not
+/// change the sums.
+template <typename Slots, typename T, bool kShared>
+__global__ void CountValues(const T* __restrict__ values, size_t n,
+                            unsigned long long* __restrict__ counters) {
+  extern __shared__ int block_counters[];
+  if constexpr (kShared) {
+    for (size_t i = threadIdx.x; i < Slots::kSize; i += blockDim.x) {
+      block_counters[i] = 0;
+    }
+    __syncthreads();
+  }
+  const size_t stride = size_t{gridDim.x} * blockDim.x;
+  for (size_t i = size_t{blockIdx.x} * blockDim.x + threadIdx.x; i < n;
+       i += stride) {
+    const __uint128_t hash = Hash(values[i]);
+#pragma unroll
+    for (size_t j = 0; j < Slots::kDepth; ++j) {
+      const auto [index, sign] = Slots::Get(hash, j);
+      if constexpr (kShared) {
+        atomicAdd(&block_counters[index], static_cast<int>(sign));
+      } else {
+        // adds -1 as 2^64 - 1, which wraps like the int64_t counters
+        atomicAdd(&counters[index], static_cast<unsigned long long>(sign));
+      }
+    }
+  }
+  if constexpr (kShared) {
+    __syncthreads();
+    for (size_t i = threadIdx.x; i < Slots::kSize; i += blockDim.x) {
+      const int count = block_counters[i];
+      if (count != 0) {
+        atomicAdd(&counters[i], static_cast<unsigned long long>(
+                                    static_cast<long long>(count)));
+      }
+    }
+  }
+}
+
+}  // namespace detail
+
+/// Builds the counters of a `final::CountSketch` of MurmurHash3 on a CUDA
+/// device, see `InsertBatch`.
+template <typename Sketch>
+class CountSketchBuilder;
+
+template <typename T, size_t t, size_t d, typename Counter,
+          final::CountSketchLayout kLayout>
+class CountSketchBuilder<final::CountSketch<T, t, d, Counter,
+                                            ::detail::Murmur3Hasher, kLayout>> {
+  static_assert((std::is_integral_v<T> && sizeof(T) >= 2) ||
+                    std::is_same_v<T, __int128_t> ||
+                    std::is_same_v<T, float> || std::is_same_v<T, double>,
+                "the device hashes fixed-width values only");
+
+ public:
+  using Sketch =
+      final::CountSketch<T, t, d, Counter, ::detail::Murmur3Hasher, kLayout>;
+
+  /// Allocates the device buffers for chunks of up to `chunk_size` values,
+  /// the number of values copied and counted at once.
+  /// @throws std::invalid_argument if `chunk_size` is 0 or exceeds INT_MAX,
+  ///   the bound of the 32 bit counters of a block.
+  /// @throws std::runtime_error if there is no CUDA device or it is out of
+  ///   memory.
+  explicit CountSketchBuilder(size_t chunk_size = size_t{1} << 24)
+      : chunk_size_(chunk_size), host_counters_(kSize) {
+    if (chunk_size == 0 || chunk_size > INT_MAX) {
+      throw std::invalid_argument("chunk size must be in [1, INT_MAX]: " +
+                                  std::to_string(chunk_size));
+    }
+    int device;
+    detail::Check(cudaGetDevice(&device), "cudaGetDevice");
+    detail::Check(cudaDeviceGetAttribute(&num_sms_,
+                                         cudaDevAttrMultiProcessorCount,
+                                         device),
+                  "cudaDeviceGetAttribute");
+    detail::Check(cudaOccupancyMaxActiveBlocksPerMultiprocessor(
+                      &blocks_per_sm_, Kernel(), kThreads, kSharedSize),
+                  "cudaOccupancyMaxActiveBlocksPerMultiprocessor");
+    // owned by the members as soon as they exist, so that a later failure
+    // frees them
+    cudaStream_t stream;
+    detail::Check(cudaStreamCreate(&stream), "cudaStreamCreate");
+    stream_.reset(stream);
+    T* values;
+    detail::Check(cudaMalloc(&values, chunk_size * sizeof(T)), "cudaMalloc");
+    values_.reset(values);
+    unsigned long long* counters;
+    detail::Check(cudaMalloc(&counters, kSize * sizeof(unsigned long long)),
+                  "cudaMalloc");
+    counters_.reset(counters);
+  }
+
+  CountSketchBuilder(const CountSketchBuilder&) = delete;
+  CountSketchBuilder& operator=(const CountSketchBuilder&) = delete;
+
+  /// Inserts a batch of values into `sketch`, with the same counters as
+  /// `sketch.InsertBatch(values)`.
+  ///
+  /// Copies the values to the device chunk by chunk, counts every chunk with
+  /// one kernel launch, and copies the t * d counters of the batch back once
+  /// to add them to the sketch. Every batch thus pays for a copy of the
+  /// counters and a synchronization besides the copies of the values, so
+  /// small batches are faster on the CPU; `bm_cuda_build` measures where
+  /// the device breaks even. The values are copied from pageable memory,
+  /// which the driver stages through pinned buffers.
+  /// @throws std::runtime_error if a CUDA call failed, leaving the sketch
+  ///   unchanged.
+  void InsertBatch(Sketch& sketch, std::span<const T> values) {
+    if (values.empty()) return;
+    cudaStream_t stream = stream_.get();
+    unsigned long long* counters = counters_.get();
+    detail::Check(cudaMemsetAsync(counters, 0,
+                                  kSize * sizeof(unsigned long long), stream),
+                  "cudaMemsetAsync");
+    for (size_t i = 0; i < values.size(); i += chunk_size_) {
+      const size_t n = std::min(chunk_size_, values.size() - i);
+      detail::Check(cudaMemcpyAsync(values_.get(), values.data() + i,
+                                    n * sizeof(T), cudaMemcpyHostToDevice,
+                                    stream),
+                    "cudaMemcpyAsync");
+      const size_t max_blocks = size_t{1} * num_sms_ * blocks_per_sm_;
+      const auto blocks = static_cast<unsigned int>(
+          std::min(max_blocks, (n + kThreads - 1) / kThreads));
+      Kernel()<<<blocks, kThreads, kSharedSize, stream>>>(values_.get(), n,
+                                                          counters);
+      detail::Check(cudaGetLastError(), "kernel launch");
+    }
+    detail::Check(cudaMemcpyAsync(host_counters_.data(), counters,
+                                  kSize * sizeof(unsigned long long),
+                                  cudaMemcpyDeviceToHost, stream),
+                  "cudaMemcpyAsync");
+    detail::Check(cudaStreamSynchronize(stream), "cudaStreamSynchronize");
+    for (size_t i = 0; i < kSize; ++i) {
+      const auto count = static_cast<int64_t>(host_counters_[i]);
+      if (count != 0) sketch.AddToCounter(i, count);
+    }
+  }
+
+ private:
+  static constexpr size_t kSize = t * d;
+  static constexpr unsigned int kThreads = 256;
+  /// Whether the 32 bit counters of a block fit into the 48 KiB of shared
+  /// memory that every device offers without opting in.
+  static constexpr bool kShared = kSize * sizeof(int) <= 48 * 1024;
+  static constexpr size_t kSharedSize = kShared ? kSize * sizeof(int) : 0;
+
+  /// The counter slots of the sketch, for the kernel.
+  struct Slots {
+    static constexpr size_t kSize = t * d;
+    static constexpr size_t kDepth = d;
+
+    /// @return the index into the counters and the sign of row j.
+    __host__ __device__ __forceinline__ static std::pair<uint32_t, int64_t>
+    Get(const __uint128_t& hash, size_t j) {
+      const auto [h, sign] = Sketch::slots::HashExtract(hash, j);
+      return {static_cast<uint32_t>(Sketch::slots::CounterIndex(j, h)), sign};
+    }
+  };
+
+  static constexpr auto Kernel() {
+    return &detail::CountValues<Slots, T, kShared>;
+  }
+
+  size_t chunk_size_;
+  int num_sms_ = 0;
+  int blocks_per_sm_ = 0;
+  detail::StreamPtr stream_;
+  detail::DevicePtr<T> values_;
+  detail::DevicePtr<unsigned long long> counters_;
+  std::vector<unsigned long long> host_counters_;
+};
+
+}  // namespace cuda
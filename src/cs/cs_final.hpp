@@ -1,13 +1,220 @@
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
 #include <utility>
+#include <vector>
 
 #include "compiler.hpp"
 #include "hash.hpp"
+#include "serialization.hpp"
+#include "span.hpp"
+#include "types.hpp"
+
+namespace final {
+
+/// Encodings of the counters in the CountSketch wire format.
+enum class CountSketchEncoding : uint8_t {
+  /// Raw int64 counters, which can be read in place.
+  kInt64 = 0,
+  /// Raw int32 counters, for sketches whose counters all fit into 32 bits.
+  kInt32 = 1,
+  /// Zig-zag encoded LEB128 varints, which have to be decoded sequentially.
+  kVarint = 2,
+};
+
+/// Orders of the counters of a CountSketch in memory.
+enum class CountSketchLayout : uint8_t {
+  /// The d rows one after the other, so that the d counters of a value are in
+  /// d cache lines spread over the whole table.
+  kRows = 0,
+  /// Blocks of the same columns of all rows, in the style of blocked Bloom
+  /// filters. The hash picks one block per value, so that the d counters of a
+  /// value are in one or two adjacent cache lines. See `CountSketch` for the
+  /// accuracy trade-off.
+  kBlocked = 1,
+};
+
+/// Fixed header of the CountSketch wire format.
+///
+/// A serialized sketch is the header followed by the t * d counters in the
+/// order of the layout of the sketch, in the given encoding, zero padded to a
+/// multiple of 64 bytes. All integers are little-endian.
+struct CountSketchHeader {
+  static constexpr uint32_t kMagic = 0x4b534343;  // "CCSK"
+  static constexpr uint16_t kVersion = 1;
+
+  uint32_t magic;
+  uint16_t version;
+  /// The data type of the sketch, see `detail::TypeTag`.
+  uint8_t type_tag;
+  CountSketchEncoding encoding;
+  uint32_t t;
+  uint32_t d;
+  /// Seed of the hash function, the counters are only meaningful for the
+  /// same seed.
+  uint64_t seed;
+  /// Size of the counters in bytes, without the padding.
+  uint64_t payload_size;
+  /// Hash function of the sketch, see `detail::HashFamily`. MurmurHash3 in
+  /// sketches written before the hash was configurable.
+  detail::HashFamily hash_family;
+  /// Order of the counters, rows in sketches written before it was
+  /// configurable.
+  CountSketchLayout layout;
+  /// Number of columns of a block of the blocked layout, which depends on the
+  /// counter type, see `CountSketch::kBlockWidth`. 0 for the rows layout.
+  uint16_t block_width;
+  uint8_t reserved[28];
+};
+static_assert(sizeof(CountSketchHeader) == detail::kWireAlignment);
+static_assert(std::is_trivially_copyable_v<CountSketchHeader>);
+
+}  // namespace final
+
+namespace detail {
+
+/// The counter layout of a `final::CountSketch`: where the d counters of a
+/// hashed value are and how their estimates combine. The concurrent and
+/// windowed sketches and the CUDA builder keep their counters in the same
+/// order, so that they hash, index and estimate like the final sketch and
+/// can move counters in and out of it by index.
+template <size_t t, size_t d, typename Counter, typename Hasher,
+          final::CountSketchLayout kLayout>
+struct CountSketchSlots {
+  /// Number of columns of a block of the layout, t for rows.
+  static constexpr size_t kBlockWidth = [] {
+    if (kLayout == final::CountSketchLayout::kRows) return t;
+    // the largest power of 2 for which the d rows of a block fit into a
+    // cache line of 64 bytes
+    size_t width = 1;
+    while (2 * width <= t && 2 * width * d * sizeof(Counter) <= 64) {
+      width *= 2;
+    }
+    return width;
+  }();
+
+  /// Extract the two hashes needed for counting (h, g) from one 128 bit hash.
+  ///
+  /// First, we get a j-th hash in the range [0, 2t), or in the range
+  /// [0, 2 * kBlockWidth) within the block of the value. Then, we split it
+  /// according to "Small Summaries for Big Data":
+  ///  Still, in some high performance cases, where huge amounts of data is
+  ///  processed, we wish to make this part as efficient as possible. One way
+  ///  to reduce the cost of hashing is to compute a single hash function for
+  ///  row j that maps to the range 2t, and use the last bit to determine gj
+  ///  (+1 or −1), while the remaining bits determine hj.
+  OPT_INLINE static constexpr std::pair<uint32_t, int64_t> HashExtract(
+      const __uint128_t& hash, size_t j) {
+    uint32_t hashes = 0;
+    uint32_t block = 0;
+    if constexpr (hash_bits * d + block_bits <= sizeof(hash) * 8 / 2) {
+      // We only ever use the lower half of the 128 bit hash. In the following
+      // statement we tell the compiler that explicitly, resulting in the
+      // compiler generating only half the instructions.
+      const auto lower_hash = static_cast<uint64_t>(hash);
+
+      hashes = (lower_hash >> (j * hash_bits)) % (2 * kBlockWidth);
+      if constexpr (block_bits > 0) {
+        block = (lower_hash >> (d * hash_bits)) % (t / kBlockWidth);
+      }
+    } else {
+      hashes = (hash >> (j * hash_bits)) % (2 * kBlockWidth);
+      if constexpr (block_bits > 0) {
+        block = (hash >> (d * hash_bits)) % (t / kBlockWidth);
+      }
+    }
+
+    const uint32_t h = block * kBlockWidth + (hashes >> 1);
+    const uint32_t g = hashes & 1;
+
+    // Map g to sign: 0 -> -1, 1 -> +1
+    const int64_t sign = (static_cast<int64_t>(g) * 2) - 1;
+
+    return {h, sign};
+  }
+
+  /// @return the index of the counter of column h of row j in the counters.
+  OPT_INLINE static constexpr size_t CounterIndex(size_t j, size_t h) {
+    if constexpr (kLayout == final::CountSketchLayout::kRows) {
+      return j * t + h;
+    } else {
+      return (h / kBlockWidth) * (d * kBlockWidth) + j * kBlockWidth +
+             h % kBlockWidth;
+    }
+  }
+
+  /// @return the median of the d values, reordering them.
+  ///
+  /// Small d use a branch-free median selection network, as the order of the
+  /// counters is random and a sort would mispredict. Larger d fall back to
+  /// `std::nth_element`.
+  OPT_INLINE static int64_t Median(std::array<int64_t, d>& v) {
+    if constexpr (d == 1) {
+      return v[0];
+    } else if constexpr (d == 3) {
+      CompareExchange(v[0], v[1]);
+      return std::max(v[0], std::min(v[1], v[2]));
+    } else if constexpr (d == 5) {
+      // Discard the minimum and maximum of four values, then take the median
+      // of the remaining two and v[2].
+      CompareExchange(v[0], v[1]);
+      CompareExchange(v[3], v[4]);
+      CompareExchange(v[0], v[3]);
+      CompareExchange(v[1], v[4]);
+      CompareExchange(v[1], v[3]);
+      return std::max(v[1], std::min(v[2], v[3]));
+    } else if constexpr (d == 7) {
+      // Sort the first six values, then take the median of v[2], v[3], v[6].
+      CompareExchange(v[0], v[5]);
+      CompareExchange(v[1], v[3]);
+      CompareExchange(v[2], v[4]);
+      CompareExchange(v[1], v[2]);
+      CompareExchange(v[3], v[4]);
+      CompareExchange(v[0], v[3]);
+      CompareExchange(v[2], v[5]);
+      CompareExchange(v[0], v[1]);
+      CompareExchange(v[2], v[3]);
+      CompareExchange(v[4], v[5]);
+      CompareExchange(v[1], v[2]);
+      CompareExchange(v[3], v[4]);
+      return std::max(v[2], std::min(v[3], v[6]));
+    } else {
+      std::nth_element(v.begin(), v.begin() + d / 2, v.end());
+      return v[d / 2];
+    }
+  }
+
+ private:
+  /// Compare-exchange of a sorting network, compiles to min/max or cmov.
+  OPT_INLINE static void CompareExchange(int64_t& a, int64_t& b) {
+    const int64_t lo = std::min(a, b);
+    b = std::max(a, b);
+    a = lo;
+  }
+
+  /// Number of bits needed for one hash for one layer of the sketch. The hash
+  /// is in the range [0, 2 * kBlockWidth). kBlockWidth is a power of 2. Hence
+  /// we can just count the trailing zeros.
+  constexpr static size_t hash_bits = __builtin_ctz(2 * kBlockWidth);
+  /// Number of bits of the block of a value, which all layers share. 0 for
+  /// the rows layout, whose only block spans the whole table.
+  constexpr static size_t block_bits = __builtin_ctz(t / kBlockWidth);
+
+  // We need hash_bits bits for each of the d layers, and block_bits.
+  static_assert(hash_bits * d + block_bits <= Hasher::kBits,
+                "hash must have enough bits for each layer of the sketch");
+};
+
+}  // namespace detail
 
 namespace final {
 
@@ -28,88 +235,634 @@ namespace final {
 /// @tparam d height of the sketch, must be odd.
 ///   The default value of 5 is recommended by "Small Summaries for Big Data" p.
 ///   148" which results in a theoretical error probability δ of about 0.67%
-template <typename T, size_t t = 2048, size_t d = 5>
+/// @tparam Counter type of the counters, int16_t, int32_t or int64_t.
+///   Narrow counters shrink the table, e.g. from 80 KB to 20 KB for the default
+///   shape with int16_t counters, so that it stays in L1/L2. A counter that
+///   would overflow moves its value into an int64_t carry in a side table and
+///   restarts at 0, so the counters hold the same sums for any counter type.
+///   In the rows layout the estimates are thus the same too, but the blocks
+///   of the blocked layout are narrower for wider counters, see kLayout.
+/// @tparam Hasher the hash policy, see `hash.hpp`. The default shape needs
+///   60 bits, which every policy provides, so a cheaper 64 bit hash such as
+///   `detail::WyHasher` can replace the default MurmurHash3.
+/// @tparam kLayout the order of the counters in memory.
+///   With `CountSketchLayout::kBlocked` a value hashes to one block of
+///   `kBlockWidth` columns, whose d rows share one or two cache lines, so an
+///   insert touches those lines instead of d. This pays off once the table
+///   does not fit into L2. The estimate of each row stays unbiased, but two
+///   values of a block collide in each row with probability 1/kBlockWidth
+///   instead of independently per row, so the median no longer masks heavy
+///   hitters and the tail of the error grows. Prefer narrow counters, whose
+///   blocks are wider, and a larger t to make up for the loss.
+template <typename T, size_t t = 2048, size_t d = 5, typename Counter = int64_t,
+          typename Hasher = detail::Murmur3Hasher,
+          CountSketchLayout kLayout = CountSketchLayout::kRows>
 class CountSketch {
   // For efficient hash range reduction and splitting the hash.
   static_assert((t & (t - 1)) == 0, "t must be a power of 2");
-  // We need CTZ(2*t) bits for each of the d layers.
-  static_assert(__builtin_ctz(size_t{2} * t) * d <= sizeof(__uint128_t) * 8,
-                "hash must have enough bits for each layer of the sketch");
+  // The estimate is the median of the d counters of a value.
+  static_assert(d % 2 == 1, "d must be odd");
+  static_assert(std::is_same_v<Counter, int16_t> ||
+                    std::is_same_v<Counter, int32_t> ||
+                    std::is_same_v<Counter, int64_t>,
+                "Counter must be int16_t, int32_t or int64_t");
 
  public:
+  using hasher = Hasher;
+  /// The counter layout of the sketch, see `detail::CountSketchSlots`.
+  using slots = detail::CountSketchSlots<t, d, Counter, Hasher, kLayout>;
+
+  /// Number of columns of a block of the layout, t for rows.
+  static constexpr size_t kBlockWidth = slots::kBlockWidth;
+
   /// Insert a value into the sketch.
   void Insert(const T& value) noexcept {
-    const __uint128_t hash = detail::Hash(value);
+    const __uint128_t hash = Hasher::Hash(value);
     Insert(hash);
   }
 
-  /// Insert a hashed value into the sketch.
+  /// Insert a value hashed by `Hasher::Hash` into the sketch.
   void Insert(const __uint128_t& hash) noexcept {
     for (size_t j = 0; j < d; j++) {
-      const auto [h, sign] = HashExtract(hash, j);
-      GetCounter(j, h) += sign;
+      const auto [h, sign] = slots::HashExtract(hash, j);
+      AddToCounter(j, h, sign);
     }
   }
 
   /// Insert a hashed value into the sketch.
   void Insert(const T&, const __uint128_t& hash) noexcept {
     for (size_t j = 0; j < d; j++) {
-      const auto [h, sign] = HashExtract(hash, j);
-      GetCounter(j, h) += sign;
+      const auto [h, sign] = slots::HashExtract(hash, j);
+      AddToCounter(j, h, sign);
     }
   }
 
- private:
-  /// Counters of the sketch
-  std::array<int64_t, t * d> C;
+  /// Insert a value with the given weight into the sketch, equivalent to
+  /// inserting it `weight` times.
+  template <typename Weight,
+            std::enable_if_t<detail::is_weight_v<Weight>, int> = 0>
+  void Insert(const T& value, Weight weight) noexcept {
+    const __uint128_t hash = Hasher::Hash(value);
+    Insert(hash, weight);
+  }
 
-  /// Number of bits needed for one hash for one layer of the sketch. The hash
-  /// is in the range [0, 2t). t is a power of 2. Hence we can just count the
-  /// trailing zeros.
-  constexpr static size_t hash_bits = __builtin_ctz(2 * t);
+  /// Insert a hashed value with the given weight into the sketch. Negative
+  /// weights subtract, and unsigned weights above INT64_MAX count as
+  /// INT64_MAX.
+  template <typename Weight,
+            std::enable_if_t<detail::is_weight_v<Weight>, int> = 0>
+  void Insert(const __uint128_t& hash, Weight weight) noexcept {
+    const int64_t w = detail::SignedWeight(weight);
+    for (size_t j = 0; j < d; j++) {
+      const auto [h, sign] = slots::HashExtract(hash, j);
+      AddToCounter(j, h, sign * w);
+    }
+  }
 
-  /// Counter accessor used to be able to reuse code
-  int64_t const& GetCounter(size_t j, size_t h) const { return C[j * t + h]; }
+  /// Insert a batch of values into the sketch.
+  ///
+  /// The values are hashed in blocks of `kHashBlockSize` before any counter is
+  /// touched, using the vectorized hash kernels for fixed-width types. This
+  /// decouples the latency chain of the hash function from the counter
+  /// updates, which are then issued through the pre-hashed batch path.
+  void InsertBatch(std::span<const T> values) noexcept {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      Hasher::HashBatch(values.subspan(i, n), hashes.data());
+      InsertBatch(std::span<const __uint128_t>(hashes.data(), n));
+    }
+  }
 
-  /// From  Effective C++, 3rd ed by Scott Meyers, ISBN-13: 9780321334879
-  /// Avoid Duplication in const and Non-const Member Function," p. 23 Item 3
-  int64_t& GetCounter(size_t j, size_t h) {
-    return const_cast<int64_t&>(std::as_const(*this).GetCounter(j, h));
+  /// Insert a batch of pre-aggregated values into the sketch, `values[i]` with
+  /// weight `weights[i]`. Both spans must have the same size.
+  void InsertBatch(std::span<const T> values,
+                   std::span<const uint64_t> weights) noexcept {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      Hasher::HashBatch(values.subspan(i, n), hashes.data());
+      InsertBatch(std::span<const __uint128_t>(hashes.data(), n),
+                  weights.subspan(i, n));
+    }
   }
 
-  /// Extract the two hashes needed for counting (h, g) from one 128 bit hash.
+  /// Insert a batch of hashed values into the sketch.
   ///
-  /// First, we get a j-th hash in the range [0, 2t). Then, we split it
-  /// according to "Small Summaries for Big Data":
-  ///  Still, in some high performance cases, where huge amounts of data is
-  ///  processed, we wish to make this part as efficient as possible. One way
-  ///  to reduce the cost of hashing is to compute a single hash function for
-  ///  row j that maps to the range 2t, and use the last bit to determine gj
-  ///  (+1 or −1), while the remaining bits determine hj.
-  OPT_INLINE std::pair<uint32_t, int64_t> HashExtract(const __uint128_t& hash,
-                                                      size_t j) const {
-    uint32_t hashes;
-    if constexpr (__builtin_ctz(size_t{2} * t) * d <= sizeof(hash) * 8 / 2) {
-      // We only ever use the lower half of the 128 bit hash. In the following
-      // statement we tell the compiler that explicitly, resulting in the
-      // compiler generating only half the instructions.
-      const auto lower_hash = static_cast<uint64_t>(hash);
+  /// For counter tables that do not fit into L2, the counters of the value
+  /// `kPrefetchDistance` positions ahead are prefetched, so that the d cache
+  /// misses of consecutive values overlap instead of being serialized. Smaller
+  /// tables are served fast enough by out-of-order execution alone, and the
+  /// prefetch instructions only add overhead.
+  void InsertBatch(std::span<const __uint128_t> hashes) noexcept {
+    InsertHashedBatch</*kWeighted=*/false>(hashes, nullptr);
+  }
+
+  /// Insert a batch of pre-aggregated hashed values into the sketch, see
+  /// above.
+  void InsertBatch(std::span<const __uint128_t> hashes,
+                   std::span<const uint64_t> weights) noexcept {
+    InsertHashedBatch</*kWeighted=*/true>(hashes, weights.data());
+  }
+
+  /// @return the estimated frequency of a value.
+  int64_t Estimate(const T& value) const noexcept {
+    const __uint128_t hash = Hasher::Hash(value);
+    return Estimate(hash);
+  }
+
+  /// @return the estimated frequency of a hashed value, the median of its d
+  /// signed counters.
+  int64_t Estimate(const __uint128_t& hash) const noexcept {
+    std::array<int64_t, d> estimates;
+    for (size_t j = 0; j < d; j++) {
+      const auto [h, sign] = slots::HashExtract(hash, j);
+      estimates[j] = sign * GetCounter(j, h);
+    }
+    return slots::Median(estimates);
+  }
 
-      hashes = (lower_hash >> (j * hash_bits)) % t;
-    } else if constexpr (__builtin_ctz(size_t{2} * t) * d <= sizeof(hash) * 8) {
-      hashes = (hash >> (j * hash_bits)) % t;
+  /// Adds the counters of another sketch to this sketch. The result is the
+  /// sketch of the union of the two streams.
+  ///
+  /// 64 bit counters never spill, so their arrays are added vertically in a
+  /// loop that the compiler vectorizes.
+  void Merge(const CountSketch& other) noexcept {
+    if constexpr (std::is_same_v<Counter, int64_t>) {
+      for (size_t i = 0; i < t * d; i++) {
+        C[i] += other.C[i];
+      }
     } else {
-      static_assert(!sizeof(T), "Not enough hash bits");
+      for (size_t i = 0; i < t * d; i++) {
+        AddToCounter(i, other.GetCounter(i));
+      }
     }
+  }
 
-    const uint32_t h = hashes >> 1;
-    const uint32_t g = hashes & 1;
+  /// Adds the counters of a serialized sketch to this sketch, decoding them
+  /// straight from the buffer, which may be a memory-mapped file.
+  /// @throws std::invalid_argument if the buffer does not hold a serialized
+  ///   sketch of the same type, shape and hash.
+  void Merge(std::span<const std::byte> buffer) {
+    DecodeCounters(buffer, /*replace=*/false);
+  }
 
-    // Map g to sign: 0 -> -1, 1 -> +1
-    const int64_t sign = (static_cast<int64_t>(g) * 2) - 1;
+  /// @return the size of the sketch serialized with the given encoding.
+  size_t SerializedSize(
+      CountSketchEncoding encoding = CountSketchEncoding::kInt64) const {
+    return sizeof(CountSketchHeader) +
+           detail::WireAlign(PayloadSize(encoding));
+  }
 
-    return {h, sign};
+  /// Serializes the sketch into `out`, see `CountSketchHeader`.
+  /// @return the number of bytes written, `SerializedSize(encoding)`.
+  /// @throws std::invalid_argument if `out` is too small.
+  /// @throws std::out_of_range if a counter does not fit into the encoding.
+  size_t Serialize(
+      std::span<std::byte> out,
+      CountSketchEncoding encoding = CountSketchEncoding::kInt64) const {
+    const size_t payload_size = PayloadSize(encoding);
+    const size_t size =
+        sizeof(CountSketchHeader) + detail::WireAlign(payload_size);
+    if (out.size() < size) {
+      throw std::invalid_argument("buffer of " + std::to_string(out.size()) +
+                                  " bytes is too small, need " +
+                                  std::to_string(size));
+    }
+    CountSketchHeader header{};
+    header.magic = CountSketchHeader::kMagic;
+    header.version = CountSketchHeader::kVersion;
+    header.type_tag = detail::TypeTag<T>();
+    header.encoding = encoding;
+    header.t = t;
+    header.d = d;
+    header.seed = kSeed;
+    header.hash_family = Hasher::kFamily;
+    header.layout = kLayout;
+    header.block_width = kWireBlockWidth;
+    header.payload_size = payload_size;
+    std::memcpy(out.data(), &header, sizeof(header));
+
+    std::byte* pos = out.data() + sizeof(header);
+    switch (encoding) {
+      case CountSketchEncoding::kInt64:
+        if constexpr (std::is_same_v<Counter, int64_t>) {
+          std::memcpy(pos, C.data(), payload_size);
+        } else {
+          for (size_t i = 0; i < t * d; i++) {
+            detail::StoreUnaligned(pos + i * sizeof(int64_t), GetCounter(i));
+          }
+        }
+        break;
+      case CountSketchEncoding::kInt32:
+        for (size_t i = 0; i < t * d; i++) {
+          detail::StoreUnaligned(pos + i * sizeof(int32_t),
+                                 static_cast<int32_t>(GetCounter(i)));
+        }
+        break;
+      case CountSketchEncoding::kVarint:
+        for (size_t i = 0; i < t * d; i++) {
+          pos += detail::PutVarint(detail::ZigZagEncode(GetCounter(i)), pos);
+        }
+        pos -= payload_size;
+        break;
+    }
+    std::memset(pos + payload_size, 0, size - sizeof(header) - payload_size);
+    return size;
+  }
+
+  /// Replaces the counters of this sketch with the counters of a serialized
+  /// sketch.
+  /// @throws std::invalid_argument if the buffer does not hold a serialized
+  ///   sketch of the same type, shape and hash.
+  void Deserialize(std::span<const std::byte> buffer) {
+    DecodeCounters(buffer, /*replace=*/true);
+  }
+
+  /// Read-only view of a serialized sketch that answers queries from the
+  /// buffer in place, e.g. from a memory-mapped file, without copying the
+  /// counters. The buffer must outlive the view.
+  class View {
+   public:
+    /// @throws std::invalid_argument if the buffer does not hold a serialized
+    ///   sketch of the same type, shape and hash with a fixed-width encoding.
+    explicit View(std::span<const std::byte> buffer)
+        : header_(ReadHeader(buffer)),
+          counters_(buffer.data() + sizeof(CountSketchHeader)) {
+      if (header_.encoding == CountSketchEncoding::kVarint) {
+        throw std::invalid_argument("varint counters cannot be viewed");
+      }
+    }
+
+    /// @return the estimated frequency of a value, see CountSketch::Estimate.
+    int64_t Estimate(const T& value) const noexcept {
+      return Estimate(Hasher::Hash(value));
+    }
+
+    /// @return the estimated frequency of a hashed value.
+    int64_t Estimate(const __uint128_t& hash) const noexcept {
+      if (header_.encoding == CountSketchEncoding::kInt64) {
+        return EstimateImpl<int64_t>(hash);
+      }
+      return EstimateImpl<int32_t>(hash);
+    }
+
+   private:
+    /// @tparam WireCounter type of the serialized counters.
+    template <typename WireCounter>
+    OPT_INLINE int64_t EstimateImpl(const __uint128_t& hash) const {
+      std::array<int64_t, d> estimates;
+      for (size_t j = 0; j < d; j++) {
+        const auto [h, sign] = slots::HashExtract(hash, j);
+        const std::byte* counter =
+            counters_ + slots::CounterIndex(j, h) * sizeof(WireCounter);
+        estimates[j] = sign * detail::LoadUnaligned<WireCounter>(counter);
+      }
+      return slots::Median(estimates);
+    }
+
+    CountSketchHeader header_;
+    const std::byte* counters_;
+  };
+
+  /// Estimate the frequencies of a batch of values.
+  ///
+  /// Hashes in blocks like `InsertBatch` and writes the estimate of
+  /// `values[i]` to `out[i]`.
+  void EstimateBatch(std::span<const T> values, int64_t* out) const noexcept {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      Hasher::HashBatch(values.subspan(i, n), hashes.data());
+      EstimateBatch(std::span<const __uint128_t>(hashes.data(), n), out + i);
+    }
+  }
+
+  /// Estimate the frequencies of a batch of hashed values.
+  ///
+  /// Prefetches the counters ahead for large tables like `InsertBatch`.
+  void EstimateBatch(std::span<const __uint128_t> hashes,
+                     int64_t* out) const noexcept {
+    const size_t n = hashes.size();
+    size_t i = 0;
+    if constexpr (sizeof(C) > kPrefetchMinTableSize) {
+      const size_t prologue = std::min(n, kPrefetchDistance);
+      for (size_t k = 0; k < prologue; ++k) {
+        Prefetch</*rw=*/0>(hashes[k]);
+      }
+      for (; i + kPrefetchDistance < n; ++i) {
+        Prefetch</*rw=*/0>(hashes[i + kPrefetchDistance]);
+        out[i] = Estimate(hashes[i]);
+      }
+    }
+    for (; i < n; ++i) {
+      out[i] = Estimate(hashes[i]);
+    }
+  }
+
+  /// @return the value of the counter at index i of the t * d counters, in
+  /// the order of `slots::CounterIndex`. For the sketches that share the
+  /// layout, see `detail::CountSketchSlots`.
+  OPT_INLINE int64_t GetCounter(size_t i) const noexcept {
+    if constexpr (std::is_same_v<Counter, int64_t>) {
+      return C[i];
+    } else {
+      return UNLIKELY(!spill_.empty()) ? C[i] + spill_.Get(i) : C[i];
+    }
+  }
+
+  /// Adds delta to the counter at index i, see `GetCounter`, spilling the
+  /// sum into the side table if it does not fit into the counter type.
+  OPT_INLINE void AddToCounter(size_t i, int64_t delta) noexcept {
+    if constexpr (std::is_same_v<Counter, int64_t>) {
+      C[i] += delta;
+    } else {
+      // The compiler proves that the sign of a unit insert fits, leaving only
+      // the overflow flag of the narrow add to be checked.
+      Counter sum;
+      if (LIKELY(delta == static_cast<Counter>(delta) &&
+                 !__builtin_add_overflow(C[i], static_cast<Counter>(delta),
+                                         &sum))) {
+        C[i] = sum;
+      } else {
+        Spill(i, int64_t{C[i]} + delta);
+      }
+    }
+  }
+
+  /// Sets all counters to 0.
+  void Clear() noexcept {
+    C.fill(0);
+    spill_.Clear();
+  }
+
+ private:
+  /// Number of values hashed up front by the batch insert.
+  static constexpr size_t kHashBlockSize = 64;
+  /// Number of values the batch insert prefetches the counters ahead.
+  static constexpr size_t kPrefetchDistance = 8;
+  /// Minimum size of the counter table in bytes for which the batch insert
+  /// prefetches counters.
+  static constexpr size_t kPrefetchMinTableSize = size_t{1} << 20;
+
+  /// Counters of the sketch in the order of kLayout, see `CounterIndex`. The
+  /// value of a counter is C[i] plus the carry of the counter in spill_, if
+  /// any. Aligned to cache lines, so that most blocks share one line.
+  alignas(64) std::array<Counter, t * d> C{};
+
+  /// Open addressing hash table of the int64_t carries of the counters that
+  /// overflowed their type. Overflows are rare, so the table is empty until the
+  /// first one, and reads only consult it once it is not empty.
+  class SpillTable {
+   public:
+    /// @return the value of the counter at index, inserting 0 if needed.
+    int64_t& operator[](uint32_t index) {
+      if (2 * (size_ + 1) > slots_.size()) Grow();
+      Slot* slot = Find(index);
+      if (slot->index == kEmpty) {
+        slot->index = index;
+        slot->value = 0;
+        ++size_;
+      }
+      return slot->value;
+    }
+
+    /// @return the value of the counter at index, or 0 if it is not present.
+    int64_t Get(uint32_t index) const {
+      if (size_ == 0) return 0;
+      return const_cast<SpillTable*>(this)->Find(index)->value;
+    }
+
+    bool empty() const { return size_ == 0; }
+
+    /// Removes all counters, keeping the capacity for the next spills.
+    void Clear() {
+      std::fill(slots_.begin(), slots_.end(), Slot{});
+      size_ = 0;
+    }
+
+   private:
+    static constexpr uint32_t kEmpty = std::numeric_limits<uint32_t>::max();
+
+    struct Slot {
+      uint32_t index = kEmpty;
+      int64_t value = 0;
+    };
+
+    /// @return the slot of index, or the empty slot it would be inserted to.
+    Slot* Find(uint32_t index) {
+      const size_t mask = slots_.size() - 1;
+      size_t i = ((index * uint64_t{0x9e3779b97f4a7c15}) >> 32) & mask;
+      while (slots_[i].index != index && slots_[i].index != kEmpty) {
+        i = (i + 1) & mask;
+      }
+      return &slots_[i];
+    }
+
+    void Grow() {
+      std::vector<Slot> old(std::max<size_t>(16, 2 * slots_.size()));
+      old.swap(slots_);
+      for (const Slot& slot : old) {
+        if (slot.index != kEmpty) *Find(slot.index) = slot;
+      }
+    }
+
+    std::vector<Slot> slots_;
+    size_t size_ = 0;
+  };
+
+  /// Carries of the counters that overflowed the counter type.
+  SpillTable spill_;
+
+  /// Block width recorded in the wire format, 0 for the rows layout. The
+  /// blocked counters are only meaningful for the same block width, so a
+  /// sketch with another counter type cannot read them. Blocked sketches
+  /// written before the width was recorded have 0 and are rejected.
+  static constexpr uint16_t kWireBlockWidth =
+      kLayout == CountSketchLayout::kRows ? 0 : kBlockWidth;
+
+  OPT_INLINE int64_t GetCounter(size_t j, size_t h) const {
+    return GetCounter(slots::CounterIndex(j, h));
   }
+
+  OPT_INLINE void AddToCounter(size_t j, size_t h, int64_t delta) {
+    AddToCounter(slots::CounterIndex(j, h), delta);
+  }
+
+  /// Slow path of AddToCounter, moves the sum into the carry of the counter,
+  /// which restarts at 0.
+  __attribute__((noinline, cold)) void Spill(size_t i, int64_t sum) {
+    spill_[i] += sum;
+    C[i] = 0;
+  }
+
+  /// @return the size of the counters in the given encoding.
+  size_t PayloadSize(CountSketchEncoding encoding) const {
+    switch (encoding) {
+      case CountSketchEncoding::kInt64:
+        return t * d * sizeof(int64_t);
+      case CountSketchEncoding::kInt32: {
+        // A branch-free scan for the range vectorizes, a check per counter
+        // does not.
+        int64_t min = 0;
+        int64_t max = 0;
+        for (size_t i = 0; i < t * d; i++) {
+          min = std::min(min, GetCounter(i));
+          max = std::max(max, GetCounter(i));
+        }
+        if (min < std::numeric_limits<int32_t>::min() ||
+            max > std::numeric_limits<int32_t>::max()) {
+          throw std::out_of_range("counters in [" + std::to_string(min) +
+                                  ", " + std::to_string(max) +
+                                  "] do not fit into int32");
+        }
+        return t * d * sizeof(int32_t);
+      }
+      case CountSketchEncoding::kVarint: {
+        size_t size = 0;
+        for (size_t i = 0; i < t * d; i++) {
+          size += detail::VarintSize(detail::ZigZagEncode(GetCounter(i)));
+        }
+        return size;
+      }
+    }
+    throw std::invalid_argument("unknown encoding");
+  }
+
+  /// @return the validated header of a serialized sketch.
+  /// @throws std::invalid_argument if the buffer does not hold a serialized
+  ///   sketch of the same type, shape and hash.
+  static CountSketchHeader ReadHeader(std::span<const std::byte> buffer) {
+    if (buffer.size() < sizeof(CountSketchHeader)) {
+      throw std::invalid_argument("buffer is too small for the header");
+    }
+    const auto header =
+        detail::LoadUnaligned<CountSketchHeader>(buffer.data());
+    if (header.magic != CountSketchHeader::kMagic) {
+      throw std::invalid_argument("not a serialized CountSketch");
+    }
+    if (header.version != CountSketchHeader::kVersion) {
+      throw std::invalid_argument("unsupported version " +
+                                  std::to_string(header.version));
+    }
+    if (header.type_tag != detail::TypeTag<T>() || header.t != t ||
+        header.d != d || header.seed != kSeed ||
+        header.hash_family != Hasher::kFamily || header.layout != kLayout ||
+        header.block_width != kWireBlockWidth) {
+      throw std::invalid_argument("incompatible CountSketch of t=" +
+                                  std::to_string(header.t) +
+                                  ", d=" + std::to_string(header.d) +
+                                  ", block width=" +
+                                  std::to_string(header.block_width));
+    }
+    size_t counter_size = 0;
+    switch (header.encoding) {
+      case CountSketchEncoding::kInt64:
+        counter_size = sizeof(int64_t);
+        break;
+      case CountSketchEncoding::kInt32:
+        counter_size = sizeof(int32_t);
+        break;
+      case CountSketchEncoding::kVarint:
+        break;
+      default:
+        throw std::invalid_argument("unknown encoding");
+    }
+    if ((counter_size != 0 && header.payload_size != t * d * counter_size) ||
+        header.payload_size > buffer.size() - sizeof(CountSketchHeader)) {
+      throw std::invalid_argument("truncated or malformed counters");
+    }
+    return header;
+  }
+
+  /// Decodes the counters of a serialized sketch and adds them to the
+  /// counters, or replaces the counters with them.
+  void DecodeCounters(std::span<const std::byte> buffer, bool replace) {
+    const CountSketchHeader header = ReadHeader(buffer);
+    const std::byte* pos = buffer.data() + sizeof(CountSketchHeader);
+    if (header.encoding == CountSketchEncoding::kVarint) {
+      // Validate the varints in a first pass, so that a malformed buffer
+      // leaves the sketch unchanged without decoding into a copy.
+      const std::byte* check = pos;
+      const std::byte* end = pos + header.payload_size;
+      for (size_t i = 0; i < t * d; i++) {
+        detail::GetVarint(check, end);
+      }
+      if (check != end) {
+        throw std::invalid_argument("truncated or malformed counters");
+      }
+    }
+    if (replace) Clear();
+    switch (header.encoding) {
+      case CountSketchEncoding::kInt64:
+        for (size_t i = 0; i < t * d; i++) {
+          AddToCounter(
+              i, detail::LoadUnaligned<int64_t>(pos + i * sizeof(int64_t)));
+        }
+        break;
+      case CountSketchEncoding::kInt32:
+        for (size_t i = 0; i < t * d; i++) {
+          AddToCounter(
+              i, detail::LoadUnaligned<int32_t>(pos + i * sizeof(int32_t)));
+        }
+        break;
+      case CountSketchEncoding::kVarint: {
+        const std::byte* end = pos + header.payload_size;
+        for (size_t i = 0; i < t * d; i++) {
+          AddToCounter(i, detail::ZigZagDecode(detail::GetVarint(pos, end)));
+        }
+        break;
+      }
+      default:
+        break;
+    }
+  }
+
+  /// Insert a batch of hashed values, with the given weights if kWeighted.
+  template <bool kWeighted>
+  OPT_INLINE void InsertHashedBatch(std::span<const __uint128_t> hashes,
+                                    const uint64_t* weights) {
+    const auto insert = [&](size_t i) {
+      if constexpr (kWeighted) {
+        Insert(hashes[i], weights[i]);
+      } else {
+        Insert(hashes[i]);
+      }
+    };
+    const size_t n = hashes.size();
+    size_t i = 0;
+    if constexpr (sizeof(C) > kPrefetchMinTableSize) {
+      const size_t prologue = std::min(n, kPrefetchDistance);
+      for (size_t k = 0; k < prologue; ++k) {
+        Prefetch(hashes[k]);
+      }
+      for (; i + kPrefetchDistance < n; ++i) {
+        Prefetch(hashes[i + kPrefetchDistance]);
+        insert(i);
+      }
+    }
+    for (; i < n; ++i) {
+      insert(i);
+    }
+  }
+
+  /// Prefetch the d counters of a hashed value, for writing by default.
+  template <int rw = 1>
+  OPT_INLINE void Prefetch(const __uint128_t& hash) const {
+    if constexpr (kLayout == CountSketchLayout::kBlocked) {
+      // the counters of a block span at most two lines
+      const auto [h, sign] = slots::HashExtract(hash, 0);
+      const size_t first = slots::CounterIndex(0, h - h % kBlockWidth);
+      __builtin_prefetch(&C[first], rw);
+      __builtin_prefetch(&C[first + d * kBlockWidth - 1], rw);
+    } else {
+      for (size_t j = 0; j < d; j++) {
+        const auto [h, sign] = slots::HashExtract(hash, j);
+        __builtin_prefetch(&C[slots::CounterIndex(j, h)], rw);
+      }
+    }
+  }
+
 };
 
 }  // namespace final
@@ -70,9 +70,9 @@ class CountSketch {
       // compiler generating only half the instructions.
       const auto lower_hash = static_cast<uint64_t>(hash);
 
-      hashes = (lower_hash >> (j * hash_bits)) % t;
+      hashes = (lower_hash >> (j * hash_bits)) % (2 * t);
     } else {
-      hashes = (hash >> (j * hash_bits)) % t;
+      hashes = (hash >> (j * hash_bits)) % (2 * t);
     }
 
     const uint32_t h = hashes >> 1;
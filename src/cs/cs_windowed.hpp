@@ -0,0 +1,160 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+#include "compiler.hpp"
+#include "cs/cs_final.hpp"
+#include "hash.hpp"
+#include "span.hpp"
+
+namespace windowed {
+
+/// Count Sketch of a sliding window of the last `kWindows` epochs, e.g. the
+/// last 5 minutes in epochs of a minute.
+///
+/// Keeps a ring of `kWindows + 1` counter tables, one per epoch of the window
+/// and a spare, and the sum of the tables of all epochs but the current one.
+/// Inserts only update the table of the current epoch, and queries add the
+/// sum, so both cost the same as in `final::CountSketch` plus a counter read.
+/// The caller ends an epoch with `Rotate`.
+///
+/// A rotation makes the cleared spare the table of the new epoch and expires
+/// the oldest epoch: the table of the ending epoch is added to the sum, the
+/// expired table is subtracted and cleared to become the next spare. This fold
+/// is one pass over three tables that the compiler vectorizes, but at t * d
+/// counters it would still stall the insert that triggers it. So `Rotate`
+/// only switches the tables, and the fold runs in steps of `kFoldStep`
+/// counters on the inserts after it. Until a counter is folded, queries add
+/// the ending and subtract the expired table themselves, so every counter
+/// reads the same as after a complete fold. The fold of the default shape
+/// completes after 160 inserts. A `Rotate` before the previous fold completed
+/// finishes it first.
+///
+/// The counters are 64 bit, so subtracting an epoch is exact.
+///
+/// @tparam T the data type the sketch summarizes.
+/// @tparam t width of the sketch, must be a power of 2.
+/// @tparam d height of the sketch, must be odd.
+/// @tparam kWindows number of epochs of the window, at least 2.
+/// @tparam Hasher the hash policy, see `hash.hpp`.
+template <typename T, size_t t = 2048, size_t d = 5, size_t kWindows = 5,
+          typename Hasher = detail::Murmur3Hasher>
+class CountSketch {
+  using Slots = typename final::CountSketch<T, t, d, int64_t, Hasher>::slots;
+
+  static_assert(kWindows >= 2, "the window must span at least two epochs");
+
+ public:
+  using hasher = Hasher;
+
+  /// Number of counters folded per insert after a rotation.
+  static constexpr size_t kFoldStep = 64;
+
+  /// Insert a value into the current epoch.
+  void Insert(const T& value) noexcept { Insert(Hasher::Hash(value)); }
+
+  /// Insert a value hashed by `Hasher::Hash` into the current epoch.
+  void Insert(const __uint128_t& hash) noexcept { Add(hash, 1); }
+
+  /// Insert a value with the given weight into the current epoch. Weights
+  /// above INT64_MAX count as INT64_MAX.
+  void Insert(const T& value, uint64_t weight) noexcept {
+    Add(Hasher::Hash(value), detail::SignedWeight(weight));
+  }
+
+  /// Insert a batch of values into the current epoch, hashing them in blocks
+  /// like `final::CountSketch::InsertBatch`.
+  void InsertBatch(std::span<const T> values) noexcept {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      Hasher::HashBatch(values.subspan(i, n), hashes.data());
+      for (size_t k = 0; k < n; ++k) {
+        Add(hashes[k], 1);
+      }
+    }
+  }
+
+  /// @return the estimated frequency of a value in the window.
+  int64_t Estimate(const T& value) const noexcept {
+    return Estimate(Hasher::Hash(value));
+  }
+
+  /// @return the estimated frequency of a hashed value in the window, the
+  /// median of its d signed counters.
+  int64_t Estimate(const __uint128_t& hash) const noexcept {
+    std::array<int64_t, d> estimates;
+    for (size_t j = 0; j < d; j++) {
+      const auto [h, sign] = Slots::HashExtract(hash, j);
+      estimates[j] = sign * GetCounter(Slots::CounterIndex(j, h));
+    }
+    return Slots::Median(estimates);
+  }
+
+  /// Ends the current epoch and expires the oldest one, in O(1) time unless
+  /// the fold of the previous rotation is still running, see the class
+  /// comment.
+  void Rotate() noexcept {
+    if (folded_ < kSize) Fold(kSize);
+    ended_ = current_;
+    current_ = (current_ + 1) % kTables;
+    expired_ = (current_ + 1) % kTables;
+    folded_ = 0;
+  }
+
+ private:
+  static constexpr size_t kSize = t * d;
+  /// Number of tables, one per epoch and the spare.
+  static constexpr size_t kTables = kWindows + 1;
+  /// Number of values hashed up front by the batch insert.
+  static constexpr size_t kHashBlockSize = 64;
+
+  /// @return the counter at index i summed over the epochs of the window.
+  OPT_INLINE int64_t GetCounter(size_t i) const {
+    int64_t counter = closed_[i] + epochs_[current_][i];
+    if (UNLIKELY(i >= folded_)) {
+      counter += epochs_[ended_][i] - epochs_[expired_][i];
+    }
+    return counter;
+  }
+
+  OPT_INLINE void Add(const __uint128_t& hash, int64_t weight) {
+    auto& counters = epochs_[current_];
+    for (size_t j = 0; j < d; j++) {
+      const auto [h, sign] = Slots::HashExtract(hash, j);
+      counters[Slots::CounterIndex(j, h)] += sign * weight;
+    }
+    if (UNLIKELY(folded_ < kSize)) Fold(std::min(folded_ + kFoldStep, kSize));
+  }
+
+  /// Folds the counters up to index end, adding the ending epoch to the sum
+  /// and moving the expired epoch out of it.
+  void Fold(size_t end) noexcept {
+    int64_t* __restrict closed = closed_.data();
+    int64_t* __restrict expired = epochs_[expired_].data();
+    const int64_t* __restrict ended = epochs_[ended_].data();
+    for (size_t i = folded_; i < end; ++i) {
+      closed[i] += ended[i] - expired[i];
+      expired[i] = 0;
+    }
+    folded_ = end;
+  }
+
+  /// Counters of every epoch in the layout of `final::CountSketch`, a ring
+  /// in the order of the epochs.
+  alignas(64) std::array<std::array<int64_t, kSize>, kTables> epochs_{};
+  /// Sum of the counters of all epochs but the current one.
+  alignas(64) std::array<int64_t, kSize> closed_{};
+  size_t current_ = 0;
+  /// Epoch that ended with the last rotation.
+  size_t ended_ = 0;
+  /// Epoch that expired with the last rotation, the next spare.
+  size_t expired_ = 1;
+  /// Number of counters folded since the last rotation, from the front.
+  size_t folded_ = kSize;
+};
+
+}  // namespace windowed
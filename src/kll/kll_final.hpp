@@ -19,7 +19,8 @@
 // of the sketch. We made the following significant changes:
 // - Adapted the code to the common interface used in this repo by copying over
 //    the relevant functions.
-// - Removed quantiles_sorted_view as we are only looking at inserts here.
+// - Replaced quantiles_sorted_view with a sorted view that is cached until the
+//    next change of n, so that inserts do not need to invalidate it.
 // - Removed min and max element tracking, which we don't need.
 // - Removed self move protection for fundamental types, saving a few branches.
 // - Removed some debug assertions from the hot path.
@@ -29,23 +30,48 @@
 //    faster without sacrificing randomness quality.
 // - Reducing the number of allocations pre-allocating the maximum
 //    sketch size. It can at maximum contain 985 elements for k=200.
+// - Merging into a workspace that is allocated by the first merge and reused
+//    afterwards, instead of allocating a temporary buffer for every merge.
+// - Added weighted inserts, which place a value on the levels given by the
+//    binary digits of its weight instead of inserting it repeatedly.
+// - Branch-free compaction kernels for fundamental types: level zero is sorted
+//    with a sorting network or a radix sort, the halving gathers every other
+//    value in blocks, and the merges select the smaller head without a branch.
+// - Added batch inserts, which copy blocks of values into level zero and
+//    compact only when it is full.
+// - Storing the level boundaries inline, and constructing the sorted view with
+//    the allocator of the sketch, so that a fleet of sketches can allocate from
+//    an arena. Added Reset to reuse a sketch without reallocating.
+// - Added a compact wire format of the live levels that can be queried in
+//    place, and snapshots that share the items storage with the sketch.
+// - Drawing the random bits of the compactions 64 at a time from pcg64_fast
+//    instead of calling pcg32_fast for every bit, with a seed parameter.
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <functional>
+#include <iterator>
 #include <memory>
-#include <random>
 #include <stdexcept>
+#include <string>
 #include <type_traits>
 #include <utility>
 #include <vector>
 
+#include "branchless_sort.hpp"
+#include "compiler.hpp"
 #include "const.hpp"
-#include "pcg_random.hpp"
+#include "random_bits.hpp"
+#include "serialization.hpp"
 #include "span.hpp"
+#include "types.hpp"
 
 namespace final {
 
@@ -62,6 +88,9 @@ const uint16_t MAX_K = (1 << 16) - 1;
 
 class kll_helper {
  public:
+  // largest level sorted with the radix sort, whose scratch is on the stack
+  static constexpr size_t kMaxRadixSortSize = 1024;
+
   // this version moves objects within the same buffer
   // assumes that destination has initialized objects
   // does not destroy the originals after the move
@@ -77,6 +106,24 @@ class kll_helper {
     uint32_t a = start_a;
     uint32_t b = start_b;
 
+    if constexpr (std::is_fundamental_v<T>) {
+      // The branches below mispredict on every other value of random data.
+      // The output never overtakes b while a has values left, so the heads
+      // are read before they can be overwritten.
+      uint32_t c = start_c;
+      while (a < lim_a && b < lim_b) {
+        const T value_a = buf[a];
+        const T value_b = buf[b];
+        const bool take_a = C()(value_a, value_b);
+        buf[c++] = take_a ? value_a : value_b;
+        a += take_a;
+        b += !take_a;
+      }
+      while (a < lim_a) buf[c++] = buf[a++];
+      while (b < lim_b) buf[c++] = buf[b++];
+      return;
+    }
+
     for (size_t c = start_c; c < lim_c; ++c) {
       if (a == lim_a) {
         if (std::is_fundamental_v<T> || b != c) buf[c] = std::move(buf[b]);
@@ -94,6 +141,103 @@ class kll_helper {
     }
   }
 
+  // this version merges into a different, uninitialized buffer
+  // moves the objects of the first array and copies the second one
+  // does not destroy the originals after the move
+  template <typename T, typename C>
+  static void merge_sorted_arrays(T* buf_a, uint32_t start_a, uint32_t len_a,
+                                  const T* buf_b, uint32_t start_b,
+                                  uint32_t len_b, T* buf_c, uint32_t start_c) {
+    const uint32_t len_c = len_a + len_b;
+    const uint32_t lim_a = start_a + len_a;
+    const uint32_t lim_b = start_b + len_b;
+    const uint32_t lim_c = start_c + len_c;
+
+    uint32_t a = start_a;
+    uint32_t b = start_b;
+
+    if constexpr (std::is_fundamental_v<T>) {
+      uint32_t c = start_c;
+      while (a < lim_a && b < lim_b) {
+        const T value_a = buf_a[a];
+        const T value_b = buf_b[b];
+        const bool take_a = C()(value_a, value_b);
+        buf_c[c++] = take_a ? value_a : value_b;
+        a += take_a;
+        b += !take_a;
+      }
+      while (a < lim_a) buf_c[c++] = buf_a[a++];
+      while (b < lim_b) buf_c[c++] = buf_b[b++];
+      return;
+    }
+
+    for (uint32_t c = start_c; c < lim_c; ++c) {
+      if (a == lim_a) {
+        new (&buf_c[c]) T(buf_b[b++]);
+      } else if (b == lim_b) {
+        new (&buf_c[c]) T(std::move(buf_a[a++]));
+      } else if (C()(buf_a[a], buf_b[b])) {
+        new (&buf_c[c]) T(std::move(buf_a[a++]));
+      } else {
+        new (&buf_c[c]) T(buf_b[b++]);
+      }
+    }
+  }
+
+  // sorts a level without data dependent branches if it orders like the
+  // comparator: level zero shrinks to a few values as the sketch grows, which
+  // the sorting network handles, while a new sketch sorts up to k values
+  template <typename T, typename C>
+  static void sort_level(T* first, T* last, const C& comparator) {
+    if constexpr (detail::is_radix_sortable_v<T> &&
+                  std::is_same_v<C, std::less<T>>) {
+      const size_t n = last - first;
+      if (n > 8 && n <= 16) {
+        detail::SortSmall(first, n);
+        return;
+      }
+      if (detail::PrefersRadixSort<T>(n) && n <= kMaxRadixSortSize) {
+        std::array<T, kMaxRadixSortSize> scratch;
+        detail::RadixSort(first, n, scratch.data());
+        return;
+      }
+    }
+    std::sort(first, last, comparator);
+  }
+
+  // out[i] = in[2 * i] for i < n, where in >= out, in the same buffer
+  // the values are gathered in blocks that are read before they are written,
+  // so that the compiler can vectorize the gather
+  template <typename T>
+  static void gather_every_other(T* out, const T* in, uint32_t n) {
+    constexpr uint32_t kBlock = 64 / sizeof(T);
+    uint32_t i = 0;
+    // a last full block would read in[2 * n - 1], past the level
+    for (; i + kBlock < n; i += kBlock) {
+      T block[2 * kBlock];
+      std::memcpy(block, in + 2 * i, sizeof(block));
+      for (uint32_t k = 0; k < kBlock; ++k) out[i + k] = block[2 * k];
+    }
+    for (; i < n; ++i) out[i] = in[2 * i];
+  }
+
+  // out_last[-i] = in_last[-2 * i] for i < n, where in_last <= out_last, the
+  // mirror image of gather_every_other
+  template <typename T>
+  static void gather_every_other_down(T* out_last, const T* in_last,
+                                      uint32_t n) {
+    constexpr uint32_t kBlock = 64 / sizeof(T);
+    uint32_t i = 0;
+    for (; i + kBlock < n; i += kBlock) {
+      T block[2 * kBlock];
+      std::memcpy(block, in_last - 2 * i - (2 * kBlock - 1), sizeof(block));
+      for (uint32_t k = 0; k < kBlock; ++k) {
+        *(out_last - i - k) = block[2 * kBlock - 1 - 2 * k];
+      }
+    }
+    for (; i < n; ++i) *(out_last - i) = *(in_last - 2 * i);
+  }
+
   template <typename T>
   static void move_construct(T* src, size_t src_first, size_t src_last, T* dst,
                              size_t dst_first, bool destroy) {
@@ -103,6 +247,73 @@ class kll_helper {
       src_first++;
     }
   }
+
+  template <typename T>
+  static void copy_construct(const T* src, size_t src_first, size_t src_last,
+                             T* dst, size_t dst_first) {
+    while (src_first != src_last) {
+      new (&dst[dst_first++]) T(src[src_first++]);
+    }
+  }
+};
+
+/// Fixed header of the KLL wire format.
+///
+/// A serialized sketch is the header followed by the num_levels + 1 level
+/// boundaries as uint32 offsets into the retained values, zero padded to a
+/// multiple of 64 bytes, and the retained values from level zero up, level
+/// zero sorted, zero padded to a multiple of 64 bytes. Only the live levels
+/// are stored, not the free space of level zero. Fixed-width values are stored
+/// as they are, strings as the varint of their size followed by their bytes.
+/// All integers are little-endian.
+struct KllHeader {
+  static constexpr uint32_t kMagic = 0x4c4c4b43;  // "CKLL"
+  static constexpr uint16_t kVersion = 1;
+
+  uint32_t magic;
+  uint16_t version;
+  /// The data type of the sketch, see `detail::TypeTag`.
+  uint8_t type_tag;
+  uint8_t num_levels;
+  uint16_t k;
+  /// Smallest k of the sketches merged into the sketch, for the error bound.
+  uint16_t min_k;
+  uint32_t num_retained;
+  /// Number of values inserted into the sketch, the total weight of the
+  /// retained values.
+  uint64_t n;
+  /// Size of the boundaries and values in bytes, without the final padding.
+  uint64_t payload_size;
+  uint8_t reserved[32];
+};
+static_assert(sizeof(KllHeader) == detail::kWireAlignment);
+static_assert(std::is_trivially_copyable_v<KllHeader>);
+
+/// Items storage of a KLL sketch shared with its snapshots. Owns the values in
+/// [begin, capacity) of the storage, and destroys them and frees the storage
+/// with its last owner, unless the sketch took the storage back.
+template <typename T, typename A>
+struct kll_shared_items {
+  kll_shared_items(const A& allocator, T* storage, size_t capacity,
+                   size_t begin)
+      : allocator(allocator),
+        storage(storage),
+        capacity(capacity),
+        begin(begin) {}
+
+  ~kll_shared_items() {
+    if (storage == nullptr) return;
+    for (size_t i = begin; i < capacity; i++) storage[i].~T();
+    allocator.deallocate(storage, capacity);
+  }
+
+  kll_shared_items(const kll_shared_items&) = delete;
+  kll_shared_items& operator=(const kll_shared_items&) = delete;
+
+  A allocator;
+  T* storage;
+  size_t capacity;
+  size_t begin;
 };
 
 template <typename T, typename C = std::less<T>, typename A = std::allocator<T>>
@@ -114,11 +325,32 @@ class KarninLangLiberty {
   using vector_u32 = std::vector<
       uint32_t,
       typename std::allocator_traits<A>::template rebind_alloc<uint32_t>>;
+  using vector_double = std::vector<
+      double, typename std::allocator_traits<A>::template rebind_alloc<double>>;
+  using vector_t = std::vector<T, A>;
+  /// Quantiles of arithmetic types are returned by value, all others by
+  /// reference into the sorted view, valid until the sketch is changed.
+  using quantile_return_type =
+      std::conditional_t<std::is_arithmetic_v<T>, T, const T&>;
+
+  /// 60 levels are enough to fit std::numeric_limits<size_t>::max() elements.
+  static constexpr size_t kMaxNumLevels = 60;
+
+  /// Seed of the random bits of the compactions unless one is given.
+  static constexpr uint64_t kDefaultSeed = 0xcafef00dd15ea5e5;
 
   explicit KarninLangLiberty(uint16_t k = 200, const C& comparator = C(),
                              const A& allocator = A())
+      : KarninLangLiberty(k, kDefaultSeed, comparator, allocator) {}
 
-      : comparator_(comparator),
+  /// Sketches with the same k and seed that are fed the same inserts, merges
+  /// and resets retain the same values, e.g. for replicas or tests. Sketches
+  /// that are merged with each other should have different seeds, so that
+  /// their compactions are independent.
+  KarninLangLiberty(uint16_t k, uint64_t seed, const C& comparator = C(),
+                    const A& allocator = A())
+      : random_bit(seed),
+        comparator_(comparator),
         allocator_(allocator),
         k_(k),
         m_(8),
@@ -126,9 +358,10 @@ class KarninLangLiberty {
         num_levels_(1),
         is_level_zero_sorted_(false),
         n_(0),
-        levels_(kMaxNumLevels, 0, allocator),
+        level_capacities(compute_level_capacities(k_, m_)),
         max_capacity_(compute_total_capacity(kMaxNumLevels)),
-        level_capacities(compute_level_capacities(k_, m_)) {
+        levels_{},
+        sorted_view_(sorted_view_allocator(allocator)) {
     if (k < kll_constants::MIN_K || k > kll_constants::MAX_K) {
       throw std::invalid_argument(
           "K must be >= " + std::to_string(kll_constants::MIN_K) + " and <= " +
@@ -142,17 +375,71 @@ class KarninLangLiberty {
   ~KarninLangLiberty() {
     if (items_storage_ != nullptr) {
       const uint32_t begin = levels_[0];
-      const uint32_t end = levels_[num_levels_];
+      // the values shared with snapshots are destroyed by their last owner
+      const uint32_t end = shared_items_ != nullptr
+                               ? shared_items_->begin - items_offset()
+                               : levels_[num_levels_];
       for (uint32_t i = begin; i < end; i++) items_[i].~T();
-      allocator_.deallocate(items_storage_, max_capacity_);
+      if (shared_items_ == nullptr) {
+        allocator_.deallocate(items_storage_, max_capacity_);
+      }
+    }
+    if (workspace_ != nullptr) {
+      allocator_.deallocate(workspace_, workspace_capacity_);
     }
-    // reset_sorted_view();
   }
 
   KarninLangLiberty(const KarninLangLiberty& other) = delete;
   KarninLangLiberty& operator=(const KarninLangLiberty& other) = delete;
-  KarninLangLiberty(KarninLangLiberty&& other) = delete;
-  KarninLangLiberty& operator=(KarninLangLiberty&& other) = delete;
+
+  /// Takes over the storage of `other`, which may only be destroyed or assigned
+  /// to afterwards.
+  KarninLangLiberty(KarninLangLiberty&& other) noexcept
+      : random_bit(std::move(other.random_bit)),
+        comparator_(std::move(other.comparator_)),
+        allocator_(std::move(other.allocator_)),
+        k_(other.k_),
+        m_(other.m_),
+        min_k_(other.min_k_),
+        num_levels_(other.num_levels_),
+        is_level_zero_sorted_(other.is_level_zero_sorted_),
+        n_(other.n_),
+        level_capacities(other.level_capacities),
+        max_capacity_(other.max_capacity_),
+        levels_(std::move(other.levels_)),
+        items_storage_(std::exchange(other.items_storage_, nullptr)),
+        items_(other.items_),
+        shared_items_(std::move(other.shared_items_)),
+        workspace_(std::exchange(other.workspace_, nullptr)),
+        workspace_capacity_(std::exchange(other.workspace_capacity_, 0)),
+        sorted_view_(std::move(other.sorted_view_)),
+        sorted_view_n_(other.sorted_view_n_) {}
+
+  /// Swaps the storage with `other`, which releases the previous storage of
+  /// this sketch when it is destroyed.
+  KarninLangLiberty& operator=(KarninLangLiberty&& other) noexcept {
+    using std::swap;
+    swap(random_bit, other.random_bit);
+    swap(comparator_, other.comparator_);
+    swap(allocator_, other.allocator_);
+    swap(k_, other.k_);
+    swap(m_, other.m_);
+    swap(min_k_, other.min_k_);
+    swap(num_levels_, other.num_levels_);
+    swap(is_level_zero_sorted_, other.is_level_zero_sorted_);
+    swap(n_, other.n_);
+    swap(level_capacities, other.level_capacities);
+    swap(max_capacity_, other.max_capacity_);
+    swap(levels_, other.levels_);
+    swap(items_storage_, other.items_storage_);
+    swap(items_, other.items_);
+    swap(shared_items_, other.shared_items_);
+    swap(workspace_, other.workspace_);
+    swap(workspace_capacity_, other.workspace_capacity_);
+    swap(sorted_view_, other.sorted_view_);
+    swap(sorted_view_n_, other.sorted_view_n_);
+    return *this;
+  }
 
   /// Insert a value into the sketch.
   void Insert(const T& x) noexcept { update(x); }
@@ -160,9 +447,467 @@ class KarninLangLiberty {
   /// Insert a value into the sketch.
   void Insert(T&& x) noexcept { update(std::move(x)); }
 
+  /// Insert a batch of values into the sketch, equivalent to inserting them one
+  /// by one.
+  ///
+  /// Copies as many values as fit into the free space of level zero at once,
+  /// and compacts only after level zero filled up, so the bookkeeping per value
+  /// of `Insert` is paid once per block. Integers are copied without checking
+  /// them, NaN values are dropped without a branch.
+  void InsertBatch(std::span<const T> values) noexcept {
+    const T* next = values.data();
+    const T* const end = next + values.size();
+    while (next != end) {
+      if (levels_[0] == 0) compress_while_updating();
+      const uint32_t free = levels_[0];
+      const uint32_t n = static_cast<uint32_t>(
+          std::min<size_t>(free, static_cast<size_t>(end - next)));
+      // the values fill level zero downwards like in update, which keeps the
+      // results identical, since an odd level keeps its first value
+      uint32_t count = n;
+      if constexpr (std::is_floating_point_v<T>) {
+        // every NaN is overwritten by the next value
+        count = 0;
+        for (uint32_t i = 0; i < n; ++i) {
+          items_[free - 1 - count] = next[i];
+          count += !std::isnan(next[i]);
+        }
+      } else {
+        std::uninitialized_copy_n(
+            next, n, std::make_reverse_iterator(items_.data() + free));
+      }
+      levels_[0] = free - count;
+      n_ += count;
+      next += n;
+    }
+    if (!values.empty()) is_level_zero_sorted_ = false;
+  }
+
+  /// Insert a value with the given weight into the sketch, equivalent to
+  /// inserting it `weight` times.
+  ///
+  /// Weights that fit into the free space of level zero are inserted one by
+  /// one. Larger weights are split into their binary digits, and a copy of the
+  /// value is placed on every level h > 0 whose digit is set, where it stands
+  /// for 2^h inserted values. The levels are then compacted like in Merge, so
+  /// the insert takes O(r) time for r retained values regardless of the weight.
+  /// @throws std::invalid_argument if the weight is 2^kMaxWeightBits or more.
+  void Insert(const T& x, uint64_t weight) {
+    if (weight >> kMaxWeightBits != 0) {
+      throw std::invalid_argument("weight must be < 2^" +
+                                  std::to_string(kMaxWeightBits) + ": " +
+                                  std::to_string(weight));
+    }
+    update_weighted(x, weight);
+  }
+
+  /// Merges another sketch into this sketch.
+  ///
+  /// Level zero of `other` is inserted item by item. The higher levels are
+  /// merged level by level with the levels of this sketch into the merge
+  /// workspace, compacted, and moved back into the preallocated items storage.
+  /// Only the first merge allocates the workspace, later merges reuse it.
+  void Merge(const KarninLangLiberty& other) {
+    if (other.is_empty()) return;
+    const uint64_t final_n = n_ + other.n_;
+    for (uint32_t i = other.levels_[0]; i < other.levels_[1]; i++) {
+      const uint32_t index = internal_update();
+      new (&items_[index]) T(other.items_[i]);
+    }
+    if (other.num_levels_ >= 2) merge_higher_levels(other);
+    n_ = final_n;
+    if (other.is_estimation_mode()) min_k_ = std::min(min_k_, other.min_k_);
+  }
+
+  /// Empties the sketch in place, e.g. at the end of a time window.
+  ///
+  /// Keeps the items storage, the merge workspace and the sorted view buffer,
+  /// so a reset sketch fills up again without allocating.
+  void Reset() noexcept {
+    if (UNLIKELY(shared_items_ != nullptr)) unshare_items();
+    for (uint32_t i = levels_[0]; i < levels_[num_levels_]; i++) {
+      items_[i].~T();
+    }
+    levels_.fill(0);
+    levels_[0] = levels_[1] = k_;
+    items_ = std::span<T>(items_storage_ + (max_capacity_ - k_), k_);
+    min_k_ = k_;
+    num_levels_ = 1;
+    is_level_zero_sorted_ = false;
+    n_ = 0;
+    sorted_view_.clear();
+    sorted_view_n_ = 0;
+  }
+
+  /// @return the number of values inserted into the sketch.
+  uint64_t GetN() const noexcept { return n_; }
+
+  /// @return the number of values retained by the sketch.
+  uint32_t GetNumRetained() const noexcept {
+    return levels_[num_levels_] - levels_[0];
+  }
+
+  // The queries below are answered from a sorted view of the retained values
+  // and their weights. The view is built by the first query after the sketch
+  // changed, which takes O(r log r) time for r retained values, and reused by
+  // all queries until then, which take O(log r) time. Since the view is cached
+  // inside the sketch, concurrent queries need external synchronization.
+
+  /// @return the approximate value at the given normalized rank.
+  /// @param rank normalized rank in [0, 1].
+  /// @param inclusive if true, the weight of the returned value is included in
+  ///   the rank.
+  /// @throws std::runtime_error if the sketch is empty.
+  /// @throws std::invalid_argument if the rank is not in [0, 1].
+  quantile_return_type GetQuantile(double rank, bool inclusive = true) const {
+    check_rank(rank);
+    const auto& view = get_sorted_view();
+    const double weight = rank * static_cast<double>(n_);
+    const uint64_t target =
+        inclusive ? static_cast<uint64_t>(std::ceil(weight))
+                  : static_cast<uint64_t>(weight);
+    const auto by_weight = [](const auto& entry, uint64_t w) {
+      return entry.second < w;
+    };
+    const auto by_weight_rev = [](uint64_t w, const auto& entry) {
+      return w < entry.second;
+    };
+    auto it =
+        inclusive
+            ? std::lower_bound(view.begin(), view.end(), target, by_weight)
+            : std::upper_bound(view.begin(), view.end(), target, by_weight_rev);
+    if (it == view.end()) --it;
+    return it->first;
+  }
+
+  /// @return the approximate values at the given normalized ranks.
+  /// @see GetQuantile
+  vector_t GetQuantiles(std::span<const double> ranks,
+                        bool inclusive = true) const {
+    vector_t quantiles(allocator_);
+    quantiles.reserve(ranks.size());
+    for (const double rank : ranks) {
+      quantiles.push_back(GetQuantile(rank, inclusive));
+    }
+    return quantiles;
+  }
+
+  /// @return the approximate normalized rank of the given value.
+  /// @param inclusive if true, the weight of the given value is included in
+  ///   the rank.
+  /// @throws std::runtime_error if the sketch is empty.
+  double GetRank(const T& value, bool inclusive = true) const {
+    const auto& view = get_sorted_view();
+    return static_cast<double>(weight_below(view, value, inclusive)) /
+           static_cast<double>(n_);
+  }
+
+  /// Returns the approximate cumulative distribution function at the given
+  /// split points, i.e. the normalized ranks of the split points followed by
+  /// 1.0 for the interval to the right of the last split point.
+  /// @param split_points unique values in increasing order.
+  /// @throws std::runtime_error if the sketch is empty.
+  /// @throws std::invalid_argument if the split points are not increasing.
+  vector_double GetCDF(std::span<const T> split_points,
+                       bool inclusive = true) const {
+    check_split_points(split_points);
+    const auto& view = get_sorted_view();
+    vector_double ranks(allocator_);
+    ranks.reserve(split_points.size() + 1);
+    for (const auto& split_point : split_points) {
+      ranks.push_back(
+          static_cast<double>(weight_below(view, split_point, inclusive)) /
+          static_cast<double>(n_));
+    }
+    ranks.push_back(1.0);
+    return ranks;
+  }
+
+  /// Returns the approximate probability mass function of the intervals
+  /// defined by the given split points, i.e. the fraction of the values before
+  /// the first split point, between each pair of split points, and after the
+  /// last split point.
+  /// @see GetCDF
+  vector_double GetPMF(std::span<const T> split_points,
+                       bool inclusive = true) const {
+    vector_double masses = GetCDF(split_points, inclusive);
+    for (size_t i = masses.size() - 1; i > 0; --i) {
+      masses[i] -= masses[i - 1];
+    }
+    return masses;
+  }
+
+  /// @return the size of the sketch serialized, see `KllHeader`.
+  size_t SerializedSize() const {
+    return serialized_size(items_.data(), levels_.data(), num_levels_);
+  }
+
+  /// Serializes the live levels of the sketch into `out`, see `KllHeader`.
+  ///
+  /// Takes O(r) time for r retained values, and sorts a copy of level zero
+  /// unless it is sorted. To serialize the sketch on another thread while the
+  /// inserts continue, serialize a `Snapshot` instead.
+  /// @return the number of bytes written, `SerializedSize()`.
+  /// @throws std::invalid_argument if `out` is too small.
+  size_t Serialize(std::span<std::byte> out) const {
+    return serialize_levels(header(), items_.data(), levels_.data(),
+                            is_level_zero_sorted_, comparator_, allocator_,
+                            out);
+  }
+
+  /// Replaces the state of this sketch with a serialized sketch, whose
+  /// levels it continues to compact like the sketch it was serialized from.
+  /// @throws std::invalid_argument if the buffer does not hold a serialized
+  ///   sketch of the same type and k.
+  void Deserialize(std::span<const std::byte> buffer) {
+    const KllHeader header = ReadHeader(buffer);
+    if (header.k != k_) {
+      throw std::invalid_argument("incompatible KLL sketch of k=" +
+                                  std::to_string(header.k));
+    }
+    const auto levels = read_levels(buffer, header);
+    const uint32_t capacity = compute_total_capacity(header.num_levels);
+    if (header.num_retained > capacity) {
+      throw std::invalid_argument("more retained values than the levels hold");
+    }
+    const std::byte* pos = buffer.data() + values_offset(header.num_levels);
+    const std::byte* end = buffer.data() + sizeof(KllHeader) +
+                           header.payload_size;
+    if constexpr (detail::is_string_v<T>) {
+      // Validate the sizes in a first pass, so that a malformed buffer leaves
+      // the sketch unchanged without decoding into a copy.
+      const std::byte* check = pos;
+      for (uint32_t i = 0; i < header.num_retained; i++) {
+        const uint64_t size = detail::GetVarint(check, end);
+        if (size > static_cast<uint64_t>(end - check)) {
+          throw std::invalid_argument("truncated or malformed values");
+        }
+        check += size;
+      }
+      if (check != end) {
+        throw std::invalid_argument("truncated or malformed values");
+      }
+    }
+
+    Reset();
+    items_ = std::span<T>(items_storage_ + max_capacity_ - capacity, capacity);
+    const uint32_t begin = capacity - header.num_retained;
+    for (uint8_t level = 0; level <= header.num_levels; level++) {
+      levels_[level] = begin + levels[level];
+    }
+    for (uint32_t i = begin; i < capacity; i++) {
+      if constexpr (detail::is_string_v<T>) {
+        const uint64_t size = detail::GetVarint(pos, end);
+        new (&items_[i]) T(reinterpret_cast<const char*>(pos), size);
+        pos += size;
+      } else {
+        new (&items_[i]) T(detail::LoadUnaligned<T>(pos));
+        pos += sizeof(T);
+      }
+    }
+    num_levels_ = header.num_levels;
+    n_ = header.n;
+    min_k_ = header.min_k;
+    is_level_zero_sorted_ = true;
+  }
+
+  /// Read-only view of a serialized sketch that answers queries from the
+  /// buffer in place, e.g. from a memory-mapped file after a restart, without
+  /// copying the retained values or building a sorted view.
+  ///
+  /// Every level of the wire format is sorted, so a rank is the sum of a
+  /// binary search per level, and a quantile is found by a binary search per
+  /// level over the ranks of its values. For h levels and r retained values, a
+  /// rank takes O(h log(r)) time and a quantile O(h^2 log(r)^2) time, and the
+  /// results are the same as those of the serialized sketch. Only arithmetic
+  /// values can be viewed. The buffer must outlive the view.
+  class View {
+    static_assert(std::is_arithmetic_v<T>,
+                  "only sketches of arithmetic values can be viewed");
+
+   public:
+    /// @throws std::invalid_argument if the buffer does not hold a serialized
+    ///   sketch of the same type.
+    explicit View(std::span<const std::byte> buffer)
+        : header_(ReadHeader(buffer)),
+          levels_(read_levels(buffer, header_)),
+          values_(buffer.data() + values_offset(header_.num_levels)) {}
+
+    /// @return the number of values inserted into the serialized sketch.
+    uint64_t GetN() const noexcept { return header_.n; }
+
+    /// @return the number of values retained by the serialized sketch.
+    uint32_t GetNumRetained() const noexcept { return header_.num_retained; }
+
+    /// @return the approximate normalized rank of the given value, see
+    /// KarninLangLiberty::GetRank.
+    /// @throws std::runtime_error if the sketch is empty.
+    double GetRank(const T& value, bool inclusive = true) const {
+      check_not_empty();
+      return static_cast<double>(weight_below(value, inclusive)) /
+             static_cast<double>(header_.n);
+    }
+
+    /// @return the approximate value at the given normalized rank, see
+    /// KarninLangLiberty::GetQuantile.
+    /// @throws std::runtime_error if the sketch is empty.
+    /// @throws std::invalid_argument if the rank is not in [0, 1].
+    T GetQuantile(double rank, bool inclusive = true) const {
+      check_rank(rank);
+      check_not_empty();
+      const double weight = rank * static_cast<double>(header_.n);
+      const uint64_t target =
+          inclusive ? static_cast<uint64_t>(std::ceil(weight))
+                    : static_cast<uint64_t>(weight);
+      // The sorted view of the sketch returns the smallest value whose
+      // inclusive rank reaches (or, if exclusive, exceeds) the target, or the
+      // largest value if there is none.
+      const auto below_target = [&](const T& v) {
+        const uint64_t w = weight_below(v, /*inclusive=*/true);
+        return inclusive ? w < target : w <= target;
+      };
+      bool found = false;
+      T quantile{};
+      for (uint8_t level = 0; level < header_.num_levels; ++level) {
+        const uint32_t last = levels_[level + 1];
+        const uint32_t i = search(levels_[level], last, below_target);
+        if (i == last) continue;
+        const T v = value(i);
+        if (!found || C()(v, quantile)) quantile = v;
+        found = true;
+      }
+      if (found) return quantile;
+      for (uint8_t level = 0; level < header_.num_levels; ++level) {
+        if (levels_[level] == levels_[level + 1]) continue;
+        const T v = value(levels_[level + 1] - 1);
+        if (!found || C()(quantile, v)) quantile = v;
+        found = true;
+      }
+      return quantile;
+    }
+
+   private:
+    OPT_INLINE T value(uint32_t i) const {
+      return detail::LoadUnaligned<T>(values_ + size_t{i} * sizeof(T));
+    }
+
+    /// @return the first index in [first, last) whose value does not satisfy
+    /// pred, where pred holds for a prefix of the range.
+    template <typename Pred>
+    uint32_t search(uint32_t first, uint32_t last, const Pred& pred) const {
+      while (first < last) {
+        const uint32_t mid = first + (last - first) / 2;
+        if (pred(value(mid))) {
+          first = mid + 1;
+        } else {
+          last = mid;
+        }
+      }
+      return first;
+    }
+
+    /// @return the total weight of the values less than (or equal to, if
+    /// inclusive) the given value.
+    uint64_t weight_below(const T& v, bool inclusive) const {
+      uint64_t weight = 0;
+      for (uint8_t level = 0; level < header_.num_levels; ++level) {
+        const uint32_t first = levels_[level];
+        const uint32_t i =
+            inclusive
+                ? search(first, levels_[level + 1],
+                         [&](const T& x) { return !C()(v, x); })
+                : search(first, levels_[level + 1],
+                         [&](const T& x) { return C()(x, v); });
+        weight += uint64_t{i - first} << level;
+      }
+      return weight;
+    }
+
+    void check_not_empty() const {
+      if (header_.n == 0) {
+        throw std::runtime_error("operation is undefined for an empty sketch");
+      }
+    }
+
+    KllHeader header_;
+    /// Boundaries of the levels, as indices of the values.
+    std::array<uint32_t, kMaxNumLevels + 2> levels_;
+    const std::byte* values_;
+  };
+
+  /// Read-only copy of the retained values of a sketch, taken by
+  /// `TakeSnapshot`, e.g. to serialize a sketch on a background thread while
+  /// the inserts continue.
+  ///
+  /// A snapshot shares the items storage of the sketch instead of copying it.
+  /// Inserts only write into the free space below level zero, so the shared
+  /// values stay unchanged until the sketch compacts, merges or resets. Before
+  /// it does, the sketch copies its values into a new storage and leaves the
+  /// old one to the snapshot, unless the snapshot was destroyed by then. The
+  /// copy is the cost of the snapshot, paid once per snapshot at most, and
+  /// never while the snapshot is taken. A snapshot can be read on another
+  /// thread than the sketch without synchronization, and outlive the sketch.
+  class Snapshot {
+   public:
+    /// @return the number of values inserted into the sketch when the
+    /// snapshot was taken.
+    uint64_t GetN() const noexcept { return header_.n; }
+
+    /// @return the number of values retained by the sketch when the snapshot
+    /// was taken.
+    uint32_t GetNumRetained() const noexcept { return header_.num_retained; }
+
+    /// @return the size of the snapshot serialized, like
+    /// KarninLangLiberty::SerializedSize.
+    size_t SerializedSize() const {
+      return serialized_size(items_, levels_.data(), header_.num_levels);
+    }
+
+    /// Serializes the snapshot into `out`, like KarninLangLiberty::Serialize.
+    /// @return the number of bytes written, `SerializedSize()`.
+    /// @throws std::invalid_argument if `out` is too small.
+    size_t Serialize(std::span<std::byte> out) const {
+      return serialize_levels(header_, items_, levels_.data(),
+                              is_level_zero_sorted_, comparator_, allocator_,
+                              out);
+    }
+
+   private:
+    friend class KarninLangLiberty;
+
+    explicit Snapshot(const KarninLangLiberty& sketch)
+        : shared_items_(sketch.shared_items_),
+          items_(sketch.items_.data()),
+          levels_(sketch.levels_),
+          header_(sketch.header()),
+          is_level_zero_sorted_(sketch.is_level_zero_sorted_),
+          comparator_(sketch.comparator_),
+          allocator_(sketch.allocator_) {}
+
+    std::shared_ptr<const kll_shared_items<T, A>> shared_items_;
+    const T* items_;
+    std::array<uint32_t, kMaxNumLevels + 2> levels_;
+    KllHeader header_;
+    bool is_level_zero_sorted_;
+    C comparator_;
+    A allocator_;
+  };
+
+  /// @return a snapshot of the sketch, see `Snapshot`.
+  ///
+  /// Takes O(1) time, unless an earlier snapshot still shares the values,
+  /// which the sketch then copies like a compaction would.
+  Snapshot TakeSnapshot() {
+    if (shared_items_ != nullptr) unshare_items();
+    shared_items_ = std::allocate_shared<kll_shared_items<T, A>>(
+        allocator_, allocator_, items_storage_, max_capacity_,
+        items_offset() + levels_[0]);
+    return Snapshot(*this);
+  }
+
  private:
-  /// Randomness source.
-  std::independent_bits_engine<pcg32_fast, 1, uint32_t> random_bit;
+  /// Randomness source, one draw of the engine per 64 compactions.
+  detail::RandomBits<pcg64_fast> random_bit;
 
   C comparator_;
   A allocator_;
@@ -172,18 +917,51 @@ class KarninLangLiberty {
   uint8_t num_levels_;
   bool is_level_zero_sorted_;
   uint64_t n_;
+
+  /// A weighted insert occupies one level per bit of the weight, which leaves
+  /// enough levels for the compaction to grow the sketch.
+  static constexpr size_t kMaxWeightBits = 48;
+  /// Declared before max_capacity_, which is computed from the capacities.
+  std::array<uint16_t, kMaxNumLevels> level_capacities;
+
   size_t max_capacity_;
-  vector_u32 levels_;
+  /// Level boundaries, stored inline so that a sketch makes one allocation.
+  /// Holds the "extra" index at the top, and the index above it for a new top
+  /// level.
+  std::array<uint32_t, kMaxNumLevels + 2> levels_;
   T* items_storage_;
   std::span<T> items_;
+  /// Owner of the items storage while snapshots share it, see TakeSnapshot.
+  std::shared_ptr<kll_shared_items<T, A>> shared_items_;
 
-  /// 60 levels are enough to fit std::numeric_limits<size_t>::max() elements.
-  static constexpr size_t kMaxNumLevels = 60;
-  std::array<uint16_t, kMaxNumLevels> level_capacities;
+  /// Uninitialized buffer the levels are merged into, see Merge.
+  T* workspace_ = nullptr;
+  uint32_t workspace_capacity_ = 0;
+
+  /// Sorted (value, cumulative weight) pairs, built for sorted_view_n_ values.
+  using sorted_view_entry = std::pair<T, uint64_t>;
+  using sorted_view_allocator = typename std::allocator_traits<
+      A>::template rebind_alloc<sorted_view_entry>;
+  using sorted_view = std::vector<sorted_view_entry, sorted_view_allocator>;
+  mutable sorted_view sorted_view_;
+  /// The sketch only ever grows until it is reset, so n identifies the state
+  /// the view was built for. An empty sketch has no valid view.
+  mutable uint64_t sorted_view_n_ = 0;
+
+  struct compress_result {
+    uint8_t final_num_levels;
+    uint32_t final_capacity;
+    uint32_t final_num_items;
+  };
 
   void randomly_halve_down(T* buf, uint32_t start, uint32_t length) {
     const uint32_t half_length = length / 2;
     const uint32_t offset = random_bit();
+    if constexpr (std::is_fundamental_v<T>) {
+      kll_helper::gather_every_other(buf + start, buf + start + offset,
+                                     half_length);
+      return;
+    }
     uint32_t j = start + offset;
     for (uint32_t i = start; i < (start + half_length); i++) {
       if (std::is_fundamental_v<T> || i != j) buf[i] = std::move(buf[j]);
@@ -194,6 +972,12 @@ class KarninLangLiberty {
   void randomly_halve_up(T* buf, uint32_t start, uint32_t length) {
     const uint32_t half_length = length / 2;
     const uint32_t offset = random_bit();
+    if constexpr (std::is_fundamental_v<T>) {
+      kll_helper::gather_every_other_down(buf + start + length - 1,
+                                          buf + start + length - 1 - offset,
+                                          length - half_length);
+      return;
+    }
     uint32_t j = (start + length) - 1 - offset;
     for (uint32_t i = (start + length) - 1; i >= (start + half_length); i--) {
       if (std::is_fundamental_v<T> || i != j) buf[i] = std::move(buf[j]);
@@ -269,6 +1053,303 @@ class KarninLangLiberty {
 
   bool is_empty() const { return n_ == 0; }
 
+  /// @return the index of the first item of items_ in the items storage.
+  size_t items_offset() const {
+    return static_cast<size_t>(items_.data() - items_storage_);
+  }
+
+  /// Stops sharing the retained values with snapshots before they change.
+  /// Takes the items storage back if no snapshot refers to it anymore, and
+  /// otherwise leaves it to the snapshots and continues on a copy.
+  __attribute__((noinline, cold)) void unshare_items() {
+    if (shared_items_.use_count() == 1) {
+      // Synchronizes with the release of the last snapshot, so that its reads
+      // happen before the values are overwritten.
+      std::atomic_thread_fence(std::memory_order_acquire);
+      shared_items_->storage = nullptr;
+      shared_items_.reset();
+      return;
+    }
+    const size_t offset = items_offset();
+    const size_t shared_begin = shared_items_->begin;
+    T* storage = allocator_.allocate(max_capacity_);
+    // the values inserted since the snapshot are moved, the shared ones copied
+    kll_helper::move_construct<T>(items_storage_, offset + levels_[0],
+                                  shared_begin, storage, offset + levels_[0],
+                                  true);
+    kll_helper::copy_construct<T>(items_storage_, shared_begin, max_capacity_,
+                                  storage, shared_begin);
+    items_storage_ = storage;
+    items_ = std::span<T>(storage + offset, items_.size());
+    shared_items_.reset();
+  }
+
+  /// @return the header of the sketch without the payload size.
+  KllHeader header() const {
+    KllHeader header{};
+    header.magic = KllHeader::kMagic;
+    header.version = KllHeader::kVersion;
+    header.type_tag = detail::TypeTag<T>();
+    header.num_levels = num_levels_;
+    header.k = k_;
+    header.min_k = min_k_;
+    header.num_retained = GetNumRetained();
+    header.n = n_;
+    return header;
+  }
+
+  /// @return the size of the level boundaries in the wire format, padded.
+  static size_t boundaries_size(uint8_t num_levels) {
+    return detail::WireAlign((size_t{num_levels} + 1) * sizeof(uint32_t));
+  }
+
+  /// @return the offset of the values in a serialized sketch.
+  static size_t values_offset(uint8_t num_levels) {
+    return sizeof(KllHeader) + boundaries_size(num_levels);
+  }
+
+  /// @return the size of the values [first, last) in the wire format.
+  static size_t values_size(const T* first, const T* last) {
+    static_assert(std::is_arithmetic_v<T> || detail::is_string_v<T>,
+                  "only arithmetic values and strings can be serialized");
+    if constexpr (detail::is_string_v<T>) {
+      size_t size = 0;
+      for (; first != last; ++first) {
+        size += detail::VarintSize(first->size()) + first->size();
+      }
+      return size;
+    } else {
+      return static_cast<size_t>(last - first) * sizeof(T);
+    }
+  }
+
+  /// Writes the values [first, last) in the wire format to pos.
+  /// @return the position after the values.
+  static std::byte* put_values(const T* first, const T* last, std::byte* pos) {
+    if constexpr (detail::is_string_v<T>) {
+      for (; first != last; ++first) {
+        pos += detail::PutVarint(first->size(), pos);
+        std::memcpy(pos, first->data(), first->size());
+        pos += first->size();
+      }
+      return pos;
+    } else {
+      const size_t size = static_cast<size_t>(last - first) * sizeof(T);
+      std::memcpy(pos, first, size);
+      return pos + size;
+    }
+  }
+
+  /// @return the size of the serialized levels [levels[0],
+  /// levels[num_levels]) of items.
+  static size_t serialized_size(const T* items, const uint32_t* levels,
+                                uint8_t num_levels) {
+    return sizeof(KllHeader) +
+           detail::WireAlign(boundaries_size(num_levels) +
+                             values_size(items + levels[0],
+                                         items + levels[num_levels]));
+  }
+
+  /// Serializes the levels of items given by the header into out, shared by
+  /// the sketch and its snapshots.
+  static size_t serialize_levels(KllHeader header, const T* items,
+                                 const uint32_t* levels,
+                                 bool is_level_zero_sorted,
+                                 const C& comparator, const A& allocator,
+                                 std::span<std::byte> out) {
+    const uint8_t num_levels = header.num_levels;
+    const size_t boundaries = boundaries_size(num_levels);
+    const size_t payload_size =
+        boundaries +
+        values_size(items + levels[0], items + levels[num_levels]);
+    const size_t size = sizeof(KllHeader) + detail::WireAlign(payload_size);
+    if (out.size() < size) {
+      throw std::invalid_argument("buffer of " + std::to_string(out.size()) +
+                                  " bytes is too small, need " +
+                                  std::to_string(size));
+    }
+    header.payload_size = payload_size;
+    std::memcpy(out.data(), &header, sizeof(header));
+
+    std::byte* pos = out.data() + sizeof(header);
+    for (uint8_t level = 0; level <= num_levels; level++) {
+      detail::StoreUnaligned(pos + level * sizeof(uint32_t),
+                             levels[level] - levels[0]);
+    }
+    const size_t boundaries_end = (size_t{num_levels} + 1) * sizeof(uint32_t);
+    std::memset(pos + boundaries_end, 0, boundaries - boundaries_end);
+    pos += boundaries;
+    if (is_level_zero_sorted || levels[1] - levels[0] < 2) {
+      pos = put_values(items + levels[0], items + levels[num_levels], pos);
+    } else {
+      vector_t level_zero(items + levels[0], items + levels[1], allocator);
+      kll_helper::sort_level(level_zero.data(),
+                             level_zero.data() + level_zero.size(),
+                             comparator);
+      pos = put_values(level_zero.data(), level_zero.data() + level_zero.size(),
+                       pos);
+      pos = put_values(items + levels[1], items + levels[num_levels], pos);
+    }
+    std::memset(pos, 0, out.data() + size - pos);
+    return size;
+  }
+
+  /// @return the validated header of a serialized sketch.
+  /// @throws std::invalid_argument if the buffer does not hold a serialized
+  ///   sketch of the same type.
+  static KllHeader ReadHeader(std::span<const std::byte> buffer) {
+    if (buffer.size() < sizeof(KllHeader)) {
+      throw std::invalid_argument("buffer is too small for the header");
+    }
+    const auto header = detail::LoadUnaligned<KllHeader>(buffer.data());
+    if (header.magic != KllHeader::kMagic) {
+      throw std::invalid_argument("not a serialized KLL sketch");
+    }
+    if (header.version != KllHeader::kVersion) {
+      throw std::invalid_argument("unsupported version " +
+                                  std::to_string(header.version));
+    }
+    if (header.type_tag != detail::TypeTag<T>()) {
+      throw std::invalid_argument("incompatible KLL sketch of type " +
+                                  std::to_string(header.type_tag));
+    }
+    if (header.num_levels == 0 || header.num_levels > kMaxNumLevels ||
+        header.k < kll_constants::MIN_K ||
+        header.min_k < kll_constants::MIN_K || header.min_k > header.k) {
+      throw std::invalid_argument("malformed KLL sketch of k=" +
+                                  std::to_string(header.k));
+    }
+    const size_t boundaries = boundaries_size(header.num_levels);
+    const bool fixed_width = !detail::is_string_v<T>;
+    if (header.payload_size > buffer.size() - sizeof(KllHeader) ||
+        header.payload_size < boundaries ||
+        (fixed_width && header.payload_size !=
+                            boundaries + size_t{header.num_retained} *
+                                             sizeof(T))) {
+      throw std::invalid_argument("truncated or malformed values");
+    }
+    return header;
+  }
+
+  /// @return the validated level boundaries of a serialized sketch, whose
+  /// weights add up to n.
+  /// @throws std::invalid_argument if the boundaries are malformed.
+  static std::array<uint32_t, kMaxNumLevels + 2> read_levels(
+      std::span<const std::byte> buffer, const KllHeader& header) {
+    std::array<uint32_t, kMaxNumLevels + 2> levels{};
+    const std::byte* pos = buffer.data() + sizeof(KllHeader);
+    for (uint8_t level = 0; level <= header.num_levels; level++) {
+      levels[level] =
+          detail::LoadUnaligned<uint32_t>(pos + level * sizeof(uint32_t));
+    }
+    if (levels[0] != 0 || levels[header.num_levels] != header.num_retained) {
+      throw std::invalid_argument("malformed level boundaries");
+    }
+    __uint128_t weight = 0;
+    for (uint8_t level = 0; level < header.num_levels; level++) {
+      if (levels[level + 1] < levels[level]) {
+        throw std::invalid_argument("malformed level boundaries");
+      }
+      weight += static_cast<__uint128_t>(levels[level + 1] - levels[level])
+                << level;
+    }
+    if (weight != header.n) {
+      throw std::invalid_argument(
+          "the weights of the levels do not add up to " +
+          std::to_string(header.n));
+    }
+    return levels;
+  }
+
+  /// @return the sorted view of the sketch, rebuilding it if it is outdated.
+  const sorted_view& get_sorted_view() const {
+    if (is_empty()) {
+      throw std::runtime_error("operation is undefined for an empty sketch");
+    }
+    if (sorted_view_n_ != n_) setup_sorted_view();
+    return sorted_view_;
+  }
+
+  /// Only level zero needs to be sorted, all higher levels are sorted already
+  /// and merged into the view one after the other.
+  void setup_sorted_view() const {
+    const auto by_value = [this](const auto& a, const auto& b) {
+      return comparator_(a.first, b.first);
+    };
+    sorted_view_.clear();
+    sorted_view_.reserve(GetNumRetained());
+    for (uint8_t level = 0; level < num_levels_; ++level) {
+      const uint64_t weight = uint64_t{1} << level;
+      const auto mid = static_cast<std::ptrdiff_t>(sorted_view_.size());
+      for (uint32_t i = levels_[level]; i < levels_[level + 1]; ++i) {
+        sorted_view_.emplace_back(items_[i], weight);
+      }
+      if (level == 0) {
+        std::sort(sorted_view_.begin(), sorted_view_.end(), by_value);
+      } else {
+        std::inplace_merge(sorted_view_.begin(), sorted_view_.begin() + mid,
+                           sorted_view_.end(), by_value);
+      }
+    }
+    uint64_t cumulative_weight = 0;
+    for (auto& entry : sorted_view_) {
+      cumulative_weight += entry.second;
+      entry.second = cumulative_weight;
+    }
+    sorted_view_n_ = n_;
+  }
+
+  /// @return the total weight of the values less than (or equal to, if
+  /// inclusive) the given value.
+  uint64_t weight_below(const sorted_view& view, const T& value,
+                        bool inclusive) const {
+    auto it =
+        inclusive
+            ? std::upper_bound(view.begin(), view.end(), value,
+                               [this](const T& v, const auto& entry) {
+                                 return comparator_(v, entry.first);
+                               })
+            : std::lower_bound(view.begin(), view.end(), value,
+                               [this](const auto& entry, const T& v) {
+                                 return comparator_(entry.first, v);
+                               });
+    if (it == view.begin()) return 0;
+    return std::prev(it)->second;
+  }
+
+  static void check_rank(double rank) {
+    if (!(rank >= 0 && rank <= 1)) {
+      throw std::invalid_argument(
+          "normalized rank cannot be less than 0 or greater than 1");
+    }
+  }
+
+  void check_split_points(std::span<const T> split_points) const {
+    for (size_t i = 0; i < split_points.size(); ++i) {
+      if constexpr (std::is_floating_point_v<T>) {
+        if (std::isnan(split_points[i])) {
+          throw std::invalid_argument("split points must not be NaN");
+        }
+      }
+      if (i > 0 && !comparator_(split_points[i - 1], split_points[i])) {
+        throw std::invalid_argument(
+            "split points must be unique and monotonically increasing");
+      }
+    }
+  }
+
+  bool is_estimation_mode() const { return num_levels_ > 1; }
+
+  uint32_t safe_level_size(uint8_t level) const {
+    if (level >= num_levels_) return 0;
+    return levels_[level + 1] - levels_[level];
+  }
+
+  uint32_t get_num_retained_above_level_zero() const {
+    if (num_levels_ == 1) return 0;
+    return levels_[num_levels_] - levels_[1];
+  }
+
   uint8_t find_level_to_compact() const {
     uint8_t level = 0;
     while (true) {
@@ -284,13 +1365,6 @@ class KarninLangLiberty {
   void add_empty_top_level_to_completely_full_sketch() {
     const uint32_t cur_total_cap = levels_[num_levels_];
 
-    // note that merging MIGHT over-grow levels_, in which case we might not
-    // have to grow it here
-    const uint8_t new_levels_size = num_levels_ + 2;
-    if (levels_.size() < new_levels_size) {
-      levels_.resize(new_levels_size);
-    }
-
     const uint32_t delta_cap = level_capacity(k_, num_levels_ + 1, 0, m_);
     const uint32_t new_total_cap = cur_total_cap + delta_cap;
 
@@ -308,6 +1382,7 @@ class KarninLangLiberty {
   }
 
   void compress_while_updating(void) {
+    if (UNLIKELY(shared_items_ != nullptr)) unshare_items();
     const uint8_t level = find_level_to_compact();
 
     // It is important to add the new top level right here. Be aware that this
@@ -332,7 +1407,8 @@ class KarninLangLiberty {
     // it sort_level_zero() is not used here because of the adjustment for odd
     // number of items
     if ((level == 0) && !is_level_zero_sorted_) {
-      std::sort(items_.begin() + adj_beg, items_.begin() + adj_beg + adj_pop, comparator_);
+      kll_helper::sort_level(items_.data() + adj_beg,
+                             items_.data() + adj_beg + adj_pop, comparator_);
     }
     if (pop_above == 0) {
       randomly_halve_up(items_.data(), adj_beg, adj_pop);
@@ -373,6 +1449,235 @@ class KarninLangLiberty {
     return --levels_[0];
   }
 
+  /// Grows the merge workspace to fit at least `num_items` items.
+  void reserve_workspace(uint32_t num_items) {
+    if (workspace_capacity_ >= num_items) return;
+    if (workspace_ != nullptr) {
+      allocator_.deallocate(workspace_, workspace_capacity_);
+      workspace_ = nullptr;
+    }
+    // Two full sketches always fit, so most callers allocate only once.
+    const uint32_t capacity =
+        std::max<uint32_t>(num_items, 2 * static_cast<uint32_t>(max_capacity_));
+    workspace_ = allocator_.allocate(capacity);
+    workspace_capacity_ = capacity;
+  }
+
+  void merge_higher_levels(const KarninLangLiberty& other) {
+    if (UNLIKELY(shared_items_ != nullptr)) unshare_items();
+    const uint32_t tmp_num_items =
+        GetNumRetained() + other.get_num_retained_above_level_zero();
+    reserve_workspace(tmp_num_items);
+    T* workbuf = workspace_;
+    std::array<uint32_t, kMaxNumLevels + 2> worklevels{};
+
+    const uint8_t provisional_num_levels =
+        std::max(num_levels_, other.num_levels_);
+
+    populate_work_arrays(other, workbuf, worklevels.data(),
+                         provisional_num_levels);
+
+    compress_workspace(provisional_num_levels, tmp_num_items,
+                       worklevels.data());
+  }
+
+  /// Places a weighted value on the levels of its weight above level zero,
+  /// next to the levels of this sketch in the merge workspace, and compacts
+  /// them like merge_higher_levels does.
+  void merge_weighted_levels(const T& item, uint64_t weight) {
+    if (UNLIKELY(shared_items_ != nullptr)) unshare_items();
+    const auto weight_levels =
+        static_cast<uint8_t>(64 - __builtin_clzll(weight));
+    const uint32_t tmp_num_items =
+        GetNumRetained() + __builtin_popcountll(weight >> 1);
+    reserve_workspace(tmp_num_items);
+    T* workbuf = workspace_;
+    std::array<uint32_t, kMaxNumLevels + 2> worklevels{};
+
+    const uint8_t provisional_num_levels = std::max(num_levels_, weight_levels);
+
+    worklevels[0] = 0;
+    kll_helper::move_construct<T>(items_.data(), levels_[0], levels_[1],
+                                  workbuf, 0, true);
+    worklevels[1] = safe_level_size(0);
+    for (uint8_t lvl = 1; lvl < provisional_num_levels; lvl++) {
+      const uint32_t self_pop = safe_level_size(lvl);
+      const uint32_t beg = self_pop > 0 ? levels_[lvl] : 0;
+      const uint32_t out = worklevels[lvl];
+      // the levels above zero are sorted, so the value goes after its peers
+      const uint32_t split =
+          ((weight >> lvl) & 1) == 0
+              ? self_pop
+              : std::upper_bound(items_.data() + beg,
+                                 items_.data() + beg + self_pop, item,
+                                 comparator_) -
+                    (items_.data() + beg);
+      kll_helper::move_construct<T>(items_.data(), beg, beg + split, workbuf,
+                                    out, true);
+      uint32_t added = 0;
+      if ((weight >> lvl) & 1) {
+        new (&workbuf[out + split]) T(item);
+        added = 1;
+      }
+      kll_helper::move_construct<T>(items_.data(), beg + split, beg + self_pop,
+                                    workbuf, out + split + added, true);
+      worklevels[lvl + 1] = out + self_pop + added;
+    }
+
+    compress_workspace(provisional_num_levels, tmp_num_items,
+                       worklevels.data());
+  }
+
+  /// Compacts the levels populated in the merge workspace and moves the result
+  /// back into the items storage.
+  void compress_workspace(uint8_t provisional_num_levels,
+                          uint32_t tmp_num_items, uint32_t* worklevels) {
+    T* workbuf = workspace_;
+    std::array<uint32_t, kMaxNumLevels + 2> outlevels{};
+    const compress_result result = general_compress(
+        provisional_num_levels, workbuf, worklevels, outlevels.data());
+
+    // now we need to transfer the results back into "this" sketch, the items
+    // storage fits the capacity of any number of levels
+    const uint32_t capacity = result.final_capacity;
+    items_ = std::span<T>(items_storage_ + max_capacity_ - capacity, capacity);
+    const uint32_t free_space_at_bottom =
+        result.final_capacity - result.final_num_items;
+    kll_helper::move_construct<T>(workbuf, outlevels[0],
+                                  outlevels[0] + result.final_num_items,
+                                  items_.data(), free_space_at_bottom, false);
+    for (uint32_t i = 0; i < tmp_num_items; i++) workbuf[i].~T();
+
+    const uint32_t offset = free_space_at_bottom - outlevels[0];
+    // includes the "extra" index
+    for (uint8_t lvl = 0; lvl <= result.final_num_levels; lvl++) {
+      levels_[lvl] = outlevels[lvl] + offset;
+    }
+    num_levels_ = result.final_num_levels;
+  }
+
+  // this leaves items_ uninitialized (all objects moved out and destroyed)
+  void populate_work_arrays(const KarninLangLiberty& other, T* workbuf,
+                            uint32_t* worklevels,
+                            uint8_t provisional_num_levels) {
+    worklevels[0] = 0;
+
+    // the level zero data from "other" was already inserted into "this"
+    const uint32_t self_pop_zero = safe_level_size(0);
+    kll_helper::move_construct<T>(items_.data(), levels_[0], levels_[1],
+                                  workbuf, 0, true);
+    worklevels[1] = self_pop_zero;
+
+    for (uint8_t lvl = 1; lvl < provisional_num_levels; lvl++) {
+      const uint32_t self_pop = safe_level_size(lvl);
+      const uint32_t other_pop = other.safe_level_size(lvl);
+      worklevels[lvl + 1] = worklevels[lvl] + self_pop + other_pop;
+      if ((self_pop > 0) && (other_pop == 0)) {
+        kll_helper::move_construct<T>(items_.data(), levels_[lvl],
+                                      levels_[lvl] + self_pop, workbuf,
+                                      worklevels[lvl], true);
+      } else if ((self_pop == 0) && (other_pop > 0)) {
+        kll_helper::copy_construct<T>(other.items_.data(), other.levels_[lvl],
+                                      other.levels_[lvl] + other_pop, workbuf,
+                                      worklevels[lvl]);
+      } else if ((self_pop > 0) && (other_pop > 0)) {
+        kll_helper::merge_sorted_arrays<T, C>(
+            items_.data(), levels_[lvl], self_pop, other.items_.data(),
+            other.levels_[lvl], other_pop, workbuf, worklevels[lvl]);
+        for (uint32_t i = levels_[lvl]; i < levels_[lvl] + self_pop; i++) {
+          items_[i].~T();
+        }
+      }
+    }
+  }
+
+  // compacts the merged levels until they fit the capacity of the sketch
+  compress_result general_compress(uint8_t num_levels_in, T* items,
+                                   uint32_t* in_levels, uint32_t* out_levels) {
+    const uint32_t starting_item_count =
+        in_levels[num_levels_in] - in_levels[0];
+    uint8_t current_num_levels = num_levels_in;
+    // decreases with each compaction
+    uint32_t current_item_count = starting_item_count;
+    // increases if we add levels
+    uint32_t target_item_count = compute_total_capacity(current_num_levels);
+    bool done_yet = false;
+    out_levels[0] = 0;
+    uint8_t current_level = 0;
+    while (!done_yet) {
+      // If we are at the current top level, add an empty level above it for
+      // convenience, but do not increment num_levels until later
+      if (current_level == (current_num_levels - 1)) {
+        in_levels[current_level + 2] = in_levels[current_level + 1];
+      }
+
+      const uint32_t raw_beg = in_levels[current_level];
+      const uint32_t raw_lim = in_levels[current_level + 1];
+      const uint32_t raw_pop = raw_lim - raw_beg;
+
+      if ((current_item_count < target_item_count) ||
+          (raw_pop <
+           level_capacity(k_, current_num_levels, current_level, m_))) {
+        // move level over as is
+        if (raw_beg != out_levels[current_level]) {
+          std::move(items + raw_beg, items + raw_lim,
+                    items + out_levels[current_level]);
+        }
+        out_levels[current_level + 1] = out_levels[current_level] + raw_pop;
+      } else {
+        // The sketch is too full AND this level is too full, so we compact it
+        // Note: this can add a level and thus change the sketches capacities
+        const uint32_t pop_above = in_levels[current_level + 2] - raw_lim;
+        const bool odd_pop = is_odd(raw_pop);
+        const uint32_t adj_beg = odd_pop ? 1 + raw_beg : raw_beg;
+        const uint32_t adj_pop = odd_pop ? raw_pop - 1 : raw_pop;
+        const uint32_t half_adj_pop = adj_pop / 2;
+
+        if (odd_pop) {  // move one guy over
+          items[out_levels[current_level]] = std::move(items[raw_beg]);
+          out_levels[current_level + 1] = out_levels[current_level] + 1;
+        } else {  // even number of items
+          out_levels[current_level + 1] = out_levels[current_level];
+        }
+
+        // level zero might not be sorted, so we must sort it if we wish to
+        // compact it
+        if ((current_level == 0) && !is_level_zero_sorted_) {
+          kll_helper::sort_level(items + adj_beg, items + adj_beg + adj_pop,
+                                 comparator_);
+        }
+
+        if (pop_above == 0) {  // Level above is empty, so halve up
+          randomly_halve_up(items, adj_beg, adj_pop);
+        } else {  // Level above is nonempty, so halve down, then merge up
+          randomly_halve_down(items, adj_beg, adj_pop);
+          kll_helper::merge_sorted_arrays<T, C>(items, adj_beg, half_adj_pop,
+                                                raw_lim, pop_above,
+                                                adj_beg + half_adj_pop);
+        }
+
+        // track the fact that we just eliminated some data
+        current_item_count -= half_adj_pop;
+
+        // adjust the boundaries of the level above
+        in_levels[current_level + 1] -= half_adj_pop;
+
+        // increment num levels if we just compacted the old top level
+        // this creates some more capacity (the size of the new bottom level)
+        if (current_level == (current_num_levels - 1)) {
+          current_num_levels++;
+          target_item_count += level_capacity(k_, current_num_levels, 0, m_);
+        }
+      }
+
+      // determine whether we have processed all levels yet (including any new
+      // levels that we created)
+      if (current_level == (current_num_levels - 1)) done_yet = true;
+      current_level++;
+    }
+    return {current_num_levels, target_item_count, current_item_count};
+  }
+
   template <typename FwdT>
   void update(FwdT&& item) {
     if (!check_update_item(item)) {
@@ -381,7 +1686,20 @@ class KarninLangLiberty {
     // min and max are always copies
     const uint32_t index = internal_update();
     new (&items_[index]) T(std::forward<FwdT>(item));
-    // reset_sorted_view();
+  }
+
+  void update_weighted(const T& item, uint64_t weight) {
+    if (weight == 0 || !check_update_item(item)) return;
+    // level zero has room for all copies, so no compaction is needed
+    if (weight <= levels_[0]) {
+      for (uint64_t i = 0; i < weight; i++) update(item);
+      return;
+    }
+    if (weight & 1) update(item);
+    if (weight == 1) return;
+    const uint64_t final_n = n_ + (weight & ~uint64_t{1});
+    merge_weighted_levels(item, weight);
+    n_ = final_n;
   }
 };
 
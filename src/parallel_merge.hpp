@@ -0,0 +1,88 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "span.hpp"
+#include "thread_pool.hpp"
+
+namespace concurrent {
+
+/// Merges many sketches into one on the threads of a pool.
+///
+/// The sketches are split into chunks of kChunkSize that the threads take from
+/// a shared counter, so a thread that is done with its chunks takes over the
+/// remaining chunks of the others. Every thread folds its chunks into a
+/// partial sketch, then the partial sketches are combined in a binary tree of
+/// depth log2(threads), one level of the tree in parallel at a time.
+///
+/// Works with every sketch that has `Merge(const Sketch&)`, e.g.
+/// `final::CountSketch`, whose merge adds the counter arrays vertically,
+/// `final::SpaceSaving`, and `final::KarninLangLiberty`, whose merge combines
+/// the sketches level by level.
+///
+/// The merges of `final::KarninLangLiberty` draw random bits, so the merged
+/// sketches and the partial sketches, which are merged with each other, need
+/// distinct seeds for their compactions to be independent. Give every input
+/// sketch its own seed, and a `make_partial` that seeds the partials apart
+/// from them, see `KarninLangLiberty(k, seed)`.
+///
+/// @param make_partial returns the empty sketch that partial p folds its
+///   chunks into, for p in [0, pool.NumThreads()).
+/// @return the merge of all sketches, `make_partial(0)` if there are none.
+template <typename Sketch, typename MakePartial>
+Sketch ParallelMerge(std::span<const Sketch* const> sketches,
+                     detail::ThreadPool& pool, MakePartial make_partial) {
+  // Large enough that the threads rarely touch the shared counter, small
+  // enough to balance 10k sketches over dozens of threads.
+  constexpr size_t kChunkSize = 16;
+  const size_t num_chunks = (sketches.size() + kChunkSize - 1) / kChunkSize;
+  const size_t num_partials = std::min(pool.NumThreads(), num_chunks);
+  if (num_partials <= 1) {
+    Sketch merged = make_partial(0);
+    for (const Sketch* sketch : sketches) {
+      merged.Merge(*sketch);
+    }
+    return merged;
+  }
+
+  // Sketches such as final::CountSketch are too large for the stack.
+  std::vector<std::unique_ptr<Sketch>> partials(num_partials);
+  std::atomic<size_t> next_chunk{0};
+  pool.ParallelFor(num_partials, [&](size_t p) {
+    partials[p] = std::make_unique<Sketch>(make_partial(p));
+    size_t chunk;
+    while ((chunk = next_chunk.fetch_add(1, std::memory_order_relaxed)) <
+           num_chunks) {
+      const size_t end = std::min(sketches.size(), (chunk + 1) * kChunkSize);
+      for (size_t i = chunk * kChunkSize; i < end; ++i) {
+        partials[p]->Merge(*sketches[i]);
+      }
+    }
+  });
+
+  for (size_t stride = 1; stride < num_partials; stride *= 2) {
+    pool.ParallelFor(
+        (num_partials + 2 * stride - 1) / (2 * stride), [&](size_t pair) {
+          const size_t left = 2 * stride * pair;
+          const size_t right = left + stride;
+          if (right < num_partials) partials[left]->Merge(*partials[right]);
+        });
+  }
+  return std::move(*partials[0]);
+}
+
+/// Merges many sketches into one on the threads of a pool, with default
+/// constructed partial sketches, see above. Not for
+/// `final::KarninLangLiberty`, whose partials need distinct seeds.
+template <typename Sketch>
+Sketch ParallelMerge(std::span<const Sketch* const> sketches,
+                     detail::ThreadPool& pool) {
+  return ParallelMerge(sketches, pool, [](size_t) { return Sketch(); });
+}
+
+}  // namespace concurrent
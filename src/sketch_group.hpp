@@ -0,0 +1,115 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "compiler.hpp"
+#include "hash.hpp"
+#include "sketch_traits.hpp"
+#include "span.hpp"
+
+namespace final {
+
+/// Sketches that summarize the same stream, e.g. a `CountSketch`, a
+/// `SpaceSaving` and a `KarninLangLiberty` fed by every event.
+///
+/// Hashes every value once and hands the hash to all members with a
+/// pre-hashed `Insert`, instead of letting every member hash the value again.
+/// Members without one, e.g. a `KarninLangLiberty` or a `SpaceSaving` of
+/// arithmetic values, and members with a hash policy other than MurmurHash3
+/// get the value only. The members are visited by fold
+/// expressions over the tuple of sketches, so an insert compiles to the
+/// inserts of the members without any dispatch.
+///
+/// @tparam T the data type the sketches summarize.
+/// @tparam Sketches the types of the sketches, default constructible.
+template <typename T, typename... Sketches>
+class SketchGroup {
+ public:
+  /// Insert a value into all sketches.
+  void Insert(const T& value) noexcept {
+    if constexpr (kAnyAcceptsHash) {
+      const __uint128_t hash = detail::Hash(value);
+      std::apply(
+          [&](auto&... sketch) { (InsertHashed(sketch, value, hash), ...); },
+          sketches_);
+    } else {
+      std::apply([&](auto&... sketch) { (sketch.Insert(value), ...); },
+                 sketches_);
+    }
+  }
+
+  /// Insert a batch of values into all sketches.
+  ///
+  /// The values are hashed in blocks of `kHashBlockSize` with the vectorized
+  /// hash kernels, and every block is inserted into one member after the other
+  /// through its batch insert if it has one, so that the member's state stays
+  /// in cache for the whole block.
+  void InsertBatch(std::span<const T> values) noexcept {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      const auto block = values.subspan(i, n);
+      if constexpr (kAnyAcceptsHash) detail::HashBatch(block, hashes.data());
+      std::apply(
+          [&](auto&... sketch) {
+            (InsertHashedBatch(sketch, block, hashes.data()), ...);
+          },
+          sketches_);
+    }
+  }
+
+  /// @return the I-th sketch of the group.
+  template <size_t I>
+  auto& Get() noexcept {
+    return std::get<I>(sketches_);
+  }
+
+  /// @return the I-th sketch of the group.
+  template <size_t I>
+  const auto& Get() const noexcept {
+    return std::get<I>(sketches_);
+  }
+
+ private:
+  /// Number of values hashed at once by the batch insert.
+  static constexpr size_t kHashBlockSize = 64;
+
+  static constexpr bool kAnyAcceptsHash =
+      (detail::accepts_hash_v<Sketches, T> || ...);
+
+  template <typename Sketch>
+  OPT_INLINE static void InsertHashed(Sketch& sketch, const T& value,
+                                      const __uint128_t& hash) {
+    if constexpr (detail::accepts_hash_v<Sketch, T>) {
+      sketch.Insert(value, hash);
+    } else {
+      sketch.Insert(value);
+    }
+  }
+
+  template <typename Sketch>
+  OPT_INLINE static void InsertHashedBatch(Sketch& sketch,
+                                           std::span<const T> values,
+                                           const __uint128_t* hashes) {
+    if constexpr (detail::accepts_hash_batch_v<Sketch, T>) {
+      sketch.InsertBatch(std::span<const __uint128_t>(hashes, values.size()));
+    } else if constexpr (detail::accepts_hash_v<Sketch, T>) {
+      for (size_t k = 0; k < values.size(); ++k) {
+        sketch.Insert(values[k], hashes[k]);
+      }
+    } else if constexpr (detail::supports_batch_v<Sketch, T>) {
+      sketch.InsertBatch(values);
+    } else {
+      for (const auto& value : values) sketch.Insert(value);
+    }
+  }
+
+  std::tuple<Sketches...> sketches_;
+};
+
+}  // namespace final
@@ -0,0 +1,124 @@
+#pragma once
+
+#include <type_traits>
+#include <utility>
+
+#include "hash.hpp"
+#include "span.hpp"
+
+// Traits of the interface the sketches share. Every sketch has an
+// `Insert(const T&)`; these tell which of the optional members it has, so that
+// generic code such as `final::SketchGroup` and `final::AnySketch` can pick
+// the fastest path at compile time.
+
+namespace detail {
+
+/// The hash policy of `Sketch`, its `hasher` if it has one and MurmurHash3
+/// otherwise.
+template <typename Sketch, typename = void>
+struct hasher_of {
+  using type = Murmur3Hasher;
+};
+
+template <typename Sketch>
+struct hasher_of<Sketch, std::void_t<typename Sketch::hasher>> {
+  using type = typename Sketch::hasher;
+};
+
+template <typename Sketch>
+using hasher_of_t = typename hasher_of<Sketch>::type;
+
+/// Whether `Sketch` has an `Insert(const T&, const __uint128_t&)` for values
+/// pre-hashed by `detail::Hash`.
+///
+/// Checks for exactly this signature, since a hash also converts to the
+/// weight of `Insert(const T&, uint64_t)`. Sketches with another hash policy
+/// have to hash the value themselves.
+template <typename Sketch, typename T, typename = void>
+struct accepts_hash : std::false_type {};
+
+template <typename Sketch, typename T>
+struct accepts_hash<
+    Sketch, T,
+    std::void_t<decltype(static_cast<void (Sketch::*)(
+                             const T&, const __uint128_t&)>(&Sketch::Insert))>>
+    : std::is_same<hasher_of_t<Sketch>, Murmur3Hasher> {};
+
+template <typename Sketch, typename T>
+inline constexpr bool accepts_hash_v = accepts_hash<Sketch, T>::value;
+
+/// Whether `Sketch` has an `InsertBatch(std::span<const __uint128_t>)` for
+/// batches of hashes by `detail::Hash` without their values.
+template <typename Sketch, typename T, typename = void>
+struct accepts_hash_batch : std::false_type {};
+
+template <typename Sketch, typename T>
+struct accepts_hash_batch<
+    Sketch, T,
+    std::void_t<decltype(static_cast<void (Sketch::*)(
+                             std::span<const __uint128_t>)>(
+        &Sketch::InsertBatch))>>
+    : std::bool_constant<!std::is_same_v<T, __uint128_t> &&
+                         std::is_same_v<hasher_of_t<Sketch>, Murmur3Hasher>> {};
+
+template <typename Sketch, typename T>
+inline constexpr bool accepts_hash_batch_v =
+    accepts_hash_batch<Sketch, T>::value;
+
+/// Whether `Sketch` has an `InsertBatch(std::span<const T>)`.
+template <typename Sketch, typename T, typename = void>
+struct supports_batch : std::false_type {};
+
+template <typename Sketch, typename T>
+struct supports_batch<Sketch, T,
+                      std::void_t<decltype(std::declval<Sketch&>().InsertBatch(
+                          std::declval<std::span<const T>>()))>>
+    : std::true_type {};
+
+template <typename Sketch, typename T>
+inline constexpr bool supports_batch_v = supports_batch<Sketch, T>::value;
+
+/// Whether `Sketch` has a `Merge(const Sketch&)` that adds another sketch of
+/// the same type.
+template <typename Sketch, typename = void>
+struct is_mergeable : std::false_type {};
+
+template <typename Sketch>
+struct is_mergeable<Sketch,
+                    std::void_t<decltype(std::declval<Sketch&>().Merge(
+                        std::declval<const Sketch&>()))>> : std::true_type {};
+
+template <typename Sketch>
+inline constexpr bool is_mergeable_v = is_mergeable<Sketch>::value;
+
+/// Whether `Sketch` estimates frequencies with `Estimate(const T&)`, like the
+/// Count Sketch and SpaceSaving sketches.
+template <typename Sketch, typename T, typename = void>
+struct supports_estimate : std::false_type {};
+
+template <typename Sketch, typename T>
+struct supports_estimate<
+    Sketch, T,
+    std::void_t<decltype(std::declval<const Sketch&>().Estimate(
+        std::declval<const T&>()))>> : std::true_type {};
+
+template <typename Sketch, typename T>
+inline constexpr bool supports_estimate_v = supports_estimate<Sketch, T>::value;
+
+/// Whether `Sketch` answers `GetQuantile(double)` and `GetRank(const T&)`,
+/// like the KLL sketches.
+template <typename Sketch, typename T, typename = void>
+struct supports_quantiles : std::false_type {};
+
+template <typename Sketch, typename T>
+struct supports_quantiles<
+    Sketch, T,
+    std::void_t<decltype(std::declval<const Sketch&>().GetQuantile(0.5)),
+                decltype(std::declval<const Sketch&>().GetRank(
+                    std::declval<const T&>()))>> : std::true_type {};
+
+template <typename Sketch, typename T>
+inline constexpr bool supports_quantiles_v =
+    supports_quantiles<Sketch, T>::value;
+
+}  // namespace detail
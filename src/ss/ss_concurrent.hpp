@@ -0,0 +1,291 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "compiler.hpp"
+#include "fastrange.hpp"
+#include "hash.hpp"
+#include "ring_buffer.hpp"
+#include "span.hpp"
+#include "ss/ss_final.hpp"
+#include "types.hpp"
+
+namespace concurrent {
+
+/// SpaceSaving sketch that many threads can insert into at once.
+///
+/// `final::SpaceSaving` mutates its heap on every insert and cannot be shared
+/// between threads. This sketch routes every value by its hash to one of
+/// kNumShards shards, each a `final::SpaceSaving` owned by a consumer thread
+/// of the sketch. Producers hand the values to the consumers through lock-free
+/// MPSC ring buffers, one per shard, so they never take a lock, and every
+/// shard is only touched by its consumer, which keeps it hot in the cache of
+/// that core.
+///
+/// A value always lands in the same shard, so the shards summarize disjoint
+/// partitions of the stream and every shard has the guarantees of
+/// `final::SpaceSaving` for its partition. The queries lock the shards they
+/// read against their consumers, and see the inserts the consumers already
+/// applied. Call `Flush` first to wait for all inserts that completed.
+///
+/// A consumer that finds its ring buffer empty polls it a few times and then
+/// parks on a condition variable, so an idle sketch does not keep kNumShards
+/// cores busy. Producers only take the mutex of the condition variable to wake
+/// a parked consumer.
+///
+/// @tparam T the data type the sketch summarizes.
+/// @tparam K number of elements each shard can store.
+/// @tparam kNumShards number of shards and consumer threads.
+/// @tparam kQueueCapacity capacity of the ring buffer of each shard, must be a
+/// power of 2.
+template <typename T, size_t K = 96, size_t kNumShards = 4,
+          size_t kQueueCapacity = 4096>
+class ShardedSpaceSaving {
+  using Sketch = final::SpaceSaving<T, K>;
+
+ public:
+  ShardedSpaceSaving() {
+    for (size_t s = 0; s < kNumShards; ++s) {
+      consumers_[s] = std::thread([this, s] { Consume(shards_[s]); });
+    }
+  }
+
+  /// Waits for the consumers to apply the pending inserts and joins them. All
+  /// producers must have finished inserting.
+  ~ShardedSpaceSaving() {
+    stop_.store(true, std::memory_order_release);
+    for (auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.wake_mutex);
+      shard.wake.notify_one();
+    }
+    for (auto& consumer : consumers_) {
+      consumer.join();
+    }
+  }
+
+  ShardedSpaceSaving(const ShardedSpaceSaving&) = delete;
+  ShardedSpaceSaving& operator=(const ShardedSpaceSaving&) = delete;
+
+  /// Insert a value into the sketch, callable from any thread. Spins while
+  /// the ring buffer of the shard is full.
+  void Insert(const T& v) {
+    const T& value = detail::Normalized(v);
+    const __uint128_t hash = detail::Hash(value);
+    Shard& shard = shards_[ShardOf(hash)];
+    Push(shard, value, hash);
+    Wake(shard);
+  }
+
+  /// Insert a batch of values into the sketch, hashing them in blocks like
+  /// `final::SpaceSaving::InsertBatch`.
+  void InsertBatch(std::span<const T> values) {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      if constexpr (std::is_floating_point_v<T>) {
+        for (size_t k = 0; k < n; ++k) {
+          hashes[k] = detail::Hash(detail::Normalized(values[i + k]));
+        }
+      } else {
+        detail::HashBatch(values.subspan(i, n), hashes.data());
+      }
+      for (size_t k = 0; k < n; ++k) {
+        Push(shards_[ShardOf(hashes[k])], detail::Normalized(values[i + k]),
+             hashes[k]);
+      }
+      // once per block, rather than per value
+      for (auto& shard : shards_) Wake(shard);
+    }
+  }
+
+  /// Waits until the consumers applied all inserts that completed before the
+  /// call.
+  void Flush() const {
+    for (const auto& shard : shards_) {
+      const size_t num_pushed = shard.queue.NumPushed();
+      while (shard.num_consumed.load(std::memory_order_acquire) < num_pushed) {
+        std::this_thread::yield();
+      }
+    }
+  }
+
+  /// @return the estimated weight of a value, or 0 if it is not monitored by
+  /// its shard.
+  uint64_t Estimate(const T& v) const {
+    const T& value = detail::Normalized(v);
+    const __uint128_t hash = detail::Hash(value);
+    const Shard& shard = shards_[ShardOf(hash)];
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    if constexpr (kHashed) {
+      return shard.sketch.Estimate(value, hash);
+    } else {
+      return shard.sketch.Estimate(value);
+    }
+  }
+
+  /// @return the largest minimum weight of the shards, which bounds the
+  /// estimation error of every value.
+  uint64_t GetMinWeight() const {
+    uint64_t min_weight = 0;
+    for (const auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      min_weight = std::max(min_weight, shard.sketch.GetMinWeight());
+    }
+    return min_weight;
+  }
+
+  /// Writes the monitored values with the largest weights to `out`, sorted by
+  /// decreasing weight.
+  ///
+  /// The shards partition the values, so the top-k of the sketch is the top-k
+  /// of the union of the top-k of the shards.
+  /// @return the number of values written, at most `out.size()` and
+  /// K * kNumShards.
+  size_t TopK(std::span<final::WeightedValue<T>> out) const {
+    const size_t n = std::min(out.size(), K);
+    std::vector<final::WeightedValue<T>> candidates(n * kNumShards);
+    const std::span<final::WeightedValue<T>> span(candidates);
+    size_t num_candidates = 0;
+    for (const auto& shard : shards_) {
+      std::lock_guard<std::mutex> lock(shard.mutex);
+      num_candidates += shard.sketch.TopK(span.subspan(num_candidates, n));
+    }
+    const size_t count = std::min(out.size(), num_candidates);
+    std::partial_sort(
+        candidates.begin(), candidates.begin() + count,
+        candidates.begin() + num_candidates,
+        [](const auto& a, const auto& b) { return a.weight > b.weight; });
+    std::move(candidates.begin(), candidates.begin() + count, out.begin());
+    return count;
+  }
+
+ private:
+  /// Whether the shards take the hash of the values, see the specializations
+  /// of `final::SpaceSaving`.
+  static constexpr bool kHashed = !std::is_arithmetic_v<T> ||
+                                  std::is_same_v<T, __int128_t> ||
+                                  std::is_same_v<T, __uint128_t>;
+  /// Number of values hashed up front by the batch insert.
+  static constexpr size_t kHashBlockSize = 64;
+  /// Maximum number of values a consumer inserts per lock of its shard.
+  static constexpr size_t kConsumeBatchSize = 256;
+  /// Number of times a consumer polls its empty ring buffer before it parks.
+  static constexpr size_t kNumIdlePolls = 64;
+
+  struct Entry {
+    T value;
+    __uint128_t hash;
+  };
+
+  struct alignas(detail::kCacheLineSize) Shard {
+    detail::MpscRing<Entry, kQueueCapacity> queue;
+    /// Guards the sketch against the queries.
+    mutable std::mutex mutex;
+    Sketch sketch;
+    /// Number of values the consumer inserted into the sketch.
+    std::atomic<size_t> num_consumed{0};
+    /// Whether the consumer is parked or about to park on `wake`.
+    std::atomic<bool> parked{false};
+    std::mutex wake_mutex;
+    std::condition_variable wake;
+  };
+
+  OPT_INLINE static size_t ShardOf(const __uint128_t& hash) {
+    return fastrange64(static_cast<uint64_t>(hash >> 64), kNumShards);
+  }
+
+  /// Spins while the ring buffer of the shard is full, waking its consumer in
+  /// case it parked before the values of the caller arrived.
+  void Push(Shard& shard, const T& value, const __uint128_t& hash) {
+    Entry entry{value, hash};
+    while (UNLIKELY(!shard.queue.TryPush(entry))) {
+      Wake(shard);
+      std::this_thread::yield();
+    }
+  }
+
+  /// Wakes the consumer of a shard if it parked, after values were pushed.
+  ///
+  /// The fence pairs with the one in `Park`: either the consumer sees the
+  /// pushes before it parks, or the producer sees it parked and notifies it
+  /// under the mutex it holds until it waits.
+  OPT_INLINE static void Wake(Shard& shard) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (UNLIKELY(shard.parked.load(std::memory_order_relaxed))) {
+      std::lock_guard<std::mutex> lock(shard.wake_mutex);
+      shard.wake.notify_one();
+    }
+  }
+
+  /// Blocks the consumer of a shard until values were pushed past those it
+  /// consumed, or the sketch is destroyed.
+  void Park(Shard& shard) {
+    std::unique_lock<std::mutex> lock(shard.wake_mutex);
+    shard.parked.store(true, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    shard.wake.wait(lock, [&] {
+      return stop_.load(std::memory_order_acquire) ||
+             shard.queue.NumPushed() !=
+                 shard.num_consumed.load(std::memory_order_relaxed);
+    });
+    shard.parked.store(false, std::memory_order_relaxed);
+  }
+
+  /// Inserts the values of the ring buffer of a shard into its sketch until
+  /// the sketch is destroyed. Takes the lock of the shard only once there is
+  /// a value to insert.
+  void Consume(Shard& shard) {
+    Entry entry;
+    size_t num_idle_polls = 0;
+    while (true) {
+      if (!shard.queue.TryPop(entry)) {
+        if (stop_.load(std::memory_order_acquire)) {
+          // The producers finished before the stop, so an empty ring buffer
+          // after it stays empty once all started pushes arrived.
+          if (shard.queue.NumPushed() ==
+              shard.num_consumed.load(std::memory_order_relaxed)) {
+            return;
+          }
+          std::this_thread::yield();
+        } else if (++num_idle_polls < kNumIdlePolls) {
+          std::this_thread::yield();
+        } else {
+          Park(shard);
+          num_idle_polls = 0;
+        }
+        continue;
+      }
+      num_idle_polls = 0;
+      size_t n = 0;
+      {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        do {
+          if constexpr (kHashed) {
+            shard.sketch.Insert(entry.value, entry.hash);
+          } else {
+            shard.sketch.Insert(entry.value);
+          }
+        } while (++n < kConsumeBatchSize && shard.queue.TryPop(entry));
+      }
+      // Only the consumer writes the counter.
+      shard.num_consumed.store(
+          shard.num_consumed.load(std::memory_order_relaxed) + n,
+          std::memory_order_release);
+    }
+  }
+
+  std::array<Shard, kNumShards> shards_;
+  std::array<std::thread, kNumShards> consumers_;
+  std::atomic<bool> stop_{false};
+};
+
+}  // namespace concurrent
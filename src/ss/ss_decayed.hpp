@@ -0,0 +1,208 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+
+#include "compiler.hpp"
+#include "hash.hpp"
+#include "helpers.hpp"
+#include "simd.hpp"
+#include "span.hpp"
+#include "types.hpp"
+
+namespace decayed {
+
+/// A value monitored by a decayed `SpaceSaving` sketch and its decayed weight.
+template <typename T>
+struct WeightedValue {
+  T value;
+  double weight;
+};
+
+/// SpaceSaving sketch of exponentially decayed weights, e.g. for the top keys
+/// of the last minutes without a hard window.
+///
+/// `Decay(factor)` multiplies the weights of all values inserted so far by
+/// the factor. Instead of touching the K weights, it divides a global scale by
+/// the factor, and inserts add their weight times the scale, which is forward
+/// decay with an exponential decay function as in
+///   Cormode, Graham, et al. "Forward decay: A practical time decay model for
+///   streaming systems." ICDE 2009.
+/// Scaling all weights by the same factor keeps the order of the heap, so the
+/// sketch has the guarantees of `final::SpaceSaving` for the decayed weights:
+/// an estimate overestimates the decayed weight of a value by at most
+/// `GetMinWeight()`. The weights are doubles, and are divided by the scale
+/// only once the scale gets large, in one O(K) pass every few hundred halvings.
+///
+/// Values are found with the SIMD search of `final::SpaceSaving`, over their
+/// bits for fixed-width arithmetic types and over their 64 bit hashes
+/// otherwise.
+///
+/// @tparam T the data type the sketch summarizes.
+/// @tparam K number of elements the sketch can store.
+/// @tparam Backend the SIMD backend of the find operation, see `simd.hpp`.
+/// @tparam Hasher the hash policy of the types that are not searched by their
+///   bits, see `hash.hpp`.
+template <typename T, size_t K = 96,
+          typename Backend = detail::simd::DefaultBackend,
+          typename Hasher = detail::Murmur3Hasher>
+class SpaceSaving {
+  /// K needs to be a multiple of 32 for the SIMD algorithm we use.
+  static_assert(K % 32 == 0);
+
+ public:
+  using hasher = Hasher;
+
+  /// Insert a value with weight 1 at the current time.
+  void Insert(const T& value) noexcept { Insert(value, uint64_t{1}); }
+
+  /// Insert a value with the given weight at the current time. A weight of 0
+  /// leaves the sketch unchanged.
+  ///
+  /// Takes O(K) time to check if the value already exists, and O(log(K)) time
+  /// to update the heap.
+  void Insert(const T& value, uint64_t weight) noexcept {
+    if (weight == 0) return;
+    const uint64_t key = KeyOf(value);
+    const size_t i = Find</*NotFound=*/0>(value, key);
+    keys_[i] = key;
+    values_[i] = value;
+    weights_[i] += static_cast<double>(weight) * scale_;
+    SiftDown(i);
+  }
+
+  /// Insert a batch of values with weight 1 at the current time.
+  void InsertBatch(std::span<const T> values) noexcept {
+    for (const auto& value : values) Insert(value);
+  }
+
+  /// Multiplies the weights of all values inserted so far by `factor`, e.g.
+  /// 0.5 at the end of every epoch to halve the weight of older epochs.
+  ///
+  /// Takes O(1) time, and O(K) time once every few hundred halvings.
+  /// @throws std::invalid_argument if `factor` is not in (0, 1].
+  void Decay(double factor) {
+    if (!(factor > 0 && factor <= 1)) {
+      throw std::invalid_argument("decay factor must be in (0, 1]: " +
+                                  std::to_string(factor));
+    }
+    scale_ /= factor;
+    if (UNLIKELY(scale_ > kMaxScale)) Rescale();
+  }
+
+  /// @return the estimated decayed weight of a value, or 0 if it is not
+  /// monitored.
+  double Estimate(const T& value) const noexcept {
+    const size_t i = Find(value, KeyOf(value));
+    return i < K ? weights_[i] / scale_ : 0;
+  }
+
+  /// @return the minimum decayed weight of the monitored values, which bounds
+  /// the estimation error. It is 0 until K distinct values have been inserted.
+  double GetMinWeight() const noexcept { return weights_[0] / scale_; }
+
+  /// Writes the monitored values with the largest decayed weights to `out`,
+  /// sorted by decreasing weight, see `final::SpaceSaving::TopK`.
+  /// @return the number of values written, at most `out.size()` and K.
+  size_t TopK(std::span<WeightedValue<T>> out) const {
+    std::array<uint32_t, K> order = detail::sequence<uint32_t, K>();
+    const size_t n = std::min(out.size(), K);
+    std::partial_sort(order.begin(), order.begin() + n, order.end(),
+                      [this](uint32_t a, uint32_t b) {
+                        return weights_[a] > weights_[b] ||
+                               (weights_[a] == weights_[b] && a < b);
+                      });
+    size_t count = 0;
+    for (; count < n && weights_[order[count]] > 0; ++count) {
+      out[count].value = values_[order[count]];
+      out[count].weight = weights_[order[count]] / scale_;
+    }
+    return count;
+  }
+
+ private:
+  /// Whether values are searched by their bits, which identify them, rather
+  /// than by hashes, which have to be confirmed by comparing the values.
+  static constexpr bool kKeyIsValue = std::is_arithmetic_v<T> &&
+                                      sizeof(T) <= sizeof(uint64_t);
+
+  /// Scale at which the weights are rescaled, far from the range of double
+  /// but leaving room for the weights of the inserts.
+  static constexpr double kMaxScale = 0x1p256;
+
+  OPT_INLINE static uint64_t KeyOf(const T& value) {
+    if constexpr (kKeyIsValue) {
+      // the bits of -0.0 and 0.0 are the same
+      using Bits = std::make_unsigned_t<decltype(detail::HashBits(value))>;
+      return static_cast<Bits>(detail::HashBits(value));
+    } else {
+      return detail::roll_down(Hasher::Hash(value));
+    }
+  }
+
+  /// @return the index of the value, or `NotFound`.
+  template <size_t NotFound = K>
+  size_t Find(const T& value, uint64_t key) const {
+    const auto* data = keys_.data();
+    for (size_t i = 0; i < K; ++i) {
+      i += detail::simd::FindKey<Backend>(data + i, K - i, key);
+      if (i == K) break;
+      if (kKeyIsValue || LIKELY(values_[i] == value)) return i;
+    }
+    return NotFound;
+  }
+
+  /// Sifts down the element at index i in the min heap, whose weight was
+  /// increased.
+  inline void SiftDown(size_t i) {
+    const double weight = weights_[i];
+    const uint64_t key = keys_[i];
+    T value = std::move(values_[i]);
+    size_t parent = i;
+    size_t child = 2 * parent + 1;
+    while (child < K) {
+      // Switch to right child if it is smaller.
+      const size_t right_child = child + 1;
+      if (right_child < K && weights_[child] > weights_[right_child]) {
+        child = right_child;
+      }
+      // If weight is not greater than the child's weight we are done.
+      if (!(weight > weights_[child])) break;
+      // Else sift down.
+      weights_[parent] = weights_[child];
+      keys_[parent] = keys_[child];
+      values_[parent] = std::move(values_[child]);
+      parent = child;
+      child = 2 * parent + 1;
+    }
+    weights_[parent] = weight;
+    keys_[parent] = key;
+    values_[parent] = std::move(value);
+  }
+
+  /// Divides all weights by the scale, which changes neither the decayed
+  /// weights nor the order of the heap.
+  __attribute__((noinline, cold)) void Rescale() noexcept {
+    const double inverse = 1 / scale_;
+    for (double& weight : weights_) weight *= inverse;
+    scale_ = 1;
+  }
+
+  /// Keys of the values, filled with distinct dummy keys by default.
+  /// Needs to be 32-byte aligned for SIMD operations.
+  alignas(32) std::array<uint64_t, K> keys_ = detail::sequence<uint64_t, K>();
+  /// Min heap of the weights times the scale, initialized to 0.
+  std::array<double, K> weights_{};
+  std::array<T, K> values_{};
+  /// Weight of an insert at the current time, the inverse of the product of
+  /// all decay factors since the last rescale.
+  double scale_ = 1;
+};
+
+}  // namespace decayed
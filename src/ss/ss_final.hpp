@@ -5,15 +5,420 @@
 #include <cmath>
 #include <cstddef>
 #include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
 
 #include "compiler.hpp"
 #include "hash.hpp"
 #include "helpers.hpp"
+#include "serialization.hpp"
 #include "simd.hpp"
+#include "span.hpp"
 #include "types.hpp"
 
 namespace final {
 
+/// A value monitored by a `SpaceSaving` sketch and its estimated weight.
+template <typename T>
+struct WeightedValue {
+  T value;
+  uint64_t weight;
+};
+
+/// Direct-mapped cache in front of the SIMD search of `SpaceSaving`.
+///
+/// Maps the bits of a key to the heap index of the last key with these bits.
+/// Entries are hints: the sketch compares the key at the cached index before
+/// it trusts it, so stale entries and collisions only cost a full search.
+///
+/// An insert caches the index its value ends up at after the sift down, but
+/// the keys the sift down moves up keep their old entries. Frequent values
+/// collect large weights and settle at the bottom of the heap, where the sift
+/// downs of other values rarely move them, so their entries stay current.
+/// Moving the entries along would cost a store per level of every sift down,
+/// which halves the throughput of streams that miss the cache.
+///
+/// @tparam K number of elements of the sketch.
+/// @tparam kCacheSize number of entries, 0 or a power of 2.
+template <size_t K, size_t kCacheSize>
+class FrontCache {
+  static_assert((kCacheSize & (kCacheSize - 1)) == 0,
+                "cache size must be a power of 2");
+
+ protected:
+  /// @return the cached index of a key, always less than K.
+  OPT_INLINE size_t CachedIndex(uint64_t key) const {
+    return cache_[Slot(key)];
+  }
+
+  /// Caches the index of a key, evicting the key that shared its entry.
+  OPT_INLINE void CacheIndex(uint64_t key, size_t i) { cache_[Slot(key)] = i; }
+
+ private:
+  using Index = std::conditional_t<
+      K <= (1 << 8), uint8_t,
+      std::conditional_t<K <= (1 << 16), uint16_t, uint32_t>>;
+
+  /// Fibonacci hashing, so keys that only differ in their high bits, such
+  /// as floating point values, spread over the entries.
+  OPT_INLINE static size_t Slot(uint64_t key) {
+    return ((key * 0x9E3779B97F4A7C15) >> 32) & (kCacheSize - 1);
+  }
+
+  std::array<Index, kCacheSize> cache_{};
+};
+
+/// Specialization without a cache, which takes no space in the sketch.
+template <size_t K>
+class FrontCache<K, 0> {};
+
+/// Fixed-capacity store of the K strings monitored by a `SpaceSaving` sketch.
+///
+/// Strings of up to `kInlineSize` bytes are copied into a slab inside the
+/// store, longer strings into a string per slot, which keeps its capacity
+/// when it is overwritten. Once every slot held its longest string, storing a
+/// string never allocates. The heap of the sketch refers to the slots by
+/// index, so sifting it down moves no strings.
+///
+/// @tparam T the string type, a `std::basic_string` of char.
+/// @tparam K number of slots.
+template <typename T, size_t K>
+class StringSlab {
+ public:
+  /// Strings up to this size are stored in the slab, e.g. most URL paths and
+  /// user IDs.
+  static constexpr size_t kInlineSize = 32;
+
+  /// @return the string in the given slot, valid until the slot is assigned.
+  OPT_INLINE std::string_view Get(size_t slot) const {
+    const size_t size = sizes_[slot];
+    if (LIKELY(size <= kInlineSize)) return {inline_[slot].data(), size};
+    return {long_[slot].data(), size};
+  }
+
+  /// @return whether the given slot holds the given string.
+  OPT_INLINE bool Equals(size_t slot, std::string_view value) const {
+    return sizes_[slot] == value.size() && Get(slot) == value;
+  }
+
+  /// Copies a string into the given slot.
+  OPT_INLINE void Assign(size_t slot, std::string_view value) {
+    sizes_[slot] = value.size();
+    if (LIKELY(value.size() <= kInlineSize)) {
+      std::memcpy(inline_[slot].data(), value.data(), value.size());
+    } else {
+      long_[slot].assign(value.data(), value.size());
+    }
+  }
+
+ private:
+  std::array<size_t, K> sizes_{};
+  std::array<std::array<char, kInlineSize>, K> inline_{};
+  std::array<T, K> long_{};
+};
+
+/// Fixed header of the SpaceSaving wire format.
+///
+/// A serialized sketch is the header followed by the monitored values with a
+/// nonzero weight, sorted by decreasing weight, zero padded to a multiple of
+/// 64 bytes. Every value is followed by the varint of the difference between
+/// the weight of the previous value and its weight, or of its weight for the
+/// first value, so that the similar weights of the tail take a byte or two.
+/// Fixed-width values are stored as they are, strings as the varint of their
+/// size followed by their bytes. All integers are little-endian.
+struct SpaceSavingHeader {
+  static constexpr uint32_t kMagic = 0x4b535343;  // "CSSK"
+  static constexpr uint16_t kVersion = 1;
+
+  uint32_t magic;
+  uint16_t version;
+  /// The data type of the sketch, see `detail::TypeTag`.
+  uint8_t type_tag;
+  /// Size of a fixed-width value in bytes, 0 for strings.
+  uint8_t value_size;
+  /// Capacity K of the sketch.
+  uint32_t k;
+  /// Number of monitored values, the values with a nonzero weight.
+  uint32_t num_values;
+  /// Minimum weight of the sketch, the weight of the last value if the sketch
+  /// monitors K values and 0 otherwise.
+  uint64_t min_weight;
+  /// Size of the values and weights in bytes, without the padding.
+  uint64_t payload_size;
+  uint8_t reserved[32];
+};
+static_assert(sizeof(SpaceSavingHeader) == detail::kWireAlignment);
+static_assert(std::is_trivially_copyable_v<SpaceSavingHeader>);
+
+/// Encoding of the `SpaceSaving` wire format, shared by its specializations.
+///
+/// @tparam T the data type of the sketch, fixed-width or a string.
+template <typename T>
+class SpaceSavingWire {
+  static_assert(std::is_trivially_copyable_v<T> || detail::is_string_v<T>,
+                "only fixed-width values and strings can be serialized");
+
+ public:
+  /// Type of the encoded and decoded values, a view of the bytes of strings.
+  using Value =
+      std::conditional_t<detail::is_string_v<T>, std::string_view, T>;
+  using Entry = WeightedValue<Value>;
+
+  /// @return the size of the entries serialized.
+  static size_t SerializedSize(std::span<const Entry> entries) {
+    return sizeof(SpaceSavingHeader) + detail::WireAlign(PayloadSize(entries));
+  }
+
+  /// Serializes the entries, sorted by decreasing weight, of a sketch with
+  /// capacity k and the given minimum weight into `out`.
+  /// @return the number of bytes written.
+  /// @throws std::invalid_argument if `out` is too small.
+  static size_t Serialize(std::span<const Entry> entries, size_t k,
+                          uint64_t min_weight, std::span<std::byte> out) {
+    const size_t payload_size = PayloadSize(entries);
+    const size_t size =
+        sizeof(SpaceSavingHeader) + detail::WireAlign(payload_size);
+    if (out.size() < size) {
+      throw std::invalid_argument("buffer of " + std::to_string(out.size()) +
+                                  " bytes is too small, need " +
+                                  std::to_string(size));
+    }
+    SpaceSavingHeader header{};
+    header.magic = SpaceSavingHeader::kMagic;
+    header.version = SpaceSavingHeader::kVersion;
+    header.type_tag = detail::TypeTag<T>();
+    header.value_size = kValueSize;
+    header.k = k;
+    header.num_values = entries.size();
+    header.min_weight = min_weight;
+    header.payload_size = payload_size;
+    std::memcpy(out.data(), &header, sizeof(header));
+
+    std::byte* pos = out.data() + sizeof(header);
+    uint64_t previous = 0;
+    for (const Entry& entry : entries) {
+      pos = PutValue(entry.value, pos);
+      pos += detail::PutVarint(previous == 0 ? entry.weight
+                                             : previous - entry.weight,
+                               pos);
+      previous = entry.weight;
+    }
+    std::memset(pos, 0, out.data() + size - pos);
+    return size;
+  }
+
+  /// @return the header of a serialized sketch of capacity k, whose entries
+  /// are validated.
+  /// @throws std::invalid_argument if the buffer does not hold a serialized
+  ///   sketch of the same type and capacity.
+  static SpaceSavingHeader ReadHeader(std::span<const std::byte> buffer,
+                                      size_t k) {
+    if (buffer.size() < sizeof(SpaceSavingHeader)) {
+      throw std::invalid_argument("buffer is too small for the header");
+    }
+    const auto header =
+        detail::LoadUnaligned<SpaceSavingHeader>(buffer.data());
+    if (header.magic != SpaceSavingHeader::kMagic) {
+      throw std::invalid_argument("not a serialized SpaceSaving sketch");
+    }
+    if (header.version != SpaceSavingHeader::kVersion) {
+      throw std::invalid_argument("unsupported version " +
+                                  std::to_string(header.version));
+    }
+    if (header.type_tag != detail::TypeTag<T>() ||
+        header.value_size != kValueSize || header.k != k) {
+      throw std::invalid_argument("incompatible SpaceSaving sketch of K=" +
+                                  std::to_string(header.k));
+    }
+    if (header.num_values > k ||
+        header.payload_size > buffer.size() - sizeof(SpaceSavingHeader)) {
+      throw std::invalid_argument("truncated or malformed values");
+    }
+    const std::byte* pos = Begin(buffer);
+    const std::byte* end = End(buffer, header);
+    uint64_t weight = 0;
+    for (size_t i = 0; i < header.num_values; ++i) {
+      weight = GetEntry(pos, end, weight).weight;
+    }
+    if (pos != end ||
+        header.min_weight != (header.num_values == k ? weight : 0)) {
+      throw std::invalid_argument("truncated or malformed values");
+    }
+    return header;
+  }
+
+  /// Decodes the entries of a serialized sketch of capacity k into `out`,
+  /// which has room for k entries.
+  /// @return the number of entries, sorted by decreasing weight.
+  /// @throws std::invalid_argument if the buffer does not hold a serialized
+  ///   sketch of the same type and capacity.
+  static size_t Decode(std::span<const std::byte> buffer, size_t k,
+                       std::span<Entry> out) {
+    const SpaceSavingHeader header = ReadHeader(buffer, k);
+    const std::byte* pos = Begin(buffer);
+    const std::byte* end = End(buffer, header);
+    uint64_t weight = 0;
+    for (size_t i = 0; i < header.num_values; ++i) {
+      out[i] = GetEntry(pos, end, weight);
+      weight = out[i].weight;
+    }
+    return header.num_values;
+  }
+
+  /// @return the first entry of a serialized sketch.
+  static const std::byte* Begin(std::span<const std::byte> buffer) {
+    return buffer.data() + sizeof(SpaceSavingHeader);
+  }
+
+  /// @return the end of the entries of a serialized sketch.
+  static const std::byte* End(std::span<const std::byte> buffer,
+                              const SpaceSavingHeader& header) {
+    return Begin(buffer) + header.payload_size;
+  }
+
+  /// Decodes the entry at pos and advances pos past it.
+  /// @param previous the weight of the previous entry, 0 for the first one.
+  /// @throws std::invalid_argument if the entry is truncated or malformed.
+  static Entry GetEntry(const std::byte*& pos, const std::byte* end,
+                        uint64_t previous) {
+    Entry entry;
+    entry.value = GetValue(pos, end);
+    const uint64_t delta = detail::GetVarint(pos, end);
+    // the weights are positive, so they can only decrease below the first
+    if ((previous == 0 && delta == 0) || (previous != 0 && delta >= previous)) {
+      throw std::invalid_argument("malformed weights");
+    }
+    entry.weight = previous == 0 ? delta : previous - delta;
+    return entry;
+  }
+
+ private:
+  static constexpr uint8_t kValueSize =
+      detail::is_string_v<T> ? 0 : static_cast<uint8_t>(sizeof(T));
+
+  static size_t PayloadSize(std::span<const Entry> entries) {
+    size_t size = 0;
+    uint64_t previous = 0;
+    for (const Entry& entry : entries) {
+      if constexpr (detail::is_string_v<T>) {
+        size += detail::VarintSize(entry.value.size()) + entry.value.size();
+      } else {
+        size += sizeof(T);
+      }
+      size += detail::VarintSize(previous == 0 ? entry.weight
+                                               : previous - entry.weight);
+      previous = entry.weight;
+    }
+    return size;
+  }
+
+  static std::byte* PutValue(const Value& value, std::byte* pos) {
+    if constexpr (detail::is_string_v<T>) {
+      pos += detail::PutVarint(value.size(), pos);
+      std::memcpy(pos, value.data(), value.size());
+      return pos + value.size();
+    } else {
+      detail::StoreUnaligned(pos, value);
+      return pos + sizeof(T);
+    }
+  }
+
+  static Value GetValue(const std::byte*& pos, const std::byte* end) {
+    if constexpr (detail::is_string_v<T>) {
+      const uint64_t size = detail::GetVarint(pos, end);
+      if (size > static_cast<uint64_t>(end - pos)) {
+        throw std::invalid_argument("truncated or malformed values");
+      }
+      const std::string_view value(reinterpret_cast<const char*>(pos), size);
+      pos += size;
+      return value;
+    } else {
+      if (static_cast<size_t>(end - pos) < sizeof(T)) {
+        throw std::invalid_argument("truncated or malformed values");
+      }
+      const T value = detail::LoadUnaligned<T>(pos);
+      pos += sizeof(T);
+      return value;
+    }
+  }
+};
+
+/// Read-only view of a serialized `SpaceSaving` sketch that answers queries
+/// from the buffer in place, e.g. from a memory-mapped file after a restart,
+/// without rebuilding the heap.
+///
+/// The entries are validated once by the constructor, and decoded in the
+/// order of the wire format by every query. An estimate takes O(K) time like
+/// in the sketch, without the SIMD search, and the top values are a prefix of
+/// the entries. The buffer must outlive the view.
+///
+/// @tparam T the data type of the sketch.
+/// @tparam K capacity of the sketch.
+template <typename T, size_t K>
+class SpaceSavingView {
+  using Wire = SpaceSavingWire<T>;
+
+ public:
+  /// @throws std::invalid_argument if the buffer does not hold a serialized
+  ///   sketch of the same type and K.
+  explicit SpaceSavingView(std::span<const std::byte> buffer)
+      : header_(Wire::ReadHeader(buffer, K)),
+        begin_(Wire::Begin(buffer)),
+        end_(Wire::End(buffer, header_)) {}
+
+  /// @return the estimated weight of a value, or 0 if it is not monitored,
+  /// see SpaceSaving::Estimate.
+  uint64_t Estimate(const T& value) const {
+    const std::byte* pos = begin_;
+    uint64_t weight = 0;
+    for (size_t i = 0; i < header_.num_values; ++i) {
+      const auto entry = Wire::GetEntry(pos, end_, weight);
+      if (Equals(entry.value, value)) return entry.weight;
+      weight = entry.weight;
+    }
+    return 0;
+  }
+
+  /// @return the minimum weight of the monitored values, see
+  /// SpaceSaving::GetMinWeight.
+  uint64_t GetMinWeight() const noexcept { return header_.min_weight; }
+
+  /// Writes the monitored values with the largest weights to `out`, sorted by
+  /// decreasing weight, see SpaceSaving::TopK.
+  /// @return the number of values written, at most `out.size()` and K.
+  size_t TopK(std::span<WeightedValue<T>> out) const {
+    const size_t n = std::min<size_t>(out.size(), header_.num_values);
+    const std::byte* pos = begin_;
+    uint64_t weight = 0;
+    for (size_t i = 0; i < n; ++i) {
+      const auto entry = Wire::GetEntry(pos, end_, weight);
+      out[i].value = T(entry.value);
+      out[i].weight = weight = entry.weight;
+    }
+    return n;
+  }
+
+ private:
+  /// @return whether a decoded value is the given value, comparing
+  /// floating point values by their bits like the sketch.
+  static bool Equals(const typename Wire::Value& stored, const T& value) {
+    if constexpr (std::is_floating_point_v<T>) {
+      // the sketch stores 0.0 for both zeros, and finds NaN by its bits
+      const T key = value == 0 ? T{0} : value;
+      return std::memcmp(&stored, &key, sizeof(T)) == 0;
+    } else {
+      return stored == value;
+    }
+  }
+
+  SpaceSavingHeader header_;
+  const std::byte* begin_;
+  const std::byte* end_;
+};
+
 /// SpaceSaving sketch for frequent item estimation.
 ///
 /// The implementation roughly follows the book
@@ -22,6 +427,10 @@ namespace final {
 /// It stores the weights and values in a min-heap, and leverages SIMD search
 /// for fast find operations.
 ///
+/// The estimated weight of a monitored value overestimates its frequency by at
+/// most `GetMinWeight()`, and the frequency of a value that is not monitored is
+/// at most `GetMinWeight()`.
+///
 /// The sketch was introduced in the paper
 ///   Metwally, Ahmed, Divyakant Agrawal, and Amr El Abbadi. "Efficient
 ///   computation of frequent and top-k elements in data streams." International
@@ -30,7 +439,18 @@ namespace final {
 ///
 /// @tparam T the data type the sketch summarizes.
 /// @tparam K number of elements the sketch can store.
-template <typename T, size_t K = 96, typename = void>
+/// @tparam Backend the SIMD backend of the find operation, see `simd.hpp`.
+/// @tparam kCacheSize number of entries of a `FrontCache` that maps recently
+/// inserted values to their index, so that inserts of these values skip the
+/// SIMD search. Pays off on skewed streams where a few values make up most of
+/// the inserts. 0 disables the cache.
+/// @tparam Hasher the hash policy of non-arithmetic types, see `hash.hpp`. The
+/// sketch folds every hash to 64 bits, so a 64 bit hash such as
+/// `detail::Xxh3Hasher` is enough. Arithmetic values are stored as they are.
+template <typename T, size_t K = 96,
+          typename Backend = detail::simd::DefaultBackend,
+          size_t kCacheSize = 0, typename Hasher = detail::Murmur3Hasher,
+          typename = void>
 class SpaceSaving {};
 
 /// SpaceSaving sketch for frequent item estimation.
@@ -39,11 +459,13 @@ class SpaceSaving {};
 /// their weights, organized as a min-heap.
 ///
 /// For more details see the doc comment on the SpaceSaving primary template.
-template <typename T, size_t K>
-class SpaceSaving<T, K,
+template <typename T, size_t K, typename Backend, size_t kCacheSize,
+          typename Hasher>
+class SpaceSaving<T, K, Backend, kCacheSize, Hasher,
                   std::enable_if_t<std::is_arithmetic_v<T> &&
                                    !std::is_same_v<T, __int128_t> &&
-                                   !std::is_same_v<T, __uint128_t>>> {
+                                   !std::is_same_v<T, __uint128_t>>>
+    : private FrontCache<K, kCacheSize> {
  public:
   /// Update the weight of a given value.
   ///
@@ -55,7 +477,152 @@ class SpaceSaving<T, K,
     UpdateHeap(value, i);
   }
 
+  /// Update the weight of a given value by `weight`, equivalent to inserting
+  /// it `weight` times. Weights of 0 and below leave the sketch unchanged.
+  template <typename Weight,
+            std::enable_if_t<detail::is_weight_v<Weight>, int> = 0>
+  void Insert(const T& v, Weight w) noexcept {
+    const uint64_t weight = detail::ClampWeight(w);
+    if (weight == 0) return;
+    const auto& value = Normalized(v);
+    size_t i = Find</*NotFound=*/0>(value);
+    UpdateHeap(value, i, weight);
+  }
+
+  /// Update the weights of a batch of pre-aggregated values, `values[i]` by
+  /// `weights[i]`. Both spans must have the same size. Values of weight 0 are
+  /// skipped.
+  void InsertBatch(std::span<const T> values,
+                   std::span<const uint64_t> weights) noexcept {
+    for (size_t i = 0; i < values.size(); ++i) {
+      Insert(values[i], weights[i]);
+    }
+  }
+
+  /// @return the estimated weight of a value, or 0 if it is not monitored.
+  ///
+  /// Takes O(K) time using the same SIMD search as the insert.
+  uint64_t Estimate(const T& value) const noexcept {
+    const size_t i = Find(Normalized(value));
+    return i < K ? weights[i] : 0;
+  }
+
+  /// @return the minimum weight of the monitored values, which bounds the
+  /// estimation error. It is 0 until K distinct values have been inserted.
+  uint64_t GetMinWeight() const noexcept { return weights[0]; }
+
+  /// Writes the monitored values with the largest weights to `out`, sorted by
+  /// decreasing weight.
+  ///
+  /// Does not allocate, the ordering is computed on the stack. Values with
+  /// equal weights are ordered by their position in the heap.
+  /// @return the number of values written, at most `out.size()` and K.
+  size_t TopK(std::span<WeightedValue<T>> out) const {
+    std::array<uint32_t, K> order = detail::sequence<uint32_t, K>();
+    const size_t n = std::min(out.size(), K);
+    std::partial_sort(order.begin(), order.begin() + n, order.end(),
+                      [this](uint32_t a, uint32_t b) {
+                        return weights[a] > weights[b] ||
+                               (weights[a] == weights[b] && a < b);
+                      });
+    size_t count = 0;
+    for (; count < n && weights[order[count]] > 0; ++count) {
+      out[count].value = values[order[count]];
+      out[count].weight = weights[order[count]];
+    }
+    return count;
+  }
+
+  /// Merges another sketch into this sketch.
+  ///
+  /// Follows the merge of Agarwal et al., "Mergeable summaries": a value that
+  /// only one of the sketches monitors is estimated with the minimum weight of
+  /// the other sketch, the estimates of both sketches are added, and the K
+  /// values with the largest sums are kept. The merged sketch has the
+  /// guarantees of the class comment for the union of both streams.
+  ///
+  /// Takes O(K) time for the SIMD searches and O(K log(K)) time to rebuild
+  /// the heap.
+  void Merge(const SpaceSaving& other) noexcept {
+    std::array<WeightedValue<T>, 2 * K> candidates;
+    size_t n = 0;
+    for (size_t i = 0; i < K; ++i) {
+      if (weights[i] == 0) continue;
+      // A value that other does not monitor maps to its minimum at index 0.
+      const size_t j = other.Find</*NotFound=*/0>(values[i]);
+      candidates[n++] = {values[i], weights[i] + other.weights[j]};
+    }
+    for (size_t j = 0; j < K; ++j) {
+      if (other.weights[j] == 0) continue;
+      const size_t i = Find(other.values[j]);
+      if (i < K && weights[i] > 0) continue;
+      candidates[n++] = {other.values[j], other.weights[j] + weights[0]};
+    }
+
+    const size_t m = std::min(n, K);
+    std::partial_sort(
+        candidates.begin(), candidates.begin() + m, candidates.begin() + n,
+        [](const auto& a, const auto& b) { return a.weight > b.weight; });
+    Rebuild(candidates.data(), m);
+  }
+
+  /// Read-only view of a serialized sketch, see `SpaceSavingView`.
+  using View = SpaceSavingView<T, K>;
+
+  /// @return the size of the sketch serialized, see `SpaceSavingHeader`.
+  size_t SerializedSize() const {
+    std::array<WeightedValue<T>, K> entries;
+    return SpaceSavingWire<T>::SerializedSize(
+        {entries.data(), TopK({entries.data(), K})});
+  }
+
+  /// Serializes the monitored values into `out`, see `SpaceSavingHeader`.
+  ///
+  /// Sorts the values by weight in O(K log(K)) time. To serialize the sketch
+  /// on another thread while the inserts continue, serialize a copy, which is
+  /// a copy of the K slots and does not allocate.
+  /// @return the number of bytes written, `SerializedSize()`.
+  /// @throws std::invalid_argument if `out` is too small.
+  size_t Serialize(std::span<std::byte> out) const {
+    std::array<WeightedValue<T>, K> entries;
+    const size_t n = TopK({entries.data(), K});
+    return SpaceSavingWire<T>::Serialize({entries.data(), n}, K,
+                                         GetMinWeight(), out);
+  }
+
+  /// Replaces the monitored values of this sketch with those of a serialized
+  /// sketch.
+  /// @throws std::invalid_argument if the buffer does not hold a serialized
+  ///   sketch of the same type and K.
+  void Deserialize(std::span<const std::byte> buffer) {
+    std::array<WeightedValue<T>, K> entries;
+    const size_t n =
+        SpaceSavingWire<T>::Decode(buffer, K, {entries.data(), K});
+    Rebuild(entries.data(), n);
+  }
+
  private:
+  /// Replaces the heap with the first m of the given values, sorted by
+  /// decreasing weight.
+  void Rebuild(const WeightedValue<T>* candidates, size_t m) {
+    // Values sorted by increasing weight form a valid min heap. The free slots
+    // in front get distinct dummy values with weight 0, like a new sketch.
+    size_t dummy = 0;
+    for (size_t i = 0; i < K - m; ++i) {
+      while (std::any_of(candidates, candidates + m, [&](const auto& c) {
+        return c.value == static_cast<T>(dummy);
+      })) {
+        ++dummy;
+      }
+      values[i] = static_cast<T>(dummy++);
+      weights[i] = 0;
+    }
+    for (size_t i = K - m; i < K; ++i) {
+      values[i] = candidates[K - 1 - i].value;
+      weights[i] = candidates[K - 1 - i].weight;
+    }
+  }
+
   /// Returns a normalized representation of the given value.
   ///
   /// Since we use bit equality to compare the values, we need to normalize
@@ -97,12 +664,13 @@ class SpaceSaving<T, K,
     }
     weights[parent] = weight;
     values[parent] = value;
+    if constexpr (kCacheSize > 0) this->CacheIndex(KeyOf(value), parent);
   }
 
   /// Sets the value at index i in the min heap to value and increments the
-  /// weight. Then restores the min heap condition.
-  void UpdateHeap(const T& value, size_t i) {
-    weights[i] += 1;
+  /// weight by `weight`. Then restores the min heap condition.
+  void UpdateHeap(const T& value, size_t i, uint64_t weight = 1) {
+    weights[i] += weight;
     values[i] = value;
     SiftDown(i);
   }
@@ -114,43 +682,25 @@ class SpaceSaving<T, K,
   /// @tparam NotFound the value to return if the value was not found.
   template <size_t NotFound = K>
   size_t Find(const T& value) const {
-    size_t i = 0;
-    if constexpr (sizeof(T) == 2) {
-      const auto* data = reinterpret_cast<const uint16_t*>(values.data());
-      const __m256i v =
-          detail::broadcast_epi16(*reinterpret_cast<const uint16_t*>(&value));
-      for (; i + 64 <= K; i += 64) {
-        const uint64_t mask = detail::Compare64Keys16Bit(v, data + i);
-        if (mask != 0) return i + __builtin_ctzll(mask);
-      }
-      for (; i + 32 <= K; i += 32) {
-        const uint64_t mask = detail::Compare32Keys16Bit(v, data + i);
-        if (mask != 0) return i + __builtin_ctzll(mask);
-      }
-    } else if constexpr (sizeof(T) == 4) {
-      const auto* data = reinterpret_cast<const uint32_t*>(values.data());
-      const __m256i v =
-          detail::broadcast_epi32(*reinterpret_cast<const uint32_t*>(&value));
-      for (; i + 64 <= K; i += 64) {
-        const uint64_t mask = detail::Compare64Keys32Bit(v, data + i);
-        if (mask != 0) return i + __builtin_ctzll(mask);
-      }
-      for (; i + 32 <= K; i += 32) {
-        const uint64_t mask = detail::Compare32Keys32Bit(v, data + i);
-        if (mask != 0) return i + __builtin_ctzll(mask);
-      }
-    } else if constexpr (sizeof(T) == 8) {
-      const auto* data = reinterpret_cast<const uint64_t*>(values.data());
-      const __m256i v =
-          detail::broadcast_epi64(*reinterpret_cast<const uint64_t*>(&value));
-      for (; i + 32 <= K; i += 32) {
-        const uint64_t mask = detail::Compare32Keys64Bit(v, data + i);
-        if (mask != 0) return i + __builtin_ctzll(mask);
-      }
-    } else {
-      static_assert(!sizeof(T), "Unsupported datatype T");
+    const auto* keys = reinterpret_cast<const Key*>(values.data());
+    const Key key = KeyOf(value);
+    if constexpr (kCacheSize > 0) {
+      const size_t i = this->CachedIndex(key);
+      if (LIKELY(keys[i] == key)) return i;
     }
-    return NotFound;
+    const size_t i = detail::simd::FindKey<Backend>(keys, K, key);
+    return i < K ? i : NotFound;
+  }
+
+  static_assert(sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8,
+                "Unsupported datatype T");
+  /// Unsigned integer with the bits of a value, compared by the search.
+  using Key = std::conditional_t<
+      sizeof(T) == 2, uint16_t,
+      std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>;
+
+  OPT_INLINE static Key KeyOf(const T& value) {
+    return *reinterpret_cast<const Key*>(&value);
   }
 
   /// Values array filled with distinct dummy values by default.
@@ -166,22 +716,28 @@ class SpaceSaving<T, K,
 
 /// SpaceSaving sketch for frequent item estimation.
 ///
-/// Specialization non-arithmetic types which are stored in an auxiliary array.
+/// Specialization non-arithmetic types which are stored in an auxiliary array,
+/// except for strings, see below.
 /// This implementation works just like the implementation for arithmetic types,
 /// but instead of operating on the values themselves, we operator on 64 bit
 /// hashes. For the Find operation, we have to check all matches from the
 /// returned bitmask for equality instead of just taking the first one.
 ///
 /// For more details see the doc comment on the SpaceSaving primary template.
-template <typename T, size_t K>
-class SpaceSaving<T, K,
-                  std::enable_if_t<!std::is_arithmetic_v<T> ||
+template <typename T, size_t K, typename Backend, size_t kCacheSize,
+          typename Hasher>
+class SpaceSaving<T, K, Backend, kCacheSize, Hasher,
+                  std::enable_if_t<(!std::is_arithmetic_v<T> &&
+                                    !detail::is_string_v<T>) ||
                                    std::is_same_v<T, __int128_t> ||
-                                   std::is_same_v<T, __uint128_t>>> {
+                                   std::is_same_v<T, __uint128_t>>>
+    : private FrontCache<K, kCacheSize> {
  public:
+  using hasher = Hasher;
+
   /// Update the weight of element a given value.
   void Insert(const T& value) noexcept {
-    __uint128_t hash = detail::Hash(value);
+    __uint128_t hash = Hasher::Hash(value);
     Insert(value, hash);
   }
 
@@ -195,7 +751,205 @@ class SpaceSaving<T, K,
     UpdateHeap(value, hash, i);
   }
 
+  /// Update the weight of a given value by `weight`, equivalent to inserting
+  /// it `weight` times. Weights of 0 and below leave the sketch unchanged.
+  template <typename Weight,
+            std::enable_if_t<detail::is_weight_v<Weight>, int> = 0>
+  void Insert(const T& value, Weight weight) noexcept {
+    Insert(value, Hasher::Hash(value), detail::ClampWeight(weight));
+  }
+
+  /// Update the weight of a given pre-hashed value by `weight`. A weight of 0
+  /// leaves the sketch unchanged.
+  void Insert(const T& value, const __uint128_t& h, uint64_t weight) noexcept {
+    if (weight == 0) return;
+    uint64_t hash = detail::roll_down(h);
+    size_t i = Find</*NotFound=*/0>(value, hash);
+    UpdateHeap(value, hash, i, weight);
+  }
+
+  /// Update the weights of a batch of values.
+  ///
+  /// The values are hashed in blocks of `kHashBlockSize`, using the vectorized
+  /// hash kernels for 128 bit integers, before they are inserted one by one.
+  void InsertBatch(std::span<const T> values) noexcept {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      Hasher::HashBatch(values.subspan(i, n), hashes.data());
+      for (size_t k = 0; k < n; ++k) {
+        Insert(values[i + k], hashes[k]);
+      }
+    }
+  }
+
+  /// Update the weights of a batch of pre-aggregated values, `values[i]` by
+  /// `weights[i]`. Both spans must have the same size. Values of weight 0 are
+  /// skipped.
+  void InsertBatch(std::span<const T> values,
+                   std::span<const uint64_t> weights) noexcept {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      Hasher::HashBatch(values.subspan(i, n), hashes.data());
+      for (size_t k = 0; k < n; ++k) {
+        Insert(values[i + k], hashes[k], weights[i + k]);
+      }
+    }
+  }
+
+  /// @return the estimated weight of a value, or 0 if it is not monitored.
+  ///
+  /// Takes O(K) time using the same SIMD search as the insert.
+  uint64_t Estimate(const T& value) const noexcept {
+    return Estimate(value, Hasher::Hash(value));
+  }
+
+  /// @return the estimated weight of a pre-hashed value, or 0 if it is not
+  /// monitored.
+  uint64_t Estimate(const T& value, const __uint128_t& h) const noexcept {
+    const size_t i = Find(value, detail::roll_down(h));
+    return i < K ? weights[i] : 0;
+  }
+
+  /// @return the minimum weight of the monitored values, which bounds the
+  /// estimation error. It is 0 until K distinct values have been inserted.
+  uint64_t GetMinWeight() const noexcept { return weights[0]; }
+
+  /// Writes the monitored values with the largest weights to `out`, sorted by
+  /// decreasing weight.
+  ///
+  /// Does not allocate, the ordering is computed on the stack. Values with
+  /// equal weights are ordered by their position in the heap.
+  /// @return the number of values written, at most `out.size()` and K.
+  size_t TopK(std::span<WeightedValue<T>> out) const {
+    std::array<uint32_t, K> order = detail::sequence<uint32_t, K>();
+    const size_t n = std::min(out.size(), K);
+    std::partial_sort(order.begin(), order.begin() + n, order.end(),
+                      [this](uint32_t a, uint32_t b) {
+                        return weights[a] > weights[b] ||
+                               (weights[a] == weights[b] && a < b);
+                      });
+    size_t count = 0;
+    for (; count < n && weights[order[count]] > 0; ++count) {
+      out[count].value = values[order[count]];
+      out[count].weight = weights[order[count]];
+    }
+    return count;
+  }
+
+  /// Merges another sketch into this sketch.
+  ///
+  /// Works like the merge of the specialization for arithmetic types, see
+  /// there. The values monitored by this sketch are moved, those of the other
+  /// sketch are copied.
+  void Merge(const SpaceSaving& other) {
+    std::array<Candidate, 2 * K> candidates;
+    size_t n = 0;
+    for (size_t i = 0; i < K; ++i) {
+      if (weights[i] == 0) continue;
+      // A value that other does not monitor maps to its minimum at index 0.
+      const size_t j =
+          other.Find</*NotFound=*/0>(values[i], hashes[i]);
+      candidates[n++] = {weights[i] + other.weights[j], hashes[i], &values[i]};
+    }
+    for (size_t j = 0; j < K; ++j) {
+      if (other.weights[j] == 0) continue;
+      const size_t i = Find(other.values[j], other.hashes[j]);
+      if (i < K && weights[i] > 0) continue;
+      candidates[n++] = {other.weights[j] + weights[0], other.hashes[j],
+                         &other.values[j]};
+    }
+
+    const size_t m = std::min(n, K);
+    std::partial_sort(
+        candidates.begin(), candidates.begin() + m, candidates.begin() + n,
+        [](const auto& a, const auto& b) { return a.weight > b.weight; });
+    Rebuild(candidates.data(), m);
+  }
+
+  /// Read-only view of a serialized sketch, see `SpaceSavingView`.
+  using View = SpaceSavingView<T, K>;
+
+  /// @return the size of the sketch serialized, see `SpaceSavingHeader`.
+  size_t SerializedSize() const {
+    std::array<WeightedValue<T>, K> entries;
+    return SpaceSavingWire<T>::SerializedSize(
+        {entries.data(), TopK({entries.data(), K})});
+  }
+
+  /// Serializes the monitored values into `out`, see `SpaceSavingHeader`.
+  /// Only fixed-width values can be serialized.
+  ///
+  /// Sorts the values by weight in O(K log(K)) time. To serialize the sketch
+  /// on another thread while the inserts continue, serialize a copy, which is
+  /// a copy of the K slots.
+  /// @return the number of bytes written, `SerializedSize()`.
+  /// @throws std::invalid_argument if `out` is too small.
+  size_t Serialize(std::span<std::byte> out) const {
+    std::array<WeightedValue<T>, K> entries;
+    const size_t n = TopK({entries.data(), K});
+    return SpaceSavingWire<T>::Serialize({entries.data(), n}, K,
+                                         GetMinWeight(), out);
+  }
+
+  /// Replaces the monitored values of this sketch with those of a serialized
+  /// sketch, whose values are hashed again.
+  /// @throws std::invalid_argument if the buffer does not hold a serialized
+  ///   sketch of the same type and K.
+  void Deserialize(std::span<const std::byte> buffer) {
+    std::array<WeightedValue<T>, K> entries;
+    const size_t n =
+        SpaceSavingWire<T>::Decode(buffer, K, {entries.data(), K});
+    std::array<Candidate, K> candidates;
+    for (size_t i = 0; i < n; ++i) {
+      candidates[i] = {entries[i].weight,
+                       detail::roll_down(Hasher::Hash(entries[i].value)),
+                       &entries[i].value};
+    }
+    Rebuild(candidates.data(), n);
+  }
+
  private:
+  /// Number of values hashed up front by the batch insert.
+  static constexpr size_t kHashBlockSize = 64;
+
+  /// A value of this or another sketch that may be kept by a merge.
+  struct Candidate {
+    uint64_t weight;
+    uint64_t hash;
+    const T* value;
+  };
+
+  /// Replaces the heap with the first m candidates, sorted by decreasing
+  /// weight. Candidates among the values of this sketch are moved, all others
+  /// copied.
+  void Rebuild(const Candidate* candidates, size_t m) {
+    // Values sorted by increasing weight form a valid min heap. The free slots
+    // in front get distinct dummy hashes with weight 0, like a new sketch.
+    std::array<T, K> merged_values{};
+    uint64_t dummy = 0;
+    for (size_t i = 0; i < K - m; ++i) {
+      while (std::any_of(candidates, candidates + m,
+                         [&](const auto& c) { return c.hash == dummy; })) {
+        ++dummy;
+      }
+      hashes[i] = dummy++;
+      weights[i] = 0;
+    }
+    for (size_t i = K - m; i < K; ++i) {
+      const Candidate& c = candidates[K - 1 - i];
+      if (c.value >= values.data() && c.value < values.data() + K) {
+        merged_values[i] = std::move(const_cast<T&>(*c.value));
+      } else {
+        merged_values[i] = *c.value;
+      }
+      hashes[i] = c.hash;
+      weights[i] = c.weight;
+    }
+    values = std::move(merged_values);
+  }
+
   /// Sifts down the element at index i in the min heap
   ///
   /// This assumes that the weight at index i was increased, and will restore
@@ -225,13 +979,15 @@ class SpaceSaving<T, K,
     weights[parent] = weight;
     hashes[parent] = hash;
     values[parent] = std::move(value);
+    if constexpr (kCacheSize > 0) this->CacheIndex(hash, parent);
   }
 
   /// Sets the value at index i in the min heap to value and increments the
-  /// weight. Then restores the min heap condition.
-  void UpdateHeap(const T& value, uint64_t hash, size_t i) {
+  /// weight by `weight`. Then restores the min heap condition.
+  void UpdateHeap(const T& value, uint64_t hash, size_t i,
+                  uint64_t weight = 1) {
     hashes[i] = hash;
-    weights[i] += 1;
+    weights[i] += weight;
     values[i] = value;
     SiftDown(i);
   }
@@ -241,15 +997,15 @@ class SpaceSaving<T, K,
   /// @tparam NotFound the value to return if the value was not found.
   template <size_t NotFound = K>
   size_t Find(const T& value, uint64_t hash) const {
+    if constexpr (kCacheSize > 0) {
+      const size_t i = this->CachedIndex(hash);
+      if (LIKELY(hashes[i] == hash && values[i] == value)) return i;
+    }
     const auto* data = hashes.data();
-    const __m256i v = _mm256_set1_epi64x(hash);
-    for (size_t i = 0; i + 32 <= K; i += 32) {
-      uint64_t mask = detail::Compare32Keys64Bit(v, data + i);
-      while (mask != 0) {
-        uint64_t j = i + __builtin_ctzll(mask);
-        if (LIKELY(values[j] == value)) return j;
-        mask &= mask - 1;
-      }
+    for (size_t i = 0; i < K; ++i) {
+      i += detail::simd::FindKey<Backend>(data + i, K - i, hash);
+      if (i == K) break;
+      if (LIKELY(values[i] == value)) return i;
     }
     return NotFound;
   }
@@ -265,4 +1021,315 @@ class SpaceSaving<T, K,
   static_assert(K % 32 == 0);
 };
 
+/// SpaceSaving sketch for frequent item estimation.
+///
+/// Specialization for strings, which are stored in a `StringSlab`. Works like
+/// the specialization for other non-arithmetic types, but the heap orders the
+/// slot indices of the strings along with their hashes and weights, so an
+/// insert copies the bytes of a new string once and moves only integers.
+///
+/// For more details see the doc comment on the SpaceSaving primary template.
+template <typename T, size_t K, typename Backend, size_t kCacheSize,
+          typename Hasher>
+class SpaceSaving<T, K, Backend, kCacheSize, Hasher,
+                  std::enable_if_t<detail::is_string_v<T>>>
+    : private FrontCache<K, kCacheSize> {
+ public:
+  using hasher = Hasher;
+
+  /// Update the weight of element a given value.
+  void Insert(const T& value) noexcept { Insert(value, Hasher::Hash(value)); }
+
+  /// Update the weight of element a given pre-hashed value.
+  ///
+  /// Takes O(K) time to check if the value already exists, and O(log(K)) time
+  /// to update the heap.
+  void Insert(const T& value, const __uint128_t& h) noexcept {
+    Insert(value, h, 1);
+  }
+
+  /// Update the weight of a given value by `weight`, equivalent to inserting
+  /// it `weight` times. Weights of 0 and below leave the sketch unchanged.
+  template <typename Weight,
+            std::enable_if_t<detail::is_weight_v<Weight>, int> = 0>
+  void Insert(const T& value, Weight weight) noexcept {
+    Insert(value, Hasher::Hash(value), detail::ClampWeight(weight));
+  }
+
+  /// Update the weight of a given pre-hashed value by `weight`. A weight of 0
+  /// leaves the sketch unchanged.
+  void Insert(const T& value, const __uint128_t& h, uint64_t weight) noexcept {
+    if (weight == 0) return;
+    const uint64_t hash = detail::roll_down(h);
+    size_t i = Find(value, hash);
+    if (i == K) {
+      // evicts the value with the minimum weight
+      i = 0;
+      hashes[0] = hash;
+      slab.Assign(slots[0], value);
+    }
+    weights[i] += weight;
+    SiftDown(i);
+  }
+
+  /// Update the weights of a batch of values.
+  ///
+  /// The values are hashed in blocks of `kHashBlockSize` before they are
+  /// inserted one by one.
+  void InsertBatch(std::span<const T> values) noexcept {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      Hasher::HashBatch(values.subspan(i, n), hashes.data());
+      for (size_t k = 0; k < n; ++k) {
+        Insert(values[i + k], hashes[k]);
+      }
+    }
+  }
+
+  /// Update the weights of a batch of pre-aggregated values, `values[i]` by
+  /// `weights[i]`. Both spans must have the same size. Values of weight 0 are
+  /// skipped.
+  void InsertBatch(std::span<const T> values,
+                   std::span<const uint64_t> weights) noexcept {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      Hasher::HashBatch(values.subspan(i, n), hashes.data());
+      for (size_t k = 0; k < n; ++k) {
+        Insert(values[i + k], hashes[k], weights[i + k]);
+      }
+    }
+  }
+
+  /// @return the estimated weight of a value, or 0 if it is not monitored.
+  ///
+  /// Takes O(K) time using the same SIMD search as the insert.
+  uint64_t Estimate(const T& value) const noexcept {
+    return Estimate(value, Hasher::Hash(value));
+  }
+
+  /// @return the estimated weight of a pre-hashed value, or 0 if it is not
+  /// monitored.
+  uint64_t Estimate(const T& value, const __uint128_t& h) const noexcept {
+    const size_t i = Find(value, detail::roll_down(h));
+    return i < K ? weights[i] : 0;
+  }
+
+  /// @return the minimum weight of the monitored values, which bounds the
+  /// estimation error. It is 0 until K distinct values have been inserted.
+  uint64_t GetMinWeight() const noexcept { return weights[0]; }
+
+  /// Writes the monitored values with the largest weights to `out`, sorted by
+  /// decreasing weight.
+  ///
+  /// The ordering is computed on the stack, only the copies of the values
+  /// written to `out` allocate. Values with equal weights are ordered by their
+  /// position in the heap.
+  /// @return the number of values written, at most `out.size()` and K.
+  size_t TopK(std::span<WeightedValue<T>> out) const {
+    const size_t n = std::min(out.size(), K);
+    const std::array<uint32_t, K> order = SortedOrder(n);
+    size_t count = 0;
+    for (; count < n && weights[order[count]] > 0; ++count) {
+      out[count].value = T(slab.Get(slots[order[count]]));
+      out[count].weight = weights[order[count]];
+    }
+    return count;
+  }
+
+  /// Merges another sketch into this sketch.
+  ///
+  /// Works like the merge of the specialization for arithmetic types, see
+  /// there. The merged values are copied into a new slab.
+  void Merge(const SpaceSaving& other) {
+    std::array<Candidate, 2 * K> candidates;
+    size_t n = 0;
+    for (size_t i = 0; i < K; ++i) {
+      if (weights[i] == 0) continue;
+      const std::string_view value = slab.Get(slots[i]);
+      // A value that other does not monitor maps to its minimum at index 0.
+      size_t j = other.Find(value, hashes[i]);
+      if (j == K) j = 0;
+      candidates[n++] = {weights[i] + other.weights[j], hashes[i], value};
+    }
+    for (size_t j = 0; j < K; ++j) {
+      if (other.weights[j] == 0) continue;
+      const std::string_view value = other.slab.Get(other.slots[j]);
+      const size_t i = Find(value, other.hashes[j]);
+      if (i < K && weights[i] > 0) continue;
+      candidates[n++] = {other.weights[j] + weights[0], other.hashes[j], value};
+    }
+
+    const size_t m = std::min(n, K);
+    std::partial_sort(
+        candidates.begin(), candidates.begin() + m, candidates.begin() + n,
+        [](const auto& a, const auto& b) { return a.weight > b.weight; });
+    Rebuild(candidates.data(), m);
+  }
+
+  /// Read-only view of a serialized sketch, see `SpaceSavingView`.
+  using View = SpaceSavingView<T, K>;
+
+  /// @return the size of the sketch serialized, see `SpaceSavingHeader`.
+  size_t SerializedSize() const {
+    std::array<WeightedValue<std::string_view>, K> entries;
+    return SpaceSavingWire<T>::SerializedSize(
+        {entries.data(), Entries(entries)});
+  }
+
+  /// Serializes the monitored values into `out`, see `SpaceSavingHeader`.
+  ///
+  /// Sorts the values by weight in O(K log(K)) time, and copies the strings
+  /// straight from the slab. To serialize the sketch on another thread while
+  /// the inserts continue, serialize a copy, which is a copy of the K slots
+  /// that allocates only for the strings beyond the inline size.
+  /// @return the number of bytes written, `SerializedSize()`.
+  /// @throws std::invalid_argument if `out` is too small.
+  size_t Serialize(std::span<std::byte> out) const {
+    std::array<WeightedValue<std::string_view>, K> entries;
+    const size_t n = Entries(entries);
+    return SpaceSavingWire<T>::Serialize({entries.data(), n}, K,
+                                         GetMinWeight(), out);
+  }
+
+  /// Replaces the monitored values of this sketch with those of a serialized
+  /// sketch, whose strings are copied into the slab and hashed again.
+  /// @throws std::invalid_argument if the buffer does not hold a serialized
+  ///   sketch of the same type and K.
+  void Deserialize(std::span<const std::byte> buffer) {
+    std::array<WeightedValue<std::string_view>, K> entries;
+    const size_t n =
+        SpaceSavingWire<T>::Decode(buffer, K, {entries.data(), K});
+    std::array<Candidate, K> candidates;
+    for (size_t i = 0; i < n; ++i) {
+      candidates[i] = {entries[i].weight,
+                       detail::roll_down(Hasher::Hash(entries[i].value)),
+                       entries[i].value};
+    }
+    Rebuild(candidates.data(), n);
+  }
+
+ private:
+  /// Number of values hashed up front by the batch insert.
+  static constexpr size_t kHashBlockSize = 64;
+
+  /// A value of this or another sketch that may be kept by a merge.
+  struct Candidate {
+    uint64_t weight;
+    uint64_t hash;
+    std::string_view value;
+  };
+
+  /// Replaces the heap with the first m candidates, sorted by decreasing
+  /// weight, whose strings are copied into a new slab.
+  void Rebuild(const Candidate* candidates, size_t m) {
+    // Values sorted by increasing weight form a valid min heap. The free slots
+    // in front get distinct dummy hashes with weight 0, like a new sketch.
+    StringSlab<T, K> merged;
+    uint64_t dummy = 0;
+    for (size_t i = 0; i < K - m; ++i) {
+      while (std::any_of(candidates, candidates + m,
+                         [&](const auto& c) { return c.hash == dummy; })) {
+        ++dummy;
+      }
+      hashes[i] = dummy++;
+      weights[i] = 0;
+    }
+    for (size_t i = K - m; i < K; ++i) {
+      const Candidate& c = candidates[K - 1 - i];
+      merged.Assign(i, c.value);
+      hashes[i] = c.hash;
+      weights[i] = c.weight;
+    }
+    slots = detail::sequence<Slot, K>();
+    slab = std::move(merged);
+  }
+
+  /// @return the heap indices sorted by decreasing weight, the first n of
+  /// them, with equal weights in heap order.
+  std::array<uint32_t, K> SortedOrder(size_t n) const {
+    std::array<uint32_t, K> order = detail::sequence<uint32_t, K>();
+    std::partial_sort(order.begin(), order.begin() + n, order.end(),
+                      [this](uint32_t a, uint32_t b) {
+                        return weights[a] > weights[b] ||
+                               (weights[a] == weights[b] && a < b);
+                      });
+    return order;
+  }
+
+  /// Writes the monitored values like TopK, as views of the slab.
+  /// @return the number of values written.
+  size_t Entries(std::array<WeightedValue<std::string_view>, K>& out) const {
+    const std::array<uint32_t, K> order = SortedOrder(K);
+    size_t count = 0;
+    for (; count < K && weights[order[count]] > 0; ++count) {
+      out[count] = {slab.Get(slots[order[count]]), weights[order[count]]};
+    }
+    return count;
+  }
+
+  /// Sifts down the element at index i in the min heap
+  ///
+  /// This assumes that the weight at index i was increased, and will restore
+  /// the min heap condition. It will also swap the slots accordingly.
+  inline void SiftDown(size_t i) {
+    const uint64_t weight = weights[i];
+    const uint64_t hash = hashes[i];
+    const Slot slot = slots[i];
+    size_t parent = i;
+    size_t child = 2 * parent + 1;
+    while (child < K) {
+      // Switch to right child if it is smaller.
+      const size_t right_child = child + 1;
+      if (right_child < K && weights[child] > weights[right_child]) {
+        child = right_child;
+      }
+      // If weight is not greater than the child's weight we are done.
+      if (!(weight > weights[child])) break;
+      // Else sift down.
+      weights[parent] = weights[child];
+      hashes[parent] = hashes[child];
+      slots[parent] = slots[child];
+      parent = child;
+      child = 2 * parent + 1;
+    }
+    weights[parent] = weight;
+    hashes[parent] = hash;
+    slots[parent] = slot;
+    if constexpr (kCacheSize > 0) this->CacheIndex(hash, parent);
+  }
+
+  /// Finds the given value in the heap.
+  /// @return the index of the value in the heap, or K.
+  size_t Find(std::string_view value, uint64_t hash) const {
+    if constexpr (kCacheSize > 0) {
+      const size_t i = this->CachedIndex(hash);
+      if (LIKELY(hashes[i] == hash && slab.Equals(slots[i], value))) return i;
+    }
+    const auto* data = hashes.data();
+    for (size_t i = 0; i < K; ++i) {
+      i += detail::simd::FindKey<Backend>(data + i, K - i, hash);
+      if (i == K) break;
+      if (LIKELY(slab.Equals(slots[i], value))) return i;
+    }
+    return K;
+  }
+
+  using Slot = std::conditional_t<
+      K <= (1 << 8), uint8_t,
+      std::conditional_t<K <= (1 << 16), uint16_t, uint32_t>>;
+
+  /// Hashes array filled with distinct dummy values by default.
+  /// Needs to be 32-byte aligned for SIMD operations.
+  alignas(32) std::array<uint64_t, K> hashes = detail::sequence<uint64_t, K>();
+  /// Min heap of size k, with weights initialized to 0.
+  std::array<uint64_t, K> weights{};
+  /// Slots of the values in the slab, in heap order.
+  std::array<Slot, K> slots = detail::sequence<Slot, K>();
+  StringSlab<T, K> slab;
+  /// K needs to be a multiple of 32 for the SIMD algorithm we use.
+  static_assert(K % 32 == 0);
+};
+
 }  // namespace final
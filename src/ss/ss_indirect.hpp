@@ -0,0 +1,464 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+
+#include "compiler.hpp"
+#include "hash.hpp"
+#include "helpers.hpp"
+#include "simd.hpp"
+#include "span.hpp"
+#include "ss/ss_final.hpp"
+#include "types.hpp"
+
+namespace indirect {
+
+/// Min heap of the weights of K slots, ordered by slot index.
+///
+/// The heap holds the weights and the indices of their slots, and a reverse
+/// map from each slot to its position in the heap. A sift down moves a weight
+/// and a small index per level, instead of the weight and the value, and
+/// updates the position of the moved slot.
+///
+/// @tparam K number of slots.
+template <size_t K>
+class IndexHeap {
+ protected:
+  /// Index of a slot, a single byte for the default K.
+  using Slot = std::conditional_t<
+      K <= (1 << 8), uint8_t,
+      std::conditional_t<K <= (1 << 16), uint16_t, uint32_t>>;
+
+  /// @return the slot with the minimum weight, evicted first.
+  OPT_INLINE size_t MinSlot() const { return slots_[0]; }
+
+  /// @return the slot at the given heap position.
+  OPT_INLINE size_t SlotAt(size_t position) const { return slots_[position]; }
+
+  /// @return the minimum weight of all slots.
+  OPT_INLINE uint64_t MinWeight() const { return weights_[0]; }
+
+  /// @return the weight of the given slot.
+  OPT_INLINE uint64_t Weight(size_t slot) const {
+    return weights_[positions_[slot]];
+  }
+
+  /// Increments the weight of the given slot and restores the heap.
+  OPT_INLINE void Increment(size_t slot, uint64_t weight) {
+    const size_t i = positions_[slot];
+    weights_[i] += weight;
+    SiftDown(i);
+  }
+
+  /// @return the slots sorted by decreasing weight up to `n`, like the TopK of
+  /// `final::SpaceSaving`, ties are ordered by their position in the heap.
+  std::array<Slot, K> SortedSlots(size_t n) const {
+    std::array<Slot, K> order = detail::sequence<Slot, K>();
+    std::partial_sort(order.begin(), order.begin() + n, order.end(),
+                      [this](Slot a, Slot b) {
+                        return weights_[a] > weights_[b] ||
+                               (weights_[a] == weights_[b] && a < b);
+                      });
+    for (size_t i = 0; i < n; ++i) order[i] = slots_[order[i]];
+    return order;
+  }
+
+  /// Selects the candidates of a merge with the heap of another sketch, like
+  /// `final::SpaceSaving::Merge`: every slot of this heap with its weight plus
+  /// the weight of its value in other, or the minimum of other, and every slot
+  /// of other whose value this heap does not monitor with its weight plus the
+  /// own minimum. Both heaps are scanned in heap order, so that ties are
+  /// broken like in `final::SpaceSaving`.
+  /// @param find returns the slot of the value of a slot, of other if
+  ///   `from_other` and of this heap otherwise, in the opposite heap, or K.
+  /// @param make returns the candidate of a slot with the merged weight.
+  /// @return the number of the candidates kept, at most K, which are sorted
+  ///   by decreasing weight at the front of `candidates`.
+  template <typename Candidate, typename Find, typename Make>
+  size_t SelectMergeCandidates(const IndexHeap& other, Find find, Make make,
+                               std::array<Candidate, 2 * K>& candidates) const {
+    size_t n = 0;
+    for (size_t p = 0; p < K; ++p) {
+      const size_t i = SlotAt(p);
+      const uint64_t weight = Weight(i);
+      if (weight == 0) continue;
+      const size_t j = find(/*from_other=*/false, i);
+      candidates[n++] =
+          make(/*from_other=*/false, i,
+               weight + (j < K ? other.Weight(j) : other.MinWeight()));
+    }
+    for (size_t p = 0; p < K; ++p) {
+      const size_t j = other.SlotAt(p);
+      const uint64_t weight = other.Weight(j);
+      if (weight == 0) continue;
+      const size_t i = find(/*from_other=*/true, j);
+      if (i < K && Weight(i) > 0) continue;
+      candidates[n++] = make(/*from_other=*/true, j, weight + MinWeight());
+    }
+
+    const size_t m = std::min(n, K);
+    std::partial_sort(
+        candidates.begin(), candidates.begin() + m, candidates.begin() + n,
+        [](const auto& a, const auto& b) { return a.weight > b.weight; });
+    return m;
+  }
+
+  /// Sets the weights of all slots, which must not decrease with the slot
+  /// index, and resets each slot to the heap position of its index.
+  void Assign(const std::array<uint64_t, K>& weights) {
+    weights_ = weights;
+    slots_ = detail::sequence<Slot, K>();
+    positions_ = detail::sequence<Slot, K>();
+  }
+
+ private:
+  /// Sifts down the slot at position i, whose weight was increased.
+  inline void SiftDown(size_t i) {
+    const uint64_t weight = weights_[i];
+    const Slot slot = slots_[i];
+    size_t parent = i;
+    size_t child = 2 * parent + 1;
+    while (child < K) {
+      // Switch to right child if it is smaller.
+      const size_t right_child = child + 1;
+      if (right_child < K && weights_[child] > weights_[right_child]) {
+        child = right_child;
+      }
+      // If weight is not greater than the child's weight we are done.
+      if (!(weight > weights_[child])) break;
+      // Else sift down.
+      weights_[parent] = weights_[child];
+      slots_[parent] = slots_[child];
+      positions_[slots_[parent]] = parent;
+      parent = child;
+      child = 2 * parent + 1;
+    }
+    weights_[parent] = weight;
+    slots_[parent] = slot;
+    positions_[slot] = parent;
+  }
+
+  /// Weights in heap order, initialized to 0.
+  std::array<uint64_t, K> weights_{};
+  /// Slot of each heap position.
+  std::array<Slot, K> slots_ = detail::sequence<Slot, K>();
+  /// Heap position of each slot.
+  std::array<Slot, K> positions_ = detail::sequence<Slot, K>();
+};
+
+/// SpaceSaving sketch for frequent item estimation with an index heap.
+///
+/// Has the interface and the guarantees of `final::SpaceSaving`, and the same
+/// SIMD search, but the searched keys stay in their slots. The heap orders
+/// slot indices with an `IndexHeap`, so an insert writes a new value once and
+/// its sift down moves a weight and an index per level. Pays off for wide
+/// values, e.g. 128 bit integers and strings, and on streams with many
+/// evictions, whose sift downs in `final::SpaceSaving` also rewrite the
+/// searched keys. On skewed streams whose inserts mostly find their value, the
+/// indirection costs about as much as it saves.
+///
+/// @tparam T the data type the sketch summarizes.
+/// @tparam K number of elements the sketch can store.
+/// @tparam Backend the SIMD backend of the find operation, see `simd.hpp`.
+template <typename T, size_t K = 96,
+          typename Backend = detail::simd::DefaultBackend, typename = void>
+class SpaceSaving {};
+
+/// SpaceSaving sketch with an index heap for arithmetic types, whose bits are
+/// searched like in `final::SpaceSaving`.
+template <typename T, size_t K, typename Backend>
+class SpaceSaving<T, K, Backend,
+                  std::enable_if_t<std::is_arithmetic_v<T> &&
+                                   !std::is_same_v<T, __int128_t> &&
+                                   !std::is_same_v<T, __uint128_t>>>
+    : private IndexHeap<K> {
+ public:
+  /// Update the weight of a given value.
+  ///
+  /// Takes O(K) time to check if the value already exists, and O(log(K)) time
+  /// to update the heap.
+  void Insert(const T& value) noexcept { Insert(value, uint64_t{1}); }
+
+  /// Update the weight of a given value by `weight`, equivalent to inserting
+  /// it `weight` times. Weights of 0 and below leave the sketch unchanged.
+  template <typename Weight,
+            std::enable_if_t<detail::is_weight_v<Weight>, int> = 0>
+  void Insert(const T& v, Weight w) noexcept {
+    const uint64_t weight = detail::ClampWeight(w);
+    if (weight == 0) return;
+    const T& value = detail::Normalized(v);
+    size_t slot = Find(value);
+    if (slot == K) {
+      slot = this->MinSlot();
+      values[slot] = value;
+    }
+    this->Increment(slot, weight);
+  }
+
+  /// Update the weights of a batch of pre-aggregated values, `values[i]` by
+  /// `weights[i]`. Both spans must have the same size. Values of weight 0 are
+  /// skipped.
+  void InsertBatch(std::span<const T> values,
+                   std::span<const uint64_t> weights) noexcept {
+    for (size_t i = 0; i < values.size(); ++i) {
+      Insert(values[i], weights[i]);
+    }
+  }
+
+  /// @return the estimated weight of a value, or 0 if it is not monitored.
+  uint64_t Estimate(const T& value) const noexcept {
+    const size_t slot = Find(detail::Normalized(value));
+    return slot < K ? this->Weight(slot) : 0;
+  }
+
+  /// @return the minimum weight of the monitored values, which bounds the
+  /// estimation error. It is 0 until K distinct values have been inserted.
+  uint64_t GetMinWeight() const noexcept { return this->MinWeight(); }
+
+  /// Writes the monitored values with the largest weights to `out`, sorted by
+  /// decreasing weight.
+  /// @return the number of values written, at most `out.size()` and K.
+  size_t TopK(std::span<final::WeightedValue<T>> out) const {
+    const size_t n = std::min(out.size(), K);
+    const auto order = this->SortedSlots(n);
+    size_t count = 0;
+    for (; count < n && this->Weight(order[count]) > 0; ++count) {
+      out[count].value = values[order[count]];
+      out[count].weight = this->Weight(order[count]);
+    }
+    return count;
+  }
+
+  /// Merges another sketch into this sketch, like `final::SpaceSaving::Merge`.
+  void Merge(const SpaceSaving& other) noexcept {
+    std::array<final::WeightedValue<T>, 2 * K> candidates;
+    const size_t m = this->SelectMergeCandidates(
+        other,
+        [&](bool from_other, size_t slot) {
+          return from_other ? Find(other.values[slot])
+                            : other.Find(values[slot]);
+        },
+        [&](bool from_other, size_t slot, uint64_t weight) {
+          const SpaceSaving& from = from_other ? other : *this;
+          return final::WeightedValue<T>{from.values[slot], weight};
+        },
+        candidates);
+    // Slots sorted by increasing weight form a valid min heap. The free slots
+    // in front get distinct dummy values with weight 0, like a new sketch.
+    std::array<uint64_t, K> weights{};
+    size_t dummy = 0;
+    for (size_t i = 0; i < K - m; ++i) {
+      while (std::any_of(candidates.begin(), candidates.begin() + m,
+                         [&](const auto& c) {
+                           return c.value == static_cast<T>(dummy);
+                         })) {
+        ++dummy;
+      }
+      values[i] = static_cast<T>(dummy++);
+    }
+    for (size_t i = K - m; i < K; ++i) {
+      values[i] = candidates[K - 1 - i].value;
+      weights[i] = candidates[K - 1 - i].weight;
+    }
+    this->Assign(weights);
+  }
+
+ private:
+  /// @return the slot of the given value, or K.
+  size_t Find(const T& value) const {
+    const auto* keys = reinterpret_cast<const Key*>(values.data());
+    Key key;
+    std::memcpy(&key, &value, sizeof(T));
+    return detail::simd::FindKey<Backend>(keys, K, key);
+  }
+
+  static_assert(sizeof(T) == 2 || sizeof(T) == 4 || sizeof(T) == 8,
+                "Unsupported datatype T");
+  /// Unsigned integer with the bits of a value, compared by the search.
+  using Key = std::conditional_t<
+      sizeof(T) == 2, uint16_t,
+      std::conditional_t<sizeof(T) == 4, uint32_t, uint64_t>>;
+
+  /// Values of the slots, filled with distinct dummy values by default.
+  /// Needs to be 32-byte aligned for SIMD operations.
+  alignas(32) std::array<T, K> values = detail::sequence<T, K>();
+  /// K needs to be a multiple of 32 for the SIMD algorithm we use.
+  static_assert(K % 32 == 0);
+};
+
+/// SpaceSaving sketch with an index heap for all other types, whose 64 bit
+/// hashes are searched like in `final::SpaceSaving`.
+template <typename T, size_t K, typename Backend>
+class SpaceSaving<T, K, Backend,
+                  std::enable_if_t<!std::is_arithmetic_v<T> ||
+                                   std::is_same_v<T, __int128_t> ||
+                                   std::is_same_v<T, __uint128_t>>>
+    : private IndexHeap<K> {
+ public:
+  /// Update the weight of a given value.
+  void Insert(const T& value) noexcept { Insert(value, detail::Hash(value)); }
+
+  /// Update the weight of a given pre-hashed value.
+  ///
+  /// Takes O(K) time to check if the value already exists, and O(log(K)) time
+  /// to update the heap.
+  void Insert(const T& value, const __uint128_t& h) noexcept {
+    Insert(value, h, 1);
+  }
+
+  /// Update the weight of a given value by `weight`, equivalent to inserting
+  /// it `weight` times. Weights of 0 and below leave the sketch unchanged.
+  template <typename Weight,
+            std::enable_if_t<detail::is_weight_v<Weight>, int> = 0>
+  void Insert(const T& value, Weight weight) noexcept {
+    Insert(value, detail::Hash(value), detail::ClampWeight(weight));
+  }
+
+  /// Update the weight of a given pre-hashed value by `weight`. A weight of 0
+  /// leaves the sketch unchanged.
+  void Insert(const T& value, const __uint128_t& h, uint64_t weight) noexcept {
+    if (weight == 0) return;
+    const uint64_t hash = detail::roll_down(h);
+    size_t slot = Find(value, hash);
+    if (slot == K) {
+      slot = this->MinSlot();
+      hashes[slot] = hash;
+      values[slot] = value;
+    }
+    this->Increment(slot, weight);
+  }
+
+  /// Update the weights of a batch of values, hashed in blocks like
+  /// `final::SpaceSaving::InsertBatch`.
+  void InsertBatch(std::span<const T> values) noexcept {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      detail::HashBatch(values.subspan(i, n), hashes.data());
+      for (size_t k = 0; k < n; ++k) {
+        Insert(values[i + k], hashes[k]);
+      }
+    }
+  }
+
+  /// Update the weights of a batch of pre-aggregated values, `values[i]` by
+  /// `weights[i]`. Both spans must have the same size. Values of weight 0 are
+  /// skipped.
+  void InsertBatch(std::span<const T> values,
+                   std::span<const uint64_t> weights) noexcept {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      detail::HashBatch(values.subspan(i, n), hashes.data());
+      for (size_t k = 0; k < n; ++k) {
+        Insert(values[i + k], hashes[k], weights[i + k]);
+      }
+    }
+  }
+
+  /// @return the estimated weight of a value, or 0 if it is not monitored.
+  uint64_t Estimate(const T& value) const noexcept {
+    return Estimate(value, detail::Hash(value));
+  }
+
+  /// @return the estimated weight of a pre-hashed value, or 0 if it is not
+  /// monitored.
+  uint64_t Estimate(const T& value, const __uint128_t& h) const noexcept {
+    const size_t slot = Find(value, detail::roll_down(h));
+    return slot < K ? this->Weight(slot) : 0;
+  }
+
+  /// @return the minimum weight of the monitored values, which bounds the
+  /// estimation error. It is 0 until K distinct values have been inserted.
+  uint64_t GetMinWeight() const noexcept { return this->MinWeight(); }
+
+  /// Writes the monitored values with the largest weights to `out`, sorted by
+  /// decreasing weight.
+  /// @return the number of values written, at most `out.size()` and K.
+  size_t TopK(std::span<final::WeightedValue<T>> out) const {
+    const size_t n = std::min(out.size(), K);
+    const auto order = this->SortedSlots(n);
+    size_t count = 0;
+    for (; count < n && this->Weight(order[count]) > 0; ++count) {
+      out[count].value = values[order[count]];
+      out[count].weight = this->Weight(order[count]);
+    }
+    return count;
+  }
+
+  /// Merges another sketch into this sketch, like `final::SpaceSaving::Merge`.
+  /// The values monitored by this sketch are moved, those of the other sketch
+  /// are copied.
+  void Merge(const SpaceSaving& other) {
+    struct Candidate {
+      uint64_t weight;
+      uint64_t hash;
+      const T* value;
+    };
+    std::array<Candidate, 2 * K> candidates;
+    const size_t m = this->SelectMergeCandidates(
+        other,
+        [&](bool from_other, size_t slot) {
+          return from_other ? Find(other.values[slot], other.hashes[slot])
+                            : other.Find(values[slot], hashes[slot]);
+        },
+        [&](bool from_other, size_t slot, uint64_t weight) {
+          const SpaceSaving& from = from_other ? other : *this;
+          return Candidate{weight, from.hashes[slot], &from.values[slot]};
+        },
+        candidates);
+    // Slots sorted by increasing weight form a valid min heap. The free slots
+    // in front get distinct dummy hashes with weight 0, like a new sketch.
+    std::array<T, K> merged_values{};
+    std::array<uint64_t, K> weights{};
+    uint64_t dummy = 0;
+    for (size_t i = 0; i < K - m; ++i) {
+      while (std::any_of(candidates.begin(), candidates.begin() + m,
+                         [&](const auto& c) { return c.hash == dummy; })) {
+        ++dummy;
+      }
+      hashes[i] = dummy++;
+    }
+    for (size_t i = K - m; i < K; ++i) {
+      const Candidate& c = candidates[K - 1 - i];
+      if (c.value >= values.data() && c.value < values.data() + K) {
+        merged_values[i] = std::move(const_cast<T&>(*c.value));
+      } else {
+        merged_values[i] = *c.value;
+      }
+      hashes[i] = c.hash;
+      weights[i] = c.weight;
+    }
+    values = std::move(merged_values);
+    this->Assign(weights);
+  }
+
+ private:
+  /// Number of values hashed up front by the batch insert.
+  static constexpr size_t kHashBlockSize = 64;
+
+  /// @return the slot of the given value, or K.
+  size_t Find(const T& value, uint64_t hash) const {
+    const auto* data = hashes.data();
+    for (size_t i = 0; i < K; ++i) {
+      i += detail::simd::FindKey<Backend>(data + i, K - i, hash);
+      if (i == K) break;
+      if (LIKELY(values[i] == value)) return i;
+    }
+    return K;
+  }
+
+  /// Hashes of the slots, filled with distinct dummy values by default.
+  /// Needs to be 32-byte aligned for SIMD operations.
+  alignas(32) std::array<uint64_t, K> hashes = detail::sequence<uint64_t, K>();
+  /// Values of the slots.
+  std::array<T, K> values{};
+  /// K needs to be a multiple of 32 for the SIMD algorithm we use.
+  static_assert(K % 32 == 0);
+};
+
+}  // namespace indirect
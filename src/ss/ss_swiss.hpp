@@ -0,0 +1,452 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "compiler.hpp"
+#include "hash.hpp"
+#include "span.hpp"
+#include "ss/ss_final.hpp"
+#include "types.hpp"
+
+namespace swiss {
+
+/// SpaceSaving sketch for frequent item estimation with large K.
+///
+/// Has the interface and the guarantees of `final::SpaceSaving`, but a unit
+/// insert takes O(1) expected time independent of K, where the SIMD search of
+/// `final::SpaceSaving` takes O(K) time. This makes K in the thousands
+/// practical, e.g. to track the long tail of hot keys.
+///
+/// Values are looked up in an open addressing hash table in the style of
+/// Abseil's SwissTable: a control byte per slot holds 7 bits of the hash, and
+/// a probe compares the control bytes of a group of 16 slots at once with
+/// SSE2, so that only slots whose bits match are compared with the value.
+///
+/// The weights are kept in the Stream-Summary of the original paper of
+/// Metwally et al.: the monitored values are linked into buckets of equal
+/// weight, and the buckets into a list sorted by weight. A unit insert moves a
+/// value into the next bucket, and the values with the minimum weight, which
+/// are evicted first, are in the first bucket. A weighted insert walks the
+/// bucket list from the bucket of the value to the bucket of its new weight.
+///
+/// @tparam T the data type the sketch summarizes.
+/// @tparam K number of elements the sketch can store.
+template <typename T, size_t K = 96>
+class SpaceSaving {
+  static_assert(K > 0 && K < std::numeric_limits<uint32_t>::max() / 2);
+
+ public:
+  SpaceSaving()
+      : values_(K),
+        entries_(K),
+        buckets_(K + 1),
+        ctrl_(kCapacity),
+        table_(kCapacity) {
+    Clear();
+  }
+
+  /// Update the weight of a given value.
+  ///
+  /// Takes O(1) expected time, independent of K.
+  void Insert(const T& value) noexcept { Insert(value, uint64_t{1}); }
+
+  /// Update the weight of a given value by `weight`, equivalent to inserting
+  /// it `weight` times.
+  ///
+  /// Takes O(1) expected time for the lookup, and O(b) time for the weight,
+  /// where b is the number of distinct weights between the old and the new
+  /// weight of the value. A weight of 0 leaves the sketch unchanged.
+  void Insert(const T& v, uint64_t weight) noexcept {
+    if (weight == 0) return;
+    const T& value = detail::Normalized(v);
+    InsertHashed(value, detail::roll_down(detail::Hash(value)), weight);
+  }
+
+  /// Update the weights of a batch of values.
+  ///
+  /// The values are hashed in blocks of `kHashBlockSize`, like
+  /// `final::SpaceSaving::InsertBatch`.
+  void InsertBatch(std::span<const T> values) noexcept {
+    std::array<__uint128_t, kHashBlockSize> hashes;
+    for (size_t i = 0; i < values.size(); i += kHashBlockSize) {
+      const size_t n = std::min(kHashBlockSize, values.size() - i);
+      if constexpr (std::is_floating_point_v<T>) {
+        for (size_t k = 0; k < n; ++k) {
+          hashes[k] = detail::Hash(detail::Normalized(values[i + k]));
+        }
+      } else {
+        detail::HashBatch(values.subspan(i, n), hashes.data());
+      }
+      for (size_t k = 0; k < n; ++k) {
+        InsertHashed(detail::Normalized(values[i + k]),
+                     detail::roll_down(hashes[k]), 1);
+      }
+    }
+  }
+
+  /// Update the weights of a batch of pre-aggregated values, `values[i]` by
+  /// `weights[i]`. Both spans must have the same size. Values of weight 0
+  /// are skipped.
+  void InsertBatch(std::span<const T> values,
+                   std::span<const uint64_t> weights) noexcept {
+    for (size_t i = 0; i < values.size(); ++i) {
+      Insert(values[i], weights[i]);
+    }
+  }
+
+  /// @return the estimated weight of a value, or 0 if it is not monitored.
+  ///
+  /// Takes O(1) expected time.
+  uint64_t Estimate(const T& v) const noexcept {
+    const T& value = detail::Normalized(v);
+    const uint32_t e = Find(value, detail::roll_down(detail::Hash(value)));
+    return e != kNil ? WeightOf(e) : 0;
+  }
+
+  /// @return the minimum weight of the monitored values, which bounds the
+  /// estimation error. It is 0 until K distinct values have been inserted.
+  uint64_t GetMinWeight() const noexcept {
+    return buckets_[min_bucket_].weight;
+  }
+
+  /// Writes the monitored values with the largest weights to `out`, sorted by
+  /// decreasing weight.
+  ///
+  /// Walks the bucket list down from the largest weight, so it takes O(n)
+  /// time for n values written.
+  /// @return the number of values written, at most `out.size()` and K.
+  size_t TopK(std::span<final::WeightedValue<T>> out) const {
+    size_t count = 0;
+    for (uint32_t b = max_bucket_; b != kNil && buckets_[b].weight > 0;
+         b = buckets_[b].prev) {
+      for (uint32_t e = buckets_[b].head; e != kNil; e = entries_[e].next) {
+        if (count == out.size()) return count;
+        out[count].value = values_[e];
+        out[count].weight = buckets_[b].weight;
+        ++count;
+      }
+    }
+    return count;
+  }
+
+  /// Merges another sketch into this sketch.
+  ///
+  /// Follows the merge of `final::SpaceSaving`, see there, with a hash table
+  /// lookup per monitored value instead of a SIMD search. Takes O(K log(K))
+  /// time to select the K largest weights.
+  void Merge(const SpaceSaving& other) {
+    struct Candidate {
+      uint64_t weight;
+      uint64_t hash;
+      T value;
+    };
+    std::vector<Candidate> candidates;
+    candidates.reserve(2 * K);
+    for (uint32_t o = 0; o < K; ++o) {
+      const uint64_t weight = other.WeightOf(o);
+      if (weight == 0) continue;
+      const uint64_t hash = other.entries_[o].hash;
+      if (Find(other.values_[o], hash) != kNil) continue;
+      candidates.push_back({weight + GetMinWeight(), hash, other.values_[o]});
+    }
+    // The own values are moved, so they come last.
+    for (uint32_t e = 0; e < K; ++e) {
+      const uint64_t weight = WeightOf(e);
+      if (weight == 0) continue;
+      const uint64_t hash = entries_[e].hash;
+      const uint32_t o = other.Find(values_[e], hash);
+      const uint64_t other_weight =
+          o != kNil ? other.WeightOf(o) : other.GetMinWeight();
+      candidates.push_back(
+          {weight + other_weight, hash, std::move(values_[e])});
+    }
+
+    const size_t m = std::min(candidates.size(), K);
+    std::partial_sort(
+        candidates.begin(), candidates.begin() + m, candidates.end(),
+        [](const auto& a, const auto& b) { return a.weight > b.weight; });
+    Clear();
+    // Increasing weights append to the end of the bucket list.
+    for (size_t i = m; i-- > 0;) {
+      const uint32_t e = buckets_[min_bucket_].head;
+      values_[e] = std::move(candidates[i].value);
+      Emplace(e, candidates[i].hash);
+      Increment(e, candidates[i].weight);
+    }
+  }
+
+ private:
+  /// Number of values hashed up front by the batch insert.
+  static constexpr size_t kHashBlockSize = 64;
+  /// Number of slots whose control bytes a probe compares at once.
+  static constexpr size_t kGroupSize = 16;
+  /// Number of slots of the hash table, a power of 2 that keeps the load
+  /// factor at or below 1/2, so that most probes end in their first group.
+  static constexpr size_t kCapacity = [] {
+    size_t capacity = kGroupSize;
+    while (capacity < 2 * K) capacity *= 2;
+    return capacity;
+  }();
+  static constexpr size_t kNumGroups = kCapacity / kGroupSize;
+
+  /// Control bytes of free slots, full slots hold 7 bits of the hash.
+  static constexpr int8_t kEmpty = -128;
+  static constexpr int8_t kDeleted = -2;
+  static constexpr uint32_t kNil = std::numeric_limits<uint32_t>::max();
+
+  /// A monitored value, linked into the list of values of its bucket. Values
+  /// in the bucket of weight 0 are unused, and not in the hash table.
+  struct Entry {
+    uint64_t hash;
+    uint32_t bucket;
+    uint32_t prev;
+    uint32_t next;
+    /// Slot of the entry in the hash table.
+    uint32_t slot;
+  };
+
+  /// The values with the same weight, linked into the list of buckets sorted
+  /// by increasing weight. Free buckets are linked by `next`.
+  struct Bucket {
+    uint64_t weight;
+    uint32_t head;
+    uint32_t prev;
+    uint32_t next;
+  };
+
+  /// Resets the sketch to K unused entries with weight 0.
+  void Clear() {
+    for (uint32_t e = 0; e < K; ++e) {
+      entries_[e] = {0, 0, e == 0 ? kNil : e - 1, e + 1 == K ? kNil : e + 1,
+                     0};
+    }
+    buckets_[0] = {0, 0, kNil, kNil};
+    for (uint32_t b = 1; b <= K; ++b) {
+      buckets_[b].next = b == K ? kNil : b + 1;
+    }
+    free_bucket_ = 1;
+    min_bucket_ = 0;
+    max_bucket_ = 0;
+    std::fill(ctrl_.begin(), ctrl_.end(), kEmpty);
+    num_deleted_ = 0;
+  }
+
+  OPT_INLINE void InsertHashed(const T& value, uint64_t hash,
+                               uint64_t weight) {
+    uint32_t e = Find(value, hash);
+    if (e == kNil) {
+      // Replace a value with the minimum weight, the new value inherits its
+      // weight like in `final::SpaceSaving`.
+      e = buckets_[min_bucket_].head;
+      if (buckets_[min_bucket_].weight > 0) Erase(e);
+      values_[e] = value;
+      Emplace(e, hash);
+    }
+    Increment(e, weight);
+  }
+
+  /// @return bitmask of the slots of a group whose control byte is `c`.
+  OPT_INLINE static uint32_t MatchByte(const int8_t* group, int8_t c) {
+#if defined(__SSE2__)
+    const __m128i ctrl =
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c)));
+#else
+    uint32_t m = 0;
+    for (size_t i = 0; i < kGroupSize; ++i) {
+      m |= static_cast<uint32_t>(group[i] == c) << i;
+    }
+    return m;
+#endif
+  }
+
+  /// @return bitmask of the empty or deleted slots of a group.
+  OPT_INLINE static uint32_t MatchFree(const int8_t* group) {
+#if defined(__SSE2__)
+    return _mm_movemask_epi8(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(group)));
+#else
+    uint32_t m = 0;
+    for (size_t i = 0; i < kGroupSize; ++i) {
+      m |= static_cast<uint32_t>(group[i] < 0) << i;
+    }
+    return m;
+#endif
+  }
+
+  OPT_INLINE static int8_t H2(uint64_t hash) { return hash & 0x7F; }
+  OPT_INLINE static size_t H1(uint64_t hash) {
+    return (hash >> 7) & (kNumGroups - 1);
+  }
+
+  /// Finds the entry of a value in the hash table.
+  /// @return the index of the entry, or kNil if the value is not monitored.
+  uint32_t Find(const T& value, uint64_t hash) const {
+    const int8_t h2 = H2(hash);
+    size_t group = H1(hash);
+    // Triangular probing visits every group once for a power of 2 groups.
+    for (size_t probe = 1;; ++probe) {
+      const int8_t* ctrl = &ctrl_[group * kGroupSize];
+      for (uint32_t m = MatchByte(ctrl, h2); m != 0; m &= m - 1) {
+        const uint32_t e = table_[group * kGroupSize + __builtin_ctz(m)];
+        if (LIKELY(entries_[e].hash == hash && values_[e] == value)) return e;
+      }
+      if (LIKELY(MatchByte(ctrl, kEmpty) != 0)) return kNil;
+      group = (group + probe) & (kNumGroups - 1);
+    }
+  }
+
+  OPT_INLINE uint64_t WeightOf(uint32_t e) const {
+    return buckets_[entries_[e].bucket].weight;
+  }
+
+  /// Inserts an entry into the hash table, which must not contain its value.
+  void Emplace(uint32_t e, uint64_t hash) {
+    size_t group = H1(hash);
+    for (size_t probe = 1;; ++probe) {
+      const uint32_t m = MatchFree(&ctrl_[group * kGroupSize]);
+      if (LIKELY(m != 0)) {
+        const size_t slot = group * kGroupSize + __builtin_ctz(m);
+        num_deleted_ -= ctrl_[slot] == kDeleted;
+        ctrl_[slot] = H2(hash);
+        table_[slot] = e;
+        entries_[e].hash = hash;
+        entries_[e].slot = slot;
+        return;
+      }
+      group = (group + probe) & (kNumGroups - 1);
+    }
+  }
+
+  /// Removes an entry from the hash table.
+  ///
+  /// A probe only passes a group without empty slots, so the slot of a group
+  /// that still has an empty slot can be emptied. Only groups that were full
+  /// at some point get tombstones, and the table is rebuilt before these
+  /// take up a quarter of the slots, which keeps an empty slot for every
+  /// probe to end at.
+  void Erase(uint32_t e) {
+    if (UNLIKELY(num_deleted_ >= kCapacity / 4)) Rehash();
+    const size_t slot = entries_[e].slot;
+    const int8_t* ctrl = &ctrl_[slot / kGroupSize * kGroupSize];
+    if (MatchByte(ctrl, kEmpty) != 0) {
+      ctrl_[slot] = kEmpty;
+    } else {
+      ctrl_[slot] = kDeleted;
+      ++num_deleted_;
+    }
+  }
+
+  /// Rebuilds the hash table from the used entries, dropping the tombstones.
+  void Rehash() {
+    std::fill(ctrl_.begin(), ctrl_.end(), kEmpty);
+    num_deleted_ = 0;
+    for (uint32_t e = 0; e < K; ++e) {
+      if (WeightOf(e) > 0) Emplace(e, entries_[e].hash);
+    }
+  }
+
+  /// Increases the weight of an entry by `weight`, moving it to the bucket of
+  /// its new weight.
+  OPT_INLINE void Increment(uint32_t e, uint64_t weight) {
+    const uint32_t b = entries_[e].bucket;
+    const uint64_t target = buckets_[b].weight + weight;
+    uint32_t prev = b;
+    if (buckets_[max_bucket_].weight < target) {
+      // A new maximum, e.g. a heavy hitter or the rebuild of a merge.
+      prev = max_bucket_;
+    } else {
+      while (buckets_[buckets_[prev].next].weight < target) {
+        prev = buckets_[prev].next;
+      }
+    }
+    const uint32_t next = buckets_[prev].next;
+    if (next != kNil && buckets_[next].weight == target) {
+      MoveEntry(e, b, next);
+      return;
+    }
+    if (prev == b && buckets_[b].head == e && entries_[e].next == kNil) {
+      // The only entry of its bucket, whose weight can grow in place.
+      buckets_[b].weight = target;
+      return;
+    }
+    MoveEntry(e, b, NewBucket(target, prev));
+  }
+
+  /// Moves an entry from bucket `from` to bucket `to`, and frees `from` if
+  /// it turns empty.
+  OPT_INLINE void MoveEntry(uint32_t e, uint32_t from, uint32_t to) {
+    Entry& entry = entries_[e];
+    if (entry.prev != kNil) {
+      entries_[entry.prev].next = entry.next;
+    } else {
+      buckets_[from].head = entry.next;
+    }
+    if (entry.next != kNil) entries_[entry.next].prev = entry.prev;
+
+    entry.bucket = to;
+    entry.prev = kNil;
+    entry.next = buckets_[to].head;
+    if (entry.next != kNil) entries_[entry.next].prev = e;
+    buckets_[to].head = e;
+
+    if (buckets_[from].head == kNil) FreeBucket(from);
+  }
+
+  /// @return a new empty bucket with the given weight, linked after `prev`.
+  OPT_INLINE uint32_t NewBucket(uint64_t weight, uint32_t prev) {
+    const uint32_t b = free_bucket_;
+    free_bucket_ = buckets_[b].next;
+    const uint32_t next = buckets_[prev].next;
+    buckets_[b] = {weight, kNil, prev, next};
+    buckets_[prev].next = b;
+    if (next != kNil) {
+      buckets_[next].prev = b;
+    } else {
+      max_bucket_ = b;
+    }
+    return b;
+  }
+
+  OPT_INLINE void FreeBucket(uint32_t b) {
+    const Bucket& bucket = buckets_[b];
+    if (bucket.prev != kNil) {
+      buckets_[bucket.prev].next = bucket.next;
+    } else {
+      min_bucket_ = bucket.next;
+    }
+    if (bucket.next != kNil) {
+      buckets_[bucket.next].prev = bucket.prev;
+    } else {
+      max_bucket_ = bucket.prev;
+    }
+    buckets_[b].next = free_bucket_;
+    free_bucket_ = b;
+  }
+
+  std::vector<T> values_;
+  std::vector<Entry> entries_;
+  /// There are at most K used buckets, plus the one that an increment
+  /// allocates before it frees the old bucket of the entry.
+  std::vector<Bucket> buckets_;
+  uint32_t free_bucket_;
+  uint32_t min_bucket_;
+  uint32_t max_bucket_;
+  std::vector<int8_t> ctrl_;
+  /// Entry index of every full slot.
+  std::vector<uint32_t> table_;
+  size_t num_deleted_;
+};
+
+}  // namespace swiss
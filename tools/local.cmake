@@ -0,0 +1,4 @@
+add_executable(sketch_ingest "${CMAKE_CURRENT_LIST_DIR}/sketch_ingest.cpp")
+find_package(Threads REQUIRED)
+target_link_libraries(sketch_ingest Threads::Threads)
+target_compile_options(sketch_ingest PUBLIC -Wall -Wextra -Werror)
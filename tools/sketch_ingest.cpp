@@ -0,0 +1,504 @@
+/// Feeds a sketch from a file or stdin, the way the sketches are deployed.
+///
+/// Usage:
+///   sketch_ingest --sketch=cs|ss|kll --type=TYPE [--input=FILE] [--threads=N]
+///
+/// TYPE is one of int16, int32, int64, float, double or string. Numeric types
+/// are read as a binary column of little-endian values, strings as newline
+/// delimited lines. A file is memory-mapped, stdin ("-", the default) is read
+/// into large page-aligned buffers.
+///
+/// With two threads, the default, one thread reads and hashes batches of values
+/// and hands them to the inserting thread through a bounded ring buffer. With
+/// one thread, the stages run back to back. The report on stdout has the
+/// throughput and the time spent in every stage, and how often a stage waited
+/// for the other, which shows whether I/O, hashing or inserting is the
+/// bottleneck.
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "cs/cs_final.hpp"
+#include "hash.hpp"
+#include "kll/kll_final.hpp"
+#include "ring_buffer.hpp"
+#include "span.hpp"
+#include "ss/ss_final.hpp"
+#include "types.hpp"
+
+namespace {
+
+/// Maximum number of values per batch handed from the reader to the inserter.
+constexpr size_t kBatchSize = 4096;
+/// Number of batches in flight between the stages.
+constexpr size_t kNumBatches = 8;
+/// Size of the buffers stdin is read into, a multiple of the page size.
+constexpr size_t kBufferSize = 1 << 20;
+constexpr size_t kPageSize = 4096;
+
+using Clock = std::chrono::steady_clock;
+
+[[noreturn]] void ThrowErrno(const std::string& what) {
+  throw std::runtime_error(what + ": " + std::strerror(errno));
+}
+
+struct FreeDeleter {
+  void operator()(std::byte* p) const { std::free(p); }
+};
+
+/// Page-aligned buffer for reads from stdin.
+using AlignedBuffer = std::unique_ptr<std::byte[], FreeDeleter>;
+
+AlignedBuffer MakeAlignedBuffer(size_t size) {
+  auto* data = static_cast<std::byte*>(std::aligned_alloc(kPageSize, size));
+  if (data == nullptr) throw std::bad_alloc();
+  return AlignedBuffer(data);
+}
+
+/// Reads up to n bytes, fewer only at the end of the input.
+size_t ReadFully(int fd, std::byte* out, size_t n) {
+  size_t total = 0;
+  while (total < n) {
+    const ssize_t r = read(fd, out + total, n - total);
+    if (r < 0) {
+      if (errno == EINTR) continue;
+      ThrowErrno("read");
+    }
+    if (r == 0) break;
+    total += static_cast<size_t>(r);
+  }
+  return total;
+}
+
+/// Read-only memory mapping of a whole file.
+class MappedFile {
+ public:
+  explicit MappedFile(const std::string& path) {
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) ThrowErrno("open " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+      close(fd);
+      ThrowErrno("fstat " + path);
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+      void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (data == MAP_FAILED) {
+        close(fd);
+        ThrowErrno("mmap " + path);
+      }
+      data_ = static_cast<const std::byte*>(data);
+      madvise(data, size_, MADV_SEQUENTIAL);
+    }
+    close(fd);
+  }
+
+  ~MappedFile() {
+    if (data_ != nullptr) munmap(const_cast<std::byte*>(data_), size_);
+  }
+
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  std::span<const std::byte> bytes() const { return {data_, size_}; }
+
+ private:
+  const std::byte* data_ = nullptr;
+  size_t size_ = 0;
+};
+
+/// Values handed from the reading stage to the inserting stage.
+template <typename T>
+struct Batch {
+  /// The values of the batch, pointing into the mapped file, into `buffer`,
+  /// or into `strings`.
+  std::span<const T> values;
+  /// Hashes of the values, if the sketch uses them.
+  std::array<__uint128_t, kBatchSize> hashes;
+  /// Buffer for numeric values read from stdin.
+  AlignedBuffer buffer;
+  /// Lines of a string batch. The strings keep their capacity across batches,
+  /// so that steady-state reading does not allocate.
+  std::vector<std::string> strings;
+};
+
+/// Reads a binary column of numbers from a mapped file or stdin.
+template <typename T>
+class BinarySource {
+ public:
+  explicit BinarySource(const std::string& path) {
+    if (path != "-") {
+      file_ = std::make_unique<MappedFile>(path);
+      if (file_->bytes().size() % sizeof(T) != 0) {
+        throw std::runtime_error(path + " is not a column of " +
+                                 std::to_string(sizeof(T)) + " byte values");
+      }
+    }
+  }
+
+  /// Fills the batch with the next values.
+  /// @return false at the end of the input.
+  bool Next(Batch<T>& batch) {
+    if (file_ != nullptr) {
+      const auto bytes = file_->bytes();
+      const size_t n = std::min(kBatchSize, (bytes.size() - pos_) / sizeof(T));
+      batch.values = {reinterpret_cast<const T*>(bytes.data() + pos_), n};
+      pos_ += n * sizeof(T);
+      bytes_read_ += n * sizeof(T);
+      return n > 0;
+    }
+    if (batch.buffer == nullptr) {
+      batch.buffer = MakeAlignedBuffer(kBatchSize * sizeof(T));
+    }
+    const size_t n =
+        ReadFully(STDIN_FILENO, batch.buffer.get(), kBatchSize * sizeof(T));
+    if (n % sizeof(T) != 0) {
+      throw std::runtime_error("stdin ends with a truncated value");
+    }
+    batch.values = {reinterpret_cast<const T*>(batch.buffer.get()),
+                    n / sizeof(T)};
+    bytes_read_ += n;
+    return n > 0;
+  }
+
+  size_t bytes_read() const { return bytes_read_; }
+
+ private:
+  std::unique_ptr<MappedFile> file_;
+  size_t pos_ = 0;
+  size_t bytes_read_ = 0;
+};
+
+/// Reads newline delimited strings from a mapped file or stdin.
+class LineSource {
+ public:
+  explicit LineSource(const std::string& path) {
+    if (path != "-") {
+      file_ = std::make_unique<MappedFile>(path);
+      const auto bytes = file_->bytes();
+      pos_ = reinterpret_cast<const char*>(bytes.data());
+      end_ = pos_ + bytes.size();
+    } else {
+      buffer_ = MakeAlignedBuffer(kBufferSize);
+      pos_ = end_ = reinterpret_cast<const char*>(buffer_.get());
+    }
+  }
+
+  /// Fills the batch with the next lines.
+  /// @return false at the end of the input.
+  bool Next(Batch<std::string>& batch) {
+    batch.strings.resize(kBatchSize);
+    size_t n = 0;
+    while (n < kBatchSize) {
+      const auto* newline =
+          pos_ == end_ ? nullptr
+                       : static_cast<const char*>(
+                             std::memchr(pos_, '\n', end_ - pos_));
+      if (newline == nullptr) {
+        if (!eof_ && file_ == nullptr) {
+          Refill();
+          continue;
+        }
+        // The last line may lack its newline.
+        if (pos_ != end_) {
+          batch.strings[n++].assign(pos_, end_);
+          bytes_read_ += end_ - pos_;
+          pos_ = end_;
+        }
+        break;
+      }
+      batch.strings[n++].assign(pos_, newline);
+      bytes_read_ += newline + 1 - pos_;
+      pos_ = newline + 1;
+    }
+    batch.values = std::span<const std::string>(batch.strings.data(), n);
+    return n > 0;
+  }
+
+  size_t bytes_read() const { return bytes_read_; }
+
+ private:
+  /// Moves the incomplete last line to the front of the buffer and reads more
+  /// input behind it.
+  void Refill() {
+    auto* begin = reinterpret_cast<char*>(buffer_.get());
+    const size_t rest = end_ - pos_;
+    if (rest == kBufferSize) {
+      throw std::runtime_error("line longer than " +
+                               std::to_string(kBufferSize) + " bytes");
+    }
+    std::memmove(begin, pos_, rest);
+    const size_t n = ReadFully(STDIN_FILENO, buffer_.get() + rest,
+                               kBufferSize - rest);
+    eof_ = n < kBufferSize - rest;
+    pos_ = begin;
+    end_ = begin + rest + n;
+  }
+
+  std::unique_ptr<MappedFile> file_;
+  AlignedBuffer buffer_;
+  const char* pos_;
+  const char* end_;
+  bool eof_ = false;
+  size_t bytes_read_ = 0;
+};
+
+template <typename T>
+using Source =
+    std::conditional_t<detail::is_string_v<T>, LineSource, BinarySource<T>>;
+
+/// Whether the sketch inserts pre-hashed values, in which case the reading
+/// stage also hashes them.
+template <typename Sketch, typename T>
+constexpr bool kUsesHashes = false;
+template <typename T>
+constexpr bool kUsesHashes<final::CountSketch<T>, T> = true;
+template <typename T>
+constexpr bool kUsesHashes<final::SpaceSaving<T>, T> =
+    !std::is_arithmetic_v<T>;
+
+template <typename T>
+void InsertBatch(final::CountSketch<T>& sketch, const Batch<T>& batch) {
+  sketch.InsertBatch(std::span<const __uint128_t>(batch.hashes.data(),
+                                                  batch.values.size()));
+}
+
+template <typename T>
+void InsertBatch(final::SpaceSaving<T>& sketch, const Batch<T>& batch) {
+  for (size_t i = 0; i < batch.values.size(); ++i) {
+    if constexpr (kUsesHashes<final::SpaceSaving<T>, T>) {
+      sketch.Insert(batch.values[i], batch.hashes[i]);
+    } else {
+      sketch.Insert(batch.values[i]);
+    }
+  }
+}
+
+template <typename T>
+void InsertBatch(final::KarninLangLiberty<T>& sketch, const Batch<T>& batch) {
+  sketch.InsertBatch(batch.values);
+}
+
+template <typename T>
+void PrintSummary(const final::CountSketch<T>& sketch, const T& first) {
+  std::cout << "estimate_of_first_value=" << sketch.Estimate(first) << "\n";
+}
+
+template <typename T>
+void PrintSummary(const final::SpaceSaving<T>& sketch, const T&) {
+  std::array<final::WeightedValue<T>, 10> top;
+  const size_t n = sketch.TopK(top);
+  for (size_t i = 0; i < n; ++i) {
+    std::cout << "top_" << i << "=" << top[i].value << " (" << top[i].weight
+              << ")\n";
+  }
+}
+
+template <typename T>
+void PrintSummary(const final::KarninLangLiberty<T>& sketch, const T&) {
+  if (sketch.GetN() == 0) return;
+  for (const double rank : {0.5, 0.99, 0.999}) {
+    std::cout << "quantile_" << rank << "=" << sketch.GetQuantile(rank)
+              << "\n";
+  }
+}
+
+/// Time spent in a stage and the number of times it waited for the other.
+struct StageStats {
+  Clock::duration busy{};
+  size_t num_stalls = 0;
+};
+
+template <typename Sketch, typename T>
+void Run(const std::string& input, size_t num_threads) {
+  Source<T> source(input);
+  auto sketch = std::make_unique<Sketch>();
+  std::vector<std::unique_ptr<Batch<T>>> batches;
+  for (size_t i = 0; i < kNumBatches; ++i) {
+    batches.push_back(std::make_unique<Batch<T>>());
+  }
+  T first{};
+  bool has_first = false;
+  size_t num_items = 0;
+  StageStats read_stats, hash_stats, insert_stats;
+
+  // Reads and hashes one batch. @return false at the end of the input.
+  auto produce = [&](Batch<T>& batch) {
+    auto start = Clock::now();
+    const bool ok = source.Next(batch);
+    auto end = Clock::now();
+    read_stats.busy += end - start;
+    if (ok && kUsesHashes<Sketch, T>) {
+      detail::HashBatch(batch.values, batch.hashes.data());
+      hash_stats.busy += Clock::now() - end;
+    }
+    return ok;
+  };
+  auto consume = [&](const Batch<T>& batch) {
+    const auto start = Clock::now();
+    if (!has_first) {
+      first = batch.values[0];
+      has_first = true;
+    }
+    InsertBatch(*sketch, batch);
+    num_items += batch.values.size();
+    insert_stats.busy += Clock::now() - start;
+  };
+
+  const auto start = Clock::now();
+  if (num_threads == 1) {
+    while (produce(*batches[0])) consume(*batches[0]);
+  } else {
+    // The reader takes free batches from `free`, fills them and passes them
+    // on through `full`. A null batch marks the end of the input.
+    detail::MpscRing<Batch<T>*, kNumBatches> free, full;
+    for (auto& batch : batches) {
+      Batch<T>* p = batch.get();
+      free.TryPush(p);
+    }
+    std::exception_ptr error;
+    std::thread reader([&] {
+      Batch<T>* batch = nullptr;
+      try {
+        while (true) {
+          while (!free.TryPop(batch)) {
+            ++read_stats.num_stalls;
+            std::this_thread::yield();
+          }
+          if (!produce(*batch)) break;
+          while (!full.TryPush(batch)) std::this_thread::yield();
+        }
+      } catch (...) {
+        error = std::current_exception();
+      }
+      batch = nullptr;
+      while (!full.TryPush(batch)) std::this_thread::yield();
+    });
+    Batch<T>* batch;
+    while (true) {
+      while (!full.TryPop(batch)) {
+        ++insert_stats.num_stalls;
+        std::this_thread::yield();
+      }
+      if (batch == nullptr) break;
+      consume(*batch);
+      free.TryPush(batch);
+    }
+    reader.join();
+    if (error) std::rethrow_exception(error);
+  }
+  const double seconds =
+      std::chrono::duration<double>(Clock::now() - start).count();
+
+  const auto to_seconds = [](Clock::duration d) {
+    return std::chrono::duration<double>(d).count();
+  };
+  std::cout << "items=" << num_items << "\n"
+            << "bytes=" << source.bytes_read() << "\n"
+            << "seconds=" << seconds << "\n"
+            << "items_per_second=" << num_items / seconds << "\n"
+            << "bytes_per_second=" << source.bytes_read() / seconds << "\n"
+            << "read_seconds=" << to_seconds(read_stats.busy) << "\n"
+            << "hash_seconds=" << to_seconds(hash_stats.busy) << "\n"
+            << "insert_seconds=" << to_seconds(insert_stats.busy) << "\n"
+            << "reader_stalls=" << read_stats.num_stalls << "\n"
+            << "inserter_stalls=" << insert_stats.num_stalls << "\n";
+  if (has_first) PrintSummary(*sketch, first);
+}
+
+template <typename T>
+void RunSketch(const std::string& sketch, const std::string& input,
+               size_t num_threads) {
+  if (sketch == "cs") {
+    Run<final::CountSketch<T>, T>(input, num_threads);
+  } else if (sketch == "ss") {
+    Run<final::SpaceSaving<T>, T>(input, num_threads);
+  } else if (sketch == "kll") {
+    Run<final::KarninLangLiberty<T>, T>(input, num_threads);
+  } else {
+    throw std::invalid_argument("unknown sketch: " + sketch);
+  }
+}
+
+void RunType(const std::string& type, const std::string& sketch,
+             const std::string& input, size_t num_threads) {
+  if (type == "int16") {
+    RunSketch<int16_t>(sketch, input, num_threads);
+  } else if (type == "int32") {
+    RunSketch<int32_t>(sketch, input, num_threads);
+  } else if (type == "int64") {
+    RunSketch<int64_t>(sketch, input, num_threads);
+  } else if (type == "float") {
+    RunSketch<float>(sketch, input, num_threads);
+  } else if (type == "double") {
+    RunSketch<double>(sketch, input, num_threads);
+  } else if (type == "string") {
+    RunSketch<std::string>(sketch, input, num_threads);
+  } else {
+    throw std::invalid_argument("unknown type: " + type);
+  }
+}
+
+constexpr const char* kUsage =
+    "usage: sketch_ingest --sketch=cs|ss|kll "
+    "--type=int16|int32|int64|float|double|string [--input=FILE] "
+    "[--threads=1|2]\n";
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  std::string sketch, type, input = "-";
+  size_t num_threads = 2;
+  for (int i = 1; i < argc; ++i) {
+    const std::string_view arg = argv[i];
+    const auto value = [&](std::string_view flag) -> const char* {
+      if (arg.substr(0, flag.size()) != flag) return nullptr;
+      return argv[i] + flag.size();
+    };
+    if (const char* v = value("--sketch=")) {
+      sketch = v;
+    } else if (const char* v = value("--type=")) {
+      type = v;
+    } else if (const char* v = value("--input=")) {
+      input = v;
+    } else if (const char* v = value("--threads=")) {
+      num_threads = std::strtoul(v, nullptr, 10);
+    } else {
+      std::cerr << kUsage;
+      return 2;
+    }
+  }
+  if (sketch.empty() || type.empty() || num_threads < 1 || num_threads > 2) {
+    std::cerr << kUsage;
+    return 2;
+  }
+
+  try {
+    RunType(type, sketch, input, num_threads);
+  } catch (const std::exception& e) {
+    std::cerr << "sketch_ingest: " << e.what() << "\n";
+    return 1;
+  }
+  return 0;
+}